@@ -38,6 +38,16 @@ namespace Whisper
 		// Performance information
 		HRESULT __stdcall timingsPrint();
 		HRESULT __stdcall timingsReset();
+
+		// Transcribe several independent audio buffers with a single decoder, one token of every stream per decoder step.
+		// Only implemented by the hybrid model; the callbacks in the parameters are not called in this mode.
+		// results must point to an array of `count` elements, the method creates a new result object for every buffer.
+		HRESULT __stdcall runBatch( const sFullParams& params, uint32_t count, const iAudioBuffer* const* buffers, eResultFlags flags, iTranscribeResult** results );
+
+		// Split long audio at silences into up to `countContexts` spans, and transcribe them concurrently on temporary contexts which share the model.
+		// The segments are stitched in time order into the results of this context. Only implemented by the hybrid model, the GPU model runs sequentially.
+		// new_segment_callback is called once at the end, the rest of the callbacks are not called in this mode.
+		HRESULT __stdcall runParallel( const sFullParams& params, const iAudioBuffer* buffer, uint32_t countContexts );
 	};
 
 	__interface __declspec( novtable, uuid( "abefb4c9-e8d8-46a3-8747-5afbadef1adb" ) ) iModel : public IUnknown
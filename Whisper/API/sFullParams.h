@@ -9,7 +9,8 @@ namespace Whisper
 	{
 		// Always select the most probable token
 		Greedy,
-		// TODO: not implemented yet!
+		// Keep several hypotheses, and pick the one with the best length-normalized probability
+		// Only implemented by the hybrid model, the GPU model falls back to greedy sampling
 		BeamSearch,
 	};
 
@@ -31,6 +32,10 @@ namespace Whisper
 		// Experimental
 		TokenTimestamps = 0x100,
 		SpeedupAudio = 0x200,
+		// Hybrid model only: encode the next 30-seconds window on another context while the current one is decoding
+		PipelinedEncode = 0x400,
+		// Run VAD over the complete audio before transcribing, and skip long silences without encoding them
+		SkipSilence = 0x800,
 	};
 
 	inline eFullParamsFlags operator | ( eFullParamsFlags a, eFullParamsFlags b )
@@ -85,6 +90,16 @@ namespace Whisper
 		pfnEncoderBegin encoder_begin_callback;
 		void* encoder_begin_callback_user_data;
 
+		// Speculative decoding, only implemented by the hybrid model with the greedy strategy.
+		// A smaller model with the same vocabulary proposes tokens, the main model verifies them in a single decoder call.
+		// The verification samples every row with the same fused routine as the greedy loop, but the decoder computes several rows per call,
+		// and the batched matrix multiplication kernels may round the logits differently from single-token calls.
+		// When the top two tokens are nearly tied, the output may occasionally differ from the output without the draft model.
+		// Set to nullptr to disable.
+		iModel* draftModel;
+		// Count of tokens proposed by the draft model for every verification, 0 = default
+		int draftTokens;
+
 		// Couple utility methods, they workaround the lack of bit fields in C++
 		inline bool flag( eFullParamsFlags f ) const
 		{
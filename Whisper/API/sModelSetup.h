@@ -8,7 +8,9 @@ namespace Whisper
 		// GPGPU implementation based on Direct3D 11.0 compute shaders
 		GPU = 1,
 
-		// A hybrid implementation which uses DirectCompute for encode, and decodes on CPU
+		// A hybrid implementation which runs both encode and decode on CPU
+		// The model still creates a Direct3D 11 hardware device, the contexts use it for the constant buffer and the GPU profiler.
+		// Loading fails when D3D11CreateDevice fails, e.g. on some GPU-less servers and containers.
 		// Not implemented in the published builds of the DLL. To enable, change BUILD_HYBRID_VERSION macro to 1
 		Hybrid = 2,
 
@@ -24,6 +26,21 @@ namespace Whisper
 		NoReshapedMatMul = 4,
 		UseReshapedMatMul = 8,
 		Cloneable = 0x10,
+		// Hybrid model only: quantize FP16 matrices of the decoder into 8-bit blocks while loading the model
+		QuantizeQ8 = 0x20,
+		// Hybrid model only: quantize FP16 matrices of the decoder into 4-bit blocks while loading the model
+		QuantizeQ4 = 0x40,
+		// Hybrid model only: on computers with multiple NUMA nodes, distribute the decoder matrices across the nodes, and run the CPU threads on these nodes
+		NumaAware = 0x80,
+		// Map the model file into memory instead of reading it.
+		// GPU model uploads the tensors straight from the mapped pages, the hybrid model keeps the tensors which don't need conversion in these pages.
+		MemoryMapped = 0x100,
+		// Hybrid model only: save the tensors in their final layout into "<model>.cache" file, and load from that file when it's up to date.
+		// Ignored with NumaAware flag, the cached tensors are used directly from the mapped file.
+		ModelCache = 0x200,
+		// Hybrid model only: pin the CPU threads to distinct logical processors of the process.
+		// Ignored with NumaAware flag on computers with multiple NUMA nodes, the threads are then pinned to these nodes.
+		PinThreads = 0x400,
 	};
 
 	struct sModelSetup
@@ -29,9 +29,9 @@ namespace CpuCompute
 		TensorPair crossAttnQuery;
 
 		// decoder.blocks.*.cross_attn.key
-		// Tensor crossAttnKey;
+		Tensor crossAttnKey;
 		// decoder.blocks.*.cross_attn.value
-		// TensorPair crossAttnValue;
+		TensorPair crossAttnValue;
 
 		// decoder.blocks.*.mlp_ln
 		TensorPair mlpLn;
@@ -0,0 +1,43 @@
+#pragma once
+#include <vector>
+#include "Tensor.h"
+
+namespace CpuCompute
+{
+	// A set of tensors for one encoder's layer
+	struct LayerEncoder
+	{
+		// encoder.blocks.*.attn_ln
+		TensorPair attnLn0;
+		// encoder.blocks.*.attn.out
+		TensorPair attnLn1;
+		// encoder.blocks.*.attn.query
+		TensorPair attnQuery;
+		// encoder.blocks.*.attn.key
+		Tensor attnKey;
+		// encoder.blocks.*.attn.value
+		TensorPair attnValue;
+		// encoder.blocks.*.mlp_ln
+		TensorPair mlpLn;
+		// encoder.blocks.*.mlp.0
+		TensorPair mlp0;
+		// encoder.blocks.*.mlp.2
+		TensorPair mlp1;
+	};
+
+	// Encoder tensors in system memory, used by the hybrid model.
+	// HybridLoader loads these tensors into the same buffer as the decoder, the memory is owned by DecoderTensors structure.
+	struct EncoderTensors
+	{
+		// encoder.positional_embedding
+		Tensor positionalEmbedding;
+		// encoder.conv1
+		TensorPair conv1;
+		// encoder.conv2
+		TensorPair conv2;
+		// encoder.ln_post
+		TensorPair lnPost;
+		// A vector of layers
+		std::vector<LayerEncoder> layers;
+	};
+}
\ No newline at end of file
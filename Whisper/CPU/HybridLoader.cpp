@@ -1,8 +1,78 @@
 #include "stdafx.h"
 #include "HybridLoader.h"
+#include "quantization.h"
+#include "mulMat.h"
 using namespace CpuCompute;
 using namespace ComLight;
 
+namespace
+{
+	constexpr size_t pageSize = 4096;
+
+	inline size_t roundUpToPage( size_t cb )
+	{
+		return ( cb + pageSize - 1 ) & ~( pageSize - 1 );
+	}
+
+	// Matrices in the layers of the encoder or decoder
+	inline bool isLayerMatrix( const char* name, int n_dims )
+	{
+		return n_dims == 2 && ( 0 == strncmp( name, "decoder.blocks.", 15 ) || 0 == strncmp( name, "encoder.blocks.", 15 ) );
+	}
+
+	// Shape of the tensor in the GGML file, same as in whisper_model_load
+	bool expectedShape( const CStringA& name, const Whisper::sModelParams& mp, std::array<int, 4>& ne, int& n_dims )
+	{
+		const bool decoder = 0 == strncmp( name, "decoder.", 8 );
+		if( !decoder && 0 != strncmp( name, "encoder.", 8 ) )
+			return false;
+		const int state = decoder ? mp.n_text_state : mp.n_audio_state;
+		const char* rest = (const char*)name + 8;
+
+		ne = { 1, 1, 1, 1 };
+		auto shape = [ & ]( int dims, int ne0, int ne1 = 1, int ne2 = 1 )
+		{
+			n_dims = dims;
+			ne[ 0 ] = ne0;
+			ne[ 1 ] = ne1;
+			ne[ 2 ] = ne2;
+			return true;
+		};
+
+		if( 0 == strcmp( rest, "positional_embedding" ) )
+			return shape( 2, state, decoder ? mp.n_text_ctx : mp.n_audio_ctx );
+		if( decoder && 0 == strcmp( rest, "token_embedding.weight" ) )
+			return shape( 2, state, mp.n_vocab );
+		if( !decoder && 0 == strcmp( rest, "conv1.weight" ) )
+			return shape( 3, 3, mp.n_mels, state );
+		if( !decoder && 0 == strcmp( rest, "conv2.weight" ) )
+			return shape( 3, 3, state, state );
+		if( !decoder && ( 0 == strcmp( rest, "conv1.bias" ) || 0 == strcmp( rest, "conv2.bias" ) ) )
+			return shape( 2, 1, state );
+
+		// The rest of the names end with .weight or .bias
+		const char* dot = strrchr( rest, '.' );
+		if( nullptr == dot )
+			return false;
+		const bool bias = 0 == strcmp( dot, ".bias" );
+		if( !bias && 0 != strcmp( dot, ".weight" ) )
+			return false;
+
+		// Layer norms: ln, ln_post, and the *_ln components of the layers
+		const CStringA component( rest, (int)( dot - rest ) );
+		if( component == "ln" || component == "ln_post" || component.Right( 3 ) == "_ln" )
+			return shape( 1, state );
+		if( 0 != strncmp( rest, "blocks.", 7 ) )
+			return false;
+
+		if( component.Right( 6 ) == ".mlp.0" )
+			return bias ? shape( 1, 4 * state ) : shape( 2, state, 4 * state );
+		if( component.Right( 6 ) == ".mlp.2" )
+			return bias ? shape( 1, state ) : shape( 2, 4 * state, state );
+		return bias ? shape( 1, state ) : shape( 2, state, state );
+	}
+}
+
 static void populateDecodeTensorsMap( CAtlMap<CStringA, Tensor*>& map, int layersDec, DecoderTensors& dec )
 {
 	dec.layers.resize( layersDec );
@@ -42,19 +112,61 @@ static void populateDecodeTensorsMap( CAtlMap<CStringA, Tensor*>& map, int layer
 
 		add2( "cross_attn_ln", i, gpu.crossAttnLn0 );
 		add2( "cross_attn.query", i, gpu.crossAttnQuery );
-
-		// These 3 tensors are used by the encode() method, to compute cross-attention buffers
-		// Need them in VRAM even for the hybrid model
-		// add( "cross_attn.key.weight", i, gpu.cross_attn_k_w );
-		// add2( "cross_attn.value", i, gpu.cross_attn_v_w, gpu.cross_attn_v_b );
+		// These 2 tensors are used by the encoder to compute cross-attention buffers
+		add( "cross_attn.key.weight", i, gpu.crossAttnKey );
+		add2( "cross_attn.value", i, gpu.crossAttnValue );
 		add2( "cross_attn.out", i, gpu.crossAttnLn1 );
 	}
 }
 
-HybridLoader::HybridLoader( DecoderTensors& m, int countLayers ) :
-	destination( m )
+static void populateEncodeTensorsMap( CAtlMap<CStringA, Tensor*>& map, int layersEnc, EncoderTensors& enc )
+{
+	enc.layers.resize( layersEnc );
+
+	map[ "encoder.positional_embedding" ] = &enc.positionalEmbedding;
+	map[ "encoder.conv1.weight" ] = &enc.conv1.w;
+	map[ "encoder.conv1.bias" ] = &enc.conv1.b;
+	map[ "encoder.conv2.weight" ] = &enc.conv2.w;
+	map[ "encoder.conv2.bias" ] = &enc.conv2.b;
+	map[ "encoder.ln_post.weight" ] = &enc.lnPost.w;
+	map[ "encoder.ln_post.bias" ] = &enc.lnPost.b;
+
+	CStringA tempString;
+	auto add = [ & ]( const char* name, int i, Tensor& t )
+	{
+		tempString.Format( "encoder.blocks.%i.%s", i, name );
+		map[ tempString ] = &t;
+	};
+
+	auto add2 = [ & ]( const char* name, int i, TensorPair& tensors )
+	{
+		tempString.Format( "encoder.blocks.%i.%s.weight", i, name );
+		map[ tempString ] = &tensors.w;
+		tempString.Format( "encoder.blocks.%i.%s.bias", i, name );
+		map[ tempString ] = &tensors.b;
+	};
+
+	for( int i = 0; i < layersEnc; i++ )
+	{
+		auto& layer = enc.layers[ i ];
+		add2( "mlp_ln", i, layer.mlpLn );
+		add2( "mlp.0", i, layer.mlp0 );
+		add2( "mlp.2", i, layer.mlp1 );
+		add2( "attn_ln", i, layer.attnLn0 );
+		add2( "attn.query", i, layer.attnQuery );
+		add( "attn.key.weight", i, layer.attnKey );
+		add2( "attn.value", i, layer.attnValue );
+		add2( "attn.out", i, layer.attnLn1 );
+	}
+}
+
+HybridLoader::HybridLoader( DecoderTensors& m, int countLayers, EncoderTensors& enc, int countLayersEnc, eDataType quantize, const NumaNodes* numa ) :
+	destination( m ),
+	quantizeWeights( quantize ),
+	numa( ( nullptr != numa && !numa->empty() ) ? numa : nullptr )
 {
 	populateDecodeTensorsMap( map, countLayers, destination );
+	populateEncodeTensorsMap( map, countLayersEnc, enc );
 	pending.reserve( map.GetCount() );
 }
 
@@ -67,41 +179,157 @@ HRESULT HybridLoader::setupTensor( const CStringA& name, int n_dims, int ftype,
 	Tensor& rdi = *p->m_value;
 	PendingTensor& pt = pending.emplace_back();
 
-	__m128i vec = load16( ne.data() );
-	vec = _mm_insert_epi32( vec, 1, 3 );
-	store16( &rdi.ne, vec );
-	rdi.setDenseStrides();
-
 	pt.destPointer = p->m_value;
+	pt.name = name;
 	CHECK( stream->getPosition( pt.streamOffset ) );
-	pt.bufferOffset = bufferBytes;
 
-	size_t cbElement;
-	if( ftype == 0 )
+	// Same ftype values as GGML_TYPE_* constants
+	switch( ftype )
+	{
+	case 0:
+		pt.sourceType = eDataType::FP32;
+		break;
+	case 1:
+		pt.sourceType = eDataType::FP16;
+		break;
+	case 2:
+		pt.sourceType = eDataType::Q4_0;
+		break;
+	case 8:
+		pt.sourceType = eDataType::Q8_0;
+		break;
+	default:
+		logError( u8"Tensor \"%s\" has unsupported type %i", (const char*)name, ftype );
+		return E_NOTIMPL;
+	}
+
+	CHECK( tensorLayout( name, n_dims, ne, rdi, pt ) );
+	const size_t payloadBytes = pt.payloadBytes;
+	CHECK( stream->seek( payloadBytes, eSeekOrigin::Current ) );
+	postponedBytes += (int64_t)payloadBytes;
+
+	// The decoder is bound by memory bandwidth, on NUMA computers the matrices of the decoder are distributed across the nodes
+	pt.numaSplit = nullptr != numa && isLayerMatrix( name, n_dims ) && 0 == strncmp( name, "decoder.", 8 );
+	// Tensors which are used as they are in the file don't need a copy when the file is memory mapped.
+	// The file offsets are not aligned, fine because the compute kernels use unaligned loads for the weights.
+	pt.mapped = nullptr != mappedFile && rdi.type() == pt.sourceType && !pt.prepacked && !pt.numaSplit;
+	if( pt.mapped )
+	{
+		if( !mappedFile->contains( pt.streamOffset, payloadBytes ) )
+			return E_EOF;
+	}
+	else if( pt.numaSplit )
 	{
-		rdi.setType( eDataType::FP32 );
-		cbElement = 4;
+		pt.bufferOffset = roundUpToPage( bufferBytes );
+		bufferBytes = pt.bufferOffset + roundUpToPage( pt.tensorBytes );
 	}
 	else
 	{
-		rdi.setType( eDataType::FP16 );
-		cbElement = 2;
+		pt.bufferOffset = bufferBytes;
+		bufferBytes += ( pt.tensorBytes + 31 ) & ( ~( (size_t)31 ) );
 	}
+	return S_OK;
+}
+
+HRESULT HybridLoader::tensorLayout( const CStringA& name, int n_dims, const std::array<int, 4>& ne, Tensor& rdi, PendingTensor& pt ) const
+{
+	__m128i vec = load16( ne.data() );
+	vec = _mm_insert_epi32( vec, 1, 3 );
+	store16( &rdi.ne, vec );
+	rdi.setDenseStrides();
+
+	// Matrices in the layers are only consumed by mulMat(), which supports the quantized formats.
+	// The rest of the tensors are dequantized on load.
+	const bool layerMatrix = isLayerMatrix( name, n_dims );
+	eDataType dt = pt.sourceType;
+	if( isQuantized( dt ) )
+	{
+		if( 0 != ne[ 0 ] % quantBlockSize )
+			return E_INVALIDARG;
+		if( !layerMatrix )
+			dt = eDataType::FP16;
+	}
+	else if( dt == eDataType::FP16 && isQuantized( quantizeWeights ) && layerMatrix && 0 == strncmp( name, "decoder.", 8 ) && 0 == ne[ 0 ] % quantBlockSize )
+		dt = quantizeWeights;
+	rdi.setType( dt );
+
+	// The rest of FP16 matrices in the decoder layers are reshaped into the panels consumed by the mulMat() kernels.
+	// The decoder runs for every token, this saves transposing every weight matrix on every decoder step.
+	pt.prepacked = dt == eDataType::FP16 && pt.sourceType == eDataType::FP16 && layerMatrix && 0 == strncmp( name, "decoder.", 8 ) && ne[ 1 ] >= (int)prepackedPanelHeight;
 
 	const size_t totalElts = (size_t)(uint32_t)ne[ 0 ] * (uint32_t)ne[ 1 ] * (uint32_t)ne[ 2 ];
-	if( totalElts * cbElement > UINT_MAX )
+	auto tensorBytes = [ totalElts ]( eDataType dt )
+	{
+		return isQuantized( dt ) ? quantizedBytes( dt, totalElts ) : DirectCompute::elementSize( dt ) * totalElts;
+	};
+	const size_t payloadBytes = tensorBytes( pt.sourceType );
+	pt.payloadBytes = payloadBytes;
+	pt.tensorBytes = tensorBytes( dt );
+	if( pt.prepacked )
+	{
+		const size_t panelSize = (size_t)(uint32_t)ne[ 0 ] * prepackedPanelHeight;
+		const size_t elements = prepackedElements( (uint32_t)ne[ 0 ], (uint32_t)ne[ 1 ] );
+		pt.tensorBytes = elements * 2;
+		// Same strides as the panels made by Reshaper class for GPU
+		rdi.nb[ 0 ] = 0;
+		rdi.nb[ 1 ] = (uint32_t)panelSize;
+		rdi.nb[ 2 ] = rdi.nb[ 3 ] = (uint32_t)elements;
+	}
+	if( std::max( payloadBytes, pt.tensorBytes ) > UINT_MAX )
 		return DISP_E_OVERFLOW;
+	return S_OK;
+}
 
-	size_t payloadBytes = cbElement * totalElts;
-	pt.payloadBytes = payloadBytes;
-	CHECK( stream->seek( payloadBytes, eSeekOrigin::Current ) );
-	postponedBytes += (int64_t)payloadBytes;
+HRESULT HybridLoader::convertTensor( const PendingTensor& pt, uint8_t* rdi, const uint8_t* rsi ) const
+{
+	const Tensor& t = *pt.destPointer;
+	const size_t totalElts = (size_t)t.ne[ 0 ] * t.ne[ 1 ] * t.ne[ 2 ];
+	if( pt.prepacked )
+	{
+		prepackPanels( (uint16_t*)rdi, (const uint16_t*)rsi, t.ne[ 0 ], t.ne[ 1 ] );
+		return S_OK;
+	}
 
-	payloadBytes = ( payloadBytes + 31 ) & ( ~( (size_t)31 ) );
-	bufferBytes += payloadBytes;
+	// The rows are dense and their length is a multiple of the block size, the blocks never cross rows
+	if( pt.sourceType == eDataType::FP16 && isQuantized( t.type() ) )
+		quantizeRow( t.type(), rdi, (const uint16_t*)rsi, totalElts );
+	else if( isQuantized( pt.sourceType ) && t.type() == eDataType::FP16 )
+		dequantizeRow( pt.sourceType, (uint16_t*)rdi, rsi, totalElts );
+	else
+		return E_UNEXPECTED;
 	return S_OK;
 }
 
+// Commit the pages of the decoder matrices on different NUMA nodes.
+// Both prepacked panels and rows of the quantized matrices are in the order of the matrix rows.
+// Splitting the bytes in the same proportions as ParallelForRunner splits the panels makes most of the weights local to the threads which multiply them.
+HRESULT HybridLoader::allocateNuma( LargeBuffer& buffer ) const
+{
+	const size_t totalBytes = roundUpToPage( bufferBytes );
+	CHECK( buffer.reserve( totalBytes ) );
+
+	const size_t countNodes = numa->size();
+	size_t committed = 0;
+	for( const auto& pt : pending )
+	{
+		if( !pt.numaSplit )
+			continue;
+		assert( 0 == pt.bufferOffset % pageSize );
+		CHECK( buffer.commit( committed, pt.bufferOffset - committed ) );
+
+		const size_t cb = roundUpToPage( pt.tensorBytes );
+		size_t begin = 0;
+		for( size_t i = 0; i < countNodes; i++ )
+		{
+			const size_t end = ( i + 1 == countNodes ) ? cb : ( ( pt.tensorBytes * ( i + 1 ) ) / countNodes ) & ~( pageSize - 1 );
+			CHECK( buffer.commit( pt.bufferOffset + begin, end - begin, numa->nodeNumber( i ) ) );
+			begin = end;
+		}
+		committed = pt.bufferOffset + cb;
+	}
+	return buffer.commit( committed, totalBytes - committed );
+}
+
 HRESULT HybridLoader::completeLoad( ComLight::iReadStream* stream, iLoaderProgressSink& progressSink )
 {
 	if( pending.size() != map.GetCount() )
@@ -111,30 +339,209 @@ HRESULT HybridLoader::completeLoad( ComLight::iReadStream* stream, iLoaderProgre
 	}
 
 	LargeBuffer buffer;
-	CHECK( buffer.allocate( bufferBytes ) );
-
-	uint8_t* rdi = buffer.pointer();
+	if( 0 == bufferBytes )
+	{
+		// All tensors are in the memory mapped file
+	}
+	else if( nullptr == numa )
+	{
+		CHECK( buffer.allocate( bufferBytes ) );
+	}
+	else
+	{
+		CHECK( allocateNuma( buffer ) );
+	}
+	// Temporary buffer for the tensors converted on load
+	std::vector<uint8_t> temp;
+	size_t countConverted = 0;
+	size_t countMapped = 0;
 
 	for( const auto& pt : pending )
 	{
 		if( pt.payloadBytes > INT_MAX )
 			return DISP_E_OVERFLOW;
-		CHECK( stream->seek( pt.streamOffset, eSeekOrigin::Begin ) );
 
+		if( pt.mapped )
+		{
+			// Bounds were verified by setupTensor()
+			pt.destPointer->setDataPointer( (void*)( mappedFile->data() + pt.streamOffset ) );
+			CHECK( progressSink.gotBytes( (int64_t)pt.payloadBytes ) );
+			countMapped++;
+			continue;
+		}
+
+		uint8_t* const rdi = buffer.pointer() + pt.bufferOffset;
 		int written = 0;
-		CHECK( stream->read( rdi, (int)pt.payloadBytes, written ) );
+		if( nullptr != mappedFile )
+		{
+			// Copy or convert straight from the mapped pages, without the temporary buffer
+			if( !mappedFile->contains( pt.streamOffset, pt.payloadBytes ) )
+				return E_EOF;
+			const uint8_t* rsi = mappedFile->data() + pt.streamOffset;
+			if( pt.sourceType == pt.destPointer->type() && !pt.prepacked )
+				memcpy( rdi, rsi, pt.payloadBytes );
+			else
+			{
+				CHECK( convertTensor( pt, rdi, rsi ) );
+				countConverted++;
+			}
+		}
+		else if( pt.sourceType == pt.destPointer->type() && !pt.prepacked )
+		{
+			CHECK( stream->seek( pt.streamOffset, eSeekOrigin::Begin ) );
+			CHECK( stream->read( rdi, (int)pt.payloadBytes, written ) );
+		}
+		else
+		{
+			CHECK( stream->seek( pt.streamOffset, eSeekOrigin::Begin ) );
+			try
+			{
+				temp.resize( pt.payloadBytes );
+			}
+			catch( const std::bad_alloc& )
+			{
+				return E_OUTOFMEMORY;
+			}
+			CHECK( stream->read( temp.data(), (int)pt.payloadBytes, written ) );
+			CHECK( convertTensor( pt, rdi, temp.data() ) );
+			countConverted++;
+		}
 		CHECK( progressSink.gotBytes( (int64_t)pt.payloadBytes ) );
 
 		pt.destPointer->setDataPointer( rdi );
-
-		const size_t cb = ( pt.payloadBytes + 31 ) & ( ~( (size_t)31 ) );
-		rdi += cb;
 	}
 
-	CHECK( buffer.setReadOnly( bufferBytes ) );
+	if( 0 != bufferBytes )
+	{
+		CHECK( buffer.setReadOnly( bufferBytes ) );
+	}
 	destination.setMemoryBuffer( std::move( buffer ) );
 
 	constexpr double mulMb = 1.0 / ( 1 << 20 );
-	logDebug( u8"Loaded %zu decoder tensors, %g MB RAM", pending.size(), mulMb * (double)(int64_t)bufferBytes );
+	logDebug( u8"Loaded %zu tensors, %g MB RAM", pending.size(), mulMb * (double)(int64_t)bufferBytes );
+	if( 0 != countConverted )
+		logDebug( u8"Converted %zu tensors on load", countConverted );
+	if( 0 != countMapped )
+		logDebug( u8"%zu tensors are used directly from the memory mapped file", countMapped );
+	if( nullptr != numa )
+		logDebug( u8"Decoder matrices are distributed across %zu NUMA nodes", numa->size() );
+	return S_OK;
+}
+
+HRESULT HybridLoader::saveCache( ModelCacheWriter& writer, sModelCacheHeader& header ) const
+{
+	// Compute offsets of the payloads, the table goes first
+	header.tableOffset = writer.position();
+	header.countTensors = (uint32_t)pending.size();
+	size_t cbTable = 0;
+	for( const auto& pt : pending )
+		cbTable += cachedTensorRecordSize( pt.name.GetLength() );
+
+	std::vector<uint8_t> table;
+	try
+	{
+		table.resize( cbTable );
+	}
+	catch( const std::bad_alloc& )
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	constexpr uint64_t alignMask = modelCacheAlignment - 1;
+	uint64_t payloadOffset = ( header.tableOffset + cbTable + alignMask ) & ~alignMask;
+	uint8_t* rdi = table.data();
+	for( const auto& pt : pending )
+	{
+		const Tensor& t = *pt.destPointer;
+		if( pt.name.GetLength() > UCHAR_MAX )
+			return DISP_E_OVERFLOW;
+
+		sCachedTensor ct = {};
+		ct.offset = payloadOffset;
+		ct.bytes = (uint32_t)pt.tensorBytes;
+		ct.type = (uint8_t)t.type();
+		ct.nameLength = (uint8_t)pt.name.GetLength();
+		ct.sourceType = (uint8_t)pt.sourceType;
+		ct.ne = t.ne;
+		ct.nb = t.nb;
+		memcpy( rdi, &ct, sizeof( ct ) );
+		memcpy( rdi + sizeof( ct ), (const char*)pt.name, ct.nameLength );
+		rdi += cachedTensorRecordSize( ct.nameLength );
+
+		payloadOffset = ( payloadOffset + pt.tensorBytes + alignMask ) & ~alignMask;
+	}
+	CHECK( writer.write( table.data(), table.size() ) );
+
+	for( const auto& pt : pending )
+	{
+		CHECK( writer.align() );
+		CHECK( writer.write( pt.destPointer->data(), pt.tensorBytes ) );
+	}
+	return S_OK;
+}
+
+HRESULT HybridLoader::loadCache( const MappedFile& cache, const sModelCacheHeader& header, const Whisper::sModelParams& mp )
+{
+	if( header.countTensors != map.GetCount() )
+	{
+		logError( u8"Not all tensors in the model cache - expected %zu, got %zu", map.GetCount(), (size_t)header.countTensors );
+		return E_INVALIDARG;
+	}
+
+	uint64_t offset = header.tableOffset;
+	CStringA name;
+	CAtlMap<CStringA, bool> loaded;
+	for( uint32_t i = 0; i < header.countTensors; i++ )
+	{
+		sCachedTensor ct;
+		if( !cache.contains( (int64_t)offset, sizeof( ct ) ) )
+			return E_EOF;
+		memcpy( &ct, cache.data() + offset, sizeof( ct ) );
+		if( !cache.contains( (int64_t)offset, cachedTensorRecordSize( ct.nameLength ) ) )
+			return E_EOF;
+		name.SetString( (const char*)cache.data() + offset + sizeof( ct ), ct.nameLength );
+		offset += cachedTensorRecordSize( ct.nameLength );
+
+		auto p = map.Lookup( name );
+		if( nullptr == p )
+		{
+			logError( u8"Unknown tensor '%s' in the model cache", (const char*)name );
+			return E_INVALIDARG;
+		}
+		if( 0 != ct.offset % modelCacheAlignment || !cache.contains( (int64_t)ct.offset, ct.bytes ) )
+			return E_INVALIDARG;
+		// With the count verified above, no duplicates means every tensor of the model has its data
+		if( nullptr != loaded.Lookup( name ) )
+		{
+			logError( u8"Duplicate tensor '%s' in the model cache", (const char*)name );
+			return E_INVALIDARG;
+		}
+		loaded[ name ] = true;
+
+		// Make the layout of the tensor with the same code as the GGML loader, it must be exactly the one in the cache
+		std::array<int, 4> ne;
+		int n_dims;
+		if( !expectedShape( name, mp, ne, n_dims ) )
+			return E_INVALIDARG;
+		PendingTensor pt;
+		pt.sourceType = (eDataType)ct.sourceType;
+		if( pt.sourceType != eDataType::FP32 && pt.sourceType != eDataType::FP16 && pt.sourceType != eDataType::Q4_0 && pt.sourceType != eDataType::Q8_0 )
+			return E_INVALIDARG;
+		Tensor expected;
+		CHECK( tensorLayout( name, n_dims, ne, expected, pt ) );
+		if( expected.type() != (eDataType)ct.type || expected.ne != ct.ne || expected.nb != ct.nb || pt.tensorBytes > ct.bytes )
+		{
+			logError( u8"Tensor '%s' in the model cache doesn't match the model", (const char*)name );
+			return E_INVALIDARG;
+		}
+
+		Tensor& t = *p->m_value;
+		t.setType( expected.type() );
+		t.ne = expected.ne;
+		t.nb = expected.nb;
+		t.setDataPointer( (void*)( cache.data() + ct.offset ) );
+	}
+
+	logDebug( u8"Loaded %zu tensors from the model cache", (size_t)header.countTensors );
 	return S_OK;
 }
\ No newline at end of file
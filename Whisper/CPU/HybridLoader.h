@@ -1,5 +1,10 @@
 #pragma once
 #include "DecoderTensors.h"
+#include "EncoderTensors.h"
+#include "NumaNodes.h"
+#include "../Utils/MappedFile.h"
+#include "ModelCache.h"
+#include "../Whisper/sModelParams.h"
 #include <atlstr.h>
 #include <atlcoll.h>
 #include "../../ComLightLib/streams.h"
@@ -16,22 +21,59 @@ namespace CpuCompute
 		DecoderTensors& destination;
 		CAtlMap<CStringA, Tensor*> map;
 		size_t bufferBytes = 0;
+		// FP16 matrices of the decoder layers are quantized into this type on load, FP16 = keep them as they are
+		const eDataType quantizeWeights;
+		// When not nullptr, the matrices of the decoder layers are split across these NUMA nodes
+		const NumaNodes* const numa;
+		// When not nullptr, the tensors which don't need conversion point directly into the mapped pages of the model file
+		const MappedFile* mappedFile = nullptr;
 
 		struct alignas( 32 ) PendingTensor
 		{
 			Tensor* destPointer = nullptr;
+			CStringA name;
 			int64_t streamOffset = 0;
 			size_t bufferOffset = 0;
 			size_t payloadBytes = 0;
+			// Bytes in the destination buffer, different from payloadBytes when the tensor is converted on load
+			size_t tensorBytes = 0;
+			// Type of the payload in the file
+			eDataType sourceType;
+			// True when the FP16 matrix is reshaped into panels for the matrix multiplication
+			bool prepacked = false;
+			// True when the pages of the tensor are distributed across NUMA nodes, the tensor is aligned by memory pages
+			bool numaSplit = false;
+			// True when the tensor uses the payload in the memory mapped file, and takes no space in the buffer
+			bool mapped = false;
 		};
 		std::vector<PendingTensor> pending;
 
+		// Set shape, type and strides of the tensor from the sourceType field of the pending tensor.
+		// Also sets prepacked, payloadBytes and tensorBytes fields of the pending tensor.
+		HRESULT tensorLayout( const CStringA& name, int n_dims, const std::array<int, 4>& ne, Tensor& rdi, PendingTensor& pt ) const;
+		HRESULT convertTensor( const PendingTensor& pt, uint8_t* rdi, const uint8_t* rsi ) const;
+		HRESULT allocateNuma( LargeBuffer& buffer ) const;
+
 	public:
 
-		HybridLoader( DecoderTensors& m, int countLayers );
+		HybridLoader( DecoderTensors& m, int countLayers, EncoderTensors& enc, int countLayersEnc, eDataType quantize = eDataType::FP16, const NumaNodes* numa = nullptr );
+
+		// Must be called before the first setupTensor()
+		void setMappedFile( const MappedFile* mf )
+		{
+			assert( pending.empty() );
+			mappedFile = ( nullptr != mf && !mf->empty() ) ? mf : nullptr;
+		}
 
 		HRESULT setupTensor( const CStringA& name, int n_dims, int ftype, const std::array<int, 4>& ne, ComLight::iReadStream* stream, int64_t& postponedBytes );
 
 		HRESULT completeLoad( ComLight::iReadStream* stream, iLoaderProgressSink& progressSink );
+
+		// Write the table and payload of the loaded tensors into the cache file; must be called after completeLoad()
+		HRESULT saveCache( ModelCacheWriter& writer, sModelCacheHeader& header ) const;
+
+		// Instead of setupTensor / completeLoad, point the tensors into the memory mapped cache file.
+		// Fails when the table doesn't have exactly the tensors setupTensor would make for the model with these parameters.
+		HRESULT loadCache( const MappedFile& cache, const sModelCacheHeader& header, const Whisper::sModelParams& mp );
 	};
 }
\ No newline at end of file
@@ -10,12 +10,47 @@ namespace CpuCompute
 		uint16_t* keys = nullptr;
 		uint16_t* values = nullptr;
 		uint32_t size = 0;
+		// Geometry of a slot: rowsPerLayer rows of rowLength elements for every layer
+		uint32_t layers = 0, rowsPerLayer = 0, rowLength = 0;
+		uint32_t slotsCount = 0;
 
 		CpuCompute::LargeBuffer memory;
 
+		HRESULT allocate( uint32_t n_layer, uint32_t n_ctx, uint32_t n_state, uint32_t slots );
+
 	public:
-		// Create these two large tensors, FP16 precision
-		HRESULT create( const Whisper::sModelParams& mp );
+		// Create these two large tensors, FP16 precision, for memory_k / memory_v tensors
+		// The beam search uses a separate slot for every beam, the slots are stored sequentially in these tensors.
+		HRESULT create( const Whisper::sModelParams& mp, uint32_t slots = 1 );
+
+		// Create these two large tensors, FP16 precision, for memory_cross_k / memory_cross_v tensors
+		// Batched decoding uses a separate slot for the encoder output of every stream.
+		HRESULT createCross( const Whisper::sModelParams& mp, uint32_t slots = 1 );
+
+		uint32_t countSlots() const { return slotsCount; }
+
+		// Offset of the first element of the slot
+		uint32_t slotOffset( uint32_t slot ) const
+		{
+			assert( slot < slotsCount );
+			return slot * layers * rowsPerLayer * rowLength;
+		}
+
+		// Copy the first `rows` rows of every layer from one slot to another, to fork the history of a beam
+		HRESULT copySlot( uint32_t dest, uint32_t source, uint32_t rows );
+
+		// Exchange the buffers with another instance, without copying any data
+		void swap( KvTensors& that )
+		{
+			std::swap( keys, that.keys );
+			std::swap( values, that.values );
+			std::swap( size, that.size );
+			std::swap( layers, that.layers );
+			std::swap( rowsPerLayer, that.rowsPerLayer );
+			std::swap( rowLength, that.rowLength );
+			std::swap( slotsCount, that.slotsCount );
+			std::swap( memory, that.memory );
+		}
 
 		// A slice of model.memory_cross_k tensor
 		Tensor keysView( uint32_t len, uint32_t off ) const
@@ -3,17 +3,54 @@
 using namespace CpuCompute;
 
 // Create these two large tensors, FP16 precision
-HRESULT KvTensors::create( const Whisper::sModelParams& mp )
+HRESULT KvTensors::create( const Whisper::sModelParams& mp, uint32_t slots )
 {
-	const uint32_t n_mem = mp.n_text_layer * mp.n_text_ctx;
-	const uint32_t n_elements = mp.n_text_state * n_mem;
+	return allocate( mp.n_text_layer, mp.n_text_ctx, mp.n_text_state, slots );
+}
 
-	const size_t cb = sizeof( uint16_t ) * (size_t)n_elements * 2;
+HRESULT KvTensors::createCross( const Whisper::sModelParams& mp, uint32_t slots )
+{
+	return allocate( mp.n_text_layer, mp.n_audio_ctx, mp.n_text_state, slots );
+}
+
+HRESULT KvTensors::allocate( uint32_t n_layer, uint32_t n_ctx, uint32_t n_state, uint32_t slots )
+{
+	if( 0 == slots )
+		return E_INVALIDARG;
+	const size_t n_elements = (size_t)n_layer * n_ctx * n_state * slots;
+	if( n_elements > UINT_MAX )
+		return DISP_E_OVERFLOW;
+
+	const size_t cb = sizeof( uint16_t ) * n_elements * 2;
 	CHECK( memory.allocate( cb ) );
 
 	uint16_t* pointer = (uint16_t*)memory.pointer();
 	keys = pointer;
 	values = pointer + n_elements;
-	size = n_elements;
+	size = (uint32_t)n_elements;
+	layers = n_layer;
+	rowsPerLayer = n_ctx;
+	rowLength = n_state;
+	slotsCount = slots;
+	return S_OK;
+}
+
+HRESULT KvTensors::copySlot( uint32_t dest, uint32_t source, uint32_t rows )
+{
+	if( dest >= slotsCount || source >= slotsCount || rows > rowsPerLayer )
+		return E_BOUNDS;
+	if( dest == source || 0 == rows )
+		return S_OK;
+
+	const size_t layerStride = (size_t)rowsPerLayer * rowLength;
+	const size_t cb = sizeof( uint16_t ) * rows * rowLength;
+	const size_t offDest = slotOffset( dest );
+	const size_t offSource = slotOffset( source );
+	for( uint32_t i = 0; i < layers; i++ )
+	{
+		const size_t off = i * layerStride;
+		memcpy( keys + offDest + off, keys + offSource + off, cb );
+		memcpy( values + offDest + off, values + offSource + off, cb );
+	}
 	return S_OK;
 }
\ No newline at end of file
@@ -20,6 +20,35 @@ HRESULT LargeBuffer::allocate( size_t cb )
 	return HRESULT_FROM_WIN32( GetLastError() );
 }
 
+HRESULT LargeBuffer::reserve( size_t cb )
+{
+	deallocate();
+
+	pv = VirtualAlloc( nullptr, cb, MEM_RESERVE, PAGE_READWRITE );
+	if( nullptr != pv )
+		return S_OK;
+	return HRESULT_FROM_WIN32( GetLastError() );
+}
+
+HRESULT LargeBuffer::commit( size_t offset, size_t cb, uint32_t numaNode )
+{
+	if( nullptr == pv )
+		return OLE_E_BLANK;
+	assert( 0 == ( offset % 4096 ) && 0 == ( cb % 4096 ) );
+	if( 0 == cb )
+		return S_OK;
+
+	void* const ptr = (uint8_t*)pv + offset;
+	void* res;
+	if( numaNode == UINT_MAX )
+		res = VirtualAlloc( ptr, cb, MEM_COMMIT, PAGE_READWRITE );
+	else
+		res = VirtualAllocExNuma( GetCurrentProcess(), ptr, cb, MEM_COMMIT, PAGE_READWRITE, numaNode );
+	if( nullptr != res )
+		return S_OK;
+	return HRESULT_FROM_WIN32( GetLastError() );
+}
+
 HRESULT LargeBuffer::setReadOnly( size_t cb )
 {
 	if( nullptr != pv )
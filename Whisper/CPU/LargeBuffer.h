@@ -28,6 +28,13 @@ namespace CpuCompute
 		// The OS kernel guarantees zero-initialization of that memory.
 		HRESULT allocate( size_t cb );
 
+		// Reserve address space for the buffer without allocating any memory, the pages need to be committed before use
+		HRESULT reserve( size_t cb );
+
+		// Commit a range of pages of the reserved buffer, the physical memory comes from the specified NUMA node when possible.
+		// Offset and size must be multiples of the page size, UINT_MAX node = no preference
+		HRESULT commit( size_t offset, size_t cb, uint32_t numaNode = UINT_MAX );
+
 		// Change memory protection of the buffer to read only
 		HRESULT setReadOnly( size_t cb );
 
@@ -1,6 +1,7 @@
 #pragma once
 #include "Tensor.h"
 #include "ParallelForRunner.h"
+#include "mulMat.h"
 
 namespace CpuCompute
 {
@@ -8,6 +9,8 @@ namespace CpuCompute
 	{
 		ParallelForRunner pfor;
 		iMemoryAllocator* allocator = nullptr;
+		// Matrix multiplication kernels for the instruction set of this CPU
+		const MulMatKernels& mulMatKernels;
 
 	public:
 		MlContext( int threads );
@@ -19,6 +22,16 @@ namespace CpuCompute
 			return pfor.setThreadsCount( threads );
 		}
 
+		HRESULT setNumaNodes( const NumaNodes& nodes )
+		{
+			return pfor.setNumaNodes( nodes );
+		}
+
+		HRESULT setPinThreads( bool pin )
+		{
+			return pfor.setPinThreads( pin );
+		}
+
 		iMemoryAllocator* setAllocator( iMemoryAllocator* alloc )
 		{
 			iMemoryAllocator* const ret = allocator;
@@ -30,9 +43,14 @@ namespace CpuCompute
 		Tensor createTensor( eDataType type, std::initializer_list<uint32_t> size );
 
 		Tensor addRows( const Tensor& d_te, const Tensor& d_pe, const int* tokens, const int n_tokens, const int n_past );
+		// Same as above, with an explicit position for every token, for batches of independent sequences
+		Tensor addRows( const Tensor& d_te, const Tensor& d_pe, const int* tokens, const uint32_t* positions, const int n_tokens );
 
 		Tensor norm( const Tensor& arg );
 
+		// Fused norm() + fmaRepeat(), both w and b must have the same length as the rows of the argument
+		Tensor norm( const Tensor& arg, const TensorPair& wb );
+
 		// cur = add( mul( repeat( w, cur ), cur ), repeat( b, cur ) );
 		void fmaRepeat( Tensor& cur, const Tensor& w, const Tensor& b );
 
@@ -44,6 +62,24 @@ namespace CpuCompute
 		// Multiply two matrices
 		Tensor mulMat( const Tensor& a, const Tensor& b );
 
+		// Multiply two matrices, and apply the elementwise operations to the output tiles of the product
+		Tensor mulMat( const Tensor& a, const Tensor& b, const MulMatEpilogue& epilogue );
+
+		// Fused mulMat() + addRepeat()
+		Tensor mulMatBias( const Tensor& a, const Tensor& b, const Tensor& bias );
+		// Fused mulMat() + addRepeatScale()
+		Tensor mulMatBiasScale( const Tensor& a, const Tensor& b, const Tensor& bias, float scaling );
+		// Fused mulMat() + scale()
+		Tensor mulMatScale( const Tensor& a, const Tensor& b, float scaling );
+		// Fused mulMat() + addRepeatGelu()
+		Tensor mulMatBiasGelu( const Tensor& a, const Tensor& b, const Tensor& bias );
+		// Fused mulMat() + addRepeat() + add(), the residual tensor must be dense, with the same shape as the product
+		Tensor mulMatBiasAdd( const Tensor& a, const Tensor& b, const Tensor& bias, const Tensor& residual );
+
+		// 1D convolution with 3 elements wide kernel and padding 1, equivalent to ggml_conv_1d_1s or ggml_conv_1d_2s depending on the stride.
+		// The source tensor is [ length, channels ], the output is transposed compared to GGML: [ output channels, length / stride ]
+		Tensor conv1d( const Tensor& w, const Tensor& source, uint32_t stride );
+
 		// cur = add( repeat( b, cur ), cur ); cur = scale(cur, scaling)
 		void addRepeatScale( Tensor& cur, const Tensor& b, float scaling );
 
@@ -60,6 +96,11 @@ namespace CpuCompute
 
 		void softMax( Tensor& cur, float inputScale = 1.0f );
 
+		// Fused softmax( K^T * Q * inputScale ) * V, equivalent to mulMat + diagMaskInf + softMax + mulMat without the intermediate KQ tensor.
+		// V is the transposed FP16 tensor [ n_ctx, head size, heads ] like in ggml_flash_attn, but the elements of each key must be adjacent in memory.
+		// Unlike the GPU version, the scale is not applied implicitly: the decoder pre-scales both Q and K.
+		Tensor flashAttention( const Tensor& q, const Tensor& k, const Tensor& v, bool masked, float inputScale = 1.0f );
+
 		Tensor copy( const Tensor& a, eDataType type, std::initializer_list<uint32_t> size );
 
 		HRESULT copyImpl( Tensor& result, const Tensor& source );
@@ -67,5 +108,8 @@ namespace CpuCompute
 		Tensor permute( const Tensor& a, uint8_t axis0, uint8_t axis1, uint8_t axis2, uint8_t axis3 );
 
 		void copyInPlace( Tensor& dest, const Tensor& a, eDataType type, std::initializer_list<uint32_t> size );
+
+	private:
+		Tensor normImpl( const Tensor& arg, const float* w, const float* b );
 	};
 }
\ No newline at end of file
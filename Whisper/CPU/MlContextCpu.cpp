@@ -2,9 +2,12 @@
 #include "MlContext.h"
 #include "simdUtils.h"
 #include "mulMat.h"
+#include "flashAttention.h"
 using namespace CpuCompute;
 
-MlContext::MlContext( int threads ) : pfor( threads )
+MlContext::MlContext( int threads ) :
+	pfor( threads ),
+	mulMatKernels( selectMulMatKernels() )
 {
 }
 
@@ -61,6 +64,29 @@ Tensor MlContext::addRows( const Tensor& d_te, const Tensor& d_pe, const int* to
 	return res;
 }
 
+Tensor MlContext::addRows( const Tensor& d_te, const Tensor& d_pe, const int* tokens, const uint32_t* positions, const int n_tokens )
+{
+	if( d_te.type() != eDataType::FP16 || d_pe.type() != eDataType::FP32 )
+		throw E_INVALIDARG;
+	if( d_te.ne[ 0 ] != d_pe.ne[ 0 ] )
+		throw E_INVALIDARG;
+	if( n_tokens <= 0 )
+		throw E_BOUNDS;
+
+	Tensor res = createTensor( eDataType::FP32, { d_te.ne[ 0 ], (uint32_t)n_tokens } );
+
+	const size_t inner = (size_t)d_te.ne[ 0 ];
+	const size_t outer = (size_t)n_tokens;
+	float* rdi = res.fp32();
+	for( size_t i = 0; i < outer; i++, rdi += inner, tokens++, positions++ )
+	{
+		const uint16_t* const source1 = getRow16( d_te, *(const uint32_t*)tokens );
+		const float* const source2 = getRow32( d_pe, *positions );
+		addF16to32( rdi, source1, source2, inner );
+	}
+	return res;
+}
+
 namespace
 {
 	class DispatchHelper3
@@ -123,6 +149,9 @@ namespace
 		size_t inner;
 		DispatchHelper3 threads;
 		std::array<uint32_t, 3> nbInput;
+		// Optional affine transform, fused into the normalization
+		const float* w = nullptr;
+		const float* b = nullptr;
 
 		HRESULT __stdcall compute( size_t i, size_t end ) const override final
 		{
@@ -133,14 +162,14 @@ namespace
 			for( ; i < end; i++, rdi += inner, threads.next( idx ) )
 			{
 				const float* rsi = sourceRow( source, idx, nbInput[ 0 ], nbInput[ 1 ], nbInput[ 2 ] );
-				norm( rdi, temp, rsi, inner );
+				norm( rdi, temp, rsi, inner, w, b );
 			}
 			return S_OK;
 		}
 	};
 }
 
-Tensor MlContext::norm( const Tensor& arg )
+Tensor MlContext::normImpl( const Tensor& arg, const float* w, const float* b )
 {
 	if( arg.type() != eDataType::FP32 || arg.nb[ 0 ] != 1 )
 		throw E_INVALIDARG;
@@ -152,11 +181,29 @@ Tensor MlContext::norm( const Tensor& arg )
 	context.inner = arg.ne[ 0 ];
 	context.threads = DispatchHelper3( arg.ne[ 1 ], arg.ne[ 2 ], arg.ne[ 3 ] );
 	context.nbInput = { arg.nb[ 1 ], arg.nb[ 2 ], arg.nb[ 3 ] };
+	context.w = w;
+	context.b = b;
 
 	check( pfor.parallelFor( context, context.threads.groupsCount() ) );
 	return res;
 }
 
+Tensor MlContext::norm( const Tensor& arg )
+{
+	return normImpl( arg, nullptr, nullptr );
+}
+
+Tensor MlContext::norm( const Tensor& arg, const TensorPair& wb )
+{
+	const Tensor& w = wb.w;
+	const Tensor& b = wb.b;
+	if( !( w.isContinuous() && b.isContinuous() && w.type() == eDataType::FP32 && b.type() == eDataType::FP32 ) )
+		throw E_INVALIDARG;
+	if( w.countElements() != arg.ne[ 0 ] || b.countElements() != arg.ne[ 0 ] )
+		throw E_INVALIDARG;
+	return normImpl( arg, w.fp32(), b.fp32() );
+}
+
 void MlContext::fmaRepeat( Tensor& cur, const Tensor& w, const Tensor& b )
 {
 	if( !( cur.isContinuous() && w.isContinuous() && b.isContinuous() ) )
@@ -197,10 +244,151 @@ Tensor MlContext::mulMat( const Tensor& a, const Tensor& b )
 	std::array<uint32_t, 4> ne{ a.ne[ 1 ], b.ne[ 1 ], a.ne[ 2 ], b.ne[ 3 ] };
 	Tensor result = createTensor( eDataType::FP32, ne );
 
-	check( CpuCompute::mulMat( result, a, b, pfor ) );
+	check( mulMatKernels.mulMat( result, a, b, pfor, nullptr ) );
+	return result;
+}
+
+Tensor MlContext::mulMat( const Tensor& a, const Tensor& b, const MulMatEpilogue& epilogue )
+{
+	if( !DirectCompute::canMulMat( a, b ) )
+		throw E_INVALIDARG;
+
+	std::array<uint32_t, 4> ne{ a.ne[ 1 ], b.ne[ 1 ], a.ne[ 2 ], b.ne[ 3 ] };
+	Tensor result = createTensor( eDataType::FP32, ne );
+
+	check( mulMatKernels.mulMat( result, a, b, pfor, &epilogue ) );
 	return result;
 }
 
+namespace
+{
+	// The kernels add the bias vector to every column of the product
+	const float* biasPointer( const Tensor& bias, const Tensor& a )
+	{
+		if( !( bias.isContinuous() && bias.type() == eDataType::FP32 && bias.countElements() == a.ne[ 1 ] ) )
+			throw E_INVALIDARG;
+		return bias.fp32();
+	}
+}
+
+Tensor MlContext::mulMatBias( const Tensor& a, const Tensor& b, const Tensor& bias )
+{
+	MulMatEpilogue ep;
+	ep.bias = biasPointer( bias, a );
+	return mulMat( a, b, ep );
+}
+
+Tensor MlContext::mulMatBiasScale( const Tensor& a, const Tensor& b, const Tensor& bias, float scaling )
+{
+	MulMatEpilogue ep;
+	ep.bias = biasPointer( bias, a );
+	ep.scale = scaling;
+	return mulMat( a, b, ep );
+}
+
+Tensor MlContext::mulMatScale( const Tensor& a, const Tensor& b, float scaling )
+{
+	MulMatEpilogue ep;
+	ep.scale = scaling;
+	return mulMat( a, b, ep );
+}
+
+Tensor MlContext::mulMatBiasGelu( const Tensor& a, const Tensor& b, const Tensor& bias )
+{
+	MulMatEpilogue ep;
+	ep.bias = biasPointer( bias, a );
+	ep.gelu = true;
+	return mulMat( a, b, ep );
+}
+
+Tensor MlContext::mulMatBiasAdd( const Tensor& a, const Tensor& b, const Tensor& bias, const Tensor& residual )
+{
+	const std::array<uint32_t, 4> ne{ a.ne[ 1 ], b.ne[ 1 ], a.ne[ 2 ], b.ne[ 3 ] };
+	if( !( residual.isContinuous() && residual.type() == eDataType::FP32 && residual.ne == ne ) )
+		throw E_INVALIDARG;
+
+	MulMatEpilogue ep;
+	ep.bias = biasPointer( bias, a );
+	ep.residual = residual.fp32();
+	return mulMat( a, b, ep );
+}
+
+namespace
+{
+	// Gather sliding windows of the source into columns of a matrix, for 1D convolution with the 3 elements wide kernel.
+	// Order of elements in the columns is [ 3, channels ], same as the layout of the convolution kernels in the model.
+	struct Im2ColContext : public iComputeRange
+	{
+		const float* source;
+		float* result;
+		size_t length, channels;
+		// Strides of the source tensor: along the time, and between channels
+		size_t strideTime, strideChannel;
+		size_t stride;
+
+		HRESULT __stdcall compute( size_t i, size_t end ) const override final
+		{
+			const size_t columnLength = channels * 3;
+			float* rdi = result + i * columnLength;
+			for( ; i < end; i++ )
+			{
+				// The kernel is centered on the output element, the first tap is at -1 i.e. padding = 1
+				const ptrdiff_t t0 = (ptrdiff_t)( i * stride ) - 1;
+				const bool inside = t0 >= 0 && t0 + 3 <= (ptrdiff_t)length;
+				const float* rsi = source + t0 * (ptrdiff_t)strideTime;
+				for( size_t c = 0; c < channels; c++, rsi += strideChannel, rdi += 3 )
+				{
+					if( inside )
+					{
+						// This branch is very predictable, only the first and the last columns are different
+						rdi[ 0 ] = rsi[ 0 ];
+						rdi[ 1 ] = rsi[ strideTime ];
+						rdi[ 2 ] = rsi[ strideTime * 2 ];
+						continue;
+					}
+					for( ptrdiff_t k = 0; k < 3; k++ )
+					{
+						const ptrdiff_t t = t0 + k;
+						rdi[ k ] = ( t >= 0 && t < (ptrdiff_t)length ) ? rsi[ k * (ptrdiff_t)strideTime ] : 0.0f;
+					}
+				}
+			}
+			return S_OK;
+		}
+	};
+}
+
+Tensor MlContext::conv1d( const Tensor& w, const Tensor& source, uint32_t stride )
+{
+	if( w.type() != eDataType::FP16 || source.type() != eDataType::FP32 )
+		throw E_INVALIDARG;
+	if( w.ne[ 0 ] != 3 || w.ne[ 1 ] != source.ne[ 1 ] || !w.isContinuous() || !source.isMatrix() )
+		throw E_INVALIDARG;
+	if( stride != 1 && stride != 2 )
+		throw E_NOTIMPL;
+
+	const uint32_t channels = source.ne[ 1 ];
+	const uint32_t outLength = source.ne[ 0 ] / stride;
+	const uint32_t columnLength = channels * 3;
+
+	// Convert convolution into matrix multiplication, the columns tensor is [ 3 * channels, outLength ]
+	Tensor columns = createTensor( eDataType::FP32, { columnLength, outLength } );
+
+	Im2ColContext context;
+	context.source = source.fp32();
+	context.result = columns.fp32();
+	context.length = source.ne[ 0 ];
+	context.channels = channels;
+	context.strideTime = source.nb[ 0 ];
+	context.strideChannel = source.nb[ 1 ];
+	context.stride = stride;
+	check( pfor.parallelFor( context, outLength ) );
+
+	// Kernels are [ 3, channels, output channels ], reshape into a matrix
+	const Tensor kernels = w.reshape3d( columnLength, w.ne[ 2 ], 1 );
+	return mulMat( kernels, columns );
+}
+
 // cur = add( repeat( b, cur ), cur ); cur = scale(cur, scaling)
 void MlContext::addRepeatScale( Tensor& cur, const Tensor& b, float scaling )
 {
@@ -327,6 +515,13 @@ void MlContext::softMax( Tensor& cur, float inputScale )
 	pfor.parallelFor( context, n );
 }
 
+Tensor MlContext::flashAttention( const Tensor& q, const Tensor& k, const Tensor& v, bool masked, float inputScale )
+{
+	Tensor result = createTensor( eDataType::FP32, q.ne );
+	check( CpuCompute::flashAttention( result, q, k, v, masked, inputScale, pfor ) );
+	return result;
+}
+
 namespace
 {
 	template<class R, class S>
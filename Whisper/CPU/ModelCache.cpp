@@ -0,0 +1,94 @@
+#include "stdafx.h"
+#include "ModelCache.h"
+#include "../Utils/MurmurHash3.h"
+using namespace CpuCompute;
+
+HRESULT ModelCacheFile::initialize( const wchar_t* modelPath )
+{
+	path = modelPath;
+	path += L".cache";
+
+	WIN32_FILE_ATTRIBUTE_DATA fad;
+	if( !GetFileAttributesExW( modelPath, GetFileExInfoStandard, &fad ) )
+		return getLastHr();
+
+	// The first 64kb of the model contain the parameters, MEL filters, and the start of the vocabulary.
+	// Along with the size and the timestamp, that's enough to detect a different model, without reading the complete file.
+	constexpr DWORD cbHead = 1u << 16;
+	std::vector<uint8_t> buffer;
+	buffer.resize( cbHead + 16 );
+	CAtlFile file;
+	CHECK( file.Create( modelPath, GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING ) );
+	DWORD cb = 0;
+	CHECK( file.Read( buffer.data(), cbHead, cb ) );
+
+	uint8_t* rdi = buffer.data() + cb;
+	memcpy( rdi, &fad.nFileSizeLow, 4 );
+	memcpy( rdi + 4, &fad.nFileSizeHigh, 4 );
+	memcpy( rdi + 8, &fad.ftLastWriteTime, 8 );
+	MurmurHash3_x64_128( buffer.data(), (int)( cb + 16 ), modelCacheVersion, sourceHash.data() );
+	return S_OK;
+}
+
+ModelCacheWriter::~ModelCacheWriter()
+{
+	if( file )
+	{
+		// Not committed, drop the incomplete file
+		file.Close();
+		DeleteFileW( tempPath.c_str() );
+	}
+}
+
+HRESULT ModelCacheWriter::create( const std::wstring& path )
+{
+	finalPath = path;
+	// Unique name of the temporary file, in case multiple processes compile the same model at the same time
+	tempPath = path;
+	tempPath += L".";
+	tempPath += std::to_wstring( GetCurrentProcessId() );
+	tempPath += L".tmp";
+
+	CHECK( file.Create( tempPath.c_str(), GENERIC_WRITE, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN ) );
+	const sModelCacheHeader placeholder = {};
+	offset = 0;
+	return write( &placeholder, sizeof( placeholder ) );
+}
+
+HRESULT ModelCacheWriter::write( const void* pv, size_t cb )
+{
+	const uint8_t* rsi = (const uint8_t*)pv;
+	while( cb > 0 )
+	{
+		// CAtlFile::Write takes DWORD length, write large tensors in 1GB pieces
+		const DWORD chunk = (DWORD)std::min( cb, (size_t)1 << 30 );
+		CHECK( file.Write( rsi, chunk ) );
+		rsi += chunk;
+		cb -= chunk;
+		offset += chunk;
+	}
+	return S_OK;
+}
+
+HRESULT ModelCacheWriter::align()
+{
+	const size_t rem = (size_t)( offset % modelCacheAlignment );
+	if( 0 == rem )
+		return S_OK;
+	const std::array<uint8_t, modelCacheAlignment> zeros = {};
+	return write( zeros.data(), modelCacheAlignment - rem );
+}
+
+HRESULT ModelCacheWriter::commit( const sModelCacheHeader& header )
+{
+	CHECK( file.Seek( 0, FILE_BEGIN ) );
+	CHECK( file.Write( &header, (DWORD)sizeof( header ) ) );
+	CHECK( file.Flush() );
+	file.Close();
+
+	if( MoveFileExW( tempPath.c_str(), finalPath.c_str(), MOVEFILE_REPLACE_EXISTING ) )
+		return S_OK;
+	const HRESULT hr = getLastHr();
+	DeleteFileW( tempPath.c_str() );
+	return hr;
+}
\ No newline at end of file
@@ -0,0 +1,89 @@
+#pragma once
+#include <stdint.h>
+#include <array>
+#include <string>
+#define WIN32_LEAN_AND_MEAN
+#include <atlfile.h>
+
+namespace CpuCompute
+{
+	// The hybrid model can save the tensors in their final memory layout into a cache file next to the model: prepacked, and quantized when requested.
+	// Next time, the tensors are used directly from the memory mapped cache, without parsing nor converting the GGML model.
+	constexpr uint32_t modelCacheMagic = 0x4D434857; // "WHCM"
+	constexpr uint32_t modelCacheVersion = 2;
+	// Offsets of the tensors in the cache file are aligned by this count of bytes
+	constexpr uint32_t modelCacheAlignment = 64;
+
+	struct sModelCacheHeader
+	{
+		uint32_t magic, version;
+		// Length of the GGML file prefix with the parameters, MEL filters and vocabulary; the copy of these bytes follows this header.
+		uint32_t cbPrefix;
+		uint32_t countTensors;
+		// Hash of the source GGML file, see ModelCacheFile::initialize
+		std::array<uint64_t, 2> sourceHash;
+		// Offset of the sCachedTensor table in the cache file
+		uint64_t tableOffset;
+		// eDataType used to quantize the decoder matrices on load, and the height of the prepacked panels
+		uint8_t quantize, panelHeight;
+		uint16_t reserved16;
+		uint32_t reserved32;
+	};
+	static_assert( sizeof( sModelCacheHeader ) == 48 );
+
+	// The table contains these structures, each one followed by the name of the tensor, padded to the multiple of 8 bytes
+	struct sCachedTensor
+	{
+		uint64_t offset;
+		uint32_t bytes;
+		uint8_t type;
+		uint8_t nameLength;
+		// eDataType of the tensor in the GGML file, the loader verifies the layout of the tensor is the one made by HybridLoader.setupTensor
+		uint8_t sourceType;
+		uint8_t reserved;
+		std::array<uint32_t, 4> ne, nb;
+	};
+	static_assert( sizeof( sCachedTensor ) == 48 );
+
+	inline size_t cachedTensorRecordSize( size_t nameLength )
+	{
+		return sizeof( sCachedTensor ) + ( ( nameLength + 7 ) & ~(size_t)7 );
+	}
+
+	// Location of the cache, and identity of the model file it was compiled from
+	struct ModelCacheFile
+	{
+		std::wstring path;
+		std::array<uint64_t, 2> sourceHash = {};
+
+		// Set the path of the cache, and hash the size, last write time, and the first 64kb of the model file
+		HRESULT initialize( const wchar_t* modelPath );
+	};
+
+	// Sequential writer of the cache file.
+	// Writes into a temporary file which is renamed on commit, concurrent processes never see incomplete caches.
+	class ModelCacheWriter
+	{
+		CAtlFile file;
+		std::wstring tempPath, finalPath;
+		uint64_t offset = 0;
+
+	public:
+		ModelCacheWriter() = default;
+		ModelCacheWriter( const ModelCacheWriter& ) = delete;
+		~ModelCacheWriter();
+
+		// Create the temporary file, and reserve space for the header
+		HRESULT create( const std::wstring& path );
+
+		HRESULT write( const void* pv, size_t cb );
+
+		// Pad the file with zeros to the next multiple of modelCacheAlignment
+		HRESULT align();
+
+		uint64_t position() const { return offset; }
+
+		// Write the header, close the file, and replace the cache
+		HRESULT commit( const sModelCacheHeader& header );
+	};
+}
\ No newline at end of file
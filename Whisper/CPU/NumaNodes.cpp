@@ -0,0 +1,29 @@
+#include "stdafx.h"
+#include "NumaNodes.h"
+using namespace CpuCompute;
+
+HRESULT NumaNodes::query()
+{
+	nodes.clear();
+
+	ULONG highest = 0;
+	if( !GetNumaHighestNodeNumber( &highest ) )
+		return getLastHr();
+	if( 0 == highest )
+		return S_OK;
+
+	for( ULONG i = 0; i <= highest; i++ )
+	{
+		GROUP_AFFINITY ga;
+		if( !GetNumaNodeProcessorMaskEx( (USHORT)i, &ga ) )
+			return getLastHr();
+		// Memory-only nodes don't have processors to run the threads
+		if( 0 == ga.Mask )
+			continue;
+		nodes.push_back( Node{ i, ga } );
+	}
+
+	if( nodes.size() < 2 )
+		nodes.clear();
+	return S_OK;
+}
\ No newline at end of file
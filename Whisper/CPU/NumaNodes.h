@@ -0,0 +1,37 @@
+#pragma once
+#include <vector>
+
+namespace CpuCompute
+{
+	// NUMA nodes of the computer, which have processors
+	class NumaNodes
+	{
+		struct Node
+		{
+			uint32_t number;
+			GROUP_AFFINITY processors;
+		};
+		std::vector<Node> nodes;
+
+	public:
+
+		// Enumerate the nodes. On computers with a single node, the collection stays empty.
+		HRESULT query();
+
+		bool empty() const { return nodes.empty(); }
+		size_t size() const { return nodes.size(); }
+
+		// NUMA node number for VirtualAllocExNuma
+		uint32_t nodeNumber( size_t idx ) const { return nodes[ idx ].number; }
+
+		// Logical processors of the node, for SetThreadGroupAffinity
+		const GROUP_AFFINITY& processors( size_t idx ) const { return nodes[ idx ].processors; }
+
+		// When a range of things is split evenly across the nodes, index of the node which receives the item
+		size_t nodeForItem( size_t i, size_t count ) const
+		{
+			assert( i < count );
+			return ( i * nodes.size() ) / count;
+		}
+	};
+}
\ No newline at end of file
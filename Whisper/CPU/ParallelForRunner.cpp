@@ -1,7 +1,39 @@
 #include "stdafx.h"
 #include "ParallelForRunner.h"
+#include <immintrin.h>
+#include <bit>
 using namespace CpuCompute;
 
+namespace
+{
+	thread_local uint32_t currentThreadIndex = UINT_MAX;
+
+	// How many times to poll for the next job before going to sleep, and for the workers before waiting for them.
+	// Depending on the CPU, PAUSE instruction takes 10-150 cycles, this makes 10-200 microseconds of spinning.
+	constexpr uint32_t spinIterations = 2048;
+
+	// Count of chunks per slice. More chunks improve the load balancing, at the cost of more compute() calls.
+	constexpr size_t chunksPerThread = 4;
+
+	// Wait until the atomic value is different from the argument, return the new value
+	template<class T>
+	inline T spinThenWait( const std::atomic<T>& value, T old )
+	{
+		T current = value.load( std::memory_order_acquire );
+		for( uint32_t i = 0; current == old && i < spinIterations; i++ )
+		{
+			_mm_pause();
+			current = value.load( std::memory_order_acquire );
+		}
+		while( current == old )
+		{
+			value.wait( old, std::memory_order_acquire );
+			current = value.load( std::memory_order_acquire );
+		}
+		return current;
+	}
+}
+
 ParallelForRunner::ParallelForRunner( int threads ) :
 	maxThreads( threads )
 {
@@ -11,9 +43,7 @@ ParallelForRunner::ParallelForRunner( int threads ) :
 		return;
 	}
 
-	work = CreateThreadpoolWork( &workCallbackStatic, this, nullptr );
-	if( nullptr == work )
-		throw getLastHr();
+	check( createWorkers() );
 	threadBuffers.resize( maxThreads );
 }
 
@@ -27,57 +57,196 @@ HRESULT ParallelForRunner::setThreadsCount( int threads )
 	}
 
 	threadBuffers.resize( maxThreads );
-	if( nullptr == work )
+	CHECK( createWorkers() );
+	// The node of the thread depends on the count of threads
+	if( !numa.empty() )
+		CHECK( applyAffinity() );
+	return S_OK;
+}
+
+// Create missing worker threads; when the count of threads decreases, the extra workers stay asleep
+HRESULT ParallelForRunner::createWorkers()
+{
+	const size_t count = (size_t)maxThreads;
+	if( workers.size() + 1 >= count )
+		return S_OK;
+
+	try
 	{
-		work = CreateThreadpoolWork( &workCallbackStatic, this, nullptr );
-		if( nullptr == work )
-			return getLastHr();
+		slices = std::make_unique<Slice[]>( count );
+		workers.reserve( count - 1 );
+		while( workers.size() + 1 < count )
+		{
+			const size_t ith = workers.size() + 1;
+			std::unique_ptr<Worker> w = std::make_unique<Worker>();
+			Worker* const pw = w.get();
+			pw->thread = std::thread( &ParallelForRunner::workerThread, this, pw, ith );
+			workers.emplace_back( std::move( w ) );
+			if( pinThreads || !numa.empty() )
+				CHECK( applyAffinity( *pw, ith ) );
+		}
+		return S_OK;
+	}
+	catch( const std::bad_alloc& )
+	{
+		return E_OUTOFMEMORY;
+	}
+	catch( const std::system_error& ex )
+	{
+		logError( u8"Unable to create a thread: %s", ex.what() );
+		return E_FAIL;
 	}
-	return S_OK;
 }
 
 ParallelForRunner::~ParallelForRunner()
 {
-	if( nullptr != work )
+	stopWorkers();
+}
+
+void ParallelForRunner::stopWorkers() noexcept
+{
+	shuttingDown.store( true );
+	for( auto& w : workers )
 	{
-		if( S_FALSE == status )
-			WaitForThreadpoolWorkCallbacks( work, FALSE );
-		CloseThreadpoolWork( work );
+		w->ticket.fetch_add( 1, std::memory_order_release );
+		w->ticket.notify_one();
 	}
+	for( auto& w : workers )
+		if( w->thread.joinable() )
+			w->thread.join();
+	workers.clear();
 }
 
-namespace
+HRESULT ParallelForRunner::applyAffinity( Worker& w, size_t ith ) const
 {
-	thread_local uint32_t currentThreadIndex = UINT_MAX;
+	if( !numa.empty() )
+	{
+		// Workers which were left asleep after the count of threads decreased go to the last node
+		const size_t count = (size_t)(uint32_t)maxThreads;
+		const size_t node = numa.nodeForItem( std::min( ith, count - 1 ), count );
+		if( !SetThreadGroupAffinity( (HANDLE)w.thread.native_handle(), &numa.processors( node ), nullptr ) )
+			return getLastHr();
+		return S_OK;
+	}
+
+	DWORD_PTR processMask, systemMask;
+	if( !GetProcessAffinityMask( GetCurrentProcess(), &processMask, &systemMask ) )
+		return getLastHr();
+
+	DWORD_PTR mask = processMask;
+	if( pinThreads )
+	{
+		// The ith processor of the process, wrapping around when there're more threads than processors
+		const uint32_t countProcessors = (uint32_t)std::popcount( (uint64_t)processMask );
+		if( 0 == countProcessors )
+			return E_UNEXPECTED;
+		uint32_t index = (uint32_t)( ith % countProcessors );
+		DWORD_PTR bits = processMask;
+		while( index-- > 0 )
+			bits &= bits - 1;
+		mask = bits & ( ~bits + 1 );
+	}
+
+	if( 0 == SetThreadAffinityMask( (HANDLE)w.thread.native_handle(), mask ) )
+		return getLastHr();
+	return S_OK;
 }
 
-void ParallelForRunner::runBatch( size_t ith ) noexcept
+HRESULT ParallelForRunner::applyAffinity() const
 {
-	currentThreadIndex = (uint32_t)ith;
-	const size_t begin = ( ith * countItems ) / countThreads;
-	const size_t end = ( ( ith + 1 ) * countItems ) / countThreads;
+	for( size_t i = 0; i < workers.size(); i++ )
+		CHECK( applyAffinity( *workers[ i ], i + 1 ) );
+	return S_OK;
+}
+
+HRESULT ParallelForRunner::setPinThreads( bool pin )
+{
+	if( pin == pinThreads )
+		return S_OK;
+	pinThreads = pin;
+	return applyAffinity();
+}
+
+HRESULT ParallelForRunner::setNumaNodes( const NumaNodes& nodes )
+{
+	numa = nodes;
+	numaCallerThread = 0;
+	return applyAffinity();
+}
+
+// The slice #0 goes to the calling thread, move that thread to the node which has the first slice of the weights.
+// Changing affinity is a kernel call, only doing that once per calling thread.
+void ParallelForRunner::pinCallerThread()
+{
+	const DWORD tid = GetCurrentThreadId();
+	if( tid == numaCallerThread )
+		return;
+	numaCallerThread = tid;
+	if( !SetThreadGroupAffinity( GetCurrentThread(), &numa.processors( 0 ), nullptr ) )
+		logWarning( u8"SetThreadGroupAffinity failed, the calling thread stays on the current NUMA node" );
+}
+
+void ParallelForRunner::workerThread( Worker* w, size_t ith ) noexcept
+{
+	uint32_t ticket = 0;
+	while( true )
+	{
+		ticket = spinThenWait( w->ticket, ticket );
+		if( shuttingDown.load( std::memory_order_acquire ) )
+			return;
+
+		runBatch( ith );
+
+		if( 1 == pending.fetch_sub( 1, std::memory_order_acq_rel ) )
+			pending.notify_one();
+	}
+}
 
-	HRESULT hr = E_UNEXPECTED;
+HRESULT ParallelForRunner::computeChunk( size_t begin, size_t end ) noexcept
+{
 	try
 	{
-		hr = computeRange->compute( begin, end );
+		return computeRange->compute( begin, end );
 	}
 	catch( HRESULT code )
 	{
-		hr = code;
+		return code;
 	}
 	catch( const std::bad_alloc& )
 	{
-		hr = E_OUTOFMEMORY;
+		return E_OUTOFMEMORY;
 	}
 	catch( const std::exception& )
 	{
-		hr = E_FAIL;
+		return E_FAIL;
 	}
+}
+
+void ParallelForRunner::runBatch( size_t ith ) noexcept
+{
+	currentThreadIndex = (uint32_t)ith;
+	const size_t nth = countThreads;
+	const size_t chunk = chunkSize;
+
+	// Start with the own slice of the thread, then steal chunks from the slices of the other threads
+	HRESULT hr = S_OK;
+	for( size_t i = 0; i < nth && SUCCEEDED( hr ); i++ )
+	{
+		Slice& s = slices[ ( ith + i ) % nth ];
+		while( SUCCEEDED( hr ) )
+		{
+			const size_t begin = s.next.fetch_add( chunk, std::memory_order_relaxed );
+			if( begin >= s.end )
+				break;
+			hr = computeChunk( begin, std::min( begin + chunk, s.end ) );
+		}
+	}
+
 	currentThreadIndex = UINT_MAX;
 	if( SUCCEEDED( hr ) )
 		return;
-	InterlockedCompareExchange( &status, hr, S_FALSE );
+	HRESULT expected = S_FALSE;
+	status.compare_exchange_strong( expected, hr );
 }
 
 void* ParallelForRunner::threadLocalBuffer( size_t cb )
@@ -105,43 +274,52 @@ void* ParallelForRunner::threadLocalBuffer( size_t cb )
 	}
 }
 
-void __stdcall ParallelForRunner::workCallbackStatic( PTP_CALLBACK_INSTANCE Instance, void* pv, PTP_WORK Work ) noexcept
-{
-	ParallelForRunner& context = *(ParallelForRunner*)pv;
-	const size_t ith = (uint32_t)( InterlockedIncrement( &context.threadIndex ) );
-	context.runBatch( ith );
-}
-
 HRESULT ParallelForRunner::parallelFor( iComputeRange& compute, size_t length, size_t minBatch )
 {
-	if( maxThreads <= 1 )
+	assert( minBatch > 0 );
+	size_t nth = length / minBatch;
+	nth = std::min( nth, (size_t)(uint32_t)maxThreads );
+	// Can be less than maxThreads after a failure to create the threads
+	nth = std::min( nth, workers.size() + 1 );
+
+	if( nth <= 1 )
 	{
 		currentThreadIndex = 0;
 		const HRESULT hr1 = compute.compute( 0, length );
 		currentThreadIndex = UINT_MAX;
 		return hr1;
 	}
-	assert( minBatch > 0 );
 
-	size_t nth = length / minBatch;
-	nth = std::min( nth, (size_t)(uint32_t)maxThreads );
+	if( !numa.empty() )
+		pinCallerThread();
 
 	computeRange = &compute;
-	countItems = length;
 	countThreads = nth;
-	threadIndex = 0;
-	status = S_FALSE;
+	chunkSize = std::max( minBatch, length / ( nth * chunksPerThread ) );
+	for( size_t i = 0; i < nth; i++ )
+	{
+		slices[ i ].next.store( ( i * length ) / nth, std::memory_order_relaxed );
+		slices[ i ].end = ( ( i + 1 ) * length ) / nth;
+	}
+	status.store( S_FALSE, std::memory_order_relaxed );
+	pending.store( (uint32_t)( nth - 1 ), std::memory_order_relaxed );
 
+	// The release ordering of the tickets publishes the above fields to the workers
 	for( size_t i = 1; i < nth; i++ )
-		SubmitThreadpoolWork( work );
+	{
+		Worker& w = *workers[ i - 1 ];
+		w.ticket.fetch_add( 1, std::memory_order_release );
+		w.ticket.notify_one();
+	}
 	runBatch( 0 );
 
-	if( nth > 1 )
-		WaitForThreadpoolWorkCallbacks( work, FALSE );
+	uint32_t remaining = pending.load( std::memory_order_acquire );
+	while( 0 != remaining )
+		remaining = spinThenWait( pending, remaining );
 
 	computeRange = nullptr;
-	const HRESULT hr = status;
-	status = S_OK;
+	const HRESULT hr = status.load( std::memory_order_relaxed );
+	status.store( S_OK, std::memory_order_relaxed );
 	if( SUCCEEDED( hr ) )
 		return S_OK;
 
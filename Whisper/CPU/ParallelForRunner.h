@@ -1,5 +1,9 @@
 #pragma once
 #include "LargeBuffer.h"
+#include "NumaNodes.h"
+#include <atomic>
+#include <thread>
+#include <memory>
 
 namespace CpuCompute
 {
@@ -7,10 +11,13 @@ namespace CpuCompute
 	__interface iComputeRange
 	{
 		// The implementation calls this method on multiple thread pool threads in parallel, and aggregates status codes.
+		// The same thread may call this method multiple times for different chunks of the range.
 		HRESULT __stdcall compute( size_t begin, size_t end ) const;
 	};
 
-	// Similar to ThreadPoolWork in parallelFor.h, optimized to be used as a direct replacement of OpenMP pool.
+	// Portable thread pool, optimized to be used as a direct replacement of OpenMP pool.
+	// The range is split into equal slices, one per thread. The threads consume the slices in chunks, and the threads which complete their slices steal the remaining chunks from other slices.
+	// Idle workers spin for a short while before sleeping, the model runs many small compute jobs in rapid succession.
 	class alignas( 64 ) ParallelForRunner
 	{
 	public:
@@ -19,6 +26,14 @@ namespace CpuCompute
 
 		HRESULT setThreadsCount( int threads );
 
+		// Pin the worker threads to distinct logical processors of the process, or let the OS schedule them again
+		HRESULT setPinThreads( bool pin );
+
+		// Distribute the threads evenly across NUMA nodes: thread #i runs on the node nodes.nodeForItem( i, threads ).
+		// The parallelFor splits ranges in the same proportions, consecutive items are computed on the same node.
+		// When enabled, this overrides setPinThreads, and the thread which calls parallelFor is moved to the first node.
+		HRESULT setNumaNodes( const NumaNodes& nodes );
+
 		HRESULT parallelFor( iComputeRange& compute, size_t length, size_t minBatch = 1 );
 
 		// Allocate a temporary buffer for the calling thread.
@@ -28,10 +43,13 @@ namespace CpuCompute
 	private:
 
 		int maxThreads;
-		PTP_WORK work = nullptr;
+		bool pinThreads = false;
+		NumaNodes numa;
+		// ID of the last thread which called parallelFor, and was moved to the first NUMA node
+		DWORD numaCallerThread = 0;
 		iComputeRange* computeRange = nullptr;
-		size_t countItems = 0;
 		size_t countThreads = 0;
+		size_t chunkSize = 0;
 
 		// Aligning by cache lines.
 		// Avoiding cache line sharing between CPU cores improves performance, despite wasting a few bytes of memory.
@@ -42,11 +60,35 @@ namespace CpuCompute
 		};
 		std::vector<ThreadBuffer> threadBuffers;
 
-		alignas( 64 ) volatile long threadIndex = 0;
-		volatile HRESULT status = S_OK;
+		// Range of items initially assigned to a thread. The owner and the thieves advance the same cursor.
+		struct alignas( 64 ) Slice
+		{
+			std::atomic_size_t next = 0;
+			size_t end = 0;
+		};
+		std::unique_ptr<Slice[]> slices;
 
-		void runBatch( size_t ith ) noexcept;
+		// Worker threads, the thread which calls parallelFor is the thread #0, these are threads #1 and above
+		struct alignas( 64 ) Worker
+		{
+			// parallelFor increments the value to start a job on the worker, the worker sleeps while it doesn't change
+			std::atomic_uint32_t ticket = 0;
+			std::thread thread;
+		};
+		std::vector<std::unique_ptr<Worker>> workers;
 
-		static void __stdcall workCallbackStatic( PTP_CALLBACK_INSTANCE Instance, void* pv, PTP_WORK Work ) noexcept;
+		// Count of workers still running the current job
+		alignas( 64 ) std::atomic_uint32_t pending = 0;
+		std::atomic<HRESULT> status = S_OK;
+		std::atomic_bool shuttingDown = false;
+
+		HRESULT createWorkers();
+		HRESULT applyAffinity( Worker& w, size_t ith ) const;
+		HRESULT applyAffinity() const;
+		void pinCallerThread();
+		void stopWorkers() noexcept;
+		void workerThread( Worker* w, size_t ith ) noexcept;
+		void runBatch( size_t ith ) noexcept;
+		HRESULT computeChunk( size_t begin, size_t end ) noexcept;
 	};
 }
\ No newline at end of file
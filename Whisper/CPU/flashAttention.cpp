@@ -0,0 +1,223 @@
+#include "stdafx.h"
+#include "flashAttention.h"
+#include "simdUtils.h"
+#include "../ML/LookupTablesData.h"
+#include <cmath>
+using namespace CpuCompute;
+
+namespace
+{
+	// Count of keys processed between the updates of the running maximum
+	constexpr uint32_t keysBlock = 32;
+
+	__forceinline __m256 load16( const uint16_t* rsi )
+	{
+		return _mm256_cvtph_ps( _mm_loadu_si128( ( const __m128i* )rsi ) );
+	}
+
+	__forceinline float horizontalSum( __m256 vec )
+	{
+		__m128 v = _mm256_extractf128_ps( vec, 1 );
+		v = _mm_add_ps( v, _mm256_castps256_ps128( vec ) );
+		v = _mm_add_ps( v, _mm_movehl_ps( v, v ) );
+		v = _mm_add_ss( v, _mm_movehdup_ps( v ) );
+		return _mm_cvtss_f32( v );
+	}
+
+	// Dot products of the FP32 query with 4 consecutive FP16 keys, length is a multiple of 8
+	__forceinline __m128 dotProduct4( const float* q, const uint16_t* k, size_t stride, size_t length )
+	{
+		__m256 a0 = _mm256_setzero_ps();
+		__m256 a1 = _mm256_setzero_ps();
+		__m256 a2 = _mm256_setzero_ps();
+		__m256 a3 = _mm256_setzero_ps();
+		const uint16_t* k1 = k + stride;
+		const uint16_t* k2 = k1 + stride;
+		const uint16_t* k3 = k2 + stride;
+		for( size_t i = 0; i < length; i += 8 )
+		{
+			const __m256 qv = _mm256_load_ps( q + i );
+			a0 = _mm256_fmadd_ps( qv, load16( k + i ), a0 );
+			a1 = _mm256_fmadd_ps( qv, load16( k1 + i ), a1 );
+			a2 = _mm256_fmadd_ps( qv, load16( k2 + i ), a2 );
+			a3 = _mm256_fmadd_ps( qv, load16( k3 + i ), a3 );
+		}
+		// Transpose and reduce 4 vectors into [ a0, a1, a2, a3 ]
+		const __m256 t01 = _mm256_hadd_ps( a0, a1 );
+		const __m256 t23 = _mm256_hadd_ps( a2, a3 );
+		const __m256 t = _mm256_hadd_ps( t01, t23 );
+		return _mm_add_ps( _mm256_castps256_ps128( t ), _mm256_extractf128_ps( t, 1 ) );
+	}
+
+	__forceinline float dotProduct( const float* q, const uint16_t* k, size_t length )
+	{
+		__m256 acc = _mm256_setzero_ps();
+		for( size_t i = 0; i < length; i += 8 )
+			acc = _mm256_fmadd_ps( _mm256_load_ps( q + i ), load16( k + i ), acc );
+		return horizontalSum( acc );
+	}
+
+	// acc += v * p
+	__forceinline void accumulateRow( float* acc, const uint16_t* v, __m256 p, size_t length )
+	{
+		for( size_t i = 0; i < length; i += 8 )
+		{
+			__m256 a = _mm256_load_ps( acc + i );
+			a = _mm256_fmadd_ps( load16( v + i ), p, a );
+			_mm256_store_ps( acc + i, a );
+		}
+	}
+
+	__forceinline void scaleRow( float* rdi, float mul, size_t length )
+	{
+		const __m256 m = _mm256_set1_ps( mul );
+		for( size_t i = 0; i < length; i += 8 )
+			_mm256_store_ps( rdi + i, _mm256_mul_ps( _mm256_load_ps( rdi + i ), m ) );
+	}
+
+	struct FlashAttentionContext : public iComputeRange
+	{
+		const float* q;
+		const uint16_t* k;
+		const uint16_t* v;
+		float* result;
+		// D = length of the rows, N = count of queries, M = count of keys
+		uint32_t D, N, M, heads;
+		bool masked;
+		float scale;
+		std::array<uint32_t, 3> nbQ, nbK;
+		// Strides of V between keys, and between heads
+		uint32_t vStrideKey, vStrideHead, vStrideBatch;
+		const DirectCompute::LookupTablesData* lookup;
+
+		__forceinline float exponent( float f ) const
+		{
+			// Same FP16 lookup table as softMax(), for consistent results with the unfused version
+			const uint16_t f16 = (uint16_t)_mm_cvtsi128_si32( _mm_cvtps_ph( _mm_set_ss( f ), 0 ) );
+			const __m128i e = _mm_cvtsi32_si128( lookup->exponent[ f16 ] );
+			return _mm_cvtss_f32( _mm_cvtph_ps( e ) );
+		}
+
+		HRESULT __stdcall compute( size_t i, size_t end ) const override final
+		{
+			ALIGNED_SPAN( qRow, D );
+			ALIGNED_SPAN( acc, D );
+			ALIGNED_SPAN( scores, keysBlock );
+
+			for( ; i < end; i++ )
+			{
+				const uint32_t iq = (uint32_t)( i % N );
+				const uint32_t ih = (uint32_t)( ( i / N ) % heads );
+				const uint32_t ib = (uint32_t)( i / ( (size_t)N * heads ) );
+
+				// Copy the query into the aligned buffer, applying the scale
+				const float* rsi = q + (size_t)iq * nbQ[ 0 ] + (size_t)ih * nbQ[ 1 ] + (size_t)ib * nbQ[ 2 ];
+				const __m256 scaleVec = _mm256_set1_ps( scale );
+				for( uint32_t j = 0; j < D; j += 8 )
+				{
+					_mm256_store_ps( qRow + j, _mm256_mul_ps( _mm256_loadu_ps( rsi + j ), scaleVec ) );
+					_mm256_store_ps( acc + j, _mm256_setzero_ps() );
+				}
+
+				const uint16_t* keys = k + (size_t)ih * nbK[ 1 ] + (size_t)ib * nbK[ 2 ];
+				const uint16_t* values = v + (size_t)ih * vStrideHead + (size_t)ib * vStrideBatch;
+				const size_t kStride = nbK[ 0 ];
+
+				// Causal mask, same condition as diagMaskInf() with n_past = M - N
+				const uint32_t countKeys = masked ? std::min( M, M - N + iq + 1 ) : M;
+
+				float maxScore = -INFINITY;
+				float sum = 0;
+				for( uint32_t j0 = 0; j0 < countKeys; j0 += keysBlock )
+				{
+					const uint32_t len = std::min( keysBlock, countKeys - j0 );
+					const uint16_t* kRow = keys + j0 * kStride;
+
+					// Scores for the block of keys
+					uint32_t j = 0;
+					for( ; j + 4 <= len; j += 4, kRow += kStride * 4 )
+						_mm_store_ps( scores + j, dotProduct4( qRow, kRow, kStride, D ) );
+					for( ; j < len; j++, kRow += kStride )
+						scores[ j ] = dotProduct( qRow, kRow, D );
+
+					float blockMax = maxScore;
+					for( j = 0; j < len; j++ )
+						blockMax = std::max( blockMax, scores[ j ] );
+
+					// Online softmax: when the maximum grows, rescale the accumulators computed so far
+					if( blockMax > maxScore )
+					{
+						if( sum != 0 )
+						{
+							const float mul = std::exp( maxScore - blockMax );
+							sum *= mul;
+							scaleRow( acc, mul, D );
+						}
+						maxScore = blockMax;
+					}
+
+					const uint16_t* vRow = values + (size_t)j0 * vStrideKey;
+					for( j = 0; j < len; j++, vRow += vStrideKey )
+					{
+						const float p = exponent( scores[ j ] - maxScore );
+						sum += p;
+						accumulateRow( acc, vRow, _mm256_set1_ps( p ), D );
+					}
+				}
+
+				float* rdi = result + i * D;
+				const __m256 finalScale = _mm256_set1_ps( 1.0f / sum );
+				for( uint32_t j = 0; j < D; j += 8 )
+					_mm256_storeu_ps( rdi + j, _mm256_mul_ps( _mm256_load_ps( acc + j ), finalScale ) );
+			}
+			return S_OK;
+		}
+	};
+}
+
+HRESULT CpuCompute::flashAttention( Tensor& result, const Tensor& q, const Tensor& k, const Tensor& v, bool masked, float scale, ParallelForRunner& pfor )
+{
+	if( q.type() != eDataType::FP32 || k.type() != eDataType::FP16 || v.type() != eDataType::FP16 )
+		return E_NOTIMPL;
+
+	const uint32_t D = q.ne[ 0 ];
+	const uint32_t N = q.ne[ 1 ];
+	const uint32_t M = k.ne[ 1 ];
+	if( k.ne[ 0 ] != D || v.ne[ 0 ] != M || v.ne[ 1 ] != D )
+		return E_INVALIDARG;
+	if( k.ne[ 2 ] != q.ne[ 2 ] || v.ne[ 2 ] != q.ne[ 2 ] || k.ne[ 3 ] != q.ne[ 3 ] || v.ne[ 3 ] != q.ne[ 3 ] )
+		return E_INVALIDARG;
+	if( masked && M < N )
+		return E_INVALIDARG;
+	if( result.type() != eDataType::FP32 || result.ne != q.ne || !result.isContinuous() )
+		return E_INVALIDARG;
+
+	// The kernel streams over complete rows of Q, K and V.
+	// For V this requires the transposed layout where elements of the same key are adjacent in memory,
+	// that's what permute( 1, 2, 0, 3 ) of the FP16 values produces.
+	if( 0 != D % 8 )
+		return E_NOTIMPL;
+	if( q.nb[ 0 ] != 1 || k.nb[ 0 ] != 1 || v.nb[ 1 ] != 1 )
+		return E_NOTIMPL;
+
+	FlashAttentionContext context;
+	context.q = q.fp32();
+	context.k = k.fp16();
+	context.v = v.fp16();
+	context.result = result.fp32();
+	context.D = D;
+	context.N = N;
+	context.M = M;
+	context.heads = q.ne[ 2 ];
+	context.masked = masked;
+	context.scale = scale;
+	context.nbQ = { q.nb[ 1 ], q.nb[ 2 ], q.nb[ 3 ] };
+	context.nbK = { k.nb[ 1 ], k.nb[ 2 ], k.nb[ 3 ] };
+	context.vStrideKey = v.nb[ 0 ];
+	context.vStrideHead = v.nb[ 2 ];
+	context.vStrideBatch = v.nb[ 3 ];
+	context.lookup = &getLookupTables();
+
+	const size_t rows = (size_t)N * q.ne[ 2 ] * q.ne[ 3 ];
+	return pfor.parallelFor( context, rows );
+}
\ No newline at end of file
@@ -0,0 +1,11 @@
+#pragma once
+#include "ParallelForRunner.h"
+#include "Tensor.h"
+
+namespace CpuCompute
+{
+	// Fused attention, softmax( scale * K^T * Q ) * V computed without materializing the KQ matrix.
+	// Q is FP32 [ D, N, heads ], K is FP16 [ D, M, heads ], V is FP16 [ M, D, heads ] like in ggml_flash_attn; the result is FP32 [ D, N, heads ]
+	// When masked is true, query i only attends to the first ( M - N + i + 1 ) keys.
+	HRESULT flashAttention( Tensor& result, const Tensor& q, const Tensor& k, const Tensor& v, bool masked, float scale, ParallelForRunner& pfor );
+}
\ No newline at end of file
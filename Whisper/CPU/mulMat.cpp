@@ -1,24 +1,125 @@
 ﻿#include "stdafx.h"
 #include "mulMat.h"
 #include "mulMatImpl.h"
+#include "quantization.h"
+#include <intrin.h>
 using namespace CpuCompute;
 
+// Set this to 1 to always use the AVX kernels, even on the CPUs which support AVX-512
+#define DBG_DISABLE_AVX512 0
+
 namespace
 {
 	template<uint8_t panelHeightRegs, uint8_t tileWidthFloats>
-	static HRESULT mulMatImpl( Tensor& result, const Tensor& a, const Tensor& b, ParallelForRunner& pfor )
+	static HRESULT mulMatImpl( Tensor& result, const Tensor& a, const Tensor& b, ParallelForRunner& pfor, const MulMatEpilogue* epilogue )
+	{
+		MulMatImpl<panelHeightRegs, tileWidthFloats> impl{ result, a, b, pfor, epilogue };
+		return impl.run( pfor );
+	}
+
+	template<uint8_t panelHeightZmm, uint8_t tileWidthFloats>
+	static HRESULT mulMatImplAvx512( Tensor& result, const Tensor& a, const Tensor& b, ParallelForRunner& pfor, const MulMatEpilogue* epilogue )
 	{
-		MulMatImpl<panelHeightRegs, tileWidthFloats> impl{ result, a, b, pfor };
+		MulMatImplAvx512<panelHeightZmm, tileWidthFloats> impl{ result, a, b, pfor, epilogue };
 		return impl.run( pfor );
 	}
+
+	HRESULT checkTypes( const Tensor& a, const Tensor& b )
+	{
+		if( isQuantized( a.type() ) )
+		{
+			// The quantized weights are dequantized into FP16 panels, only implemented for continuous rows
+			if( a.nb[ 0 ] != 1 || 0 != a.ne[ 0 ] % quantBlockSize || 0 != a.nb[ 1 ] % quantBlockSize )
+				return E_NOTIMPL;
+		}
+		else if( a.type() != eDataType::FP16 )
+			return E_NOTIMPL;
+		if( b.type() != eDataType::FP32 )
+			return E_NOTIMPL;
+		return S_OK;
+	}
+
+	// AVX512F instructions, and the OS saves the complete state of the AVX-512 registers on context switches
+	bool checkAvx512Support()
+	{
+		int cpuInfo[ 4 ];
+		__cpuid( cpuInfo, 1 );
+		constexpr int osxsave = 1 << 27;
+		if( 0 == ( cpuInfo[ 2 ] & osxsave ) )
+			return false;
+
+		__cpuid( cpuInfo, 0 );
+		if( cpuInfo[ 0 ] < 7 )
+			return false;
+		__cpuidex( cpuInfo, 7, 0 );
+		constexpr int avx512f = 1 << 16;
+		if( 0 == ( cpuInfo[ 1 ] & avx512f ) )
+			return false;
+
+		// XMM, YMM, opmask, upper halves of ZMM0-15, and ZMM16-31 states
+		constexpr uint64_t xcr0Mask = 0b11100110;
+		return ( _xgetbv( 0 ) & xcr0Mask ) == xcr0Mask;
+	}
+
+	const MulMatKernels s_kernelsAvx{ &CpuCompute::mulMat, "AVX" };
+	const MulMatKernels s_kernelsAvx512{ &CpuCompute::mulMatAvx512, "AVX-512" };
+
+	const MulMatKernels& detectKernels()
+	{
+#if !DBG_DISABLE_AVX512
+		if( checkAvx512Support() )
+		{
+			logDebug( u8"Using %s kernels for the matrix multiplication", s_kernelsAvx512.name );
+			return s_kernelsAvx512;
+		}
+#endif
+		logDebug( u8"Using %s kernels for the matrix multiplication", s_kernelsAvx.name );
+		return s_kernelsAvx;
+	}
+}
+
+const MulMatKernels& CpuCompute::selectMulMatKernels()
+{
+	// CPUID is slow, only doing that once per process
+	static const MulMatKernels& kernels = detectKernels();
+	return kernels;
 }
 
-HRESULT CpuCompute::mulMat( Tensor& result, const Tensor& a, const Tensor& b, ParallelForRunner& pfor )
+HRESULT CpuCompute::mulMatAvx512( Tensor& result, const Tensor& a, const Tensor& b, ParallelForRunner& pfor, const MulMatEpilogue* epilogue )
 {
-	if( a.type() != eDataType::FP16 )
-		return E_NOTIMPL;
-	if( b.type() != eDataType::FP32 )
-		return E_NOTIMPL;
+	CHECK( checkTypes( a, b ) );
+
+	// The pre-packed matrices have 32 rows in the panels
+	const bool prepacked = 0 == a.nb[ 0 ];
+	// Short matrices have less than 16 rows in the panel, the 8-wide kernels are faster for them
+	if( a.ne[ 1 ] < 16 && !prepacked )
+		return mulMat( result, a, b, pfor, epilogue );
+
+	// There're 32 AVX-512 registers, enough for larger tiles than the AVX version uses
+	const bool tall = prepacked || a.ne[ 1 ] >= 32;
+	switch( b.ne[ 1 ] )
+	{
+	case 1:
+		return tall ? mulMatImplAvx512<2, 1>( result, a, b, pfor, epilogue ) : mulMatImplAvx512<1, 1>( result, a, b, pfor, epilogue );
+	case 2:
+		return tall ? mulMatImplAvx512<2, 2>( result, a, b, pfor, epilogue ) : mulMatImplAvx512<1, 2>( result, a, b, pfor, epilogue );
+	case 3:
+		return tall ? mulMatImplAvx512<2, 3>( result, a, b, pfor, epilogue ) : mulMatImplAvx512<1, 3>( result, a, b, pfor, epilogue );
+	}
+	return tall ? mulMatImplAvx512<2, 8>( result, a, b, pfor, epilogue ) : mulMatImplAvx512<1, 8>( result, a, b, pfor, epilogue );
+}
+
+HRESULT CpuCompute::mulMat( Tensor& result, const Tensor& a, const Tensor& b, ParallelForRunner& pfor, const MulMatEpilogue* epilogue )
+{
+	CHECK( checkTypes( a, b ) );
+
+	if( 0 == a.nb[ 0 ] )
+	{
+		// The pre-packed panels are 4 vectors high, only 2 columns wide tiles fit in the registers
+		if( b.ne[ 1 ] == 1 )
+			return mulMatImpl<4, 1>( result, a, b, pfor, epilogue );
+		return mulMatImpl<4, 2>( result, a, b, pfor, epilogue );
+	}
 
 	// return mulMatImpl<1, 1>( result, a, b, pfor );
 
@@ -26,29 +127,29 @@ HRESULT CpuCompute::mulMat( Tensor& result, const Tensor& a, const Tensor& b, Pa
 	{
 		// Multiplying by a single row
 		if( a.ne[ 1 ] >= 32 )
-			return mulMatImpl<4, 1>( result, a, b, pfor );
+			return mulMatImpl<4, 1>( result, a, b, pfor, epilogue );
 		else
-			return mulMatImpl<1, 1>( result, a, b, pfor );
+			return mulMatImpl<1, 1>( result, a, b, pfor, epilogue );
 	}
 	else if( b.ne[ 1 ] == 2 )
 	{
 		if( a.ne[ 1 ] >= 32 )
-			return mulMatImpl<4, 2>( result, a, b, pfor );
+			return mulMatImpl<4, 2>( result, a, b, pfor, epilogue );
 		else
-			return mulMatImpl<1, 2>( result, a, b, pfor );
+			return mulMatImpl<1, 2>( result, a, b, pfor, epilogue );
 	}
 	else if( b.ne[ 1 ] == 3 )
 	{
 		if( a.ne[ 1 ] >= 16 )
-			return mulMatImpl<2, 3>( result, a, b, pfor );
+			return mulMatImpl<2, 3>( result, a, b, pfor, epilogue );
 		else
-			return mulMatImpl<1, 3>( result, a, b, pfor );
+			return mulMatImpl<1, 3>( result, a, b, pfor, epilogue );
 	}
 	else
 	{
 		if( a.ne[ 1 ] >= 16 )
-			return mulMatImpl<2, 4>( result, a, b, pfor );
+			return mulMatImpl<2, 4>( result, a, b, pfor, epilogue );
 		else
-			return mulMatImpl<1, 4>( result, a, b, pfor );
+			return mulMatImpl<1, 4>( result, a, b, pfor, epilogue );
 	}
 }
\ No newline at end of file
@@ -4,7 +4,49 @@
 
 namespace CpuCompute
 {
-	HRESULT mulMat( Tensor& result, const Tensor& a, const Tensor& b, ParallelForRunner& pfor );
+	// Optional elementwise operations fused into the matrix multiplication: result = residual + scale * gelu( a * b + bias )
+	// The kernels apply them to every output tile right after it's computed, while the tile is still in L1 cache.
+	struct MulMatEpilogue
+	{
+		// Vector of a.ne[ 1 ] elements added to every column of the product, or nullptr
+		const float* bias = nullptr;
+		bool gelu = false;
+		float scale = 1.0f;
+		// Dense tensor of the same shape as the result, or nullptr
+		const float* residual = nullptr;
+	};
+
+	// Matrix multiplication with the 8-wide AVX kernels
+	HRESULT mulMat( Tensor& result, const Tensor& a, const Tensor& b, ParallelForRunner& pfor, const MulMatEpilogue* epilogue = nullptr );
+
+	// Matrix multiplication with the 16-wide AVX-512 kernels, only call this when the CPU supports AVX512F
+	HRESULT mulMatAvx512( Tensor& result, const Tensor& a, const Tensor& b, ParallelForRunner& pfor, const MulMatEpilogue* epilogue = nullptr );
+
+	// Height of the panels in the pre-packed matrices, in elements.
+	// The kernels process such panels with 4 AVX or 2 AVX-512 vectors.
+	constexpr uint32_t prepackedPanelHeight = 32;
+
+	// Count of FP16 elements in the pre-packed matrix, including the zero padding of the last panel
+	inline size_t prepackedElements( uint32_t width, uint32_t height )
+	{
+		const size_t panels = ( height + prepackedPanelHeight - 1 ) / prepackedPanelHeight;
+		return panels * prepackedPanelHeight * width;
+	}
+
+	// Reshape a dense row major FP16 matrix into the column major horizontal panels consumed by the kernels, same as Reshaper::makePanels does on GPU.
+	// The output must be aligned by 32 bytes. The tensors reshaped this way have nb[ 0 ] = 0, and the panel size in nb[ 1 ].
+	void prepackPanels( uint16_t* rdi, const uint16_t* rsi, uint32_t width, uint32_t height );
+
+	// Table of the compute kernels which depend on the instruction set of the CPU
+	struct MulMatKernels
+	{
+		HRESULT( *mulMat )( Tensor& result, const Tensor& a, const Tensor& b, ParallelForRunner& pfor, const MulMatEpilogue* epilogue );
+		// Name of the instruction set, for the log
+		const char* name;
+	};
+
+	// Use CPUID to pick the fastest kernels supported by the CPU and the OS
+	const MulMatKernels& selectMulMatKernels();
 }
 
 #if TENSOR_GGML_COMPAT
@@ -0,0 +1,161 @@
+#include "stdafx.h"
+#include "mulMatImpl.h"
+#include <immintrin.h>
+using namespace CpuCompute;
+
+// The code in this source file is only called when the CPU supports AVX512F, see selectMulMatKernels() function.
+// To avoid AVX-512 instructions in the inline functions shared with other source files, this one doesn't call any of them:
+// the helpers are TU-local and __forceinline, the only standard library templates are instantiated with __m512 which no other file uses,
+// and the sizes and pointers come from the out-of-line methods MulMatBase::getKernelSizes and getPanelPointers.
+namespace
+{
+	// Load 16 FP16 values from the panel, and upcast them to FP32
+	__forceinline __m512 loadUpcasted16( const uint16_t* rsi )
+	{
+		const __m256i i = _mm256_load_si256( ( const __m256i* )rsi );
+		return _mm512_cvtph_ps( i );
+	}
+
+	template<uint8_t panelHeightZmm, uint8_t tileWidthFloats>
+	struct ResultTile512
+	{
+		std::array<__m512, (size_t)panelHeightZmm * tileWidthFloats> arr;
+
+		__forceinline void setZero()
+		{
+			for( size_t i = 0; i < arr.size(); i++ )
+				arr[ i ] = _mm512_setzero_ps();
+		}
+
+		// The loops have compile-time trip counts, the compiler unrolls them and keeps the accumulators in registers
+		__forceinline void kernel( const std::array<__m512, panelHeightZmm>& panel, const float* rsi, size_t stride )
+		{
+			for( size_t c = 0; c < tileWidthFloats; c++, rsi += stride )
+			{
+				const __m512 b = _mm512_set1_ps( *rsi );
+				for( size_t r = 0; r < panelHeightZmm; r++ )
+					arr[ c * panelHeightZmm + r ] = _mm512_fmadd_ps( panel[ r ], b, arr[ c * panelHeightZmm + r ] );
+			}
+		}
+
+		__forceinline void kernelPartial( const std::array<__m512, panelHeightZmm>& panel, const float* rsi, size_t stride, size_t rem )
+		{
+			assert( rem > 0 && rem < tileWidthFloats );
+			for( size_t c = 0; c < tileWidthFloats; c++, rsi += stride )
+			{
+				// Very predictable branch, same outcome for all iterations of the outer loop
+				if( c >= rem )
+					break;
+				const __m512 b = _mm512_set1_ps( *rsi );
+				for( size_t r = 0; r < panelHeightZmm; r++ )
+					arr[ c * panelHeightZmm + r ] = _mm512_fmadd_ps( panel[ r ], b, arr[ c * panelHeightZmm + r ] );
+			}
+		}
+
+		// Store w * h block of the output, w is height of the panel, h is count of columns
+		__forceinline void store( float* rdi, size_t w, size_t h, size_t stride ) const
+		{
+			assert( w > 0 && w <= panelHeightZmm * 16 );
+			assert( h > 0 && h <= tileWidthFloats );
+
+			const size_t completeRegs = w / 16;
+			const size_t rem = w % 16;
+			// AVX-512 has masked stores for any vector width, no need for the lookup tables
+			const __mmask16 mask = (__mmask16)( ( 1u << rem ) - 1 );
+
+			for( size_t c = 0; c < h; c++, rdi += stride )
+			{
+				const __m512* rsi = &arr[ c * panelHeightZmm ];
+				for( size_t r = 0; r < completeRegs; r++ )
+					_mm512_storeu_ps( rdi + r * 16, rsi[ r ] );
+				if( 0 != rem )
+					_mm512_mask_storeu_ps( rdi + completeRegs * 16, mask, rsi[ completeRegs ] );
+			}
+		}
+	};
+
+	template<size_t panelHeightZmm>
+	__forceinline void loadPanel( const uint16_t* rsi, std::array<__m512, panelHeightZmm>& dest )
+	{
+		for( size_t r = 0; r < panelHeightZmm; r++ )
+			dest[ r ] = loadUpcasted16( rsi + r * 16 );
+	}
+}
+
+// Same algorithm as MulMatImpl::compute, in mulMatImpl.cpp
+template<uint8_t panelHeightZmm, uint8_t tileWidthFloats>
+HRESULT __stdcall MulMatImplAvx512<panelHeightZmm, tileWidthFloats>::compute( size_t i, size_t end ) const noexcept
+{
+	constexpr size_t panelHeightFloats = panelHeightZmm * 16;
+	sKernelSizes sizes;
+	getKernelSizes( sizes );
+	uint16_t* const panelBuffer = ( nullptr != pfnMakePanel ) ? (uint16_t*)runner.threadLocalBuffer( sizes.panelBufferElements * 2 ) : nullptr;
+	const size_t resultStride = sizes.resultStride;
+	const size_t length = sizes.length;
+	const size_t strideB0 = sizes.strideB0;
+	const size_t strideB1 = sizes.strideB1;
+
+	for( ; i < end; i++ )
+	{
+		const size_t iPanel = i % sizes.countPanels;
+		size_t j = i / sizes.countPanels;
+		const size_t m2 = j % sizes.resultLayers;
+		const size_t m3 = j / sizes.resultLayers;
+
+		// The panels are produced by the same methods as for the AVX kernels
+		const uint16_t* panel;
+		const float* pb;
+		float* rdi;
+		getPanelPointers( iPanel, m2, m3, panel, pb, rdi );
+		if( nullptr != pfnMakePanel )
+		{
+			CHECK( ( this->*pfnMakePanel )( panelBuffer, iPanel, m2, m3 ) );
+			panel = panelBuffer;
+		}
+
+		const size_t panelRemainder = sizes.resultHeight - iPanel * panelHeightFloats;
+		const size_t storeWidth = ( panelRemainder < panelHeightFloats ) ? panelRemainder : panelHeightFloats;
+		std::array<__m512, panelHeightZmm> vecPanel;
+		ResultTile512<panelHeightZmm, tileWidthFloats> tile;
+		const uint16_t* const rsiAEnd = panel + length * panelHeightFloats;
+
+		for( j = 0; j < completeTilesPerPanel; j++, pb += tileWidthFloats * strideB1, rdi += resultStride * tileWidthFloats )
+		{
+			tile.setZero();
+			const float* rsiB = pb;
+			for( const uint16_t* rsiA = panel; rsiA < rsiAEnd; rsiA += panelHeightFloats, rsiB += strideB0 )
+			{
+				loadPanel( rsiA, vecPanel );
+				tile.kernel( vecPanel, rsiB, strideB1 );
+			}
+			tile.store( rdi, storeWidth, tileWidthFloats, resultStride );
+			if( hasEpilogue )
+				applyEpilogue( rdi, iPanel, storeWidth, tileWidthFloats );
+		}
+
+		if( 0 != lastColumnsInPanel )
+		{
+			tile.setZero();
+			const float* rsiB = pb;
+			for( const uint16_t* rsiA = panel; rsiA < rsiAEnd; rsiA += panelHeightFloats, rsiB += strideB0 )
+			{
+				loadPanel( rsiA, vecPanel );
+				tile.kernelPartial( vecPanel, rsiB, strideB1, lastColumnsInPanel );
+			}
+			tile.store( rdi, storeWidth, lastColumnsInPanel, resultStride );
+			if( hasEpilogue )
+				applyEpilogue( rdi, iPanel, storeWidth, lastColumnsInPanel );
+		}
+	}
+	return S_OK;
+}
+
+// Instantiate the templates we need, see CpuCompute::mulMatAvx512 function
+template class MulMatImplAvx512<2, 1>;
+template class MulMatImplAvx512<1, 1>;
+template class MulMatImplAvx512<2, 2>;
+template class MulMatImplAvx512<1, 2>;
+template class MulMatImplAvx512<2, 3>;
+template class MulMatImplAvx512<1, 3>;
+template class MulMatImplAvx512<2, 8>;
+template class MulMatImplAvx512<1, 8>;
\ No newline at end of file
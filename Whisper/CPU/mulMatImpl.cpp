@@ -1,7 +1,9 @@
 #include "stdafx.h"
 #include <intrin.h>
 #include "mulMatImpl.h"
+#include "mulMat.h"
 #include "mulMat.kernel.hpp"
+#include "simdUtils.h"
 
 #define DBG_TRACK_TEMPLATE_INSTANTIATION 0
 
@@ -31,12 +33,20 @@ namespace
 
 const bool MulMatBase::haveAvx2 = checkAvx2Support();
 
-MulMatBase::MulMatBase( Tensor& result, const Tensor& a, const Tensor& b, ParallelForRunner& pfor, uint8_t panelHeightRegs, uint8_t tileWidthFloats ) :
+MulMatBase::MulMatBase( Tensor& result, const Tensor& a, const Tensor& b, ParallelForRunner& pfor, const MulMatEpilogue* ep, uint8_t panelHeightRegs, uint8_t tileWidthFloats ) :
 	resultPointer( result.fp32() ),
 	pa( a.data() ),
 	pb( b.data() ),
-	runner( pfor )
+	runner( pfor ),
+	hasEpilogue( nullptr != ep )
 {
+	if( hasEpilogue )
+	{
+		epilogue = *ep;
+		if( epilogue.gelu )
+			geluLookup = &getLookupTables();
+	}
+
 	length = a.ne[ 0 ];
 	resultStrides[ 0 ] = result.nb[ 1 ];
 	resultStrides[ 1 ] = result.nb[ 2 ];
@@ -53,7 +63,18 @@ MulMatBase::MulMatBase( Tensor& result, const Tensor& a, const Tensor& b, Parall
 
 	// Pick a method which reshapes a panel of the matrix A into the shape we need to compute the product
 	// Store the pointer to that method in the field of this class
-	if( a.nb[ 0 ] == 1 )
+	if( a.type() == eDataType::Q8_0 )
+		pfnMakePanel = &MulMatBase::dequantizePanelQ8;
+	else if( a.type() == eDataType::Q4_0 )
+		pfnMakePanel = &MulMatBase::dequantizePanelQ4;
+	else if( a.nb[ 0 ] == 0 )
+	{
+		// The matrix was reshaped into panels on load, the compute method reads them directly
+		if( panelHeightRegs * 8 != prepackedPanelHeight )
+			throw E_INVALIDARG;
+		pfnMakePanel = nullptr;
+	}
+	else if( a.nb[ 0 ] == 1 )
 	{
 		if( haveAvx2 )
 			pfnMakePanel = &MulMatBase::transposePanelAvx2;
@@ -99,6 +120,25 @@ HRESULT MulMatBase::run( ParallelForRunner& pfor )
 	return pfor.parallelFor( *this, length );
 }
 
+void MulMatBase::applyEpilogue( float* rdi, size_t iPanel, size_t w, size_t h ) const
+{
+	const size_t stride = resultStrides[ 0 ];
+	const float* bias = epilogue.bias;
+	if( nullptr != bias )
+		bias += iPanel * panelHeightRegisters * 8;
+	// The residual tensor has the same layout as the result
+	const float* residual = epilogue.residual;
+	if( nullptr != residual )
+		residual += rdi - resultPointer;
+
+	for( size_t c = 0; c < h; c++, rdi += stride )
+	{
+		mulMatEpilogueRow( rdi, w, bias, epilogue.scale, residual, geluLookup );
+		if( nullptr != residual )
+			residual += stride;
+	}
+}
+
 const float* MulMatBase::getLayerB( size_t m2, size_t m3 ) const
 {
 	const float* rsi = (const float*)this->pb;
@@ -107,13 +147,32 @@ const float* MulMatBase::getLayerB( size_t m2, size_t m3 ) const
 	return rsi;
 }
 
+void MulMatBase::getKernelSizes( sKernelSizes& rdi ) const
+{
+	rdi.length = length;
+	rdi.resultStride = resultStrides[ 0 ];
+	rdi.strideB0 = stridesB[ 0 ];
+	rdi.strideB1 = stridesB[ 1 ];
+	rdi.countPanels = countPanels;
+	rdi.resultHeight = resultSize[ 0 ];
+	rdi.resultLayers = resultSize[ 2 ];
+	rdi.panelBufferElements = floatsPerPanel();
+}
+
+void MulMatBase::getPanelPointers( size_t i, size_t m2, size_t m3, const uint16_t*& a, const float*& b, float*& dest ) const
+{
+	a = ( nullptr != pfnMakePanel ) ? nullptr : getPanelA( i, m2, m3 );
+	b = getLayerB( m2, m3 );
+	dest = getPanelDest( i, m2, m3 );
+}
+
 // This method is the main one, its called by the thread pool
 template<uint8_t panelHeightRegs, uint8_t tileWidthFloats>
 HRESULT __stdcall MulMatImpl<panelHeightRegs, tileWidthFloats>::compute( size_t i, size_t end ) const noexcept
 {
-	// Allocate a thread-local buffer for the transposed panel
+	// Allocate a thread-local buffer for the transposed panel, unless the matrix was pre-packed on load
 	constexpr size_t panelHeightFloats = panelHeightRegs * 8;
-	uint16_t* const panel = (uint16_t*)runner.threadLocalBuffer( floatsPerPanel() * 2 );
+	uint16_t* const panelBuffer = ( nullptr != pfnMakePanel ) ? (uint16_t*)runner.threadLocalBuffer( floatsPerPanel() * 2 ) : nullptr;
 	const size_t resultStride = resultStrides[ 0 ];
 
 	// Load a few numbers from this class into local variables, while upcasting from DWORD into size_t
@@ -130,8 +189,15 @@ HRESULT __stdcall MulMatImpl<panelHeightRegs, tileWidthFloats>::compute( size_t
 		const size_t m2 = j % (size_t)resultSize[ 2 ];
 		const size_t m3 = j / (size_t)resultSize[ 2 ];
 
-		CHECK( ( this->*pfnMakePanel )( panel, iPanel, m2, m3 ) );
-		// We got a column-major panel in the thread local buffer, of size [ length, panelHeightRegs * 8 ]
+		const uint16_t* panel;
+		if( nullptr != pfnMakePanel )
+		{
+			CHECK( ( this->*pfnMakePanel )( panelBuffer, iPanel, m2, m3 ) );
+			panel = panelBuffer;
+		}
+		else
+			panel = getPanelA( iPanel, m2, m3 );
+		// We got a column-major panel of size [ length, panelHeightRegs * 8 ], either in the thread local buffer, or in the pre-packed matrix
 		// Hopefully, these buffers should all fit at least in L3 cache
 		// The longest matrix I saw in the debugger had 4096 elements, with panelHeightRegs = 4 that's 256 kb of data in the panel
 		const float* pb = getLayerB( m2, m3 );
@@ -157,6 +223,8 @@ HRESULT __stdcall MulMatImpl<panelHeightRegs, tileWidthFloats>::compute( size_t
 				tile.kernel( vecPanel, rsiB, stridesB[ 1 ] );
 			}
 			tile.store( rdi, storeWidth, tileWidthFloats, resultStride );
+			if( hasEpilogue )
+				applyEpilogue( rdi, iPanel, storeWidth, tileWidthFloats );
 		}
 
 		if( 0 != lastColumnsInPanel )
@@ -171,6 +239,8 @@ HRESULT __stdcall MulMatImpl<panelHeightRegs, tileWidthFloats>::compute( size_t
 				tile.kernelPartial( vecPanel, rsiB, stridesB[ 1 ], lastColumnsInPanel );
 			}
 			tile.store( rdi, storeWidth, lastColumnsInPanel, resultStride );
+			if( hasEpilogue )
+				applyEpilogue( rdi, iPanel, storeWidth, lastColumnsInPanel );
 		}
 #else
 		// This version bypasses horizontal tiling, instead implements a brute force algorithm to multiply the current panel by the complete B matrix
@@ -6,6 +6,12 @@
 // https://link.springer.com/article/10.1007/s11227-022-05003-3
 #include "ParallelForRunner.h"
 #include "Tensor.h"
+#include "mulMat.h"
+
+namespace DirectCompute
+{
+	struct LookupTablesData;
+}
 
 namespace CpuCompute
 {
@@ -49,12 +55,23 @@ namespace CpuCompute
 		// Same as tileWidthFloats template argument - width of the tile, in floats
 		uint8_t tileWidth;
 
-		// Method pointer to reshape a panel from the source matrix into a thread-local buffer
+		// Method pointer to reshape a panel from the source matrix into a thread-local buffer.
+		// nullptr when the source matrix was reshaped into panels on load, the kernels then read the panels directly from that matrix.
 		using pfnTransposePanel = HRESULT( MulMatBase::* )( uint16_t* rdi, size_t i, size_t m2, size_t m3 ) const;
 		pfnTransposePanel pfnMakePanel;
 		// The object which implements multithreading for this job, and supplies memory for thread-local buffers
 		ParallelForRunner& runner;
 
+		// Fused elementwise operations, only used when hasEpilogue is true
+		MulMatEpilogue epilogue;
+		bool hasEpilogue;
+		// Lookup table for the GELU activation, nullptr when the epilogue has no activation
+		const DirectCompute::LookupTablesData* geluLookup = nullptr;
+
+		// Apply the epilogue to the block of the output which was just stored by the kernel.
+		// The block is w * h elements, w is count of valid elements in the panel, h is count of columns
+		void applyEpilogue( float* rdi, size_t iPanel, size_t w, size_t h ) const;
+
 		// Count of FP16 values in the thread-local panel buffer
 		uint32_t floatsPerPanel() const
 		{
@@ -68,11 +85,22 @@ namespace CpuCompute
 		HRESULT copyPanelColumnMajor8( uint16_t* rdi, size_t i, size_t m2, size_t m3 ) const;
 		HRESULT copyPanelColumnMajor16( uint16_t* rdi, size_t i, size_t m2, size_t m3 ) const;
 		HRESULT copyPanelColumnMajor32( uint16_t* rdi, size_t i, size_t m2, size_t m3 ) const;
+		// Dequantize a horizontal panel of the first matrix into FP16, for the block-quantized formats; rows must be continuous.
+		// Implemented in mulMatImpl.quantized.cpp
+		HRESULT dequantizePanelQ8( uint16_t* rdi, size_t i, size_t m2, size_t m3 ) const;
+		HRESULT dequantizePanelQ4( uint16_t* rdi, size_t i, size_t m2, size_t m3 ) const;
 		// Transpose a panel of the first matrix for irregular layout of that matrix, when neither rows nor columns are at sequential addresses.
 		// This one ain't implemented yet.
 		HRESULT gatherPanel( uint16_t* rdi, size_t i, size_t m2, size_t m3 ) const;
 
-		const uint16_t* getPanelA( size_t i, size_t m2, size_t m3 ) const;
+		const uint16_t* getPanelA( size_t i, size_t m2, size_t m3 ) const
+		{
+			const uint16_t* rsi = (const uint16_t*)pa;
+			rsi += m3 * stridesA[ 3 ];
+			rsi += m2 * stridesA[ 2 ];
+			rsi += i * stridesA[ 1 ];
+			return rsi;
+		}
 		// Pointer to the first element of the second source matrix in the specified layer
 		const float* getLayerB( size_t m2, size_t m3 ) const;
 
@@ -86,9 +114,20 @@ namespace CpuCompute
 			return rdi;
 		}
 
+		// Sizes and strides of the job as plain integers, for the AVX-512 kernels
+		struct sKernelSizes
+		{
+			size_t length, resultStride, strideB0, strideB1, countPanels, resultHeight, resultLayers, panelBufferElements;
+		};
+		// These two are not inline, and the AVX-512 kernels call them instead of the inline methods above.
+		// An inline function used in mulMatImpl.avx512.cpp is compiled there with AVX-512, and the linker may keep that copy for all callers.
+		void getKernelSizes( sKernelSizes& rdi ) const;
+		// The source panel is nullptr when pfnMakePanel is set
+		void getPanelPointers( size_t i, size_t m2, size_t m3, const uint16_t*& a, const float*& b, float*& dest ) const;
+
 		static const bool haveAvx2;
 	public:
-		MulMatBase( Tensor& result, const Tensor& a, const Tensor& b, ParallelForRunner& pfor, uint8_t panelHeightRegs, uint8_t tileWidthFloats );
+		MulMatBase( Tensor& result, const Tensor& a, const Tensor& b, ParallelForRunner& pfor, const MulMatEpilogue* ep, uint8_t panelHeightRegs, uint8_t tileWidthFloats );
 		HRESULT run( ParallelForRunner& pfor );
 	};
 
@@ -99,8 +138,21 @@ namespace CpuCompute
 		HRESULT __stdcall compute( size_t i, size_t end ) const noexcept override final;
 
 	public:
-		MulMatImpl( Tensor& result, const Tensor& a, const Tensor& b, ParallelForRunner& pfor ) :
-			MulMatBase( result, a, b, pfor, panelHeightRegs, tileWidthFloats )
+		MulMatImpl( Tensor& result, const Tensor& a, const Tensor& b, ParallelForRunner& pfor, const MulMatEpilogue* ep = nullptr ) :
+			MulMatBase( result, a, b, pfor, ep, panelHeightRegs, tileWidthFloats )
+		{ }
+	};
+
+	// Same as above, with 16-wide AVX-512 kernels. The panels are the same, each pair of AVX vectors is loaded into a single AVX-512 vector.
+	// Implemented in mulMatImpl.avx512.cpp
+	template<uint8_t panelHeightZmm, uint8_t tileWidthFloats>
+	class MulMatImplAvx512 : public MulMatBase
+	{
+		HRESULT __stdcall compute( size_t i, size_t end ) const noexcept override final;
+
+	public:
+		MulMatImplAvx512( Tensor& result, const Tensor& a, const Tensor& b, ParallelForRunner& pfor, const MulMatEpilogue* ep = nullptr ) :
+			MulMatBase( result, a, b, pfor, ep, panelHeightZmm * 2, tileWidthFloats )
 		{ }
 	};
 }
\ No newline at end of file
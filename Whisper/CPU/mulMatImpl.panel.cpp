@@ -2,6 +2,7 @@
 #include <intrin.h>
 #include "mulMatImpl.h"
 #include "mulMatUtils.hpp"
+#include "mulMat.h"
 using namespace CpuCompute;
 
 // We want to keep code size reasonable, that's why these panel reshaping methods are in the base class
@@ -52,15 +53,6 @@ HRESULT MulMatBase::transposePanel( uint16_t* rdi, size_t i, size_t m2, size_t m
 	return S_OK;
 }
 
-inline const uint16_t* MulMatBase::getPanelA( size_t i, size_t m2, size_t m3 ) const
-{
-	const uint16_t* rsi = (const uint16_t*)pa;
-	rsi += m3 * stridesA[ 3 ];
-	rsi += m2 * stridesA[ 2 ];
-	rsi += i * stridesA[ 1 ];
-	return rsi;
-}
-
 HRESULT MulMatBase::copyPanelColumnMajor8( uint16_t* rdi, size_t i, size_t m2, size_t m3 ) const
 {
 	assert( stridesA[ 1 ] == 1 );
@@ -271,4 +263,31 @@ HRESULT MulMatBase::gatherPanel( uint16_t* rdi, size_t i, size_t m2, size_t m3 )
 		}
 	}
 	return S_OK;
+}
+
+void CpuCompute::prepackPanels( uint16_t* rdi, const uint16_t* rsi, uint32_t width, uint32_t height )
+{
+	assert( 0 == ( (size_t)rdi ) % 32 );
+	const size_t panelSize = (size_t)width * prepackedPanelHeight;
+
+	for( uint32_t i = 0; i < height; i += prepackedPanelHeight, rdi += panelSize, rsi += panelSize )
+	{
+		const uint32_t rows = std::min( height - i, prepackedPanelHeight );
+		if( rows < prepackedPanelHeight )
+		{
+			// A partial panel, at the bottom of the matrix
+			zeroAlignedMemory( rdi, panelSize * sizeof( uint16_t ) );
+		}
+
+		uint16_t* dest = rdi;
+		const uint16_t* source = rsi;
+		for( uint32_t r = 0; r < rows; r += 8, dest += 8, source += (size_t)width * 8 )
+		{
+			const uint32_t h = std::min( rows - r, (uint32_t)8 );
+			if( h == 8 )
+				transpose8( dest, width, source, width, prepackedPanelHeight );
+			else
+				transpose8Partial( dest, width, h, source, width, prepackedPanelHeight );
+		}
+	}
 }
\ No newline at end of file
@@ -0,0 +1,79 @@
+#include "stdafx.h"
+#include "mulMatImpl.h"
+#include "mulMatUtils.hpp"
+#include "quantization.h"
+using namespace CpuCompute;
+
+namespace
+{
+	// Dequantize rows of the block-quantized matrix, and transpose them into the column-major FP16 panel.
+	// The weights are read from memory exactly once per panel, that's where the bandwidth savings come from.
+	template<class Block>
+	__forceinline void dequantizePanel( uint16_t* rdi, const uint8_t* rsi, size_t rowStride, size_t length, size_t height, size_t heightFloats )
+	{
+		// 8 rows * 32 columns of FP16 values
+		alignas( 32 ) std::array<uint16_t, 8 * quantBlockSize> temp;
+		const size_t blocks = length / quantBlockSize;
+		const size_t destStride = heightFloats * quantBlockSize;
+
+		for( size_t r0 = 0; r0 < height; r0 += 8, rdi += 8, rsi += 8 * rowStride )
+		{
+			const size_t rows = std::min( height - r0, (size_t)8 );
+			if( rows < 8 )
+				temp.fill( 0 );
+
+			uint16_t* dest = rdi;
+			for( size_t b = 0; b < blocks; b++, dest += destStride )
+			{
+				const uint8_t* block = rsi + b * sizeof( Block );
+				for( size_t r = 0; r < rows; r++, block += rowStride )
+					dequantizeBlock( *(const Block*)block, &temp[ r * quantBlockSize ] );
+				transpose8( dest, quantBlockSize, temp.data(), quantBlockSize, heightFloats );
+			}
+		}
+	}
+}
+
+HRESULT MulMatBase::dequantizePanelQ8( uint16_t* rdi, size_t i, size_t m2, size_t m3 ) const
+{
+	assert( stridesA[ 0 ] == 1 );
+
+	const size_t heightFloats = (size_t)panelHeightRegisters * 8;
+	i *= heightFloats;
+
+	// The strides are in elements, all of them are multiples of the block size
+	size_t offset = m3 * stridesA[ 3 ] + m2 * stridesA[ 2 ] + i * stridesA[ 1 ];
+	const uint8_t* rsi = (const uint8_t*)pa + ( offset / quantBlockSize ) * sizeof( BlockQ8_0 );
+	const size_t rowStride = ( stridesA[ 1 ] / quantBlockSize ) * sizeof( BlockQ8_0 );
+
+	size_t height = heightFloats;
+	if( i + heightFloats > resultSize[ 0 ] )
+	{
+		// A partial panel, at the bottom of the first argument matrix
+		height = resultSize[ 0 ] - i;
+		zeroAlignedMemory( rdi, heightFloats * length * sizeof( uint16_t ) );
+	}
+	dequantizePanel<BlockQ8_0>( rdi, rsi, rowStride, length, height, heightFloats );
+	return S_OK;
+}
+
+HRESULT MulMatBase::dequantizePanelQ4( uint16_t* rdi, size_t i, size_t m2, size_t m3 ) const
+{
+	assert( stridesA[ 0 ] == 1 );
+
+	const size_t heightFloats = (size_t)panelHeightRegisters * 8;
+	i *= heightFloats;
+
+	size_t offset = m3 * stridesA[ 3 ] + m2 * stridesA[ 2 ] + i * stridesA[ 1 ];
+	const uint8_t* rsi = (const uint8_t*)pa + ( offset / quantBlockSize ) * sizeof( BlockQ4_0 );
+	const size_t rowStride = ( stridesA[ 1 ] / quantBlockSize ) * sizeof( BlockQ4_0 );
+
+	size_t height = heightFloats;
+	if( i + heightFloats > resultSize[ 0 ] )
+	{
+		height = resultSize[ 0 ] - i;
+		zeroAlignedMemory( rdi, heightFloats * length * sizeof( uint16_t ) );
+	}
+	dequantizePanel<BlockQ4_0>( rdi, rsi, rowStride, length, height, heightFloats );
+	return S_OK;
+}
\ No newline at end of file
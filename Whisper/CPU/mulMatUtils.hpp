@@ -72,7 +72,7 @@ __forceinline void transpose8( uint16_t* rdi, size_t w, const uint16_t* rsi, siz
 	}
 
 #pragma loop( no_vector )
-	for( size_t i = 0; i < rem; rsi++, rsi5++, rdi += destStride )
+	for( size_t i = 0; i < rem; i++, rsi++, rsi5++, rdi += destStride )
 	{
 		const int16_t* p0 = (const int16_t*)rsi;
 		const int16_t* p5 = (const int16_t*)rsi5;
@@ -169,7 +169,7 @@ inline void transpose8Partial( uint16_t* rdi, size_t w, size_t h, const uint16_t
 	}
 
 #pragma loop( no_vector )
-	for( size_t i = 0; i < rem; rsi++, rsi5++, rdi += destStride )
+	for( size_t i = 0; i < rem; i++, rsi++, rsi5++, rdi += destStride )
 	{
 		const int16_t* p0 = (const int16_t*)rsi;
 		const int16_t* p5 = (const int16_t*)rsi5;
@@ -0,0 +1,163 @@
+#include "stdafx.h"
+#include "quantization.h"
+#include <immintrin.h>
+using namespace CpuCompute;
+
+namespace
+{
+	__forceinline __m256 load8( const uint16_t* rsi )
+	{
+		return _mm256_cvtph_ps( _mm_loadu_si128( ( const __m128i* )rsi ) );
+	}
+
+	__forceinline float maxAbs( const uint16_t* rsi )
+	{
+		const __m256 signBit = _mm256_set1_ps( -0.0f );
+		__m256 ax = _mm256_setzero_ps();
+		for( size_t i = 0; i < quantBlockSize; i += 8 )
+			ax = _mm256_max_ps( ax, _mm256_andnot_ps( signBit, load8( rsi + i ) ) );
+		__m128 v = _mm_max_ps( _mm256_castps256_ps128( ax ), _mm256_extractf128_ps( ax, 1 ) );
+		v = _mm_max_ps( v, _mm_movehl_ps( v, v ) );
+		v = _mm_max_ss( v, _mm_movehdup_ps( v ) );
+		return _mm_cvtss_f32( v );
+	}
+
+	__forceinline uint16_t fp16( float f )
+	{
+		return (uint16_t)_mm_cvtsi128_si32( _mm_cvtps_ph( _mm_set_ss( f ), 0 ) );
+	}
+
+	__forceinline float fp32( uint16_t f16 )
+	{
+		return _mm_cvtss_f32( _mm_cvtph_ps( _mm_cvtsi32_si128( f16 ) ) );
+	}
+
+	// Round 8 FP32 values to nearest integers, and pack them into int32 lanes
+	__forceinline __m256i roundScaled( const uint16_t* rsi, __m256 mul )
+	{
+		__m256 v = _mm256_mul_ps( load8( rsi ), mul );
+		v = _mm256_round_ps( v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC );
+		return _mm256_cvtps_epi32( v );
+	}
+
+	// Saturate 8 int32 lanes into the 8 lowest bytes of the vector
+	__forceinline __m128i packBytes( __m256i v )
+	{
+		__m128i low = _mm256_castsi256_si128( v );
+		__m128i high = _mm256_extractf128_si256( v, 1 );
+		__m128i words = _mm_packs_epi32( low, high );
+		return _mm_packs_epi16( words, words );
+	}
+
+	void quantizeBlock( BlockQ8_0& block, const uint16_t* rsi )
+	{
+		const float amax = maxAbs( rsi );
+		const float d = amax / 127.0f;
+		const float id = ( d != 0 ) ? 1.0f / d : 0.0f;
+		block.d = fp16( d );
+
+		const __m256 mul = _mm256_set1_ps( id );
+		for( size_t i = 0; i < quantBlockSize; i += 8 )
+			_mm_storel_epi64( ( __m128i* )( &block.qs[ i ] ), packBytes( roundScaled( rsi + i, mul ) ) );
+	}
+
+	void quantizeBlock( BlockQ4_0& block, const uint16_t* rsi )
+	{
+		// Same as quantize_row_q4_0_reference in GGML: the value with the largest magnitude maps to -8
+		float amax = 0;
+		float max = 0;
+		for( size_t i = 0; i < quantBlockSize; i++ )
+		{
+			const float v = fp32( rsi[ i ] );
+			if( amax < std::abs( v ) )
+			{
+				amax = std::abs( v );
+				max = v;
+			}
+		}
+		const float d = max / -8.0f;
+		const float id = ( d != 0 ) ? 1.0f / d : 0.0f;
+		block.d = fp16( d );
+
+		constexpr size_t half = quantBlockSize / 2;
+		for( size_t i = 0; i < half; i++ )
+		{
+			const float x0 = fp32( rsi[ i ] ) * id;
+			const float x1 = fp32( rsi[ i + half ] ) * id;
+			const uint8_t q0 = (uint8_t)std::min( 15, (int)( x0 + 8.5f ) );
+			const uint8_t q1 = (uint8_t)std::min( 15, (int)( x1 + 8.5f ) );
+			block.qs[ i ] = q0 | ( q1 << 4 );
+		}
+	}
+
+	// Convert 8 int32 lanes into FP16, and store into 16 bytes of memory
+	__forceinline void store8( uint16_t* rdi, __m128i low, __m128i high, __m256 d )
+	{
+		const __m256 v = _mm256_mul_ps( _mm256_cvtepi32_ps( _mm256_setr_m128i( low, high ) ), d );
+		_mm_store_si128( ( __m128i* )rdi, _mm256_cvtps_ph( v, 0 ) );
+	}
+}
+
+// These two functions are called by the matrix multiplication for every block of the weights, they only use AVX1 and F16C instructions
+void CpuCompute::dequantizeBlock( const BlockQ8_0& block, uint16_t* rdi )
+{
+	assert( 0 == ( (size_t)rdi ) % 32 );
+	const __m256 d = _mm256_set1_ps( fp32( block.d ) );
+	for( size_t i = 0; i < quantBlockSize; i += 16 )
+	{
+		const __m128i bytes = _mm_loadu_si128( ( const __m128i* )( &block.qs[ i ] ) );
+		store8( rdi + i, _mm_cvtepi8_epi32( bytes ), _mm_cvtepi8_epi32( _mm_srli_si128( bytes, 4 ) ), d );
+		store8( rdi + i + 8, _mm_cvtepi8_epi32( _mm_srli_si128( bytes, 8 ) ), _mm_cvtepi8_epi32( _mm_srli_si128( bytes, 12 ) ), d );
+	}
+}
+
+void CpuCompute::dequantizeBlock( const BlockQ4_0& block, uint16_t* rdi )
+{
+	assert( 0 == ( (size_t)rdi ) % 32 );
+	const __m256 d = _mm256_set1_ps( fp32( block.d ) );
+	const __m128i bytes = _mm_loadu_si128( ( const __m128i* )( &block.qs[ 0 ] ) );
+	const __m128i lowMask = _mm_set1_epi8( 0xF );
+	const __m128i eight = _mm_set1_epi8( 8 );
+	// Unpack nibbles into signed bytes in [ -8 .. +7 ] interval
+	const __m128i lo = _mm_sub_epi8( _mm_and_si128( bytes, lowMask ), eight );
+	const __m128i hi = _mm_sub_epi8( _mm_and_si128( _mm_srli_epi16( bytes, 4 ), lowMask ), eight );
+
+	store8( rdi, _mm_cvtepi8_epi32( lo ), _mm_cvtepi8_epi32( _mm_srli_si128( lo, 4 ) ), d );
+	store8( rdi + 8, _mm_cvtepi8_epi32( _mm_srli_si128( lo, 8 ) ), _mm_cvtepi8_epi32( _mm_srli_si128( lo, 12 ) ), d );
+	store8( rdi + 16, _mm_cvtepi8_epi32( hi ), _mm_cvtepi8_epi32( _mm_srli_si128( hi, 4 ) ), d );
+	store8( rdi + 24, _mm_cvtepi8_epi32( _mm_srli_si128( hi, 8 ) ), _mm_cvtepi8_epi32( _mm_srli_si128( hi, 12 ) ), d );
+}
+
+void CpuCompute::quantizeRow( eDataType dt, void* rdi, const uint16_t* rsi, size_t length )
+{
+	assert( 0 == length % quantBlockSize );
+	const size_t blocks = length / quantBlockSize;
+	if( dt == eDataType::Q8_0 )
+	{
+		BlockQ8_0* dest = (BlockQ8_0*)rdi;
+		for( size_t i = 0; i < blocks; i++, rsi += quantBlockSize )
+			quantizeBlock( dest[ i ], rsi );
+	}
+	else
+	{
+		assert( dt == eDataType::Q4_0 );
+		BlockQ4_0* dest = (BlockQ4_0*)rdi;
+		for( size_t i = 0; i < blocks; i++, rsi += quantBlockSize )
+			quantizeBlock( dest[ i ], rsi );
+	}
+}
+
+void CpuCompute::dequantizeRow( eDataType dt, uint16_t* rdi, const void* rsi, size_t length )
+{
+	assert( 0 == length % quantBlockSize );
+	const size_t blocks = length / quantBlockSize;
+	alignas( 32 ) std::array<uint16_t, quantBlockSize> temp;
+	for( size_t i = 0; i < blocks; i++, rdi += quantBlockSize )
+	{
+		if( dt == eDataType::Q8_0 )
+			dequantizeBlock( ( (const BlockQ8_0*)rsi )[ i ], temp.data() );
+		else
+			dequantizeBlock( ( (const BlockQ4_0*)rsi )[ i ], temp.data() );
+		memcpy( rdi, temp.data(), sizeof( temp ) );
+	}
+}
\ No newline at end of file
@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+#include "Tensor.h"
+
+namespace CpuCompute
+{
+	// Count of elements in one block of the quantized formats
+	constexpr uint32_t quantBlockSize = 32;
+
+	// Same memory layout as block_q8_0 in GGML: x[ i ] = d * qs[ i ]
+	struct BlockQ8_0
+	{
+		uint16_t d;
+		int8_t qs[ quantBlockSize ];
+	};
+	static_assert( sizeof( BlockQ8_0 ) == 34 );
+
+	// Same memory layout as block_q4_0 in GGML: low nibbles contain the first 16 elements, high nibbles the last 16 elements.
+	// x[ i ] = d * ( q[ i ] - 8 )
+	struct BlockQ4_0
+	{
+		uint16_t d;
+		uint8_t qs[ quantBlockSize / 2 ];
+	};
+	static_assert( sizeof( BlockQ4_0 ) == 18 );
+
+	inline bool isQuantized( eDataType dt )
+	{
+		return dt == eDataType::Q8_0 || dt == eDataType::Q4_0;
+	}
+
+	inline size_t quantizedBlockBytes( eDataType dt )
+	{
+		assert( isQuantized( dt ) );
+		return ( dt == eDataType::Q8_0 ) ? sizeof( BlockQ8_0 ) : sizeof( BlockQ4_0 );
+	}
+
+	// Count of bytes for the specified count of elements, which must be a multiple of the block size
+	inline size_t quantizedBytes( eDataType dt, size_t elements )
+	{
+		assert( 0 == elements % quantBlockSize );
+		return ( elements / quantBlockSize ) * quantizedBlockBytes( dt );
+	}
+
+	// Quantize FP16 values, length must be a multiple of the block size
+	void quantizeRow( eDataType dt, void* rdi, const uint16_t* rsi, size_t length );
+
+	// Convert quantized values back to FP16, length must be a multiple of the block size
+	void dequantizeRow( eDataType dt, uint16_t* rdi, const void* rsi, size_t length );
+
+	// Dequantize a single block of 32 elements into FP16 values, the output is 32 bytes aligned
+	void dequantizeBlock( const BlockQ8_0& block, uint16_t* rdi );
+	void dequantizeBlock( const BlockQ4_0& block, uint16_t* rdi );
+}
\ No newline at end of file
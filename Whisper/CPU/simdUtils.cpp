@@ -1,6 +1,7 @@
 #include "stdafx.h"
 #include "simdUtils.h"
 #include "../ML/LookupTablesData.h"
+#include "../Whisper/sEncodeParams.h"
 #include <cmath>
 #include <memory>
 
@@ -250,7 +251,7 @@ namespace
 	}
 }
 
-void norm( float* rdi, float* temp, const float* rsi, size_t length )
+void norm( float* rdi, float* temp, const float* rsi, size_t length, const float* w, const float* b )
 {
 	assert( (size_t)temp % 32 == 0 );
 	const float* rsiEndAligned = rsi + ( length & maskAlign8 );
@@ -302,6 +303,28 @@ void norm( float* rdi, float* temp, const float* rsi, size_t length )
 	const float scaleScalar = 1.0f / std::sqrtf( horizontalSum( sum ) / lengthFloat + eps );
 	const __m256 scale = _mm256_set1_ps( scaleScalar );
 
+	if( nullptr != w )
+	{
+		// Fused affine transform, saves another pass over the row
+		assert( nullptr != b );
+		for( t = temp; t < tEndAligned; t += 8, rdi += 8, w += 8, b += 8 )
+		{
+			__m256 v = _mm256_load_ps( t );
+			v = _mm256_mul_ps( v, scale );
+			v = _mm256_fmadd_ps( v, _mm256_loadu_ps( w ), _mm256_loadu_ps( b ) );
+			_mm256_storeu_ps( rdi, v );
+		}
+		if( 0 != rem )
+		{
+			const __m256i mask = loadTailMaskInt( rem );
+			__m256 v = _mm256_load_ps( t );
+			v = _mm256_mul_ps( v, scale );
+			v = _mm256_fmadd_ps( v, _mm256_maskload_ps( w, mask ), _mm256_maskload_ps( b, mask ) );
+			_mm256_maskstore_ps( rdi, mask, v );
+		}
+		return;
+	}
+
 	for( t = temp; t < tEndAligned; t += 8, rdi += 8 )
 	{
 		__m256 v = _mm256_load_ps( t );
@@ -535,6 +558,26 @@ void addRepeatGeluRow( float* rdi, size_t len, const float* b, size_t lenPattern
 	}
 }
 
+void mulMatEpilogueRow( float* rdi, size_t len, const float* bias, float scale, const float* residual, const DirectCompute::LookupTablesData* geluLookup )
+{
+	// The rows are columns of the output tiles, at most 32 elements, the masked loads and stores are fine
+	const __m256 scaleVec = _mm256_set1_ps( scale );
+	for( size_t i = 0; i < len; i += 8 )
+	{
+		const __m256i mask = loadTailMaskInt<false>( std::min( len - i, (size_t)8 ) );
+		__m256 v = _mm256_maskload_ps( rdi + i, mask );
+		if( nullptr != bias )
+			v = _mm256_add_ps( v, _mm256_maskload_ps( bias + i, mask ) );
+		if( nullptr != geluLookup )
+			v = gelu( v, *geluLookup );
+		if( nullptr != residual )
+			v = _mm256_fmadd_ps( v, scaleVec, _mm256_maskload_ps( residual + i, mask ) );
+		else
+			v = _mm256_mul_ps( v, scaleVec );
+		_mm256_maskstore_ps( rdi + i, mask, v );
+	}
+}
+
 void __vectorcall scaleRow( float* rdi, size_t len, const __m256 scale )
 {
 	float* rdiEndAligned = rdi + ( len & maskAlign8 );
@@ -652,6 +695,98 @@ void softMax( float* rdi, size_t length, const float inputScale )
 	}
 }
 
+void softMaxSample( const float* logits, size_t length, const DirectCompute::sSampleRules& rules, DirectCompute::sSampledToken& rdi )
+{
+	const size_t tsBegin = rules.timestampBegin;
+	const size_t tsEnd = rules.timestampEnd;
+	assert( tsBegin < tsEnd && tsEnd <= length );
+
+	// First pass, compute maximum
+	const float* const rsiEndAligned = logits + ( length & maskAlign8 );
+	const size_t remainder = length % 8;
+	__m256 max = _mm256_set1_ps( -INFINITY );
+	const float* rsi;
+	for( rsi = logits; rsi < rsiEndAligned; rsi += 8 )
+		max = _mm256_max_ps( max, _mm256_loadu_ps( rsi ) );
+	if( 0 != remainder )
+	{
+		const __m256i tailMask = loadTailMaskInt( remainder );
+		__m256 v = _mm256_maskload_ps( rsi, tailMask );
+		v = _mm256_max_ps( max, v );
+		max = _mm256_blendv_ps( max, v, _mm256_castsi256_ps( tailMask ) );
+	}
+
+	// Same exponent as the second pass of softMax()
+	const LookupTablesData& lookup = getLookupTables();
+	const float maxScalar = horizontalMax( max );
+	auto exponent = [ & ]( float f )
+	{
+		if( f == -INFINITY )
+			return 0.0f;
+		f = f - maxScalar;
+		return _cvtsh_ss( lookup.exponent[ _cvtss_sh( f, 0 ) ] );
+	};
+	auto isSuppressed = [ & ]( size_t i )
+	{
+		return (int)i == rules.suppress[ 0 ] || (int)i == rules.suppress[ 1 ] || (int)i == rules.suppress[ 2 ];
+	};
+
+	// Second pass: the sum in the same order as softMax(), the maximum of all text tokens, and the best text token which can be sampled
+	double sum = 0;
+	float maxText = 0;
+	float bestText = -1;
+	int bestTextId = -1;
+	size_t i;
+	for( i = 0; i < tsBegin; i++ )
+	{
+		const float e = exponent( logits[ i ] );
+		sum += e;
+		maxText = std::max( maxText, e );
+		if( e > bestText && !isSuppressed( i ) )
+		{
+			bestText = e;
+			bestTextId = (int)i;
+		}
+	}
+	for( ; i < length; i++ )
+		sum += exponent( logits[ i ] );
+	const float finalScale = (float)( 1.0 / sum );
+
+	// Third pass over the timestamp tokens, the probabilities are rounded to FP32 the same way as in softMax()
+	double sumTs = 0;
+	double maxTs = -1.0;
+	int tid = 0;
+	for( i = tsBegin; i < tsEnd; i++ )
+	{
+		const double p = exponent( logits[ i ] ) * finalScale;
+		sumTs += p;
+		if( p > maxTs )
+		{
+			maxTs = p;
+			tid = (int)i;
+		}
+	}
+	const double maxTx = ( tsBegin > 0 ) ? (double)( maxText * finalScale ) : -1.0;
+
+	rdi.tid = tid;
+	rdi.pt = (float)( maxTs / ( sumTs + 1e-10 ) );
+	rdi.ptsum = (float)sumTs;
+
+	// When the timestamp tokens are more probable than any text token, only sample the timestamps
+	const bool textSuppressed = rules.forceTimestamp || sumTs > maxTx;
+	const double pText = ( bestTextId >= 0 ) ? (double)( bestText * finalScale ) : -1.0;
+	if( !textSuppressed && pText > maxTs )
+	{
+		rdi.id = bestTextId;
+		rdi.p = (float)pText;
+	}
+	else
+	{
+		rdi.id = tid;
+		rdi.p = (float)maxTs;
+	}
+}
+
 void floatsUpcast( float* rdi, const uint16_t* rsi, size_t length )
 {
 	const uint16_t* rsiEndAligned = rsi + ( length & maskAlign8 );
@@ -32,7 +32,8 @@ inline size_t tempBufferForFloats( size_t count )
 
 #define ALIGNED_SPAN( name, countFloats ) AlignedSpan name{ _alloca( tempBufferForFloats( countFloats ) ) }
 
-void norm( float* rdi, float* temp, const float* rsi, size_t length );
+// When w and b are not nullptr, the final pass also applies rdi = rdi * w + b, equivalent to norm + fmaRepeatRow with the complete pattern
+void norm( float* rdi, float* temp, const float* rsi, size_t length, const float* w = nullptr, const float* b = nullptr );
 
 void fmaRepeatRow( float* rdi, size_t len, const float* w, const float* b, size_t lenPattern );
 void __vectorcall addRepeatScaleRow( float* rdi, size_t len, const float* b, size_t lenPattern, const __m256 scale );
@@ -46,8 +47,21 @@ namespace DirectCompute
 const DirectCompute::LookupTablesData& getLookupTables();
 void addRepeatGeluRow( float* rdi, size_t len, const float* b, size_t lenPattern, const DirectCompute::LookupTablesData& lookup );
 
+// rdi = residual + scale * gelu( rdi + bias ), used for the fused epilogue of the matrix multiplication.
+// bias, residual and geluLookup pointers are optional, pass nullptr to skip these steps.
+void mulMatEpilogueRow( float* rdi, size_t len, const float* bias, float scale, const float* residual, const DirectCompute::LookupTablesData* geluLookup );
+
 void softMax( float* rdi, size_t length, const float inputScale );
 
+namespace DirectCompute
+{
+	struct sSampleRules;
+	struct sSampledToken;
+}
+// Equivalent to softMax() of the logits followed by the sampling rules, without writing the probabilities.
+// The probabilities of the sampled tokens are bitwise equal to the output of softMax().
+void softMaxSample( const float* logits, size_t length, const DirectCompute::sSampleRules& rules, DirectCompute::sSampledToken& rdi );
+
 // A cache line-aligned array where first 8 elements have all bits set, last 8 elements are zeros
 extern const std::array<int, 16> s_zeroTailMask;
 
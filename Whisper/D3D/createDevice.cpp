@@ -85,6 +85,13 @@ HRESULT DirectCompute::validateFlags( uint32_t flags )
 		logError( u8"eGpuModelFlags.%s and eGpuModelFlags.%s are mutually exclusive", "NoReshapedMatMul", "UseReshapedMatMul" );
 		return E_INVALIDARG;
 	}
+
+	constexpr uint32_t quantizeBoth = eGpuModelFlags::QuantizeQ8 | eGpuModelFlags::QuantizeQ4;
+	if( ( flags & quantizeBoth ) == quantizeBoth )
+	{
+		logError( u8"eGpuModelFlags.%s and eGpuModelFlags.%s are mutually exclusive", "QuantizeQ8", "QuantizeQ4" );
+		return E_INVALIDARG;
+	}
 	return S_OK;
 }
 
@@ -9,6 +9,10 @@ namespace DirectCompute
 		FP16,
 		FP32,
 		U32,
+		// Block-quantized formats, only supported as the first argument of the CPU matrix multiplication.
+		// These tensors have strides expressed in elements like the rest of them, the size of the rows must be a multiple of 32.
+		Q8_0,
+		Q4_0,
 	};
 
 	inline size_t elementSize( eDataType dt )
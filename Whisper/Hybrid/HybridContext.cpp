@@ -1,7 +1,8 @@
 #include "stdafx.h"
-#include <immintrin.h>
 #include <optional>
+#include <cmath>
 #include "HybridContext.h"
+#include "../CPU/simdUtils.h"
 #include "../Utils/Trace/tracing.h"
 
 #if BUILD_HYBRID_VERSION
@@ -34,90 +35,84 @@ namespace
 HybridContext::HybridContext( const Whisper::WhisperModel& wm ) :
 	ml( threadsCount( 0 ) ),
 	model( wm.shared->hybridTensors ),
+	encoder( wm.shared->hybridEncoder ),
 	whisperModel( wm )
 { }
 
 namespace
 {
-	enum struct eModelType : uint8_t
-	{
-		Tiny = 0,
-		Base = 1,
-		Small = 2,
-		Medium = 3,
-		Large = 4,
-	};
-
-	static HRESULT detectModelType( const Whisper::sModelParams& modelParams, eModelType& mt )
+	// The encoder runs on the same arenas as the decoder.
+	// These estimates are conservative, VirtualAllocator only commits the pages which are actually used.
+
+	// Bytes for the outer arena of the encoder: input, convolutions, and ln_post
+	inline size_t encoderArenaBytes( const Whisper::sModelParams& mp )
 	{
-		switch( modelParams.n_audio_layer )
-		{
-		case 4:
-			mt = eModelType::Tiny;
-			return S_OK;
-		case 6:
-			mt = eModelType::Base;
-			return S_OK;
-		case 12:
-			mt = eModelType::Small;
-			return S_OK;
-		case 24:
-			mt = eModelType::Medium;
-			return S_OK;
-		case 32:
-			mt = eModelType::Large;
-			return S_OK;
-		}
-		logError( u8"Unrecognized model" );
-		return E_INVALIDARG;
+		const size_t ctx = (uint32_t)mp.n_audio_ctx;
+		const size_t state = (uint32_t)mp.n_audio_state;
+		const size_t mels = (uint32_t)mp.n_mels;
+		// mel input = 2 * ctx * mels, conv1 columns = 6 * ctx * mels
+		size_t floats = ctx * mels * 8;
+		// conv1 output = 2 * ctx * state, conv2 columns = 3 * ctx * state, conv2 output, ln_post
+		floats += ctx * state * 7;
+		return floats * 4 + MB;
 	}
 
-	struct alignas( 2 ) RamMB
+	// Bytes for the per-layer arena of the encoder
+	inline size_t encoderLayerArenaBytes( const Whisper::sModelParams& mp )
 	{
-		uint8_t dec, decLayer;
-		constexpr RamMB( uint8_t d, uint8_t dl ) : dec( d ), decLayer( dl ) { }
+		const size_t ctx = (uint32_t)mp.n_audio_ctx;
+		const size_t state = (uint32_t)mp.n_audio_state;
+		// Up to 12 tensors of [ state, ctx ] size, including the FP16 ones and [ 4 * state, ctx ] for the MLP
+		// The attention is fused, there's no KQ matrix
+		const size_t floats = ctx * state * 12;
+		return floats * 4 + MB;
+	}
 
-		__m128i loadBytes() const
-		{
-			__m128i v = _mm_loadu_si16( this );
-			// Upcast bytes to int64_t. That instruction can load directly from memory, too bad VC++ optimized doesn't care
-			v = _mm_cvtepu8_epi64( v );
-			// Scale from megabytes into bytes, the multiplier is obviously 2^20
-			v = _mm_slli_epi64( v, 20 );
-			return v;
-		}
-	};
+	// Bytes for the outer arena of the decoder, for the longest batch of n_text_ctx tokens: embeddings, ln, and the logits
+	// HybridContext::decodeImpl rejects longer batches
+	inline size_t decoderArenaBytes( const Whisper::sModelParams& mp )
+	{
+		const size_t ctx = (uint32_t)mp.n_text_ctx;
+		const size_t state = (uint32_t)mp.n_text_state;
+		const size_t vocab = (uint32_t)mp.n_vocab;
+		const size_t floats = ctx * state * 2 + ctx * vocab;
+		return floats * 4 + MB;
+	}
 
-	// The magic numbers are from MEM_REQ_DECODE and MEM_REQ_DECODE_LAYER red/black maps in the reference version,
-	// near the top of whisper.cpp source file
-	static const std::array<RamMB, 5> s_memRequirements =
+	// Bytes for the per-layer arena of the decoder
+	inline size_t decoderLayerArenaBytes( const Whisper::sModelParams& mp )
 	{
-		RamMB{ 200, 32 },	// Tiny
-		RamMB{ 202, 44 },	// Base
-		RamMB{ 204, 64 },	// Small
-		RamMB{ 206, 84 },	// Medium
-		RamMB{ 208, 110 },	// Large
-	};
+		const size_t ctx = (uint32_t)mp.n_text_ctx;
+		const size_t state = (uint32_t)mp.n_text_state;
+		// 3 norms, Q/K/V, cross-attention Q, 2 attention outputs with per-row copies, 2 residuals, [ 4 * state, ctx ] for the MLP
+		const size_t floats = ctx * state * 20;
+		return floats * 4 + MB;
+	}
 }
 
 HRESULT HybridContext::create()
 {
 	// Allocate buffers for compute
 	// We know they're large, so bypassing the heap
-	eModelType modelType;
-	CHECK( detectModelType( whisperModel.parameters, modelType ) );
-
-	const __m128i bytes = s_memRequirements.at( (uint8_t)modelType ).loadBytes();
-	CHECK( allocCompute.create( _mm_cvtsi128_si64( bytes ) ) );
-	CHECK( allocComputeLayer.create( _mm_extract_epi64( bytes, 1 ) ) );
+	// The sizes are computed from the parameters of the model, this works for the variants which are not tiny/base/small/medium/large
+	const auto& mp = whisperModel.parameters;
+	CHECK( allocCompute.create( std::max( decoderArenaBytes( mp ), encoderArenaBytes( mp ) ) ) );
+	CHECK( allocComputeLayer.create( std::max( decoderLayerArenaBytes( mp ), encoderLayerArenaBytes( mp ) ) ) );
 
-	// Create staging buffers to download output from encoder stage,
+	// Create RAM buffers for the output of the encoder,
 	// in the reference version they're named memory_cross_k / memory_cross_v
-	CHECK( kvCross.create( whisperModel.parameters ) );
+	CHECK( kvCross.createCross( mp ) );
 
 	// Create RAM buffers for memory_k / memory_v
 	CHECK( kv.create( whisperModel.parameters ) );
 
+	// Run the threads on the NUMA nodes which have the decoder matrices
+	const CpuCompute::NumaNodes& numa = whisperModel.shared->numaNodes;
+	if( !numa.empty() )
+		CHECK( ml.setNumaNodes( numa ) );
+	else if( whisperModel.shared->pinThreads )
+		CHECK( ml.setPinThreads( true ) );
+
 	return S_OK;
 }
 
@@ -141,7 +136,299 @@ public:
 	}
 };
 
+CpuCompute::Tensor HybridContext::melInput( Whisper::iSpectrogram& spectrogram, const DirectCompute::sEncodeParams& encParams )
+{
+	// Ported from MelInputTensor::create, the tensor stays in system RAM
+	using namespace CpuCompute;
+	const uint32_t ne0 = encParams.n_ctx * 2;
+	const uint32_t ne1 = encParams.n_mels;
+	Tensor res = ml.createTensor( eDataType::FP32, { ne0, ne1 } );
+	float* const dst = res.fp32();
+	memset( dst, 0, (size_t)ne0 * ne1 * 4 );
+
+	const size_t n_len = spectrogram.getLength();
+	const size_t i0 = std::min( (size_t)encParams.mel_offset, n_len );
+	const size_t i1 = std::min( (size_t)encParams.mel_offset + ne0, n_len );
+
+	Whisper::MelBufferRaii sourceBuffer;
+	check( sourceBuffer.make( spectrogram, i0, i1 - i0 ) );
+
+	constexpr uint32_t n_mel = Whisper::N_MEL;
+	const size_t rowBytes = ( i1 - i0 ) * 4;
+	for( uint32_t j = 0; j < n_mel; j++ )
+		memcpy( dst + (size_t)j * ne0, sourceBuffer[ j ], rowBytes );
+	return res;
+}
+
+CpuCompute::Tensor HybridContext::convolutionAndGelu( const CpuCompute::Tensor& mel, uint32_t n_ctx )
+{
+	using namespace CpuCompute;
+	const uint32_t n_state = encoder.conv1.w.ne[ 2 ];
+
+	// Unlike GGML, output of these convolutions is transposed: [ n_state, length ]
+	// The biases are [ 1, n_state ] in the model file, reshaping them into rows to repeat
+	Tensor cur = ml.conv1d( encoder.conv1.w, mel, 1 );
+	ml.addRepeatGelu( cur, encoder.conv1.b.reshape3d( n_state, 1, 1 ) );
+	Tracing::tensor( "enc.temp1", cur );
+
+	cur = ml.conv1d( encoder.conv2.w, ml.permute( cur, 1, 0, 2, 3 ), 2 );
+	ml.addRepeatGelu( cur, encoder.conv2.b.reshape3d( n_state, 1, 1 ) );
+
+	// Because the convolution output is already transposed, the first n_ctx rows of the positional embedding are just added to the tensor
+	const Tensor& posEmbed = encoder.positionalEmbedding;
+	if( posEmbed.ne[ 0 ] != n_state || posEmbed.ne[ 1 ] < n_ctx )
+		throw E_BOUNDS;
+	const Tensor e_pe = Tensor::fromData( (void*)posEmbed.data(), eDataType::FP32, n_state * n_ctx );
+	ml.addInPlace( cur, e_pe );
+	return cur;
+}
+
+CpuCompute::Tensor HybridContext::encodeLayer( const CpuCompute::Tensor& source, size_t index, uint32_t n_state, uint32_t n_head, uint32_t n_ctx )
+{
+	using namespace CpuCompute;
+	const LayerEncoder& layer = encoder.layers[ index ];
+	SetAllocatorRaii acLayer{ this, allocComputeLayer };
+
+	// norm
+	Tensor cur = ml.norm( source );
+	ml.fmaRepeat( cur, layer.attnLn0 );
+	if( 0 == index ) Tracing::tensor( "enc-norm", cur );
+
+	// self-attention
+	{
+		Tensor Qcur = ml.mulMat( layer.attnQuery.w, cur );
+		ml.addRepeat( Qcur, layer.attnQuery.b );
+		if( 0 == index ) Tracing::tensor( "enc-Qcur", Qcur );
+
+		// note: no bias for Key
+		Tensor Kcur = ml.mulMat( layer.attnKey, cur );
+		if( 0 == index ) Tracing::tensor( "enc-Kcur", Kcur );
+
+		Tensor Vcur = ml.mulMat( layer.attnValue.w, cur );
+		ml.addRepeat( Vcur, layer.attnValue.b );
+		if( 0 == index ) Tracing::tensor( "enc-Vcur", Vcur );
+
+		// ------
+		const uint32_t headSize = n_state / n_head;
+		Tensor Q = ml.permute( Qcur.reshape3d( headSize, n_head, n_ctx ), 0, 2, 1, 3 );
+		Tensor K = ml.permute( ml.copy( Kcur, eDataType::FP16, { headSize, n_head, n_ctx } ), 0, 2, 1, 3 );
+		Tensor V_trans = ml.permute( ml.copy( Vcur, eDataType::FP16, { headSize, n_head, n_ctx } ), 1, 2, 0, 3 );
+		Tensor KQV = ml.flashAttention( Q, K, V_trans, false, 1.0f / std::sqrt( (float)headSize ) );
+		if( 0 == index ) Tracing::tensor( "enc-KQV", KQV );
+
+		Tensor KQV_merged = ml.permute( KQV, 0, 2, 1, 3 );
+		ml.copyInPlace( cur, KQV_merged, eDataType::FP32, { n_state, n_ctx } );
+	}
+
+	// projection
+	cur = ml.mulMat( layer.attnLn1.w, cur );
+	ml.addRepeat( cur, layer.attnLn1.b );
+
+	// add the input
+	ml.addInPlace( cur, source );
+
+	// feed-forward network
+	Tensor inpFF = cur;
+	cur = ml.norm( inpFF );
+	ml.fmaRepeat( cur, layer.mlpLn );
+
+	// fully connected
+	cur = ml.mulMat( layer.mlp0.w, cur );
+	ml.addRepeatGelu( cur, layer.mlp0.b );
+
+	// Same as the decoder, output of the layer goes to the special arena which survives resets of the per-layer one.
+	// The source tensor might be in that arena too, it's no longer needed at this point.
+	allocLayerOutput.resetArena();
+	ml.setAllocator( &allocLayerOutput );
+
+	// projection
+	cur = ml.mulMat( layer.mlp1.w, cur );
+	ml.addRepeat( cur, layer.mlp1.b );
+
+	// output from this layer
+	ml.addInPlace( cur, inpFF );
+	return cur;
+}
+
+HRESULT HybridContext::encode( Whisper::iSpectrogram& spectrogram, const DirectCompute::sEncodeParams& encParams, int n_threads, uint32_t crossSlot )
+{
+	if( crossSlot >= kvCross.countSlots() )
+		return E_BOUNDS;
+	CHECK( ml.setThreadsCount( n_threads ) );
+	using namespace CpuCompute;
+
+	const uint32_t n_ctx = encParams.n_ctx;
+	const uint32_t n_state = encParams.n_state;
+	const uint32_t n_head = encParams.n_head;
+
+	SetAllocatorRaii ac{ this, allocCompute };
+
+	Tensor cur = melInput( spectrogram, encParams );
+	Tracing::tensor( "enc.input", cur );
+
+	// Initial few steps
+	cur = convolutionAndGelu( cur, n_ctx );
+
+	// Process all these layers
+	for( uint32_t i = 0; i < encParams.layersCount; i++ )
+	{
+		Tracing::tensor( { "enc.layer[ %i ].in", i }, cur );
+		cur = encodeLayer( cur, i, n_state, n_head, n_ctx );
+	}
+	Tracing::tensor( "enc.layers", cur );
+
+	// A few last steps
+	cur = ml.norm( cur );
+	ml.fmaRepeat( cur, encoder.lnPost );
+
+	// pre-compute cross-attention buffers, straight into memory_cross_k / memory_cross_v
+	const float finalScaling = computeScaling( (int)n_state, (int)n_head );
+	const uint32_t stride = n_state * n_ctx;
+	const uint32_t slotOffset = kvCross.slotOffset( crossSlot );
+	for( uint32_t i = 0; i < encParams.n_text_layer; i++ )
+	{
+		const LayerDecoder& layer = model.layers[ i ];
+		SetAllocatorRaii acLayer{ this, allocComputeLayer };
+
+		Tensor Kcross = ml.mulMat( layer.crossAttnKey, cur );
+		ml.scale( Kcross, finalScaling );
+
+		Tensor Vcross = ml.mulMat( layer.crossAttnValue.w, cur );
+		ml.addRepeat( Vcross, layer.crossAttnValue.b );
+
+		Tensor k = kvCross.keysView( stride, slotOffset + stride * i );
+		CHECK( ml.copyImpl( k, Kcross ) );
+
+		Tensor v = kvCross.valuesView( stride, slotOffset + stride * i );
+		CHECK( ml.copyImpl( v, Vcross ) );
+	}
+	return S_OK;
+}
+
 HRESULT HybridContext::decode( const int* tokens, const int n_tokens, const int n_past, const sDecParams& dp, std::vector<float>& probs )
+{
+	return decodeImpl( tokens, n_tokens, n_past, nullptr, dp, probs );
+}
+
+HRESULT HybridContext::decodeSample( const int* tokens, const int n_tokens, const int n_past, const sDecParams& dp,
+	const DirectCompute::sSampleRules& rules, DirectCompute::sSampledToken* results )
+{
+	if( rules.timestampBegin >= rules.timestampEnd || rules.timestampEnd > (uint32_t)whisperModel.parameters.n_vocab )
+		return E_BOUNDS;
+	std::vector<float> unused;
+	return decodeImpl( tokens, n_tokens, n_past, nullptr, dp, unused, &rules, results );
+}
+
+HRESULT HybridContext::createSlots( uint32_t self, uint32_t cross )
+{
+	const auto& mp = whisperModel.parameters;
+	if( self > kv.countSlots() )
+		CHECK( kv.create( mp, self ) );
+	if( cross > kvCross.countSlots() )
+		CHECK( kvCross.createCross( mp, cross ) );
+	return S_OK;
+}
+
+HRESULT HybridContext::decodeBatch( const int* tokens, const DirectCompute::sBatchRow* rows, const int n_rows, const sDecParams& dp, std::vector<float>& probs )
+{
+	if( nullptr == rows )
+		return E_POINTER;
+	for( int i = 0; i < n_rows; i++ )
+	{
+		if( rows[ i ].slot >= kv.countSlots() || rows[ i ].crossSlot >= kvCross.countSlots() )
+			return E_BOUNDS;
+		if( rows[ i ].n_past >= (uint32_t)whisperModel.parameters.n_text_ctx )
+			return E_BOUNDS;
+	}
+	return decodeImpl( tokens, n_rows, 0, rows, dp, probs );
+}
+
+HRESULT HybridContext::forkBeam( uint32_t dest, uint32_t source, uint32_t length )
+{
+	return kv.copySlot( dest, source, length );
+}
+
+namespace
+{
+	// A view of the continuous range of rows of the matrix
+	inline CpuCompute::Tensor matrixRows( const CpuCompute::Tensor& t, uint32_t i, uint32_t count = 1 )
+	{
+		float* rsi = const_cast<float*>( t.fp32() ) + (size_t)i * t.nb[ 1 ];
+		return CpuCompute::Tensor::fromData( rsi, CpuCompute::eDataType::FP32, t.ne[ 0 ] * count );
+	}
+}
+
+void HybridContext::batchAttention( CpuCompute::Tensor& cur, const CpuCompute::Tensor& Qcur, const CpuCompute::Tensor& Kcur, const CpuCompute::Tensor& Vcur,
+	const DirectCompute::sBatchRow* rows, uint32_t il )
+{
+	using namespace CpuCompute;
+	const auto& hparams = whisperModel.parameters;
+	const uint32_t n_ctx = hparams.n_text_ctx;
+	const uint32_t n_state = hparams.n_text_state;
+	const uint32_t n_head = hparams.n_text_head;
+	const uint32_t headSize = n_state / n_head;
+	const uint32_t n_rows = Qcur.ne[ 1 ];
+
+	// The rows are processed sequentially: when several rows belong to the same sequence,
+	// each of them sees the keys and values stored by the previous ones
+	for( uint32_t i = 0; i < n_rows; i++ )
+	{
+		const uint32_t n_past = rows[ i ].n_past;
+		const uint32_t length = n_past + 1;
+		const uint32_t off = kv.slotOffset( rows[ i ].slot ) + il * n_ctx * n_state;
+
+		// store key and value of the new token to the slot of the sequence
+		Tensor k = kv.keysView( n_state, off + n_past * n_state );
+		Tensor v = kv.valuesView( n_state, off + n_past * n_state );
+		check( ml.copyImpl( k, matrixRows( Kcur, i ) ) );
+		check( ml.copyImpl( v, matrixRows( Vcur, i ) ) );
+
+		Tensor Q = ml.permute( matrixRows( Qcur, i ).reshape3d( headSize, n_head, 1 ), 0, 2, 1, 3 );
+		Tensor K = ml.permute( kv.keysView( length * n_state, off ).reshape3d( headSize, n_head, length ), 0, 2, 1, 3 );
+		Tensor V_trans = ml.permute( kv.valuesView( length * n_state, off ).reshape3d( headSize, n_head, length ), 1, 2, 0, 3 );
+
+		// With a single query, the [ headSize, 1, n_head ] output is already in the merged layout
+		Tensor KQV = ml.flashAttention( Q, K, V_trans, false );
+		memcpy( cur.fp32() + (size_t)i * cur.nb[ 1 ], KQV.fp32(), n_state * sizeof( float ) );
+	}
+}
+
+void HybridContext::batchCrossAttention( CpuCompute::Tensor& cur, const CpuCompute::Tensor& Qcur, const DirectCompute::sBatchRow* rows, uint32_t il, uint32_t M )
+{
+	using namespace CpuCompute;
+	const auto& hparams = whisperModel.parameters;
+	const uint32_t n_state = hparams.n_text_state;
+	const uint32_t n_head = hparams.n_text_head;
+	const uint32_t headSize = n_state / n_head;
+	const uint32_t n_rows = Qcur.ne[ 1 ];
+	const uint32_t len = M * n_state;
+
+	// Consecutive rows with the same encoder output, like the beams of a single stream, are computed in one call
+	for( uint32_t i = 0; i < n_rows; )
+	{
+		const uint32_t crossSlot = rows[ i ].crossSlot;
+		uint32_t count = 1;
+		while( i + count < n_rows && rows[ i + count ].crossSlot == crossSlot )
+			count++;
+
+		// Kcross is already scaled
+		const uint32_t off = kvCross.slotOffset( crossSlot ) + il * len;
+		Tensor Kcross = kvCross.keysView( len, off ).reshape3d( headSize, n_head, M );
+		Tensor Vcross = kvCross.valuesView( len, off ).reshape3d( headSize, n_head, M );
+
+		Tensor Q = ml.permute( matrixRows( Qcur, i, count ).reshape3d( headSize, n_head, count ), 0, 2, 1, 3 );
+		Tensor K = ml.permute( Kcross, 0, 2, 1, 3 );
+		Tensor V_trans = ml.permute( Vcross, 1, 2, 0, 3 );
+		Tensor KQV = ml.flashAttention( Q, K, V_trans, false );
+
+		Tensor dest = matrixRows( cur, i, count );
+		ml.copyInPlace( dest, ml.permute( KQV, 0, 2, 1, 3 ), eDataType::FP32, { n_state, count } );
+		i += count;
+	}
+}
+
+HRESULT HybridContext::decodeImpl( const int* tokens, const int n_tokens, const int n_past, const DirectCompute::sBatchRow* rows, const sDecParams& dp, std::vector<float>& probs,
+	const DirectCompute::sSampleRules* rules, DirectCompute::sSampledToken* sampled )
 {
 	CHECK( ml.setThreadsCount( dp.n_threads ) );
 
@@ -157,13 +444,28 @@ HRESULT HybridContext::decode( const int* tokens, const int n_tokens, const int
 	const uint32_t N = n_tokens;
 	const uint32_t M = dp.M;
 
+	// The compute arenas are sized for up to n_text_ctx rows, and the KV cache has n_text_ctx entries
+	if( n_tokens <= 0 || N > n_ctx )
+		return E_INVALIDARG;
+	if( nullptr == rows && (uint32_t)n_past + N > n_ctx )
+		return E_INVALIDARG;
+
 	SetAllocatorRaii ac{ this, allocCompute };
 	using namespace CpuCompute;
-	Tensor cur = ml.addRows( model.tokenEmbedding, model.positionalEmbedding, tokens, n_tokens, n_past );
+	Tensor cur;
+	if( nullptr == rows )
+		cur = ml.addRows( model.tokenEmbedding, model.positionalEmbedding, tokens, n_tokens, n_past );
+	else
+	{
+		// Every row of the batch has its own position
+		std::vector<uint32_t> positions( N );
+		for( uint32_t i = 0; i < N; i++ )
+			positions[ i ] = rows[ i ].n_past;
+		cur = ml.addRows( model.tokenEmbedding, model.positionalEmbedding, tokens, positions.data(), n_tokens );
+	}
 	Tracing::tensor( "dec-rows", cur );
 
 	Tensor inpL = cur;
-	auto kvCross = this->kvCross.map();
 
 	for( uint32_t il = 0; il < n_layer; il++ )
 	{
@@ -172,139 +474,164 @@ HRESULT HybridContext::decode( const int* tokens, const int n_tokens, const int
 		SetAllocatorRaii acLayer{ this, allocComputeLayer };
 
 		// norm
-		Tensor cur = ml.norm( inpL );
-		ml.fmaRepeat( cur, layer.attnLn0 );
+		// The elementwise operations are fused into the norm and mulMat passes, for single-token steps these extra passes were a measurable share of the time
+		Tensor cur = ml.norm( inpL, layer.attnLn0 );
 		if( 0 == il ) Tracing::tensor( "dec-norm", cur );
 
 		// self-attention
 		{
-			Tensor Qcur = ml.mulMat( layer.attnQuery.w, cur );
-			if( 0 == il ) Tracing::tensor( "dec-Qcur-0", Qcur );
 			const float scaling = computeScaling( (int)n_state, (int)n_head );
-			ml.addRepeatScale( Qcur, layer.attnQuery.b, scaling );
+			Tensor Qcur = ml.mulMatBiasScale( layer.attnQuery.w, cur, layer.attnQuery.b, scaling );
 			if( 0 == il ) Tracing::tensor( "dec-Qcur-1", Qcur );
 
 			// note: no bias for Key
-			Tensor Kcur = ml.mulMat( layer.attnKey, cur );
-			ml.scale( Kcur, scaling );
+			Tensor Kcur = ml.mulMatScale( layer.attnKey, cur, scaling );
 			if( 0 == il ) Tracing::tensor( "dec-Kcur", Kcur );
 
-			Tensor Vcur = ml.mulMat( layer.attnValue.w, cur );
-			ml.addRepeat( Vcur, layer.attnValue.b );
+			Tensor Vcur = ml.mulMatBias( layer.attnValue.w, cur, layer.attnValue.b );
 			if( 0 == il ) Tracing::tensor( "dec-Vcur", Vcur );
 
-			// store key and value to memory
+			if( nullptr != rows )
 			{
-				const uint32_t len = N * n_state;
-				const uint32_t off = n_state * ( (uint32_t)il * n_ctx + n_past );
-				Tensor k = kv.keysView( len, off );
-				Tensor v = kv.valuesView( len, off );
-
-				CHECK( ml.copyImpl( k, Kcur ) );
-				CHECK( ml.copyImpl( v, Vcur ) );
+				batchAttention( cur, Qcur, Kcur, Vcur, rows, il );
+				if( 0 == il ) Tracing::tensor( "dec-KQV", cur );
+			}
+			else
+			{
+				// store key and value to memory
+				{
+					const uint32_t len = N * n_state;
+					const uint32_t off = n_state * ( (uint32_t)il * n_ctx + n_past );
+					Tensor k = kv.keysView( len, off );
+					Tensor v = kv.valuesView( len, off );
+
+					CHECK( ml.copyImpl( k, Kcur ) );
+					CHECK( ml.copyImpl( v, Vcur ) );
+				}
+
+				// ------
+				Tensor Q = ml.permute( Qcur.reshape3d( n_state / n_head, n_head, N ), 0, 2, 1, 3 );
+				Tensor K = ml.permute( kv.keysView( ( n_past + N ) * n_state, (uint32_t)il * n_ctx * n_state )
+					.reshape3d( n_state / n_head, n_head, n_past + N ),
+					0, 2, 1, 3 );
+				Tensor V_trans = ml.permute(
+					kv.valuesView( ( n_past + N ) * n_state, (uint32_t)il * n_ctx * n_state )
+					.reshape3d( n_state / n_head, n_head, n_past + N ),
+					1, 2, 0, 3 );
+
+				// Q and K are both scaled, the causal mask hides the keys after n_past + i
+				Tensor KQV = ml.flashAttention( Q, K, V_trans, true );
+				if( 0 == il ) Tracing::tensor( "dec-KQV", KQV );
+
+				Tensor KQV_merged = ml.permute( KQV, 0, 2, 1, 3 );
+				ml.copyInPlace( cur, KQV_merged, eDataType::FP32, { n_state, N } );
 			}
-
-			// ------
-			Tensor Q = ml.permute( ml.copy( Qcur, eDataType::FP32, { n_state / n_head, n_head, N } ), 0, 2, 1, 3 );
-			Tensor K = ml.permute( kv.keysView( ( n_past + N ) * n_state, (uint32_t)il * n_ctx * n_state )
-				.reshape3d( n_state / n_head, n_head, n_past + N ),
-				0, 2, 1, 3 );
-			Tensor KQ = ml.mulMat( K, Q );
-			if( 0 == il ) Tracing::tensor( "dec-KQ-0", KQ );
-			ml.diagMaskInf( KQ, n_past );
-			if( 0 == il ) Tracing::tensor( "dec-KQ-1", KQ );
-			ml.softMax( KQ );
-			if( 0 == il ) Tracing::tensor( "dec-KQ-2", KQ );
-
-			Tensor V_trans = ml.permute(
-				kv.valuesView( ( n_past + N ) * n_state, (uint32_t)il * n_ctx * n_state )
-				.reshape3d( n_state / n_head, n_head, n_past + N ),
-				1, 2, 0, 3 );
-
-			Tensor KQV = ml.mulMat( V_trans, KQ );
-			if( 0 == il ) Tracing::tensor( "dec-KQV", KQV );
-
-			Tensor KQV_merged = ml.permute( KQV, 0, 2, 1, 3 );
-			ml.copyInPlace( cur, KQV_merged, eDataType::FP32, { n_state, N } );
-		}
-
-		{
-			cur = ml.mulMat( layer.attnLn1.w, cur );
-			ml.addRepeat( cur, layer.attnLn1.b );
 		}
 
-		// add the input
-		Tensor inpCA = ml.add( cur, inpL );
+		// projection, and add the input
+		Tensor inpCA = ml.mulMatBiasAdd( layer.attnLn1.w, cur, layer.attnLn1.b, inpL );
 
 		// norm
-		{
-			cur = ml.norm( inpCA );
-			ml.fmaRepeat( cur, layer.crossAttnLn0 );
-		}
+		cur = ml.norm( inpCA, layer.crossAttnLn0 );
 
 		// cross-attention
 		{
-			Tensor Qcur = ml.mulMat( layer.crossAttnQuery.w, cur );
-			ml.addRepeatScale( Qcur, layer.crossAttnQuery.b, computeScaling( (int)n_state, (int)n_head ) );
-
-			// Kcross is already scaled
-			const uint32_t len = M * n_state;
-			const uint32_t off = (uint32_t)il * len;
-			Tensor Kcross = kvCross.keysView( len, off ).reshape3d( n_state / n_head, n_head, M );
-			Tensor Vcross = kvCross.valuesView( len, off ).reshape3d( n_state / n_head, n_head, M );
-
-			// ------
-			Tensor Q = ml.permute( ml.copy( Qcur, eDataType::FP32, { n_state / n_head, n_head, N } ), 0, 2, 1, 3 );
-			Tensor K = ml.permute( Kcross, 0, 2, 1, 3 );
-			Tensor KQ = ml.mulMat( K, Q );
-			ml.softMax( KQ );
-			Tensor V_trans = ml.permute( Vcross, 1, 2, 0, 3 );
-			Tensor KQV = ml.mulMat( V_trans, KQ );
-			if( 0 == il ) Tracing::tensor( "dec-KQV", KQV );
-			Tensor KQV_merged = ml.permute( KQV, 0, 2, 1, 3 );
-
-			ml.copyInPlace( cur, KQV_merged, eDataType::FP32, { n_state, N } );
-		}
+			Tensor Qcur = ml.mulMatBiasScale( layer.crossAttnQuery.w, cur, layer.crossAttnQuery.b, computeScaling( (int)n_state, (int)n_head ) );
 
-		// projection
-		{
-			cur = ml.mulMat( layer.crossAttnLn1.w, cur );
-			ml.addRepeat( cur, layer.crossAttnLn1.b );
+			if( nullptr != rows )
+				batchCrossAttention( cur, Qcur, rows, il, M );
+			else
+			{
+				// Kcross is already scaled
+				const uint32_t len = M * n_state;
+				const uint32_t off = (uint32_t)il * len;
+				Tensor Kcross = kvCross.keysView( len, off ).reshape3d( n_state / n_head, n_head, M );
+				Tensor Vcross = kvCross.valuesView( len, off ).reshape3d( n_state / n_head, n_head, M );
+
+				// ------
+				Tensor Q = ml.permute( Qcur.reshape3d( n_state / n_head, n_head, N ), 0, 2, 1, 3 );
+				Tensor K = ml.permute( Kcross, 0, 2, 1, 3 );
+				Tensor V_trans = ml.permute( Vcross, 1, 2, 0, 3 );
+				Tensor KQV = ml.flashAttention( Q, K, V_trans, false );
+				if( 0 == il ) Tracing::tensor( "dec-KQV", KQV );
+				Tensor KQV_merged = ml.permute( KQV, 0, 2, 1, 3 );
+
+				ml.copyInPlace( cur, KQV_merged, eDataType::FP32, { n_state, N } );
+			}
 		}
-		// add the input
-		ml.addInPlace( cur, inpCA );
-		Tensor inpFF = cur;
+
+		// projection, and add the input
+		Tensor inpFF = ml.mulMatBiasAdd( layer.crossAttnLn1.w, cur, layer.crossAttnLn1.b, inpCA );
 
 		// feed-forward network
 		{
 			// norm
-			cur = ml.norm( inpFF );
-			ml.fmaRepeat( cur, layer.mlpLn );
+			cur = ml.norm( inpFF, layer.mlpLn );
 
-			cur = ml.mulMat( layer.mlp0.w, cur );
-			ml.addRepeatGelu( cur, layer.mlp0.b );
+			cur = ml.mulMatBiasGelu( layer.mlp0.w, cur, layer.mlp0.b );
 
 			// The mulMat() below creates a tensor for the output of this layer.
 			// We have a special memory storage for these tensors, that's how they survive resets of per-layer arenas
 			allocLayerOutput.resetArena();
 			ml.setAllocator( &allocLayerOutput );
 
-			// projection
-			cur = ml.mulMat( layer.mlp1.w, cur );
-			ml.addRepeat( cur, layer.mlp1.b );
+			// projection, and the output from this layer
+			cur = ml.mulMatBiasAdd( layer.mlp1.w, cur, layer.mlp1.b, inpFF );
 		}
-
-		// output from this layer
-		ml.addInPlace( cur, inpFF );
 		inpL = cur;
 	}
 
+	// The sampling only uses probabilities after the last token, the KV cache already has the rows of the complete prompt.
+	// Skip the [ n_vocab, n_state ] vocabulary projection of the other rows, for smaller models it was the most expensive part of the prompt prefill.
+	// The verification of the speculative decoding needs all of them.
+	if( nullptr == rows && N > 1 && !dp.allRows )
+	{
+		assert( inpL.isContinuous() );
+		inpL = Tensor::fromData( inpL.fp32() + (size_t)( N - 1 ) * n_state, eDataType::FP32, n_state );
+	}
+	else if( nullptr != rows )
+	{
+		// Same for the batches, only gather the rows which need the probabilities, like the last token of every prompt in the prefill
+		uint32_t countOutputs = 0;
+		for( uint32_t i = 0; i < N; i++ )
+			if( rows[ i ].logits )
+				countOutputs++;
+		if( 0 == countOutputs )
+		{
+			probs.clear();
+			return S_OK;
+		}
+		if( countOutputs < N )
+		{
+			assert( inpL.isContinuous() );
+			Tensor gathered = ml.createTensor( eDataType::FP32, { n_state, countOutputs } );
+			float* rdi = gathered.fp32();
+			for( uint32_t i = 0; i < N; i++ )
+			{
+				if( !rows[ i ].logits )
+					continue;
+				memcpy( rdi, inpL.fp32() + (size_t)i * n_state, n_state * sizeof( float ) );
+				rdi += n_state;
+			}
+			inpL = gathered;
+		}
+	}
+
 	// norm
-	cur = ml.norm( inpL );
-	ml.fmaRepeat( cur, model.ln );
+	cur = ml.norm( inpL, model.ln );
 
 	cur = ml.mulMat( model.tokenEmbedding, cur );
 
+	if( nullptr != sampled )
+	{
+		// Fused softmax and sampling of the rows of logits, without the n_vocab probabilities
+		assert( nullptr == rows && cur.isContinuous() && 0 == cur.countElements() % n_vocab );
+		const size_t countRows = cur.countElements() / n_vocab;
+		for( size_t i = 0; i < countRows; i++ )
+			softMaxSample( cur.fp32() + i * n_vocab, n_vocab, *rules, sampled[ i ] );
+		return S_OK;
+	}
+
 	// logits -> probs
 	ml.softMax( cur );
 
@@ -2,10 +2,12 @@
 #include "../Whisper/WhisperModel.h"
 #include "../CPU/MlContext.h"
 #include "../CPU/BufferAllocator.h"
-#include "KeyValueDownloader.h"
 #include "../CPU/KvTensors.h"
+#include "../Whisper/iSpectrogram.h"
+#include "../Whisper/sEncodeParams.h"
 
 // This version of the hybrid context uses the new, custom-built kernels
+// Both encoder and decoder run on CPU, the cross-attention buffers stay in system RAM
 class HybridContext
 {
 	CpuCompute::MlContext ml;
@@ -25,28 +27,68 @@ class HybridContext
 	AllocSingle allocLayerOutput;
 
 	const CpuCompute::DecoderTensors& model;
+	const CpuCompute::EncoderTensors& encoder;
 	const Whisper::WhisperModel& whisperModel;
-	KeyValueDownloader kvCross;
+	// memory_cross_k / memory_cross_v, the output of the encoder
+	CpuCompute::KvTensors kvCross;
+	// memory_k / memory_v
 	CpuCompute::KvTensors kv;
 
 	class SetAllocatorRaii;
 
+	// Encoder methods
+	CpuCompute::Tensor melInput( Whisper::iSpectrogram& spectrogram, const DirectCompute::sEncodeParams& encParams );
+	CpuCompute::Tensor convolutionAndGelu( const CpuCompute::Tensor& mel, uint32_t n_ctx );
+	CpuCompute::Tensor encodeLayer( const CpuCompute::Tensor& source, size_t index, uint32_t n_state, uint32_t n_head, uint32_t n_ctx );
+
 public:
 
 	HybridContext( const Whisper::WhisperModel& wm );
 
 	HRESULT create();
 
-	HRESULT downloadKeyValues( const DirectCompute::KeyValueBuffers& source )
-	{
-		return kvCross.download( source );
-	}
+	// Run the encoder, and compute cross-attention buffers for the decoder
+	HRESULT encode( Whisper::iSpectrogram& spectrogram, const DirectCompute::sEncodeParams& encParams, int n_threads, uint32_t crossSlot = 0 );
 
 	struct sDecParams
 	{
 		int n_threads;
 		int M;
+		bool allRows = false;
 	};
 
+	// Decode a sequence of tokens, the output only has probabilities after the last one unless dp.allRows is set
 	HRESULT decode( const int* tokens, const int n_tokens, const int n_past, const sDecParams& dp, std::vector<float>& probs_out );
+
+	// Decode a sequence of tokens, and sample the next one from the logits after the last token.
+	// With dp.allRows, samples after every token, the results array receives n_tokens elements.
+	// The sampling rules are fused into the softmax, the probabilities of the vocabulary are not stored anywhere.
+	HRESULT decodeSample( const int* tokens, const int n_tokens, const int n_past, const sDecParams& dp,
+		const DirectCompute::sSampleRules& rules, DirectCompute::sSampledToken* results );
+
+	// Ensure the KV caches have at least the specified count of slots, for the beam search and batched decoding
+	HRESULT createSlots( uint32_t self, uint32_t cross );
+
+	// Decode a batch of tokens which belong to independent sequences, the output has a row of probabilities for each row of the batch with the logits flag
+	HRESULT decodeBatch( const int* tokens, const DirectCompute::sBatchRow* rows, const int n_rows, const sDecParams& dp, std::vector<float>& probs_out );
+
+	// Copy the first `length` entries of KV cache between slots, when a beam forks
+	HRESULT forkBeam( uint32_t dest, uint32_t source, uint32_t length );
+
+	// Exchange the output of the encoder with another context of the same model
+	void swapCrossAttention( HybridContext& that )
+	{
+		kvCross.swap( that.kvCross );
+	}
+
+private:
+	// Decoder implementation; when rows is not nullptr, every token is a separate row of the batch with its own KV cache slots and position
+	// When sampled is not nullptr, the output is the tokens sampled with these rules from every row of logits, and probs_out is left unchanged
+	HRESULT decodeImpl( const int* tokens, const int n_tokens, const int n_past, const DirectCompute::sBatchRow* rows, const sDecParams& dp, std::vector<float>& probs_out,
+		const DirectCompute::sSampleRules* rules = nullptr, DirectCompute::sSampledToken* sampled = nullptr );
+	// Self-attention of the batch, every row attends to the history in its own KV slot
+	void batchAttention( CpuCompute::Tensor& cur, const CpuCompute::Tensor& Qcur, const CpuCompute::Tensor& Kcur, const CpuCompute::Tensor& Vcur,
+		const DirectCompute::sBatchRow* rows, uint32_t il );
+	// Cross-attention of the batch, every row attends to the output of the encoder in its own slot
+	void batchCrossAttention( CpuCompute::Tensor& cur, const CpuCompute::Tensor& Qcur, const DirectCompute::sBatchRow* rows, uint32_t il, uint32_t M );
 };
\ No newline at end of file
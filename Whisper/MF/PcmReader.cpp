@@ -310,6 +310,41 @@ PcmReader::PcmReader( const iAudioReader* iar )
 	check( getDuration( reader, m_length, sourceMono, iar ) );
 }
 
+PcmReader::PcmReader( const iAudioBuffer* buffer, size_t startChunk )
+{
+	if( nullptr == buffer )
+		throw E_POINTER;
+
+	memoryBuffer = buffer;
+	sampleHandler = nullptr;
+	m_stereoOutput = nullptr != buffer->getPcmStereo();
+	m_length = buffer->countSamples() / FFT_STEP;
+	memoryOffset = std::min( startChunk, m_length ) * FFT_STEP;
+}
+
+HRESULT PcmReader::readMemoryChunk( PcmMonoChunk& mono, PcmStereoChunk* stereo )
+{
+	const size_t countSamples = memoryBuffer->countSamples();
+	if( memoryOffset >= countSamples )
+		return E_EOF;
+
+	// The last chunk is padded with zeros, same as for the Media Foundation readers
+	const size_t samples = std::min( countSamples - memoryOffset, (size_t)FFT_STEP );
+	memcpy( mono.mono.data(), memoryBuffer->getPcmMono() + memoryOffset, samples * 4 );
+	if( samples < FFT_STEP )
+		memset( mono.mono.data() + samples, 0, ( FFT_STEP - samples ) * 4 );
+
+	if( nullptr != stereo )
+	{
+		memcpy( stereo->stereo.data(), memoryBuffer->getPcmStereo() + memoryOffset * 2, samples * 8 );
+		if( samples < FFT_STEP )
+			memset( stereo->stereo.data() + samples * 2, 0, ( FFT_STEP - samples ) * 8 );
+	}
+
+	memoryOffset += samples;
+	return S_OK;
+}
+
 HRESULT PcmReader::readNextSample()
 {
 	const size_t off = bufferReadOffset;
@@ -390,8 +425,33 @@ HRESULT PcmReader::readNextSample()
 	}
 }
 
+HRESULT PcmReader::skipChunks( size_t count )
+{
+	if( nullptr != memoryBuffer )
+	{
+		const size_t countSamples = memoryBuffer->countSamples();
+		if( memoryOffset >= countSamples )
+			return E_EOF;
+		// Same count of chunks as readMemoryChunk() delivers, the incomplete last one included
+		const size_t samples = countSamples - memoryOffset;
+		const size_t chunks = ( samples + FFT_STEP - 1 ) / FFT_STEP;
+		memoryOffset = std::min( memoryOffset + count * FFT_STEP, countSamples );
+		return ( count > chunks ) ? E_EOF : S_OK;
+	}
+
+	PcmMonoChunk mono;
+	PcmStereoChunk stereo;
+	PcmStereoChunk* const pStereo = m_stereoOutput ? &stereo : nullptr;
+	for( size_t i = 0; i < count; i++ )
+		CHECK( readChunk( mono, pStereo ) );
+	return S_OK;
+}
+
 HRESULT PcmReader::readChunk( PcmMonoChunk& mono, PcmStereoChunk* stereo )
 {
+	if( nullptr != memoryBuffer )
+		return readMemoryChunk( mono, stereo );
+
 	while( true )
 	{
 		const size_t off = bufferReadOffset;
@@ -43,10 +43,18 @@ namespace Whisper
 		// Read next sample from the reader, store in the PCM buffer in this class
 		HRESULT readNextSample();
 
+		// When reading from the in-memory buffer instead of Media Foundation, the source buffer, and the position of the next chunk in samples
+		const iAudioBuffer* memoryBuffer = nullptr;
+		size_t memoryOffset = 0;
+		HRESULT readMemoryChunk( PcmMonoChunk& mono, PcmStereoChunk* stereo );
+
 	public:
 
 		PcmReader( const iAudioReader* reader );
 
+		// Deliver chunks of the complete audio already in memory, starting at the specified chunk; the buffer must outlive this object
+		PcmReader( const iAudioBuffer* buffer, size_t startChunk );
+
 		// Count of chunks in the MEL spectrogram.
 		// The PCM audio is generally slightly longer than that, due to the incomplete last chunk.
 		size_t getLength() const noexcept
@@ -60,5 +68,9 @@ namespace Whisper
 		// Load another 10ms chunk from the stream
 		// For the last chunk in the stream, the output buffers are padded with zeros
 		HRESULT readChunk( PcmMonoChunk& mono, PcmStereoChunk* stereo );
+
+		// Skip the specified count of chunks forward, returns E_EOF when the stream ended before that.
+		// The in-memory buffer moves the position directly, Media Foundation readers decode and discard these chunks.
+		HRESULT skipChunks( size_t count );
 	};
 }
\ No newline at end of file
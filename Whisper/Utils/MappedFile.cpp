@@ -0,0 +1,102 @@
+#include "stdafx.h"
+#include "MappedFile.h"
+
+HRESULT MappedFile::open( const wchar_t* path )
+{
+	close();
+
+	file = CreateFileW( path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+	if( INVALID_HANDLE_VALUE == file )
+		return getLastHr();
+
+	LARGE_INTEGER li;
+	if( !GetFileSizeEx( file, &li ) )
+	{
+		const HRESULT hr = getLastHr();
+		close();
+		return hr;
+	}
+	if( 0 == li.QuadPart )
+	{
+		close();
+		return E_INVALIDARG;
+	}
+	if( (uint64_t)li.QuadPart > (uint64_t)SIZE_MAX )
+	{
+		close();
+		return DISP_E_OVERFLOW;
+	}
+
+	mapping = CreateFileMappingW( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+	if( nullptr == mapping )
+	{
+		const HRESULT hr = getLastHr();
+		close();
+		return hr;
+	}
+
+	view = (const uint8_t*)MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+	if( nullptr == view )
+	{
+		const HRESULT hr = getLastHr();
+		close();
+		return hr;
+	}
+	length = (size_t)li.QuadPart;
+	return S_OK;
+}
+
+void MappedFile::close()
+{
+	if( nullptr != view )
+	{
+		UnmapViewOfFile( view );
+		view = nullptr;
+	}
+	length = 0;
+	if( nullptr != mapping )
+	{
+		CloseHandle( mapping );
+		mapping = nullptr;
+	}
+	if( INVALID_HANDLE_VALUE != file )
+	{
+		CloseHandle( file );
+		file = INVALID_HANDLE_VALUE;
+	}
+}
+
+HRESULT COMLIGHTCALL MappedReadStream::read( void* lpBuffer, int nNumberOfBytesToRead, int& lpNumberOfBytesRead )
+{
+	if( nNumberOfBytesToRead < 0 )
+		return E_INVALIDARG;
+	const size_t available = length - position;
+	const size_t cb = std::min( (size_t)nNumberOfBytesToRead, available );
+	memcpy( lpBuffer, begin + position, cb );
+	position += cb;
+	lpNumberOfBytesRead = (int)cb;
+	return S_OK;
+}
+
+HRESULT COMLIGHTCALL MappedReadStream::seek( int64_t offset, ComLight::eSeekOrigin origin )
+{
+	int64_t newPosition;
+	switch( origin )
+	{
+	case ComLight::eSeekOrigin::Begin:
+		newPosition = offset;
+		break;
+	case ComLight::eSeekOrigin::Current:
+		newPosition = (int64_t)position + offset;
+		break;
+	case ComLight::eSeekOrigin::End:
+		newPosition = (int64_t)length + offset;
+		break;
+	default:
+		return E_INVALIDARG;
+	}
+	if( newPosition < 0 || newPosition > (int64_t)length )
+		return E_BOUNDS;
+	position = (size_t)newPosition;
+	return S_OK;
+}
\ No newline at end of file
@@ -0,0 +1,85 @@
+#pragma once
+#include "../../ComLightLib/streams.h"
+#include "../../ComLightLib/comLightServer.h"
+
+// Read-only memory mapped file.
+// The pages come from the OS file cache: nothing is copied until the pages are accessed, and all processes which map the same file share the physical memory.
+class MappedFile
+{
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+	const uint8_t* view = nullptr;
+	size_t length = 0;
+
+public:
+	MappedFile() = default;
+	MappedFile( const MappedFile& ) = delete;
+	void operator=( const MappedFile& ) = delete;
+	MappedFile( MappedFile&& that ) noexcept
+	{
+		*this = std::move( that );
+	}
+	void operator=( MappedFile&& that ) noexcept
+	{
+		std::swap( file, that.file );
+		std::swap( mapping, that.mapping );
+		std::swap( view, that.view );
+		std::swap( length, that.length );
+	}
+	~MappedFile()
+	{
+		close();
+	}
+
+	HRESULT open( const wchar_t* path );
+	void close();
+
+	bool empty() const { return nullptr == view; }
+	const uint8_t* data() const { return view; }
+	size_t size() const { return length; }
+
+	// True when the specified range of bytes is within the file
+	bool contains( int64_t offset, size_t cb ) const
+	{
+		if( offset < 0 || (uint64_t)offset > length )
+			return false;
+		return cb <= length - (size_t)offset;
+	}
+};
+
+// Readonly stream over the memory mapped file, reads are memcpy from the mapped pages.
+// The stream doesn't own the mapping, the MappedFile object must outlive the stream.
+class MappedReadStream : public ComLight::ObjectRoot<ComLight::iReadStream>
+{
+	const uint8_t* begin = nullptr;
+	size_t length = 0;
+	size_t position = 0;
+
+	HRESULT COMLIGHTCALL read( void* lpBuffer, int nNumberOfBytesToRead, int& lpNumberOfBytesRead ) override final;
+	HRESULT COMLIGHTCALL seek( int64_t offset, ComLight::eSeekOrigin origin ) override final;
+	HRESULT COMLIGHTCALL getPosition( int64_t& pos ) override final
+	{
+		pos = (int64_t)position;
+		return S_OK;
+	}
+	HRESULT COMLIGHTCALL getLength( int64_t& len ) override final
+	{
+		len = (int64_t)length;
+		return S_OK;
+	}
+
+public:
+
+	void attach( const MappedFile& mf )
+	{
+		attach( mf.data(), mf.size() );
+	}
+
+	// Read a slice of the mapped file
+	void attach( const uint8_t* rsi, size_t cb )
+	{
+		begin = rsi;
+		length = cb;
+		position = 0;
+	}
+};
\ No newline at end of file
@@ -59,6 +59,7 @@ namespace
 			V( Decode );
 			V( DecodeStep );
 			V( DecodeLayer );
+			V( MelMaximum );
 #undef V
 		}
 		assert( false );
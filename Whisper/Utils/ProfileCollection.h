@@ -25,6 +25,8 @@ namespace Whisper
 		Decode,
 		DecodeStep,
 		DecodeLayer,
+		// The extra pass of iContext.runFull over the audio, to normalize the streamed spectrogram like the complete one
+		MelMaximum,
 	};
 
 	class ProfileCollection
@@ -34,12 +34,15 @@ namespace Tracing
 		return s_writer.get();
 	}
 
-	using Pair = std::pair<ItemName, ggml_tensor>;
+	using Pair = std::pair<ItemName, const ggml_tensor*>;
 	static std::vector<Pair> delayed;
 
 	void delayTensor( const ItemName& name, const ggml_tensor* tensor )
 	{
-		delayed.emplace_back( name, *tensor );
+		// With ggml_set_no_alloc(), the data is only placed by ggml_graph_alloc() later, and would be reused by the later nodes of the graph.
+		// Keep the pointer to read the data after the computation, the tensor objects live until the context is released.
+		ggml_set_output( const_cast<ggml_tensor*>( tensor ) );
+		delayed.emplace_back( name, tensor );
 	}
 
 	HRESULT writeDelayedTensors()
@@ -53,7 +56,7 @@ namespace Tracing
 			return S_FALSE;
 		}
 		for( const Pair& p : delayed )
-			w->tensor( p.first, p.second );
+			w->tensor( p.first, *p.second );
 		delayed.clear();
 		return S_OK;
 	}
@@ -0,0 +1,274 @@
+#include "stdafx.h"
+#include "ContextImpl.h"
+#include "SegmentState.h"
+#include "../API/iMediaFoundation.cl.h"
+using namespace Whisper;
+
+// Transcription state of one audio buffer in the batch
+struct ContextImpl::BatchStream
+{
+	Spectrogram mel;
+	int64_t mediaTimeOffset = 0;
+	int seek = 0;
+	int seekEnd = 0;
+	std::vector<whisper_token> promptPast;
+	std::vector<Segment> segments;
+
+	// Decoder state for the current window of audio
+	SegmentRules rules;
+	SegmentState state;
+	int n_past = 0;
+	// Index of the probabilities row in the output of the last decoder step
+	size_t outputRow = 0;
+	eSegmentStatus status = eSegmentStatus::Finished;
+
+	bool hasAudio() const
+	{
+		return seek + 100 < seekEnd;
+	}
+};
+
+HRESULT COMLIGHTCALL ContextImpl::runBatch( const sFullParams& params, uint32_t count, const iAudioBuffer* const* buffers, eResultFlags flags, iTranscribeResult** results )
+{
+	if( nullptr == buffers || nullptr == results )
+		return E_POINTER;
+	if( 0 == count )
+		return S_FALSE;
+	if( params.flag( eFullParamsFlags::TokenTimestamps ) || params.flag( eFullParamsFlags::SpeedupAudio ) )
+	{
+		logError( u8"TokenTimestamps and SpeedupAudio flags are not supported in batch mode" );
+		return E_NOTIMPL;
+	}
+	for( uint32_t i = 0; i < count; i++ )
+		results[ i ] = nullptr;
+
+	auto ts = device.setForCurrentThread();
+	auto profCompleteCpu = profiler.cpuBlock( eCpuBlock::RunComplete );
+	const Whisper::Vocabulary& vocab = model.shared->vocab;
+	const size_t n_vocab = (size_t)vocab.n_vocab;
+
+	// Every stream needs a KV cache slot for the decoder, and another one for the output of the encoder
+	{
+		const HRESULT hr = context.createSlots( count, count );
+		if( hr == E_NOTIMPL )
+			logError( u8"GPU model doesn't implement batched transcription" );
+		CHECK( hr );
+	}
+	exp_n_audio_ctx = params.audio_ctx;
+
+	std::vector<whisper_token> prompt_init;
+	CHECK( makeInitialPrompt( params, prompt_init ) );
+
+	std::vector<BatchStream> streams;
+	try
+	{
+		streams.resize( count );
+		for( uint32_t i = 0; i < count; i++ )
+		{
+			BatchStream& s = streams[ i ];
+			const iAudioBuffer* buffer = buffers[ i ];
+			if( nullptr == buffer )
+				return E_POINTER;
+			CHECK( buffer->getTime( s.mediaTimeOffset ) );
+			{
+				auto p = profiler.cpuBlock( eCpuBlock::Spectrogram );
+				CHECK( s.mel.pcmToMel( buffer, model.shared->filters, params.cpuThreads ) );
+			}
+
+			s.seek = params.offset_ms / 10;
+			s.seekEnd = s.seek + ( params.duration_ms == 0 ? (int)s.mel.getLength() : params.duration_ms / 10 );
+			if( params.prompt_tokens && params.prompt_n_tokens > 0 )
+				s.promptPast.assign( params.prompt_tokens, params.prompt_tokens + params.prompt_n_tokens );
+
+			s.rules.token_beg = vocab.token_beg;
+			s.rules.token_eot = vocab.token_eot;
+			s.rules.max_tokens = params.max_tokens;
+			s.rules.singleSegment = params.flag( eFullParamsFlags::SingleSegment );
+		}
+	}
+	catch( const std::bad_alloc& )
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	// The segments are appended to result_all by storeSegments(), which is not supposed to call anything in this mode
+	sFullParams storeParams = params;
+	storeParams.new_segment_callback = nullptr;
+	storeParams.new_segment_callback_user_data = nullptr;
+
+	std::vector<int> tokens;
+	std::vector<DirectCompute::sBatchRow> rows;
+	std::vector<whisper_token> prompt;
+	std::vector<float> prefillProbs;
+	const int n_max = model.parameters.n_text_ctx / 2 - 4;
+
+	auto prof = context.completeProfiler();
+	try
+	{
+		while( true )
+		{
+			// Encode the next window of every stream which has audio left, into the cross-attention slot of that stream
+			bool any = false;
+			for( uint32_t j = 0; j < count; j++ )
+			{
+				BatchStream& s = streams[ j ];
+				if( !s.hasAudio() )
+				{
+					s.status = eSegmentStatus::Finished;
+					continue;
+				}
+				CHECK( encode( s.mel, s.seek, params.cpuThreads, j ) );
+				s.status = eSegmentStatus::Active;
+				s.state.clear();
+				s.rules.seek = s.seek;
+				s.rules.seek_end = s.seekEnd;
+				any = true;
+			}
+			if( !any )
+				break;
+
+			{
+				// Measure "Decode" profiler value, both CPU and GPU times
+				auto profDecode = context.decodeProfiler();
+				// Prefill the prompts of the active streams, same prompt as in runFullImpl().
+				// Complete prompts are packed into decoder calls of at most n_text_ctx rows, the decoder arenas are sized for that.
+				// Only the last row of every prompt computes the probabilities, the output rows of all calls are collected in prefillProbs.
+				const size_t maxRows = (size_t)model.parameters.n_text_ctx;
+				size_t outputRows = 0;
+				prefillProbs.clear();
+				tokens.clear();
+				rows.clear();
+				auto prefill = [ & ]() -> HRESULT
+				{
+					if( rows.empty() )
+						return S_OK;
+					CHECK( decodeBatch( tokens.data(), rows.data(), rows.size(), params.cpuThreads ) );
+					prefillProbs.insert( prefillProbs.end(), probs.begin(), probs.end() );
+					tokens.clear();
+					rows.clear();
+					return S_OK;
+				};
+
+				for( uint32_t j = 0; j < count; j++ )
+				{
+					BatchStream& s = streams[ j ];
+					if( s.status != eSegmentStatus::Active )
+						continue;
+
+					prompt.clear();
+					if( !s.promptPast.empty() )
+					{
+						const int n_take = std::min( std::min( params.n_max_text_ctx, model.parameters.n_text_ctx / 2 ), int( s.promptPast.size() ) );
+						s.promptPast.erase( s.promptPast.begin(), s.promptPast.end() - n_take );
+						prompt.push_back( vocab.token_prev );
+						prompt.insert( prompt.end(), s.promptPast.begin(), s.promptPast.end() );
+					}
+					prompt.insert( prompt.end(), prompt_init.begin(), prompt_init.end() );
+
+					if( rows.size() + prompt.size() > maxRows )
+						CHECK( prefill() );
+					for( size_t k = 0; k < prompt.size(); k++ )
+					{
+						tokens.push_back( prompt[ k ] );
+						rows.push_back( DirectCompute::sBatchRow{ j, j, (uint32_t)k, k + 1 == prompt.size() } );
+					}
+					s.n_past = (int)prompt.size();
+					s.outputRow = outputRows++;
+				}
+				CHECK( prefill() );
+				probs.swap( prefillProbs );
+
+				// Lockstep decoding, one token of every active stream per decoder step.
+				// The streams leave the batch as soon as they reach the end of their segment.
+				for( int i = 0; i < n_max; i++ )
+				{
+					if( i > 0 )
+					{
+						tokens.clear();
+						rows.clear();
+						for( uint32_t j = 0; j < count; j++ )
+						{
+							BatchStream& s = streams[ j ];
+							if( s.status != eSegmentStatus::Active )
+								continue;
+							s.outputRow = rows.size();
+							tokens.push_back( s.state.tokens.back().id );
+							rows.push_back( DirectCompute::sBatchRow{ j, j, (uint32_t)s.n_past } );
+							s.n_past++;
+						}
+						if( rows.empty() )
+							break;
+						CHECK( decodeBatch( tokens.data(), rows.data(), rows.size(), params.cpuThreads ) );
+					}
+
+					auto p = profiler.cpuBlock( eCpuBlock::Sample );
+					for( BatchStream& s : streams )
+					{
+						if( s.status != eSegmentStatus::Active )
+							continue;
+						const float* rsi = probs.data() + s.outputRow * n_vocab;
+						const sTokenData token = sampleBest( rsi, i == 0, i == 0 );
+						s.status = s.rules.append( s.state, token, i );
+
+						// sometimes, the decoding can get stuck in a repetition loop
+						if( s.status == eSegmentStatus::Active && i == n_max - 1 )
+							s.status = SegmentRules::acceptIncomplete( s.state ) ? eSegmentStatus::Finished : eSegmentStatus::Failed;
+					}
+				}
+			}
+
+			// Store the text of the decoded windows, and advance the streams
+			for( BatchStream& s : streams )
+			{
+				if( !s.hasAudio() )
+					continue;
+				if( s.status == eSegmentStatus::Failed )
+				{
+					logError( u8"%s: failed to generate timestamp token - skipping one second", __func__ );
+					s.seek += 100;
+					continue;
+				}
+
+				std::vector<sTokenData>& tokens_cur = s.state.tokens;
+				tokens_cur.resize( s.state.resultLength );
+				for( const auto& r : tokens_cur )
+					s.promptPast.push_back( r.id );
+
+				result_all.swap( s.segments );
+				const HRESULT hr = storeSegments( storeParams, s.seek, s.state.seekDelta, tokens_cur );
+				result_all.swap( s.segments );
+				CHECK( hr );
+				s.seek += s.state.seekDelta;
+			}
+		}
+	}
+	catch( HRESULT hr )
+	{
+		return hr;
+	}
+	catch( const std::bad_alloc& )
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	// Produce the result objects, makeResults() consumes result_all and mediaTimeOffset fields of this class
+	std::vector<ComLight::CComPtr<ComLight::Object<TranscribeResult>>> objects( count );
+	HRESULT hr = S_OK;
+	const int64_t prevOffset = mediaTimeOffset;
+	for( uint32_t j = 0; j < count && SUCCEEDED( hr ); j++ )
+	{
+		hr = ComLight::Object<TranscribeResult>::create( objects[ j ] );
+		if( FAILED( hr ) )
+			break;
+		result_all.swap( streams[ j ].segments );
+		mediaTimeOffset = streams[ j ].mediaTimeOffset;
+		hr = makeResults( flags, *objects[ j ], true );
+		result_all.swap( streams[ j ].segments );
+	}
+	mediaTimeOffset = prevOffset;
+	CHECK( hr );
+
+	for( uint32_t j = 0; j < count; j++ )
+		objects[ j ].detach( &results[ j ] );
+	return S_OK;
+}
\ No newline at end of file
@@ -0,0 +1,176 @@
+#include "stdafx.h"
+#include "ContextImpl.h"
+#include "SegmentState.h"
+#include <cmath>
+using namespace Whisper;
+
+namespace
+{
+	struct Beam
+	{
+		SegmentState state;
+		// Sum of natural logarithms of the probabilities of the tokens
+		double sumLogProbs = 0;
+		// Index of the KV cache slot
+		uint32_t slot = 0;
+
+		// Length-normalized score, to compare finished beams of different lengths
+		double score() const
+		{
+			const size_t len = std::max( state.tokens.size(), (size_t)1 );
+			return sumLogProbs / (double)len;
+		}
+	};
+
+	// A possible continuation of one of the active beams
+	struct Candidate
+	{
+		uint32_t parent;
+		sTokenData token;
+		double sumLogProbs;
+	};
+}
+
+HRESULT ContextImpl::beamSearch( const sFullParams& params, const std::vector<whisper_token>& prompt, int seek, int seek_end,
+	std::vector<sTokenData>& tokens_cur, int& seek_delta, int& result_len, bool& failed )
+{
+	const Vocabulary& vocab = model.shared->vocab;
+	const size_t n_vocab = (size_t)vocab.n_vocab;
+	const uint32_t beamWidth = (uint32_t)params.beam_search.beam_width;
+	// Stop after collecting that many finished hypotheses
+	const size_t bestOf = (size_t)std::clamp( params.beam_search.n_best, 1, (int)beamWidth );
+
+	SegmentRules ws;
+	ws.token_beg = vocab.token_beg;
+	ws.token_eot = vocab.token_eot;
+	ws.seek = seek;
+	ws.seek_end = seek_end;
+	ws.max_tokens = params.max_tokens;
+	ws.singleSegment = params.flag( eFullParamsFlags::SingleSegment );
+
+	// The prompt goes into KV slot #0, the first token is sampled from the last row of the output
+	CHECK( decode( prompt.data(), prompt.size(), 0, params.cpuThreads ) );
+	int n_past = (int)prompt.size();
+
+	std::vector<Beam> active( 1 ), next, finished;
+	std::vector<Candidate> candidates;
+	std::vector<sTokenData> top;
+	std::vector<uint32_t> parents;
+	std::vector<DirectCompute::sBatchRow> rows;
+	std::vector<int> tokens;
+	std::vector<uint8_t> slotBusy, parentInherited;
+
+	const int n_max = model.parameters.n_text_ctx / 2 - 4;
+	int i;
+	for( i = 0; i < n_max; i++ )
+	{
+		if( i > 0 )
+		{
+			// Decode the last token of all active beams in a single batch
+			tokens.clear();
+			rows.clear();
+			for( const Beam& b : active )
+			{
+				tokens.push_back( b.state.tokens.back().id );
+				rows.push_back( DirectCompute::sBatchRow{ b.slot, 0, (uint32_t)n_past } );
+			}
+			CHECK( decodeBatch( tokens.data(), rows.data(), active.size(), params.cpuThreads ) );
+			n_past++;
+		}
+
+		auto p = profiler.cpuBlock( eCpuBlock::Sample );
+
+		// Collect beamWidth + 1 continuations of every active beam, the extra one replaces a continuation which finishes the beam
+		candidates.clear();
+		for( uint32_t b = 0; b < (uint32_t)active.size(); b++ )
+		{
+			const float* rsi = ( i == 0 ) ? probs.data() + ( probs.size() - n_vocab ) : probs.data() + b * n_vocab;
+			sampleTop( rsi, i == 0, i == 0, beamWidth + 1, top );
+			for( const sTokenData& t : top )
+				candidates.push_back( Candidate{ b, t, active[ b ].sumLogProbs + std::log( (double)t.p ) } );
+		}
+		std::sort( candidates.begin(), candidates.end(), []( const Candidate& a, const Candidate& b )
+			{
+				return a.sumLogProbs > b.sumLogProbs;
+			} );
+
+		// Advance the most probable continuations
+		next.clear();
+		parents.clear();
+		for( const Candidate& c : candidates )
+		{
+			if( next.size() >= beamWidth )
+				break;
+			Beam beam = active[ c.parent ];
+			const size_t length = beam.state.tokens.size();
+			const eSegmentStatus status = ws.append( beam.state, c.token, i );
+			if( beam.state.tokens.size() != length )
+				beam.sumLogProbs = c.sumLogProbs;
+
+			if( status == eSegmentStatus::Finished )
+				finished.emplace_back( std::move( beam ) );
+			else if( status == eSegmentStatus::Active )
+			{
+				next.emplace_back( std::move( beam ) );
+				parents.push_back( c.parent );
+			}
+		}
+
+		if( finished.size() >= bestOf || next.empty() )
+			break;
+
+		// Copy-on-write forking of the KV cache: the first child of every beam inherits the slot of the parent,
+		// the rest of the children copy the history into the slots released by the beams which have no continuations
+		slotBusy.assign( beamWidth, 0 );
+		parentInherited.assign( active.size(), 0 );
+		for( size_t j = 0; j < next.size(); j++ )
+		{
+			const uint32_t parent = parents[ j ];
+			if( 0 != parentInherited[ parent ] )
+			{
+				next[ j ].slot = UINT_MAX;
+				continue;
+			}
+			parentInherited[ parent ] = 1;
+			next[ j ].slot = active[ parent ].slot;
+			slotBusy[ next[ j ].slot ] = 1;
+		}
+		uint32_t freeSlot = 0;
+		for( size_t j = 0; j < next.size(); j++ )
+		{
+			if( next[ j ].slot != UINT_MAX )
+				continue;
+			while( 0 != slotBusy[ freeSlot ] )
+				freeSlot++;
+			slotBusy[ freeSlot ] = 1;
+			CHECK( context.forkBeam( freeSlot, active[ parents[ j ] ].slot, (uint32_t)n_past ) );
+			next[ j ].slot = freeSlot;
+		}
+
+		active.swap( next );
+	}
+
+	if( i >= n_max )
+	{
+		for( Beam& b : active )
+			if( SegmentRules::acceptIncomplete( b.state ) )
+				finished.emplace_back( std::move( b ) );
+	}
+
+	if( finished.empty() )
+	{
+		failed = true;
+		return S_OK;
+	}
+
+	const Beam* best = &finished[ 0 ];
+	for( const Beam& b : finished )
+		if( b.score() > best->score() )
+			best = &b;
+
+	tokens_cur = best->state.tokens;
+	seek_delta = best->state.seekDelta;
+	result_len = best->state.resultLength;
+	failed = false;
+	return S_OK;
+}
\ No newline at end of file
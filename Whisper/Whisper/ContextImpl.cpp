@@ -2,6 +2,7 @@
 #include "ContextImpl.h"
 #include "Languages.h"
 #include "../Utils/Trace/tracing.h"
+#include <immintrin.h>
 using namespace Whisper;
 
 ContextImpl::ContextImpl( const DirectCompute::Device& dev, const WhisperModel& modelData, iModel* modelPointer ) :
@@ -12,9 +13,7 @@ ContextImpl::ContextImpl( const DirectCompute::Device& dev, const WhisperModel&
 	profiler( modelData )
 { }
 
-#define WHISPER_CHUNK_SIZE  30
-
-HRESULT ContextImpl::encode( iSpectrogram& mel, int seek )
+HRESULT ContextImpl::encode( iSpectrogram& mel, int seek, int threads, uint32_t crossSlot )
 {
 	auto prof = profiler.cpuBlock( eCpuBlock::Encode );
 	// whisper_encode
@@ -33,7 +32,7 @@ HRESULT ContextImpl::encode( iSpectrogram& mel, int seek )
 	ep.n_text_ctx = model.parameters.n_text_ctx;
 	try
 	{
-		auto cur = context.encode( mel, ep );
+		auto cur = context.encode( mel, ep, threads, crossSlot );
 		Tracing::tensor( "encode-out", cur );
 		return S_OK;
 	}
@@ -43,11 +42,9 @@ HRESULT ContextImpl::encode( iSpectrogram& mel, int seek )
 	}
 }
 
-HRESULT ContextImpl::decode( const int* tokens, size_t length, int n_past, int threads )
+DirectCompute::sDecodeParams ContextImpl::decodeParams( int n_past ) const
 {
-	// whisper_decode
-	using namespace DirectCompute;
-	sDecodeParams dp;
+	DirectCompute::sDecodeParams dp;
 	dp.n_state = model.parameters.n_audio_state;
 	dp.n_head = model.parameters.n_audio_head;
 	dp.n_ctx = model.parameters.n_text_ctx;
@@ -55,7 +52,15 @@ HRESULT ContextImpl::decode( const int* tokens, size_t length, int n_past, int t
 	dp.M = exp_n_audio_ctx > 0 ? exp_n_audio_ctx : model.parameters.n_audio_ctx;
 	dp.n_text_layer = model.parameters.n_text_layer;
 	dp.n_vocab = model.parameters.n_vocab;
+	dp.allRows = false;
+	return dp;
+}
 
+HRESULT ContextImpl::decode( const int* tokens, size_t length, int n_past, int threads, bool allRows )
+{
+	// whisper_decode
+	DirectCompute::sDecodeParams dp = decodeParams( n_past );
+	dp.allRows = allRows;
 	try
 	{
 		context.decode( tokens, (int)length, dp, probs, threads );
@@ -67,101 +72,323 @@ HRESULT ContextImpl::decode( const int* tokens, size_t length, int n_past, int t
 	}
 }
 
-// the most basic sampling scheme - select the top token
-sTokenData ContextImpl::sampleBest( const float* probs, bool force_timestamp, bool is_initial )
+HRESULT ContextImpl::decodeBatch( const int* tokens, const DirectCompute::sBatchRow* rows, size_t countRows, int threads )
 {
-	// whisper_sample_best
-	const Vocabulary& vocab = model.shared->vocab;
-	sTokenData result = { 0 };
-
-	size_t n_logits = vocab.size();
-
-	probs_id.clear();
-	probs_id.reserve( n_logits );
-
-	for( size_t i = 0; i < n_logits; i++ )
-		probs_id.emplace_back( probs[ i ], (int)i );
-
+	const DirectCompute::sDecodeParams dp = decodeParams( 0 );
+	try
 	{
-		double sum_ts = 0.0;
-		double max_ts = -1.0;
-		double max_tx = -1.0;
-
-		for( int i = 0; i < vocab.token_beg; i++ )
-			max_tx = std::max( max_tx, probs_id[ i ].first );
-
-		const int i0 = is_initial ? vocab.token_beg + 101 : vocab.token_beg;
-		const int i1 = is_initial ? vocab.token_beg + 101 : (int)n_logits;
+		context.decodeBatch( tokens, rows, (int)countRows, dp, probs, threads );
+		return S_OK;
+	}
+	catch( HRESULT hr )
+	{
+		return hr;
+	}
+}
 
-		// the initial timestamp cannot be larger than 100
-		// ref: https://github.com/openai/whisper/blob/0b1ba3d46ebf7fe6f953acfd8cad62a4f851b49f/whisper/decoding.py#L426-L429
-		if( is_initial )
+namespace
+{
+	// Value and index of the maximum element in [ begin, end ), the first one when there're several of them
+	// The indices are tracked in float lanes, they're exact for the vocabulary sizes way below 2^24
+	inline float argmax( const float* rsi, int begin, int end, int& index )
+	{
+		float maxValue = -INFINITY;
+		index = begin;
+		int i = begin;
+		if( end - begin >= 8 )
 		{
-			for( int i = i0; i < n_logits; i++ )
-				probs_id[ i ].first = -INFINITY;
+			__m256 idx = _mm256_add_ps( _mm256_set1_ps( (float)i ), _mm256_setr_ps( 0, 1, 2, 3, 4, 5, 6, 7 ) );
+			__m256 maxIdx = idx;
+			__m256 maxVec = _mm256_loadu_ps( rsi + i );
+			const __m256 inc = _mm256_set1_ps( 8 );
+			for( i += 8; i + 8 <= end; i += 8 )
+			{
+				idx = _mm256_add_ps( idx, inc );
+				const __m256 v = _mm256_loadu_ps( rsi + i );
+				const __m256 gt = _mm256_cmp_ps( v, maxVec, _CMP_GT_OQ );
+				maxVec = _mm256_blendv_ps( maxVec, v, gt );
+				maxIdx = _mm256_blendv_ps( maxIdx, idx, gt );
+			}
+
+			// Reduce the lanes into the maximum value, and the smallest index among the lanes with that value
+			alignas( 32 ) std::array<float, 8> values, indices;
+			_mm256_store_ps( values.data(), maxVec );
+			_mm256_store_ps( indices.data(), maxIdx );
+			maxValue = values[ 0 ];
+			index = (int)indices[ 0 ];
+			for( int j = 1; j < 8; j++ )
+			{
+				const int ji = (int)indices[ j ];
+				if( values[ j ] > maxValue || ( values[ j ] == maxValue && ji < index ) )
+				{
+					maxValue = values[ j ];
+					index = ji;
+				}
+			}
 		}
 
-		for( int i = vocab.token_beg; i < i1; i++ )
+		for( ; i < end; i++ )
 		{
-			sum_ts += probs_id[ i ].first;
-			if( probs_id[ i ].first > max_ts )
+			if( rsi[ i ] > maxValue )
 			{
-				max_ts = probs_id[ i ].first;
-				result.tid = probs_id[ i ].second;
+				maxValue = rsi[ i ];
+				index = i;
 			}
 		}
+		return maxValue;
+	}
 
-		// if the probability sum of all timestamp tokens is higher than the max probability of the text tokens - sample a
-		// timestamp token
-		if( sum_ts > max_tx || force_timestamp )
+	// Insert the tokens with probability above the smallest one in rdi, keeping rdi sorted in descending order, with at most `count` elements
+	// The AVX comparison skips complete blocks of 8 tokens below the threshold, that's nearly all of them
+	inline void topK( const float* rsi, int begin, int end, size_t count, const sTokenData& ts, std::vector<sTokenData>& rdi )
+	{
+		auto threshold = [ & ]() { return rdi.size() < count ? 0.0f : rdi.back().p; };
+		auto insert = [ & ]( int i )
 		{
-			// ref: https://github.com/openai/whisper/blob/0b1ba3d46ebf7fe6f953acfd8cad62a4f851b49f/whisper/decoding.py#L430-L438
-			for( int i = 0; i < vocab.token_beg; i++ )
-				probs_id[ i ].first = -INFINITY;
+			const float p = rsi[ i ];
+			if( !( p > threshold() ) )
+				return;
+			auto it = std::upper_bound( rdi.begin(), rdi.end(), p, []( float val, const sTokenData& e ) { return val > e.p; } );
+			sTokenData& token = *rdi.insert( it, ts );
+			token.id = i;
+			token.p = p;
+			if( rdi.size() > count )
+				rdi.pop_back();
+		};
+
+		int i = begin;
+		for( ; i + 8 <= end; i += 8 )
+		{
+			const __m256 v = _mm256_loadu_ps( rsi + i );
+			const __m256 gt = _mm256_cmp_ps( v, _mm256_set1_ps( threshold() ), _CMP_GT_OQ );
+			if( 0 == _mm256_movemask_ps( gt ) )
+				continue;
+			for( int j = 0; j < 8; j++ )
+				insert( i + j );
 		}
+		for( ; i < end; i++ )
+			insert( i );
+	}
+
+	// Ranges of the text tokens [ 0, token_beg ) without the special ones which are never sampled, returns count of the ranges
+	inline size_t textRanges( const Vocabulary& vocab, std::array<std::pair<int, int>, 4>& rdi )
+	{
+		std::array<int, 3> special = { vocab.token_sot, vocab.token_solm, vocab.token_not };
+		std::sort( special.begin(), special.end() );
 
-		result.pt = (float)( max_ts / ( sum_ts + 1e-10 ) );
-		result.ptsum = (float)sum_ts;
+		size_t count = 0;
+		int begin = 0;
+		for( int s : special )
+		{
+			if( s < begin || s >= vocab.token_beg )
+				continue;
+			if( s > begin )
+				rdi[ count++ ] = std::make_pair( begin, s );
+			begin = s + 1;
+		}
+		if( vocab.token_beg > begin )
+			rdi[ count++ ] = std::make_pair( begin, vocab.token_beg );
+		return count;
 	}
+}
 
-	// find the top K tokens
-	const int top_k = 4;
+// Apply the timestamp rules of whisper_sample_best, without copying the probabilities
+// Returns partially filled token data with tid, pt and ptsum fields. The id and p fields receive the most probable text token,
+// id is -1 when the rules suppress the text tokens. The maxTimestamp receives the probability of the tid token.
+sTokenData ContextImpl::applyTimestampRules( const float* probs, bool force_timestamp, bool is_initial, float& maxTimestamp )
+{
+	const Vocabulary& vocab = model.shared->vocab;
+	sTokenData result = { 0 };
 
-	std::partial_sort(
-		probs_id.begin(),
-		probs_id.begin() + top_k, probs_id.end(),
-		[]( const std::pair<double, Vocabulary::id>& a, const std::pair<double, Vocabulary::id>& b ) {
-			return a.first > b.first;
-		} );
+	// The special tokens participate in max_tx, but they are never sampled
+	std::array<std::pair<int, int>, 4> ranges;
+	const size_t countRanges = textRanges( vocab, ranges );
+	float bestText = -INFINITY;
+	int bestTextId = -1;
+	for( size_t r = 0; r < countRanges; r++ )
+	{
+		int idx;
+		const float p = argmax( probs, ranges[ r ].first, ranges[ r ].second, idx );
+		if( p > bestText || bestTextId < 0 )
+		{
+			bestText = p;
+			bestTextId = idx;
+		}
+	}
 
-	probs_id.resize( top_k );
+	double max_tx = -1.0;
+	if( vocab.token_beg > 0 )
+	{
+		max_tx = std::max( max_tx, (double)bestText );
+		for( int s : { vocab.token_sot, vocab.token_solm, vocab.token_not } )
+			if( s >= 0 && s < vocab.token_beg )
+				max_tx = std::max( max_tx, (double)probs[ s ] );
+	}
 
-	//printf("\n");
-	//for (int i = 0; i < (int) probs_id.size(); i++) {
-	//    printf("%d: '%s' %f, %d\n", i, vocab.id_to_token.at(probs_id[i].second).c_str(), probs_id[i].first, probs_id[i].second);
-	//}
+	// the initial timestamp cannot be larger than 100
+	// ref: https://github.com/openai/whisper/blob/0b1ba3d46ebf7fe6f953acfd8cad62a4f851b49f/whisper/decoding.py#L426-L429
+	const int i1 = is_initial ? vocab.token_beg + 101 : (int)vocab.size();
 
-	int res = 0;
-	while( ( probs_id[ res ].second == vocab.token_sot ||
-		probs_id[ res ].second == vocab.token_solm ||
-		probs_id[ res ].second == vocab.token_not ) &&
-		res < (int)probs_id.size() - 1 )
+	// Sequential sum in doubles, a short range of the vocabulary
+	double sum_ts = 0.0;
+	double max_ts = -1.0;
+	for( int i = vocab.token_beg; i < i1; i++ )
 	{
-		res++;
+		sum_ts += probs[ i ];
+		if( probs[ i ] > max_ts )
+		{
+			max_ts = probs[ i ];
+			result.tid = i;
+		}
 	}
 
-	result.id = probs_id[ res ].second;
-	result.p = (float)probs_id[ res ].first;
+	// if the probability sum of all timestamp tokens is higher than the max probability of the text tokens - sample a
+	// timestamp token
+	// ref: https://github.com/openai/whisper/blob/0b1ba3d46ebf7fe6f953acfd8cad62a4f851b49f/whisper/decoding.py#L430-L438
+	if( sum_ts > max_tx || force_timestamp )
+		bestTextId = -1;
+
+	result.id = bestTextId;
+	result.p = bestText;
+	result.pt = (float)( max_ts / ( sum_ts + 1e-10 ) );
+	result.ptsum = (float)sum_ts;
+	maxTimestamp = (float)max_ts;
+	return result;
+}
 
+// the most basic sampling scheme - select the top token
+sTokenData ContextImpl::sampleBest( const float* probs, bool force_timestamp, bool is_initial )
+{
+	// whisper_sample_best
+	float maxTimestamp;
+	sTokenData result = applyTimestampRules( probs, force_timestamp, is_initial, maxTimestamp );
+
+	// The most probable token is either the best text one, or the best timestamp
+	if( result.id < 0 || !( result.p > maxTimestamp ) )
+	{
+		result.id = result.tid;
+		result.p = maxTimestamp;
+	}
 	return result;
 }
 
+void ContextImpl::sampleTop( const float* probs, bool force_timestamp, bool is_initial, size_t count, std::vector<sTokenData>& rdi )
+{
+	const Vocabulary& vocab = model.shared->vocab;
+	float maxTimestamp;
+	sTokenData ts = applyTimestampRules( probs, force_timestamp, is_initial, maxTimestamp );
+	const bool textTokens = ts.id >= 0;
+	ts.id = 0;
+	ts.p = 0;
+
+	rdi.clear();
+	if( 0 == count )
+		return;
+	rdi.reserve( count + 1 );
+
+	if( textTokens )
+	{
+		std::array<std::pair<int, int>, 4> ranges;
+		const size_t countRanges = textRanges( vocab, ranges );
+		for( size_t r = 0; r < countRanges; r++ )
+			topK( probs, ranges[ r ].first, ranges[ r ].second, count, ts, rdi );
+	}
+	const int i1 = is_initial ? vocab.token_beg + 101 : (int)vocab.size();
+	topK( probs, vocab.token_beg, i1, count, ts, rdi );
+}
+
 sTokenData ContextImpl::sampleBest()
 {
 	const int n_vocab = model.shared->vocab.n_vocab;
 	return sampleBest( probs.data() + ( probs.size() - n_vocab ), false, false );
 }
 
+HRESULT ContextImpl::decodeSample( const int* tokens, size_t length, int n_past, int threads, bool force_timestamp, bool is_initial, sTokenData& result )
+{
+	if( !context.isHybrid() )
+	{
+		CHECK( decode( tokens, length, n_past, threads ) );
+		auto p = profiler.cpuBlock( eCpuBlock::Sample );
+		const int n_vocab = model.shared->vocab.n_vocab;
+		result = sampleBest( probs.data() + ( probs.size() - n_vocab ), force_timestamp, is_initial );
+		return S_OK;
+	}
+
+	const DirectCompute::sSampleRules rules = sampleRules( force_timestamp, is_initial );
+	const DirectCompute::sDecodeParams dp = decodeParams( n_past );
+	DirectCompute::sSampledToken st;
+	try
+	{
+		context.decodeSample( tokens, (int)length, dp, rules, &st, threads );
+	}
+	catch( HRESULT hr )
+	{
+		return hr;
+	}
+
+	result = makeTokenData( st );
+	return S_OK;
+}
+
+HRESULT ContextImpl::decodeSampleRows( const int* tokens, size_t length, int n_past, int threads, std::vector<sTokenData>& rdi )
+{
+	if( !context.isHybrid() )
+	{
+		CHECK( decode( tokens, length, n_past, threads, true ) );
+		auto p = profiler.cpuBlock( eCpuBlock::Sample );
+		const int n_vocab = model.shared->vocab.n_vocab;
+		if( probs.size() != length * n_vocab )
+			return E_UNEXPECTED;
+		rdi.resize( length );
+		for( size_t i = 0; i < length; i++ )
+			rdi[ i ] = sampleBest( probs.data() + i * n_vocab, false, false );
+		return S_OK;
+	}
+
+	const DirectCompute::sSampleRules rules = sampleRules( false, false );
+	DirectCompute::sDecodeParams dp = decodeParams( n_past );
+	dp.allRows = true;
+	sampledRows.resize( length );
+	try
+	{
+		context.decodeSample( tokens, (int)length, dp, rules, sampledRows.data(), threads );
+	}
+	catch( HRESULT hr )
+	{
+		return hr;
+	}
+
+	rdi.resize( length );
+	for( size_t i = 0; i < length; i++ )
+		rdi[ i ] = makeTokenData( sampledRows[ i ] );
+	return S_OK;
+}
+
+DirectCompute::sSampleRules ContextImpl::sampleRules( bool force_timestamp, bool is_initial ) const
+{
+	// Same rules as in applyTimestampRules() and sampleBest()
+	const Vocabulary& vocab = model.shared->vocab;
+	DirectCompute::sSampleRules rules;
+	rules.timestampBegin = (uint32_t)vocab.token_beg;
+	rules.timestampEnd = is_initial ? (uint32_t)vocab.token_beg + 101 : (uint32_t)vocab.size();
+	rules.suppress[ 0 ] = vocab.token_sot;
+	rules.suppress[ 1 ] = vocab.token_solm;
+	rules.suppress[ 2 ] = vocab.token_not;
+	rules.forceTimestamp = force_timestamp;
+	return rules;
+}
+
+sTokenData ContextImpl::makeTokenData( const DirectCompute::sSampledToken& st )
+{
+	sTokenData result = sTokenData{ 0 };
+	result.id = st.id;
+	result.tid = st.tid;
+	result.p = st.p;
+	result.pt = st.pt;
+	result.ptsum = st.ptsum;
+	return result;
+}
+
 sTokenData ContextImpl::sampleTimestamp( bool initial )
 {
 	const int n_vocab = model.shared->vocab.n_vocab;
@@ -449,6 +676,134 @@ public:
 	}
 };
 
+HRESULT ContextImpl::makeInitialPrompt( const sFullParams& params, std::vector<whisper_token>& prompt_init ) const
+{
+	const Whisper::Vocabulary& vocab = model.shared->vocab;
+	prompt_init = { vocab.token_sot };
+	if( vocab.is_multilingual() )
+	{
+		int langId = lookupLanguageId( params.language );
+		if( langId < 0 )
+		{
+			char lang[ 5 ];
+			*(uint32_t*)( &lang[ 0 ] ) = params.language;
+			lang[ 4 ] = '\0';
+			logError( u8"%s: unknown language '%s'", __func__, lang );
+			return E_INVALIDARG;
+		}
+
+		prompt_init.push_back( vocab.token_sot + 1 + langId );
+		if( params.flag( eFullParamsFlags::Translate ) )
+			prompt_init.push_back( vocab.token_translate );
+		else
+			prompt_init.push_back( vocab.token_transcribe );
+	}
+	return S_OK;
+}
+
+// Append segments decoded from a window of audio to result_all, and invoke the new segment callback
+HRESULT ContextImpl::storeSegments( const sFullParams& params, int seek, int seek_delta, const std::vector<sTokenData>& tokens_cur )
+{
+	if( tokens_cur.empty() )
+		return S_OK;
+
+	const Whisper::Vocabulary& vocab = model.shared->vocab;
+	int i0 = 0;
+	int t0 = seek + 2 * ( tokens_cur.front().tid - vocab.token_beg );
+	std::string text = "";
+
+	for( int i = 0; i < (int)tokens_cur.size(); i++ )
+	{
+		//printf("%s: %18s %6.3f %18s %6.3f\n", __func__,
+		//        ctx->vocab.id_to_token[tokens_cur[i].id].c_str(), tokens_cur[i].p,
+		//        ctx->vocab.id_to_token[tokens_cur[i].tid].c_str(), tokens_cur[i].pt);
+		if( params.flag( eFullParamsFlags::PrintSpecial ) || tokens_cur[ i ].id < vocab.token_eot )
+			text += vocab.string( tokens_cur[ i ].id );
+
+		if( tokens_cur[ i ].id > vocab.token_beg && !params.flag( eFullParamsFlags::SingleSegment ) )
+		{
+			const int t1 = seek + 2 * ( tokens_cur[ i ].tid - vocab.token_beg );
+			if( !text.empty() )
+			{
+				const bool speedUp = params.flag( eFullParamsFlags::SpeedupAudio );
+				const int tt0 = speedUp ? 2 * t0 : t0;
+				const int tt1 = speedUp ? 2 * t1 : t1;
+
+				if( params.flag( eFullParamsFlags::PrintRealtime ) )
+				{
+					if( params.flag( eFullParamsFlags::PrintTimestamps ) )
+						logDebug( u8"[%s --> %s]  %s", to_timestamp( tt0 ).c_str(), to_timestamp( tt1 ).c_str(), text.c_str() );
+					else
+						logDebug( u8"%s", text.c_str() );
+				}
+
+				result_all.push_back( { tt0, tt1, text, {} } );
+				for( int j = i0; j <= i; j++ )
+					result_all.back().tokens.push_back( tokens_cur[ j ] );
+
+				int n_new = 1;
+
+				if( params.flag( eFullParamsFlags::TokenTimestamps ) )
+				{
+					expComputeTokenLevelTimestamps( (int)result_all.size() - 1, params.thold_pt, params.thold_ptsum );
+					if( params.max_len > 0 )
+						n_new = wrapSegment( params.max_len );
+				}
+				if( nullptr != params.new_segment_callback )
+				{
+					auto cb = profiler.cpuBlock( eCpuBlock::Callbacks );
+					HRESULT hr = params.new_segment_callback( this, n_new, params.new_segment_callback_user_data );
+					if( FAILED( hr ) )
+						return hr;
+				}
+			}
+			text = "";
+			while( i < (int)tokens_cur.size() && tokens_cur[ i ].id > vocab.token_beg )
+				i++;
+			i--;
+			t0 = t1;
+			i0 = i + 1;
+		}
+	}
+
+	if( !text.empty() )
+	{
+		const int t1 = seek + seek_delta;
+
+		const bool speedUp = params.flag( eFullParamsFlags::SpeedupAudio );
+		const int tt0 = speedUp ? 2 * t0 : t0;
+		const int tt1 = speedUp ? 2 * t1 : t1;
+
+		if( params.flag( eFullParamsFlags::PrintRealtime ) )
+		{
+			if( params.flag( eFullParamsFlags::PrintTimestamps ) )
+				logDebug( u8"[%s --> %s]  %s", to_timestamp( tt0 ).c_str(), to_timestamp( tt1 ).c_str(), text.c_str() );
+			else
+				logDebug( u8"%s", text.c_str() );
+		}
+
+		result_all.push_back( { tt0, tt1, text, {} } );
+		for( int j = i0; j < (int)tokens_cur.size(); j++ )
+			result_all.back().tokens.push_back( tokens_cur[ j ] );
+
+		int n_new = 1;
+		if( params.flag( eFullParamsFlags::TokenTimestamps ) )
+		{
+			expComputeTokenLevelTimestamps( (int)result_all.size() - 1, params.thold_pt, params.thold_ptsum );
+			if( params.max_len > 0 )
+				n_new = wrapSegment( params.max_len );
+		}
+		if( nullptr != params.new_segment_callback )
+		{
+			auto cb = profiler.cpuBlock( eCpuBlock::Callbacks );
+			HRESULT hr = params.new_segment_callback( this, n_new, params.new_segment_callback_user_data );
+			if( FAILED( hr ) )
+				return hr;
+		}
+	}
+	return S_OK;
+}
+
 HRESULT COMLIGHTCALL ContextImpl::runFullImpl( const sFullParams& params, const sProgressSink& progress, iSpectrogram& mel )
 {
 	auto ts = device.setForCurrentThread();
@@ -488,27 +843,33 @@ HRESULT COMLIGHTCALL ContextImpl::runFullImpl( const sFullParams& params, const
 	// overwrite audio_ctx
 	exp_n_audio_ctx = params.audio_ctx;
 
-	// these tokens determine the task that will be performed
-	std::vector<whisper_token> prompt_init = { vocab.token_sot };
-	if( vocab.is_multilingual() )
+	// Beam search needs a KV cache slot for every beam, only the hybrid model has them
+	bool useBeamSearch = false;
+	if( params.strategy == eSamplingStrategy::BeamSearch && params.beam_search.beam_width > 1 )
 	{
-		int langId = lookupLanguageId( params.language );
-		if( langId < 0 )
-		{
-			char lang[ 5 ];
-			*(uint32_t*)( &lang[ 0 ] ) = params.language;
-			lang[ 4 ] = '\0';
-			logError( u8"%s: unknown language '%s'", __func__, lang );
-			return E_INVALIDARG;
-		}
-
-		prompt_init.push_back( vocab.token_sot + 1 + langId );
-		if( params.flag( eFullParamsFlags::Translate ) )
-			prompt_init.push_back( vocab.token_translate );
+		const HRESULT hr = context.createSlots( (uint32_t)params.beam_search.beam_width, 1 );
+		if( SUCCEEDED( hr ) )
+			useBeamSearch = true;
+		else if( hr == E_NOTIMPL )
+			logWarning( u8"GPU model doesn't implement beam search, using greedy sampling strategy" );
 		else
-			prompt_init.push_back( vocab.token_transcribe );
+			return hr;
 	}
 
+	// When runPipelined() has set up the helper context, it encodes the next window on half of the threads while this context decodes.
+	// Beam search decodes the window in steps of different length, it doesn't use the pipeline.
+	const bool pipelined = nullptr != pipeline && !useBeamSearch;
+	const int decodeThreads = pipelined ? params.cpuThreads - params.cpuThreads / 2 : params.cpuThreads;
+
+	// Speculative decoding with the draft model, nullptr when it's not used
+	ContextImpl* draft = nullptr;
+	if( !useBeamSearch )
+		CHECK( getDraftContext( params, &draft ) );
+
+	// these tokens determine the task that will be performed
+	std::vector<whisper_token> prompt_init;
+	CHECK( makeInitialPrompt( params, prompt_init ) );
+
 	// int progress_prev = 0;
 	// int progress_step = 5;
 
@@ -530,6 +891,9 @@ HRESULT COMLIGHTCALL ContextImpl::runFullImpl( const sFullParams& params, const
 
 	while( true )
 	{
+		// Jump over the long silences found by the VAD pre-pass, no segments are produced for them
+		seek = skipSilence( seek, seek_end );
+
 		if( nullptr != progress.pfn )
 		{
 			const int pos = seek - seek_start;
@@ -556,7 +920,21 @@ HRESULT COMLIGHTCALL ContextImpl::runFullImpl( const sFullParams& params, const
 		}
 
 		// encode audio features starting at offset seek
-		CHECK( encode( mel, seek ) );
+		if( pipelined )
+		{
+			// Speculatively encode the window at the nominal offset of the next iteration, while this one is decoding
+			const int nextSeek = seek + 100 * WHISPER_CHUNK_SIZE;
+			CHECK( encodePipelined( mel, seek, ( nextSeek + 100 < seek_end ) ? nextSeek : -1, params.cpuThreads ) );
+		}
+		else
+		{
+			CHECK( encode( mel, seek, params.cpuThreads ) );
+		}
+		if( nullptr != draft )
+		{
+			draft->exp_n_audio_ctx = exp_n_audio_ctx;
+			CHECK( draft->encode( mel, seek, params.cpuThreads ) );
+		}
 
 		int n_past = 0;
 		prompt.clear();
@@ -591,16 +969,22 @@ HRESULT COMLIGHTCALL ContextImpl::runFullImpl( const sFullParams& params, const
 		bool failed = false;
 		bool has_ts = false; // have we already sampled a non-beg timestamp token for the current segment?
 
+		if( useBeamSearch )
+		{
+			auto prof = context.decodeProfiler();
+			CHECK( beamSearch( params, prompt, seek, seek_end, tokens_cur, seek_delta, result_len, failed ) );
+		}
+		else if( nullptr != draft )
+		{
+			auto prof = context.decodeProfiler();
+			CHECK( speculativeGreedy( *draft, params, prompt, seek, seek_end, decodeThreads, tokens_cur, seek_delta, result_len, failed ) );
+		}
+		else
 		{
 			// Measure "Decode" profiler value, both CPU and GPU times
 			auto prof = context.decodeProfiler();
 			for( int i = 0, n_max = model.parameters.n_text_ctx / 2 - 4; i < n_max; i++ )
 			{
-				CHECK( decode( prompt.data(), prompt.size(), n_past, params.cpuThreads ) );
-
-				n_past += (int)prompt.size();
-				prompt.clear();
-
 				// very basic greedy sampling strategy:
 				//
 				//   - always take the most probable token
@@ -608,9 +992,15 @@ HRESULT COMLIGHTCALL ContextImpl::runFullImpl( const sFullParams& params, const
 				// more sophisticated sampling strategies could be implemented here, but we keep it simple
 				// feel free to experiment!
 				//
+				// The first token is forced to be the initial timestamp
+				sTokenData token;
+				CHECK( decodeSample( prompt.data(), prompt.size(), n_past, decodeThreads, i == 0, i == 0, token ) );
+
+				n_past += (int)prompt.size();
+				prompt.clear();
+
 				{
 					auto p = profiler.cpuBlock( eCpuBlock::Sample );
-					const sTokenData token = ( i == 0 ) ? sampleTimestamp( true ) : sampleBest();
 
 					// timestamp token - update sliding window
 					if( token.id > vocab.token_beg )
@@ -686,102 +1076,7 @@ HRESULT COMLIGHTCALL ContextImpl::runFullImpl( const sFullParams& params, const
 			prompt_past.push_back( r.id );
 
 		// store the text from this iteration
-		if( !tokens_cur.empty() )
-		{
-			int i0 = 0;
-			int t0 = seek + 2 * ( tokens_cur.front().tid - vocab.token_beg );
-			std::string text = "";
-
-			for( int i = 0; i < (int)tokens_cur.size(); i++ )
-			{
-				//printf("%s: %18s %6.3f %18s %6.3f\n", __func__,
-				//        ctx->vocab.id_to_token[tokens_cur[i].id].c_str(), tokens_cur[i].p,
-				//        ctx->vocab.id_to_token[tokens_cur[i].tid].c_str(), tokens_cur[i].pt);
-				if( params.flag( eFullParamsFlags::PrintSpecial ) || tokens_cur[ i ].id < vocab.token_eot )
-					text += vocab.string( tokens_cur[ i ].id );
-
-				if( tokens_cur[ i ].id > vocab.token_beg && !params.flag( eFullParamsFlags::SingleSegment ) )
-				{
-					const int t1 = seek + 2 * ( tokens_cur[ i ].tid - vocab.token_beg );
-					if( !text.empty() )
-					{
-						const bool speedUp = params.flag( eFullParamsFlags::SpeedupAudio );
-						const int tt0 = speedUp ? 2 * t0 : t0;
-						const int tt1 = speedUp ? 2 * t1 : t1;
-
-						if( params.flag( eFullParamsFlags::PrintRealtime ) )
-						{
-							if( params.flag( eFullParamsFlags::PrintTimestamps ) )
-								logDebug( u8"[%s --> %s]  %s", to_timestamp( tt0 ).c_str(), to_timestamp( tt1 ).c_str(), text.c_str() );
-							else
-								logDebug( u8"%s", text.c_str() );
-						}
-
-						result_all.push_back( { tt0, tt1, text, {} } );
-						for( int j = i0; j <= i; j++ )
-							result_all.back().tokens.push_back( tokens_cur[ j ] );
-
-						int n_new = 1;
-
-						if( params.flag( eFullParamsFlags::TokenTimestamps ) )
-						{
-							expComputeTokenLevelTimestamps( (int)result_all.size() - 1, params.thold_pt, params.thold_ptsum );
-							if( params.max_len > 0 )
-								n_new = wrapSegment( params.max_len );
-						}
-						if( nullptr != params.new_segment_callback )
-						{
-							auto cb = profiler.cpuBlock( eCpuBlock::Callbacks );
-							HRESULT hr = params.new_segment_callback( this, n_new, params.new_segment_callback_user_data );
-							if( FAILED( hr ) )
-								return hr;
-						}
-					}
-					text = "";
-					while( i < (int)tokens_cur.size() && tokens_cur[ i ].id > vocab.token_beg )
-						i++;
-					i--;
-					t0 = t1;
-					i0 = i + 1;
-				}
-			}
-
-			if( !text.empty() )
-			{
-				const int t1 = seek + seek_delta;
-
-				const bool speedUp = params.flag( eFullParamsFlags::SpeedupAudio );
-				const int tt0 = speedUp ? 2 * t0 : t0;
-				const int tt1 = speedUp ? 2 * t1 : t1;
-
-				if( params.flag( eFullParamsFlags::PrintRealtime ) )
-				{
-					if( params.flag( eFullParamsFlags::PrintTimestamps ) )
-						logDebug( u8"[%s --> %s]  %s", to_timestamp( tt0 ).c_str(), to_timestamp( tt1 ).c_str(), text.c_str() );
-					else
-						logDebug( u8"%s", text.c_str() );
-				}
-
-				result_all.push_back( { tt0, tt1, text, {} } );
-				for( int j = i0; j < (int)tokens_cur.size(); j++ )
-					result_all.back().tokens.push_back( tokens_cur[ j ] );
-
-				int n_new = 1;
-				if( params.flag( eFullParamsFlags::TokenTimestamps ) )
-				{
-					expComputeTokenLevelTimestamps( (int)result_all.size() - 1, params.thold_pt, params.thold_ptsum );
-					if( params.max_len > 0 )
-						n_new = wrapSegment( params.max_len );
-				}
-				if( nullptr != params.new_segment_callback )
-				{
-					auto cb = profiler.cpuBlock( eCpuBlock::Callbacks );
-					HRESULT hr = params.new_segment_callback( this, n_new, params.new_segment_callback_user_data );
-					if( FAILED( hr ) )
-						return hr;
-				}
-			}
-		}
+		CHECK( storeSegments( params, seek, seek_delta, tokens_cur ) );
 		seek += seek_delta;
 	}
 
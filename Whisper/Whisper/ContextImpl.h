@@ -7,6 +7,8 @@
 #include "sTokenData.h"
 #include "../ML/Device.h"
 
+#define WHISPER_CHUNK_SIZE  30
+
 namespace Whisper
 {
 	class ContextImpl : public ComLight::ObjectRoot<iContext>
@@ -19,6 +21,7 @@ namespace Whisper
 		int64_t mediaTimeOffset = 0;
 		iSpectrogram* currentSpectrogram = nullptr;
 		class CurrentSpectrogramRaii;
+		struct BatchStream;
 		ProfileCollection profiler;
 
 		HRESULT COMLIGHTCALL getModel( iModel** pp ) override final;
@@ -29,6 +32,23 @@ namespace Whisper
 		HRESULT COMLIGHTCALL runFull( const sFullParams& params, const iAudioBuffer* buffer ) override final;
 		HRESULT COMLIGHTCALL runStreamed( const sFullParams& params, const sProgressSink& progress, const iAudioReader* reader ) override final;
 		HRESULT COMLIGHTCALL runCapture( const sFullParams& params, const sCaptureCallbacks& callbacks, const iAudioCapture* reader ) override final;
+		HRESULT COMLIGHTCALL runBatch( const sFullParams& params, uint32_t count, const iAudioBuffer* const* buffers, eResultFlags flags, iTranscribeResult** results ) override final;
+		// Implemented in ContextImpl.parallel.cpp
+		HRESULT COMLIGHTCALL runParallel( const sFullParams& params, const iAudioBuffer* buffer, uint32_t countContexts ) override final;
+
+		// Speculative encoder of the next window, only set while runPipelined() is running. Implemented in ContextImpl.pipeline.cpp
+		class EncoderPipeline;
+		EncoderPipeline* pipeline = nullptr;
+		HRESULT runPipelined( const sFullParams& params, const iAudioBuffer* buffer );
+		// Encode the window, reusing the output of the speculative encoder when it was for the same offset.
+		// Then unless nextSeek is negative, start encoding the window at nextSeek on the helper context.
+		HRESULT encodePipelined( iSpectrogram& mel, int seek, int nextSeek, int threads );
+
+		// VAD decisions for the complete audio, 1 byte per VAD::FFT_POINTS samples; empty unless eFullParamsFlags::SkipSilence is set
+		std::vector<uint8_t> speechMap;
+		HRESULT makeSpeechMap( const iAudioBuffer* buffer );
+		// When a long silence starts at the seek position, return the position near the end of that silence, otherwise the seek argument
+		int skipSilence( int seek, int seek_end ) const;
 
 		struct Segment
 		{
@@ -51,16 +71,45 @@ namespace Whisper
 		// [EXPERIMENTAL] speed-up techniques
 		int32_t exp_n_audio_ctx = 0; // 0 - use default
 
-		HRESULT encode( iSpectrogram& mel, int seek );
-		HRESULT decode( const int* tokens, size_t length, int n_past, int threads );
+		HRESULT encode( iSpectrogram& mel, int seek, int threads, uint32_t crossSlot = 0 );
+		DirectCompute::sDecodeParams decodeParams( int n_past ) const;
+		// With allRows = true, the probs vector receives a row of probabilities after every token
+		HRESULT decode( const int* tokens, size_t length, int n_past, int threads, bool allRows = false );
+		// Decode a batch of tokens from independent sequences, the output has a row of probabilities for each row of the batch with the logits flag
+		HRESULT decodeBatch( const int* tokens, const DirectCompute::sBatchRow* rows, size_t countRows, int threads );
+		sTokenData applyTimestampRules( const float* probs, bool force_timestamp, bool is_initial, float& maxTimestamp );
 		sTokenData sampleBest( const float* probs, bool force_timestamp, bool is_initial );
+		// Collect up to `count` most probable tokens, skipping the special ones
+		void sampleTop( const float* probs, bool force_timestamp, bool is_initial, size_t count, std::vector<sTokenData>& rdi );
+		// Decode a window of audio with the beam search sampling strategy, implemented in ContextImpl.beam.cpp
+		HRESULT beamSearch( const sFullParams& params, const std::vector<whisper_token>& prompt, int seek, int seek_end,
+			std::vector<sTokenData>& tokens_cur, int& seek_delta, int& result_len, bool& failed );
 		sTokenData sampleBest();
+		// Decode the tokens, and sample the next one like sampleBest() does.
+		// The hybrid model applies the rules to the logits, the probs vector is left unchanged.
+		HRESULT decodeSample( const int* tokens, size_t length, int n_past, int threads, bool force_timestamp, bool is_initial, sTokenData& result );
+		// Decode the tokens, and sample a token after every one of them the way decodeSample() does, without the timestamp rules.
+		// Used to verify the proposals of the draft model with the same sampling as the greedy loop.
+		HRESULT decodeSampleRows( const int* tokens, size_t length, int n_past, int threads, std::vector<sTokenData>& rdi );
+		DirectCompute::sSampleRules sampleRules( bool force_timestamp, bool is_initial ) const;
+		static sTokenData makeTokenData( const DirectCompute::sSampledToken& st );
+		std::vector<DirectCompute::sSampledToken> sampledRows;
+
+		// Context of the draft model for the speculative decoding, created on first use. Implemented in ContextImpl.speculative.cpp
+		ComLight::CComPtr<iModel> draftModel;
+		ComLight::CComPtr<iContext> draftContext;
+		// Set rdi to the context of the draft model from the parameters, or nullptr when the speculative decoding is not used
+		HRESULT getDraftContext( const sFullParams& params, ContextImpl** rdi );
+		// Decode a window of audio with the greedy strategy, verifying the tokens proposed by the draft model in batches
+		HRESULT speculativeGreedy( ContextImpl& draft, const sFullParams& params, const std::vector<whisper_token>& prompt, int seek, int seek_end, int threads,
+			std::vector<sTokenData>& tokens_cur, int& seek_delta, int& result_len, bool& failed );
 		sTokenData sampleTimestamp( bool initial );
 		int wrapSegment( int max_len );
+		HRESULT makeInitialPrompt( const sFullParams& params, std::vector<whisper_token>& prompt_init ) const;
+		HRESULT storeSegments( const sFullParams& params, int seek, int seek_delta, const std::vector<sTokenData>& tokens_cur );
 		void expComputeTokenLevelTimestamps( int i_segment, float thold_pt, float thold_ptsum );
 
 		std::vector<float> probs;
-		std::vector<std::pair<double, Vocabulary::id>> probs_id;
 
 		mutable TranscribeResultStatic results;
 
@@ -2,6 +2,7 @@
 #include "ContextImpl.h"
 #include <mfapi.h>
 #include "MelStreamer.h"
+#include "voiceActivityDetection.h"
 #include "../API/iMediaFoundation.cl.h"
 #include "../Utils/Trace/tracing.h"
 using namespace Whisper;
@@ -72,6 +73,7 @@ HRESULT COMLIGHTCALL ContextImpl::fullDefaultParams( eSamplingStrategy strategy,
 	rdi->thold_pt = 0.01f;
 	rdi->thold_ptsum = 0.01f;
 	rdi->language = makeLanguageKey( "en" );
+	rdi->draftTokens = 4;
 
 	switch( strategy )
 	{
@@ -117,7 +119,6 @@ __m128i ContextImpl::getMemoryUse() const
 	cb += vectorMemoryUse( prompt_past );
 	cb += vectorMemoryUse( energy );
 	cb += vectorMemoryUse( probs );
-	cb += vectorMemoryUse( probs_id );
 	cb += vectorMemoryUse( results.segments );
 	cb += vectorMemoryUse( results.tokens );
 	cb += spectrogram.memoryUsage();
@@ -356,6 +357,53 @@ int ContextImpl::wrapSegment( int max_len )
 	return res;
 }
 
+namespace
+{
+	// Shorter silences are left to the model, in 10ms units of the spectrogram
+	constexpr int minSkippedSilence = 200;
+	// The VAD decisions are coarse, the skip stops that much before the next speech frame
+	constexpr int silencePadding = 25;
+}
+
+HRESULT ContextImpl::makeSpeechMap( const iAudioBuffer* buffer )
+{
+	auto p = profiler.cpuBlock( eCpuBlock::VAD );
+	speechMap.clear();
+	try
+	{
+		VAD vad;
+		vad.clear();
+		vad.detect( buffer->getPcmMono(), buffer->countSamples(), speechMap );
+	}
+	catch( const std::bad_alloc& )
+	{
+		return E_OUTOFMEMORY;
+	}
+	return S_OK;
+}
+
+int ContextImpl::skipSilence( int seek, int seek_end ) const
+{
+	if( speechMap.empty() || seek < 0 )
+		return seek;
+
+	constexpr size_t frameSize = VAD::FFT_POINTS;
+	size_t frame = (size_t)seek * FFT_STEP / frameSize;
+	while( frame < speechMap.size() && 0 == speechMap[ frame ] )
+		frame++;
+
+	int end;
+	if( frame < speechMap.size() )
+		end = std::min( (int)( frame * frameSize / FFT_STEP ) - silencePadding, seek_end );
+	else
+		end = seek_end;	// Silence until the end of the audio
+	if( end - seek < minSkippedSilence )
+		return seek;
+
+	logDebug( u8"Skipping silence from %.2f to %.2f seconds", seek * 0.01, end * 0.01 );
+	return end;
+}
+
 HRESULT COMLIGHTCALL ContextImpl::runFull( const sFullParams& params, const iAudioBuffer* buffer )
 {
 #if SAVE_DEBUG_TRACE
@@ -364,11 +412,6 @@ HRESULT COMLIGHTCALL ContextImpl::runFull( const sFullParams& params, const iAud
 	CHECK( buffer->getTime( mediaTimeOffset ) );
 
 	auto profCompleteCpu = profiler.cpuBlock( eCpuBlock::RunComplete );
-	{
-		auto p = profiler.cpuBlock( eCpuBlock::Spectrogram );
-		CHECK( spectrogram.pcmToMel( buffer, model.shared->filters, params.cpuThreads ) );
-	}
-
 	if( params.flag( eFullParamsFlags::TokenTimestamps ) )
 	{
 		t_beg = 0;
@@ -377,10 +420,46 @@ HRESULT COMLIGHTCALL ContextImpl::runFull( const sFullParams& params, const iAud
 		computeSignalEnergy( energy, buffer, 32 );
 	}
 
+	if( params.flag( eFullParamsFlags::SkipSilence ) )
+	{
+		CHECK( makeSpeechMap( buffer ) );
+	}
+	else
+		speechMap.clear();
+
 	try
 	{
+		if( params.flag( eFullParamsFlags::PipelinedEncode ) )
+		{
+			if( context.isHybrid() && params.cpuThreads > 1 )
+				return runPipelined( params, buffer );
+			logWarning( u8"eFullParamsFlags.PipelinedEncode flag requires the hybrid model and at least 2 CPU threads, ignoring" );
+		}
+
+		// Same MEL streamers as runStreamed, they compute the spectrogram ahead of the encoder and drop the consumed chunks.
+		// Unlike a complete Spectrogram, the memory use doesn't depend on the length of the audio.
+		// The streamers only seek forward, they start at the offset where runFullImpl() begins decoding.
+		// The output is normalized against the maximum of the complete audio, same values as Spectrogram.pcmToMel.
+		float melMaximum;
+		{
+			auto p = profiler.cpuBlock( eCpuBlock::MelMaximum );
+			CHECK( computeMelMaximum( buffer, model.shared->filters, params.cpuThreads, melMaximum ) );
+		}
+
 		sProgressSink progressSink{ nullptr, nullptr };
-		return runFullImpl( params, progressSink, spectrogram );
+		const size_t startOffset = (size_t)std::max( params.offset_ms / 10, 0 );
+		if( params.cpuThreads > 1 )
+		{
+			MelStreamerThread mel{ model.shared->filters, profiler, buffer, startOffset, params.cpuThreads };
+			mel.setMaximum( melMaximum );
+			return runFullImpl( params, progressSink, mel );
+		}
+		else
+		{
+			MelStreamerSimple mel{ model.shared->filters, profiler, buffer, startOffset };
+			mel.setMaximum( melMaximum );
+			return runFullImpl( params, progressSink, mel );
+		}
 	}
 	catch( HRESULT hr )
 	{
@@ -398,6 +477,10 @@ HRESULT COMLIGHTCALL ContextImpl::runStreamed( const sFullParams& params, const
 
 	mediaTimeOffset = 0;
 	auto profCompleteCpu = profiler.cpuBlock( eCpuBlock::RunComplete );
+	// The VAD pre-pass needs the complete audio
+	if( params.flag( eFullParamsFlags::SkipSilence ) )
+		logWarning( u8"eFullParamsFlags.SkipSilence flag is not supported in streaming mode, ignoring" );
+	speechMap.clear();
 
 	try
 	{
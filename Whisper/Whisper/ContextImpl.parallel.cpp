@@ -0,0 +1,199 @@
+#include "stdafx.h"
+#include "ContextImpl.h"
+#include "voiceActivityDetection.h"
+#include "../API/iMediaFoundation.cl.h"
+#include "../Utils/parallelFor.h"
+using namespace Whisper;
+
+namespace
+{
+	// Every span needs at least that many 30-seconds windows, otherwise the split ain't worth the extra context
+	constexpr int minWindowsPerSpan = 2;
+	// The split points are moved by up to 10 seconds to the longest silence nearby
+	constexpr int maxSplitShift = 10 * 100;
+
+	// Run the VAD over the slice of PCM, and return the sample position in the middle of the longest silence.
+	// When the complete slice is speech, returns the middle of the slice.
+	size_t findSilence( VAD& vad, const float* pcm, size_t length )
+	{
+		constexpr size_t frameSize = VAD::FFT_POINTS;
+		vad.clear();
+		// Decisions for all frames of the slice, from a single batched pass of the VAD
+		std::vector<uint8_t> speech;
+		vad.detect( pcm, length, speech );
+
+		size_t bestBegin = 0, bestLength = 0;
+		size_t runBegin = 0;
+		for( size_t i = 0; i < speech.size(); i++ )
+		{
+			if( 0 != speech[ i ] )
+			{
+				runBegin = i + 1;
+				continue;
+			}
+			const size_t runLength = i + 1 - runBegin;
+			if( runLength > bestLength )
+			{
+				bestLength = runLength;
+				bestBegin = runBegin;
+			}
+		}
+		if( 0 == bestLength )
+			return length / 2;
+		return ( bestBegin * 2 + bestLength ) * frameSize / 2;
+	}
+
+	struct ParallelSpans
+	{
+		// The first span runs on the context which called runParallel, on the calling thread
+		ContextImpl* self = nullptr;
+		std::vector<ComLight::CComPtr<ComLight::Object<ContextImpl>>> contexts;
+		std::vector<sFullParams> params;
+		iSpectrogram* mel = nullptr;
+	};
+}
+
+HRESULT COMLIGHTCALL ContextImpl::runParallel( const sFullParams& params, const iAudioBuffer* buffer, uint32_t countContexts )
+{
+	if( nullptr == buffer )
+		return E_POINTER;
+	if( params.flag( eFullParamsFlags::TokenTimestamps ) )
+	{
+		logError( u8"eFullParamsFlags.TokenTimestamps flag is not supported in parallel mode" );
+		return E_NOTIMPL;
+	}
+	if( !context.isHybrid() )
+	{
+		// GPU model runs on a single-threaded D3D device, concurrent contexts would serialize anyway
+		logWarning( u8"GPU model doesn't implement parallel transcription, running sequentially" );
+		return runFull( params, buffer );
+	}
+
+	CHECK( buffer->getTime( mediaTimeOffset ) );
+	auto profCompleteCpu = profiler.cpuBlock( eCpuBlock::RunComplete );
+	{
+		auto p = profiler.cpuBlock( eCpuBlock::Spectrogram );
+		CHECK( spectrogram.pcmToMel( buffer, model.shared->filters, params.cpuThreads ) );
+	}
+	if( params.flag( eFullParamsFlags::SkipSilence ) )
+	{
+		CHECK( makeSpeechMap( buffer ) );
+	}
+	else
+		speechMap.clear();
+
+	// Same range as in runFullImpl()
+	const int seekStart = params.offset_ms / 10;
+	const int seekEnd = seekStart + ( params.duration_ms == 0 ? (int)spectrogram.getLength() : params.duration_ms / 10 );
+	const int minSpan = minWindowsPerSpan * 100 * WHISPER_CHUNK_SIZE;
+	const int countSpans = std::max( std::min( (int)countContexts, ( seekEnd - seekStart ) / minSpan ), 1 );
+
+	ParallelSpans spans;
+	try
+	{
+		// Split points at the silences near the ideal boundaries, in 10ms units of the spectrogram
+		std::vector<int> splits;
+		splits.push_back( seekStart );
+		if( countSpans > 1 )
+		{
+			auto p = profiler.cpuBlock( eCpuBlock::VAD );
+			VAD vad;
+			const float* pcm = buffer->getPcmMono();
+			const int countMel = (int)std::min( (size_t)seekEnd, (size_t)buffer->countSamples() / FFT_STEP );
+			const int halfWindow = std::min( maxSplitShift, ( seekEnd - seekStart ) / ( countSpans * 4 ) );
+			for( int i = 1; i < countSpans; i++ )
+			{
+				const int ideal = seekStart + (int)( (int64_t)( seekEnd - seekStart ) * i / countSpans );
+				const int begin = std::max( ideal - halfWindow, splits.back() + 100 );
+				const int end = std::min( ideal + halfWindow, countMel );
+				int split = ideal;
+				if( begin < end )
+				{
+					const size_t samples = findSilence( vad, pcm + (size_t)begin * FFT_STEP, (size_t)( end - begin ) * FFT_STEP );
+					split = begin + (int)( samples / FFT_STEP );
+				}
+				splits.push_back( split );
+			}
+		}
+		splits.push_back( seekEnd );
+
+		// Worker contexts share the model, each one has its own KV cache and arenas.
+		// They are created on this thread, the device is single-threaded.
+		spans.self = this;
+		spans.mel = &spectrogram;
+		spans.contexts.resize( countSpans );
+		spans.params.resize( countSpans, params );
+		const int threadsPerSpan = std::max( params.cpuThreads / countSpans, 1 );
+		for( int i = 0; i < countSpans; i++ )
+		{
+			if( i > 0 )
+			{
+				auto ts = device.setForCurrentThread();
+				CHECK( ComLight::Object<ContextImpl>::create( spans.contexts[ i ], device, model, (iModel*)modelPtr ) );
+				spans.contexts[ i ]->speechMap = speechMap;
+			}
+
+			sFullParams& sp = spans.params[ i ];
+			sp.offset_ms = splits[ i ] * 10;
+			sp.duration_ms = ( splits[ i + 1 ] - splits[ i ] ) * 10;
+			sp.cpuThreads = threadsPerSpan;
+			// The callbacks would be called concurrently by different contexts
+			sp.new_segment_callback = nullptr;
+			sp.new_segment_callback_user_data = nullptr;
+			sp.encoder_begin_callback = nullptr;
+			sp.encoder_begin_callback_user_data = nullptr;
+		}
+	}
+	catch( const std::bad_alloc& )
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	logDebug( u8"Transcribing %i spans in parallel", countSpans );
+	pfnParallelForCallback pfn = []( int ith, void* pv ) noexcept -> HRESULT
+	{
+		ParallelSpans& spans = *(ParallelSpans*)pv;
+		ContextImpl* ci = spans.self;
+		if( 0 != ith )
+			ci = spans.contexts[ ith ];
+		try
+		{
+			const sProgressSink progressSink{ nullptr, nullptr };
+			const HRESULT hr = ci->runFullImpl( spans.params[ ith ], progressSink, *spans.mel );
+			return FAILED( hr ) ? hr : S_OK;
+		}
+		catch( HRESULT hr )
+		{
+			return hr;
+		}
+		catch( const std::bad_alloc& )
+		{
+			return E_OUTOFMEMORY;
+		}
+	};
+	CHECK( parallelFor( pfn, countSpans, &spans ) );
+
+	// Stitch the segments in time order, the timestamps are already relative to the start of the spectrogram
+	try
+	{
+		for( int i = 1; i < countSpans; i++ )
+		{
+			ContextImpl* worker = spans.contexts[ i ];
+			for( Segment& seg : worker->result_all )
+				result_all.emplace_back( std::move( seg ) );
+			worker->result_all.clear();
+			prompt_past.swap( worker->prompt_past );
+		}
+	}
+	catch( const std::bad_alloc& )
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	if( nullptr != params.new_segment_callback && !result_all.empty() )
+	{
+		auto cb = profiler.cpuBlock( eCpuBlock::Callbacks );
+		CHECK( params.new_segment_callback( this, (int)result_all.size(), params.new_segment_callback_user_data ) );
+	}
+	return S_OK;
+}
\ No newline at end of file
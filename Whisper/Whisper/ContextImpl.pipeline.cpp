@@ -0,0 +1,126 @@
+#include "stdafx.h"
+#include "ContextImpl.h"
+using namespace Whisper;
+
+// The helper context shares the model, and has its own encoder arenas and cross-attention buffers.
+// It encodes the next window on the thread pool, when the decoder advances by exactly 30 seconds the buffers are swapped into the owner context.
+class ContextImpl::EncoderPipeline
+{
+	ContextImpl& owner;
+	ComLight::CComPtr<ComLight::Object<ContextImpl>> helper;
+	PTP_WORK work = nullptr;
+	iSpectrogram* mel = nullptr;
+	// Offset of the window encoded by the helper context, -1 when there's none
+	int seek = -1;
+	int threads = 1;
+	HRESULT status = S_OK;
+	bool pending = false;
+
+	static void __stdcall callbackStatic( PTP_CALLBACK_INSTANCE Instance, PVOID pv, PTP_WORK Work )
+	{
+		EncoderPipeline* ep = (EncoderPipeline*)pv;
+		try
+		{
+			ep->status = ep->helper->encode( *ep->mel, ep->seek, ep->threads );
+		}
+		catch( const std::bad_alloc& )
+		{
+			ep->status = E_OUTOFMEMORY;
+		}
+	}
+
+public:
+	EncoderPipeline( ContextImpl& ctx ) : owner( ctx )
+	{
+		ctx.pipeline = this;
+	}
+	EncoderPipeline( const EncoderPipeline& ) = delete;
+
+	~EncoderPipeline()
+	{
+		wait();
+		if( nullptr != work )
+		{
+			CloseThreadpoolWork( work );
+			work = nullptr;
+		}
+		owner.pipeline = nullptr;
+	}
+
+	HRESULT create()
+	{
+		{
+			// The device is single-threaded, create the context on this thread
+			auto ts = owner.device.setForCurrentThread();
+			CHECK( ComLight::Object<ContextImpl>::create( helper, owner.device, owner.model, (iModel*)owner.modelPtr ) );
+		}
+		work = CreateThreadpoolWork( &callbackStatic, this, nullptr );
+		if( nullptr == work )
+			return getLastHr();
+		return S_OK;
+	}
+
+	void wait()
+	{
+		if( !pending )
+			return;
+		WaitForThreadpoolWorkCallbacks( work, FALSE );
+		pending = false;
+	}
+
+	// Start encoding the window on the thread pool
+	void launch( iSpectrogram& spectrogram, int offset, int encoderThreads )
+	{
+		assert( !pending );
+		mel = &spectrogram;
+		seek = offset;
+		threads = encoderThreads;
+		status = S_OK;
+		helper->exp_n_audio_ctx = owner.exp_n_audio_ctx;
+		pending = true;
+		SubmitThreadpoolWork( work );
+	}
+
+	// Wait for the helper. When it has encoded the window at that offset, move the output into the owner context and return S_OK.
+	// Otherwise return S_FALSE, the caller then encodes the window itself.
+	HRESULT take( int offset )
+	{
+		wait();
+		if( offset != seek )
+			return S_FALSE;
+		seek = -1;
+		CHECK( status );
+		return owner.context.swapCrossAttention( helper->context );
+	}
+};
+
+HRESULT ContextImpl::runPipelined( const sFullParams& params, const iAudioBuffer* buffer )
+{
+	// The helper context reads the spectrogram ahead of the decoder, and on misses the owner goes back to an earlier offset.
+	// The forward-only MEL streamers can't do that, this mode uses the complete spectrogram.
+	{
+		auto p = profiler.cpuBlock( eCpuBlock::Spectrogram );
+		CHECK( spectrogram.pcmToMel( buffer, model.shared->filters, params.cpuThreads ) );
+	}
+
+	EncoderPipeline ep{ *this };
+	CHECK( ep.create() );
+	const sProgressSink progressSink{ nullptr, nullptr };
+	return runFullImpl( params, progressSink, spectrogram );
+}
+
+HRESULT ContextImpl::encodePipelined( iSpectrogram& mel, int seek, int nextSeek, int threads )
+{
+	assert( nullptr != pipeline );
+	const HRESULT hr = pipeline->take( seek );
+	CHECK( hr );
+	if( S_OK != hr )
+	{
+		// The decoder advanced by less than 30 seconds, the speculative output is useless
+		CHECK( encode( mel, seek, threads ) );
+	}
+
+	if( nextSeek >= 0 )
+		pipeline->launch( mel, nextSeek, std::max( threads / 2, 1 ) );
+	return S_OK;
+}
\ No newline at end of file
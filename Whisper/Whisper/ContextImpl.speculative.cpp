@@ -0,0 +1,149 @@
+#include "stdafx.h"
+#include "ContextImpl.h"
+#include "SegmentState.h"
+using namespace Whisper;
+
+namespace
+{
+	// Count of the proposed tokens when sFullParams.draftTokens is 0, and the upper limit
+	constexpr int defaultDraftTokens = 4;
+	constexpr int maxDraftTokens = 16;
+}
+
+HRESULT ContextImpl::getDraftContext( const sFullParams& params, ContextImpl** rdi )
+{
+	*rdi = nullptr;
+	if( nullptr == params.draftModel )
+		return S_OK;
+	if( !context.isHybrid() )
+	{
+		logWarning( u8"GPU model doesn't implement speculative decoding, ignoring the draft model" );
+		return S_OK;
+	}
+
+	if( params.draftModel != (iModel*)draftModel )
+	{
+		draftContext.release();
+		draftModel.release();
+		ComLight::CComPtr<iContext> ctx;
+		CHECK( params.draftModel->createContext( &ctx ) );
+		draftModel = params.draftModel;
+		draftContext.swap( ctx );
+	}
+
+	ContextImpl* draft = static_cast<ContextImpl*>( (iContext*)draftContext );
+	if( !draft->context.isHybrid() )
+	{
+		logWarning( u8"The draft model must use the hybrid implementation, ignoring the draft model" );
+		return S_OK;
+	}
+
+	const Vocabulary& vocab = model.shared->vocab;
+	const Vocabulary& draftVocab = draft->model.shared->vocab;
+	if( draftVocab.n_vocab != vocab.n_vocab || draftVocab.token_beg != vocab.token_beg || draftVocab.token_eot != vocab.token_eot )
+	{
+		logWarning( u8"The draft model has a different vocabulary, ignoring the draft model" );
+		return S_OK;
+	}
+
+	*rdi = draft;
+	return S_OK;
+}
+
+HRESULT ContextImpl::speculativeGreedy( ContextImpl& draft, const sFullParams& params, const std::vector<whisper_token>& prompt, int seek, int seek_end, int threads,
+	std::vector<sTokenData>& tokens_cur, int& seek_delta, int& result_len, bool& failed )
+{
+	const Vocabulary& vocab = model.shared->vocab;
+	const int n_max = model.parameters.n_text_ctx / 2 - 4;
+	// Both KV caches must have room for the proposed tokens
+	const int n_ctx = std::min( model.parameters.n_text_ctx, draft.model.parameters.n_text_ctx );
+	const int draftTokens = std::clamp( params.draftTokens > 0 ? params.draftTokens : defaultDraftTokens, 1, maxDraftTokens );
+
+	SegmentRules ws;
+	ws.token_beg = vocab.token_beg;
+	ws.token_eot = vocab.token_eot;
+	ws.seek = seek;
+	ws.seek_end = seek_end;
+	ws.max_tokens = params.max_tokens;
+	ws.singleSegment = params.flag( eFullParamsFlags::SingleSegment );
+
+	SegmentState state;
+	eSegmentStatus status;
+	int i = 0;
+
+	// The prompt, followed by the accepted tokens
+	std::vector<whisper_token> sequence = prompt;
+	sequence.reserve( prompt.size() + n_max );
+
+	// The first token is the initial timestamp, sampled from the last row of the prompt
+	{
+		sTokenData token;
+		CHECK( decodeSample( prompt.data(), prompt.size(), 0, threads, true, true, token ) );
+		status = ws.append( state, token, i++ );
+		sequence.push_back( token.id );
+	}
+	// Count of the leading tokens of the sequence in the KV cache of the main model, all of them except the last one
+	int n_past = (int)prompt.size();
+
+	// Count of the leading tokens of the sequence in the KV cache of the draft model
+	int draftPast = 0;
+	std::vector<whisper_token> draftPending;
+	// The last token of the sequence, followed by the proposed ones
+	std::vector<whisper_token> batch;
+	// The tokens sampled by the main model after every token of the batch
+	std::vector<sTokenData> verified;
+
+	while( status == eSegmentStatus::Active && i < n_max )
+	{
+		batch.assign( 1, sequence.back() );
+		const int k = std::max( std::min( { draftTokens, n_max - i, n_ctx - 1 - n_past } ), 0 );
+
+		// The draft model catches up with the sequence, and proposes up to k tokens greedily, one at a time
+		draftPending.assign( sequence.begin() + draftPast, sequence.end() );
+		for( int j = 0; j < k; j++ )
+		{
+			sTokenData proposed;
+			CHECK( draft.decodeSample( draftPending.data(), draftPending.size(), draftPast, threads, false, false, proposed ) );
+			draftPast += (int)draftPending.size();
+
+			const whisper_token proposal = proposed.id;
+			batch.push_back( proposal );
+			draftPending.assign( 1, proposal );
+			if( proposal == vocab.token_eot )
+				break;
+		}
+
+		// The main model decodes the last token and all the proposals in one call, and samples a token after every one of them.
+		// That's the same fused sampling as in the greedy loop of runFullImpl, the proposals only save the decoder calls.
+		// Rejected proposals stay in the KV caches past n_past, the next decode() calls overwrite them.
+		CHECK( decodeSampleRows( batch.data(), batch.size(), n_past, threads, verified ) );
+
+		int accepted = 0;
+		for( size_t j = 0; j < batch.size(); j++ )
+		{
+			const sTokenData& token = verified[ j ];
+			status = ws.append( state, token, i++ );
+			if( status != eSegmentStatus::Active )
+				break;
+			sequence.push_back( token.id );
+			if( i >= n_max || j + 1 >= batch.size() || token.id != batch[ j + 1 ] )
+				break;
+			accepted++;
+		}
+
+		n_past += 1 + accepted;
+		draftPast = std::min( draftPast, n_past );
+	}
+
+	if( status == eSegmentStatus::Failed || ( status == eSegmentStatus::Active && !SegmentRules::acceptIncomplete( state ) ) )
+	{
+		failed = true;
+		return S_OK;
+	}
+
+	tokens_cur = state.tokens;
+	seek_delta = state.seekDelta;
+	result_len = state.resultLength;
+	failed = false;
+	return S_OK;
+}
@@ -9,17 +9,42 @@ MelStreamer::MelStreamer( const Filters& filters, ProfileCollection& prof, const
 	profiler( prof )
 { }
 
-void MelStreamer::dropOldChunks( size_t off )
+MelStreamer::MelStreamer( const Filters& filters, ProfileCollection& prof, const iAudioBuffer* buffer, size_t startOffset ) :
+	reader( buffer, startOffset ),
+	melContext( filters ),
+	profiler( prof )
+{
+	streamStartOffset = std::min( startOffset, reader.getLength() );
+}
+
+HRESULT MelStreamer::dropOldChunks( size_t off )
 {
 	const bool stereo = reader.outputsStereo();
-	for( size_t i = streamStartOffset; i < off; i++ )
+	const size_t skip = off - streamStartOffset;
+	const size_t queuedPcm = std::min( skip, queuePcmMono.size() );
+	for( size_t i = 0; i < queuedPcm; i++ )
 	{
 		queuePcmMono.pop_front();
-		queueMel.pop_front();
 		if( stereo )
 			queuePcmStereo.pop_front();
 	}
+	// At the end of the stream, the MEL queue can be longer than the PCM one, padded with zeros
+	const size_t queuedMel = std::min( skip, queueMel.size() );
+	for( size_t i = 0; i < queuedMel; i++ )
+		queueMel.pop_front();
 	streamStartOffset = off;
+
+	if( skip > queuedPcm && !readerEof )
+	{
+		// The new position is past the PCM we have read so far, move the reader there
+		assert( queuePcmMono.empty() && queueMel.empty() );
+		const HRESULT hr = reader.skipChunks( skip - queuedPcm );
+		if( hr == E_EOF )
+			readerEof = true;
+		else if( FAILED( hr ) )
+			return hr;
+	}
+	return S_OK;
 }
 
 HRESULT MelStreamer::ensurePcmChunks( size_t len )
@@ -149,7 +174,9 @@ void MelStreamer::makeTransposedBuffer( size_t off, size_t len )
 	// Second pass, clamping and normalization
 	float mmax;
 	const size_t bufferEnd = off + len;
-	if( lastBufferEnd != bufferEnd )
+	if( hasFixedMaximum )
+		mmax = fixedMaximum;
+	else if( lastBufferEnd != bufferEnd )
 	{
 		// Store maximum value in this class, along with the end sample index
 		mmax = horizontalMaximum( vMax );
@@ -191,29 +218,35 @@ HRESULT MelStreamerSimple::makeBuffer( size_t off, size_t len, const float** buf
 	if( off > streamStartOffset )
 	{
 		// The model wants to advance forward, drop now irrelevant chunks of data
-		dropOldChunks( off );
+		CHECK( dropOldChunks( off ) );
 	}
 
 	// Compute all these MEL chunks
 	const size_t availableMel = queueMel.size();
 	if( availableMel < len )
 	{
-		CHECK( ensurePcmChunks( len ) );
+		// E_EOF when a seek moved past the end of the stream, the MEL chunks are then padded with zeros
+		const HRESULT hr = ensurePcmChunks( len );
+		if( FAILED( hr ) && hr != E_EOF )
+			return hr;
 
-		const size_t pcmChunks = serializePcm( availableMel );
+		const size_t pcmChunks = ( queuePcmMono.size() > availableMel ) ? serializePcm( availableMel ) : 0;
 		const size_t missingMelChunks = len - availableMel;
 		size_t i;
 		const size_t loop1 = std::min( missingMelChunks, pcmChunks );
 		{
 			auto profilerBlock = profiler.cpuBlock( eCpuBlock::Spectrogram );
-			for( i = 0; i < loop1; i++ )
+			std::array<MelChunk, SpectrogramContext::batchSize> batch;
+			for( i = 0; i < loop1; )
 			{
-				// if( readerEof && i + 1 == loop1 ) __debugbreak();
-				auto& arr = queueMel.emplace_back();
+				const size_t count = std::min( batch.size(), loop1 - i );
 				const float* sourcePcm = tempPcm.data() + i * FFT_STEP;
 				size_t availableChunks = pcmChunks - i;
 				size_t availableFloats = availableChunks * FFT_STEP;
-				melContext.fft( arr, sourcePcm, availableFloats );
+				melContext.fftBatch( batch[ 0 ].data(), 1, N_MEL, count, sourcePcm, availableFloats );
+				for( size_t j = 0; j < count; j++ )
+					queueMel.push_back( batch[ j ] );
+				i += count;
 			}
 		}
 		for( ; i < missingMelChunks; i++ )
@@ -234,6 +267,18 @@ HRESULT MelStreamerSimple::makeBuffer( size_t off, size_t len, const float** buf
 MelStreamerThread::MelStreamerThread( const Filters& filters, ProfileCollection& profiler, const iAudioReader* iar, int countThreads ) :
 	MelStreamer( filters, profiler, iar ),
 	workerThreads( countThreads )
+{
+	startThread( filters );
+}
+
+MelStreamerThread::MelStreamerThread( const Filters& filters, ProfileCollection& profiler, const iAudioBuffer* buffer, size_t startOffset, int countThreads ) :
+	MelStreamer( filters, profiler, buffer, startOffset ),
+	workerThreads( countThreads )
+{
+	startThread( filters );
+}
+
+void MelStreamerThread::startThread( const Filters& filters )
 {
 	if( workerThreads > 1 )
 	{
@@ -285,6 +330,7 @@ HRESULT MelStreamerThread::threadMain()
 		// Count of MEL chunks remaining in the whole stream
 		// availableMel of them are already on the queue
 		const ptrdiff_t remainingMel = (ptrdiff_t)getLength() - (ptrdiff_t)streamStartOffset;
+		producing = true;
 		LeaveCriticalSection( &m_cs.m_sec );
 
 		const ptrdiff_t missingChunks = prebufferChunks - availableMel;
@@ -293,10 +339,13 @@ HRESULT MelStreamerThread::threadMain()
 		if( chunks <= 0 )
 			return S_OK; // This thread has produced all chunks of the stream
 
-		CHECK( ensurePcmChunks( availableMel + chunks ) );
-		const size_t pcmChunks = serializePcm( availableMel );
-		if( 0 == pcmChunks )
+		const HRESULT hr = ensurePcmChunks( availableMel + chunks );
+		if( hr == E_EOF )
+			return S_OK;	// A seek moved past the end of the stream
+		CHECK( hr );
+		if( queuePcmMono.size() <= (size_t)availableMel )
 			return S_OK;
+		const size_t pcmChunks = serializePcm( availableMel );
 
 		pendingChunks.clear();
 
@@ -307,13 +356,15 @@ HRESULT MelStreamerThread::threadMain()
 			if( this->workerThreads <= 1 || chunks < minChunksPerThread * 2 )
 			{
 				// Thread pool disabled with a setting, or not enough work for the thread pool
-				for( ptrdiff_t i = 0; i < chunks; i++ )
+				pendingChunks.resize( chunks );
+				constexpr ptrdiff_t batchSize = SpectrogramContext::batchSize;
+				for( ptrdiff_t i = 0; i < chunks; i += batchSize )
 				{
-					MelChunk& arr = pendingChunks.emplace_back();
+					const size_t count = (size_t)std::min( batchSize, chunks - i );
 					const float* sourcePcm = tempPcm.data() + i * FFT_STEP;
 					size_t availableChunks = pcmChunks - i;
 					size_t availableFloats = availableChunks * FFT_STEP;
-					melContext.fft( arr, sourcePcm, availableFloats );
+					melContext.fftBatch( pendingChunks[ i ].data(), 1, N_MEL, count, sourcePcm, availableFloats );
 				}
 			}
 			else
@@ -330,6 +381,7 @@ HRESULT MelStreamerThread::threadMain()
 		}
 
 		EnterCriticalSection( &m_cs.m_sec );
+		producing = false;
 		if( shuttingDown )
 		{
 			LeaveCriticalSection( &m_cs.m_sec );
@@ -360,13 +412,14 @@ HRESULT MelStreamerThread::threadPoolCallback( int ith ) noexcept
 
 	// Run these FFTs
 	const size_t pcmChunks = tempPcm.size() / FFT_STEP;
-	for( int i = i0; i < i1; i++ )
+	constexpr int batchSize = (int)SpectrogramContext::batchSize;
+	for( int i = i0; i < i1; i += batchSize )
 	{
-		MelChunk& arr = pendingChunks[ i ];
+		const size_t count = (size_t)std::min( batchSize, i1 - i );
 		const float* sourcePcm = tempPcm.data() + i * FFT_STEP;
 		size_t availableChunks = pcmChunks - i;
 		size_t availableFloats = availableChunks * FFT_STEP;
-		ctx.fft( arr, sourcePcm, availableFloats );
+		ctx.fftBatch( pendingChunks[ i ].data(), 1, N_MEL, count, sourcePcm, availableFloats );
 	}
 	return S_OK;
 }
@@ -422,8 +475,13 @@ HRESULT MelStreamerThread::makeBuffer( size_t off, size_t len, const float** buf
 
 		if( off > streamStartOffset )
 		{
+			// When the seek goes past the computed MEL chunks, wait for the background thread to publish its current batch.
+			// Then it's not using the reader nor the PCM queues, and dropOldChunks() can move the reader.
+			while( off - streamStartOffset > queueMel.size() && producing && threadStatus == eThreadStatus::Working )
+				SleepConditionVariableCS( &wakeMain, &m_cs.m_sec, INFINITE );
+
 			// The model wants to advance forward, drop now irrelevant chunks of data
-			dropOldChunks( off );
+			CHECK( dropOldChunks( off ) );
 			wakeThread = ( threadStatus == eThreadStatus::Working || threadStatus == eThreadStatus::Idle );
 		}
 
@@ -11,7 +11,7 @@
 namespace Whisper
 {
 	// Base class for both single- and multi-threaded MEL streamers
-	// Used by iContext.runStreamed method
+	// Used by iContext.runStreamed method, and by iContext.runFull for the audio already in memory
 	class MelStreamer : public iSpectrogram
 	{
 	protected:
@@ -28,8 +28,9 @@ namespace Whisper
 		std::deque<PcmStereoChunk> queuePcmStereo;
 
 		// If the streamStartOffset value is less than the argument,
-		// remove ( off - streamStartOffset ) chunks from the start of all 3 queues, and advance streamStartOffset to the `off` argument
-		void dropOldChunks( size_t off );
+		// remove up to ( off - streamStartOffset ) chunks from the start of all 3 queues, and advance streamStartOffset to the `off` argument.
+		// When the new position is past the queued PCM, the queues are cleared, and the reader skips the remaining chunks.
+		HRESULT dropOldChunks( size_t off );
 
 		// Ensure PCM queues have enough chunks to generate specified count of MEL chunks
 		// At the end of the stream, the method delivers less chunks then requested and returns S_FALSE
@@ -41,6 +42,9 @@ namespace Whisper
 
 		size_t lastBufferEnd = ~(size_t)0;
 		float lastBufferMax = 0.0f;
+		// When set, the normalization uses this maximum instead of the maximum of the requested window
+		bool hasFixedMaximum = false;
+		float fixedMaximum = 0.0f;
 		void makeTransposedBuffer( size_t off, size_t len );
 
 		size_t getLength() const noexcept override final { return reader.getLength(); }
@@ -49,6 +53,16 @@ namespace Whisper
 
 	public:
 		MelStreamer( const Filters& filters, ProfileCollection& profiler, const iAudioReader* reader );
+		// The stream starts at the specified chunk, makeBuffer() fails for earlier offsets
+		MelStreamer( const Filters& filters, ProfileCollection& profiler, const iAudioBuffer* buffer, size_t startOffset );
+
+		// Normalize against the maximum of the complete audio, like Spectrogram does.
+		// Finding that maximum costs an extra pass over the audio before streaming, see computeMelMaximum(); the profiler reports it as MelMaximum.
+		void setMaximum( float mmax )
+		{
+			fixedMaximum = mmax;
+			hasFixedMaximum = true;
+		}
 	};
 
 	// Single-threaded MEL streamer: runs these FFTs on-demand, from within makeBuffer() method
@@ -60,6 +74,8 @@ namespace Whisper
 	public:
 		MelStreamerSimple( const Filters& filters, ProfileCollection& profiler, const iAudioReader* reader ) :
 			MelStreamer( filters, profiler, reader ) { }
+		MelStreamerSimple( const Filters& filters, ProfileCollection& profiler, const iAudioBuffer* buffer, size_t startOffset ) :
+			MelStreamer( filters, profiler, buffer, startOffset ) { }
 	};
 
 	// Multi threaded MEL streamers: runs FFT on a background thread ahead of time
@@ -92,13 +108,18 @@ namespace Whisper
 		};
 		eThreadStatus threadStatus;
 		bool shuttingDown = false;
+		// True while the background thread reads PCM and runs FFTs outside of the critical section
+		bool producing = false;
 		CHandle threadHandle;
 
 		HRESULT threadPoolCallback( int ith ) noexcept override final;
+		// Create the worker contexts, and launch the background thread
+		void startThread( const Filters& filters );
 
 	public:
 
 		MelStreamerThread( const Filters& filters, ProfileCollection& profiler, const iAudioReader* reader, int countThreads );
+		MelStreamerThread( const Filters& filters, ProfileCollection& profiler, const iAudioBuffer* buffer, size_t startOffset, int countThreads );
 
 		~MelStreamerThread();
 	};
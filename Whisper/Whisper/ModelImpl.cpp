@@ -59,13 +59,22 @@ HRESULT ModelImpl::createClone( const ModelImpl& source )
 	return model.createClone( source.model );
 }
 
-HRESULT ModelImpl::load( iReadStream* stm, bool hybrid, const sLoadModelCallbacks* callbacks )
+HRESULT ModelImpl::load( iReadStream* stm, bool hybrid, const sLoadModelCallbacks* callbacks, MappedFile* mapped, const CpuCompute::ModelCacheFile* cache )
 {
 	auto ts = device.setForCurrentThread();
 	CHECK( device.create( gpuFlags, adapter ) );
-	return model.load( stm, hybrid, callbacks );
+	return model.load( stm, hybrid, gpuFlags, callbacks, mapped, cache );
 }
 
+#if BUILD_HYBRID_VERSION
+HRESULT ModelImpl::loadCache( const CpuCompute::ModelCacheFile& cache )
+{
+	auto ts = device.setForCurrentThread();
+	CHECK( device.create( gpuFlags, adapter ) );
+	return model.loadCache( cache, gpuFlags );
+}
+#endif
+
 inline bool hasSse41AndF16C()
 {
 	int cpu_info[ 4 ];
@@ -137,17 +146,64 @@ HRESULT __stdcall Whisper::loadGpuModel( const wchar_t* path, const sModelSetup&
 		return ERROR_HV_CPUID_FEATURE_VALIDATION;
 	}
 
-	ComLight::Object<ReadStream> stream;
-	HRESULT hr = stream.open( path );
-	if( FAILED( hr ) )
+	ComLight::CComPtr<ComLight::Object<ModelImpl>> obj;
+	CHECK( ComLight::Object<ModelImpl>::create( obj, setup ) );
+
+	HRESULT hr;
+	CpuCompute::ModelCacheFile cache;
+	const CpuCompute::ModelCacheFile* saveCache = nullptr;
+#if BUILD_HYBRID_VERSION
+	if( hybrid && 0 != ( setup.flags & (uint32_t)eGpuModelFlags::ModelCache ) )
 	{
-		logError16( L"Unable to open model binary file \"%s\"", path );
-		return hr;
+		if( 0 != ( setup.flags & (uint32_t)eGpuModelFlags::NumaAware ) )
+			logDebug( u8"eGpuModelFlags.ModelCache is ignored with eGpuModelFlags.NumaAware" );
+		else
+		{
+			CHECK( cache.initialize( path ) );
+			hr = obj->loadCache( cache );
+			if( S_OK == hr )
+			{
+				obj.detach( pp );
+				logInfo16( L"Loaded model from the compiled cache \"%s\"", cache.path.c_str() );
+				return S_OK;
+			}
+			if( FAILED( hr ) )
+			{
+				// The cache is damaged, start over with a new object, the normal load will overwrite the cache
+				logWarningHr( hr, u8"Unable to load the compiled model cache" );
+				obj.release();
+				CHECK( ComLight::Object<ModelImpl>::create( obj, setup ) );
+			}
+			saveCache = &cache;
+		}
 	}
+#endif
 
-	ComLight::CComPtr<ComLight::Object<ModelImpl>> obj;
-	CHECK( ComLight::Object<ModelImpl>::create( obj, setup ) );
-	hr = obj->load( &stream, hybrid, callbacks );
+	if( 0 != ( setup.flags & (uint32_t)eGpuModelFlags::MemoryMapped ) )
+	{
+		MappedFile mapped;
+		hr = mapped.open( path );
+		if( FAILED( hr ) )
+		{
+			logError16( L"Unable to map model binary file \"%s\"", path );
+			return hr;
+		}
+		// The headers are parsed from the mapped pages, the tensors are used or copied from there without reading the file
+		ComLight::Object<MappedReadStream> stream;
+		stream.attach( mapped );
+		hr = obj->load( &stream, hybrid, callbacks, &mapped, saveCache );
+	}
+	else
+	{
+		ComLight::Object<ReadStream> stream;
+		hr = stream.open( path );
+		if( FAILED( hr ) )
+		{
+			logError16( L"Unable to open model binary file \"%s\"", path );
+			return hr;
+		}
+		hr = obj->load( &stream, hybrid, callbacks, nullptr, saveCache );
+	}
 	if( FAILED( hr ) )
 	{
 		logError16( L"Error loading the model from \"%s\"", path );
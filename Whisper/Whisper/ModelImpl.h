@@ -4,6 +4,7 @@
 #include "WhisperModel.h"
 #include "../ComLightLib/streams.h"
 #include "../ML/Device.h"
+#include "../Utils/MappedFile.h"
 
 namespace Whisper
 {
@@ -60,6 +61,9 @@ namespace Whisper
 
 		void FinalRelease();
 
-		HRESULT load( iReadStream* stm, bool hybrid, const sLoadModelCallbacks* callbacks );
+		HRESULT load( iReadStream* stm, bool hybrid, const sLoadModelCallbacks* callbacks, MappedFile* mapped = nullptr, const CpuCompute::ModelCacheFile* cache = nullptr );
+#if BUILD_HYBRID_VERSION
+		HRESULT loadCache( const CpuCompute::ModelCacheFile& cache );
+#endif
 	};
 }
\ No newline at end of file
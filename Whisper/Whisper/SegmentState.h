@@ -0,0 +1,89 @@
+#pragma once
+#include <vector>
+#include "sTokenData.h"
+
+namespace Whisper
+{
+	// State of the decoder loop for a single window of audio, used by the beam search and the batched decoding
+	struct SegmentState
+	{
+		std::vector<sTokenData> tokens;
+		int seekDelta = 100 * WHISPER_CHUNK_SIZE;
+		int resultLength = 0;
+		// have we already sampled a non-beg timestamp token for the current segment?
+		bool hasTimestamp = false;
+
+		void clear()
+		{
+			tokens.clear();
+			seekDelta = 100 * WHISPER_CHUNK_SIZE;
+			resultLength = 0;
+			hasTimestamp = false;
+		}
+	};
+
+	enum struct eSegmentStatus : uint8_t
+	{
+		Active,
+		Finished,
+		Failed,
+	};
+
+	// Per-window constants for the SegmentState, the logic is the same as in the greedy loop of ContextImpl::runFullImpl
+	struct SegmentRules
+	{
+		whisper_token token_beg, token_eot;
+		int seek, seek_end;
+		int max_tokens;
+		bool singleSegment;
+
+		// Append a token to the state, i is the index of the token in the current window
+		eSegmentStatus append( SegmentState& state, const sTokenData& token, int i ) const
+		{
+			// timestamp token - update sliding window
+			if( token.id > token_beg )
+			{
+				const int seek_delta_new = 2 * ( token.id - token_beg );
+
+				// do not allow to go back in time
+				if( state.hasTimestamp && state.seekDelta > seek_delta_new && state.resultLength < i )
+					return eSegmentStatus::Finished;
+
+				state.seekDelta = seek_delta_new;
+				state.resultLength = i + 1;
+				state.hasTimestamp = true;
+			}
+
+			state.tokens.push_back( token );
+
+			// end of segment
+			if( token.id == token_eot ||
+				( max_tokens > 0 && i >= max_tokens ) ||
+				( state.hasTimestamp && seek + state.seekDelta + 100 >= seek_end ) )
+			{
+				if( state.resultLength == 0 )
+				{
+					if( seek + state.seekDelta + 100 >= seek_end )
+						state.resultLength = i + 1;
+					else
+						return eSegmentStatus::Failed;
+				}
+
+				if( singleSegment )
+				{
+					state.resultLength = i + 1;
+					state.seekDelta = 100 * WHISPER_CHUNK_SIZE;
+				}
+				return eSegmentStatus::Finished;
+			}
+			return eSegmentStatus::Active;
+		}
+
+		// sometimes, the decoding can get stuck in a repetition loop
+		// When the loop reached the length limit, the result is only accepted when it looks like a complete segment
+		static bool acceptIncomplete( const SegmentState& state )
+		{
+			return state.resultLength != 0 && state.seekDelta >= 100 * WHISPER_CHUNK_SIZE / 2;
+		}
+	};
+}
\ No newline at end of file
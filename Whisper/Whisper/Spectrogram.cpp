@@ -31,15 +31,16 @@ public:
 
 void Spectrogram::MelContext::run( int ith )
 {
-	std::array<float, N_MEL> arr;
-	for( uint32_t i = ith; i < result.length; i += n_threads )
+	// Threads take batches of consecutive frames, the FFT computes them at once, writing directly into the transposed output
+	constexpr size_t batchSize = SpectrogramContext::batchSize;
+	const size_t length = result.length;
+	const size_t countBatches = ( length + batchSize - 1 ) / batchSize;
+	for( size_t b = ith; b < countBatches; b += n_threads )
 	{
-		const int offset = i * FFT_STEP;
-		const float* rsi = samples + offset;
-		context.fft( arr, rsi, countSamples - offset );
-
-		for( size_t j = 0; j < N_MEL; j++ )
-			result.data[ j * result.length + i ] = arr[ j ];
+		const size_t i = b * batchSize;
+		const size_t offset = i * FFT_STEP;
+		const size_t count = std::min( batchSize, length - i );
+		context.fftBatch( result.data.data() + i, length, 1, count, samples + offset, countSamples - offset );
 	}
 }
 
@@ -121,6 +122,219 @@ HRESULT Spectrogram::pcmToMel( const iAudioBuffer* buffer, const Filters& filter
 	return S_OK;
 }
 
+namespace
+{
+	// Upper bound of the MEL values of a frame, before the logarithm.
+	// The power spectrum of the windowed frame sums to FFT_SIZE times the energy of that frame (Parseval's theorem),
+	// and the filter bank can't output more than its largest weight times that sum.
+	// This only costs a dot product per frame, way cheaper than the FFT and the filter bank.
+	class MelBound
+	{
+		alignas( 32 ) std::array<float, FFT_SIZE> windowSquared;
+		float scale;
+
+	public:
+		MelBound( const Filters& filters )
+		{
+			for( size_t i = 0; i < FFT_SIZE; i++ )
+				windowSquared[ i ] = s_hanning[ i ] * s_hanning[ i ];
+			float maxWeight = 0;
+			for( float w : filters.bandWeights )
+				maxWeight = std::max( maxWeight, w );
+			// 1% margin for the rounding errors of the FFT
+			scale = maxWeight * (float)FFT_SIZE * 1.01f;
+		}
+
+		// Bound of the frame at the pcm pointer; length is the count of samples available there, the rest of the frame is zeros
+		float frame( const float* pcm, size_t length ) const
+		{
+			const size_t available = std::min( length, (size_t)FFT_SIZE );
+			const size_t availableAligned = available & ~(size_t)7;
+			__m256 acc = _mm256_setzero_ps();
+			size_t i;
+			for( i = 0; i < availableAligned; i += 8 )
+			{
+				const __m256 x = _mm256_loadu_ps( pcm + i );
+				acc = _mm256_add_ps( acc, _mm256_mul_ps( _mm256_mul_ps( x, x ), _mm256_load_ps( &windowSquared[ i ] ) ) );
+			}
+			__m128 v = _mm_add_ps( _mm256_castps256_ps128( acc ), _mm256_extractf128_ps( acc, 1 ) );
+			v = _mm_add_ps( v, _mm_movehl_ps( v, v ) );
+			v = _mm_add_ss( v, _mm_movehdup_ps( v ) );
+			float energy = _mm_cvtss_f32( v );
+			for( ; i < available; i++ )
+				energy += pcm[ i ] * pcm[ i ] * windowSquared[ i ];
+			return energy * scale;
+		}
+	};
+
+	// State shared by the threads computing the maximum
+	struct MelMaxShared
+	{
+		const float* samples;
+		size_t countSamples;
+		// Count of frames, same as Spectrogram.length
+		size_t length;
+		int n_threads;
+		MelBound bound;
+		// Exact MEL value of the loudest frame, the initial maximum of the second pass
+		float initialMaximum = -1e20f;
+
+		MelMaxShared( const float* rsi, size_t len, const Filters& filters, int countThreads ) :
+			samples( rsi ), countSamples( len ), length( len / FFT_STEP ), n_threads( countThreads ), bound( filters )
+		{ }
+	};
+
+	class alignas( 64 ) MelMaxContext
+	{
+		const MelMaxShared& shared;
+		SpectrogramContext context;
+		std::array<float, N_MEL * SpectrogramContext::batchSize> batch;
+
+	public:
+		// First pass: the frame with the largest bound
+		float loudestBound = -1;
+		size_t loudestFrame = 0;
+		// Second pass: maximum MEL value of the frames computed by this thread
+		float maximum = -1e20f;
+		bool secondPass = false;
+
+		MelMaxContext( const MelMaxShared& s, const Filters& f ) :
+			shared( s ), context( f )
+		{ }
+
+		// Exact maximum MEL value of a single frame
+		float computeFrame( size_t i )
+		{
+			const size_t offset = i * FFT_STEP;
+			context.fftBatch( batch.data(), 1, N_MEL, 1, shared.samples + offset, shared.countSamples - offset );
+			return *std::max_element( batch.begin(), batch.begin() + N_MEL );
+		}
+
+		// Same batches of frames as Spectrogram::MelContext::run, the output only lives in the small batch buffer
+		void run( int ith )
+		{
+			constexpr size_t batchSize = SpectrogramContext::batchSize;
+			const size_t length = shared.length;
+			const size_t countBatches = ( length + batchSize - 1 ) / batchSize;
+
+			if( !secondPass )
+			{
+				for( size_t b = ith; b < countBatches; b += shared.n_threads )
+				{
+					const size_t end = std::min( ( b + 1 ) * batchSize, length );
+					for( size_t i = b * batchSize; i < end; i++ )
+					{
+						const size_t offset = i * FFT_STEP;
+						const float f = shared.bound.frame( shared.samples + offset, shared.countSamples - offset );
+						if( f > loudestBound )
+						{
+							loudestBound = f;
+							loudestFrame = i;
+						}
+					}
+				}
+				return;
+			}
+
+			// Only run the FFTs of the batches where the bound exceeds the current maximum, the other frames can't change the result
+			maximum = shared.initialMaximum;
+			float limit = powf( 10.0f, maximum );
+			for( size_t b = ith; b < countBatches; b += shared.n_threads )
+			{
+				const size_t i = b * batchSize;
+				const size_t offset = i * FFT_STEP;
+				const size_t count = std::min( batchSize, length - i );
+				float batchBound = 0;
+				for( size_t j = 0; j < count; j++ )
+				{
+					const size_t off = offset + j * FFT_STEP;
+					batchBound = std::max( batchBound, shared.bound.frame( shared.samples + off, shared.countSamples - off ) );
+				}
+				if( batchBound <= limit )
+					continue;
+
+				context.fftBatch( batch.data(), 1, N_MEL, count, shared.samples + offset, shared.countSamples - offset );
+				const float prev = maximum;
+				for( size_t j = 0; j < count * N_MEL; j++ )
+					maximum = std::max( maximum, batch[ j ] );
+				if( maximum != prev )
+					limit = powf( 10.0f, maximum );
+			}
+		}
+
+		static HRESULT workCallback( int ith, void* ctx ) noexcept
+		{
+			std::vector<MelMaxContext>& contexts = *(std::vector<MelMaxContext>*)ctx;
+			try
+			{
+				contexts.at( ith ).run( ith );
+				return S_OK;
+			}
+			catch( const std::bad_alloc& )
+			{
+				return E_OUTOFMEMORY;
+			}
+			catch( const std::exception& )
+			{
+				return E_FAIL;
+			}
+		}
+	};
+}
+
+HRESULT Whisper::computeMelMaximum( const iAudioBuffer* buffer, const Filters& filters, int threads, float& rdi )
+{
+	if( nullptr == buffer )
+		return E_POINTER;
+	const uint32_t countSamples = buffer->countSamples();
+	if( 0 == countSamples )
+		return OLE_E_BLANK;
+
+	try
+	{
+		MelMaxShared shared{ buffer->getPcmMono(), countSamples, filters, std::max( threads, 1 ) };
+		if( 0 == shared.length )
+		{
+			// Same as the normalization of an empty spectrogram
+			rdi = -1e20f;
+			return S_OK;
+		}
+
+		std::vector<MelMaxContext> contexts;
+		contexts.reserve( shared.n_threads );
+		for( int i = 0; i < shared.n_threads; i++ )
+			contexts.emplace_back( shared, filters );
+
+		// First pass finds the loudest frame, the exact MEL values of that frame are the initial maximum for the second pass
+		if( shared.n_threads < 2 )
+			contexts[ 0 ].run( 0 );
+		else
+			CHECK( parallelFor( &MelMaxContext::workCallback, shared.n_threads, &contexts ) );
+		const MelMaxContext* loudest = &contexts[ 0 ];
+		for( const auto& c : contexts )
+			if( c.loudestBound > loudest->loudestBound )
+				loudest = &c;
+		shared.initialMaximum = contexts[ 0 ].computeFrame( loudest->loudestFrame );
+
+		for( auto& c : contexts )
+			c.secondPass = true;
+		if( shared.n_threads < 2 )
+			contexts[ 0 ].run( 0 );
+		else
+			CHECK( parallelFor( &MelMaxContext::workCallback, shared.n_threads, &contexts ) );
+
+		float mmax = -1e20f;
+		for( const auto& c : contexts )
+			mmax = std::max( mmax, c.maximum );
+		rdi = mmax;
+		return S_OK;
+	}
+	catch( const std::bad_alloc& )
+	{
+		return E_OUTOFMEMORY;
+	}
+}
+
 void Whisper::computeSignalEnergy( std::vector<float>& result, const iAudioBuffer* buffer, int n_samples_per_half_window )
 {
 	const size_t countSamples = buffer->countSamples();
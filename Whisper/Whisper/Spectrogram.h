@@ -44,4 +44,9 @@ namespace Whisper
 
 	// average the fabs of the signal
 	void computeSignalEnergy( std::vector<float>& result, const iAudioBuffer* buffer, int n_samples_per_half_window );
+
+	// Maximum MEL value of the complete audio, same as the one used by Spectrogram.pcmToMel for the normalization.
+	// Doesn't store the spectrogram. A cheap bound from the energy of every frame skips the FFTs of the frames which can't reach the maximum,
+	// for typical audio only the loud parts are transformed twice, here and again by the MEL streamer.
+	HRESULT computeMelMaximum( const iAudioBuffer* buffer, const Filters& filters, int threads, float& rdi );
 }
\ No newline at end of file
@@ -296,10 +296,6 @@ void WhisperContext::createKeyValueBuffers( const sEncodeParams& encParams )
 		const uint32_t n_elements = encParams.n_text_state * n_mem;
 		kvCross.resize( n_elements );
 	}
-
-#if BUILD_HYBRID_VERSION
-	if( !hybridContext )
-#endif
 	{
 		const uint32_t n_mem = encParams.n_text_layer * encParams.n_text_ctx;
 		const uint32_t n_elements = encParams.n_text_state * n_mem;
@@ -307,8 +303,19 @@ void WhisperContext::createKeyValueBuffers( const sEncodeParams& encParams )
 	}
 }
 
-Tensor WhisperContext::encode( Whisper::iSpectrogram& spectrogram, const sEncodeParams& encParams )
+Tensor WhisperContext::encode( Whisper::iSpectrogram& spectrogram, const sEncodeParams& encParams, int threads, uint32_t crossSlot )
 {
+#if BUILD_HYBRID_VERSION
+	if( hybridContext )
+	{
+		// The hybrid model runs the complete encoder on CPU, the output goes straight into the cross-attention buffers in system RAM
+		check( hybridContext->encode( spectrogram, encParams, threads, crossSlot ) );
+		return Tensor{};
+	}
+#endif
+	if( 0 != crossSlot )
+		throw E_NOTIMPL;
+
 	auto prof = profiler.block( eProfilerBlock::Encode );
 	CaptureRaii renderdocCapture;
 	profiler.profileShaders = profileEncodeShaders;
@@ -387,14 +394,6 @@ Tensor WhisperContext::encode( Whisper::iSpectrogram& spectrogram, const sEncode
 			copyImpl( Vcross, v, Vcross.getType() == eDataType::FP32 );
 		}
 	}
-
-#if BUILD_HYBRID_VERSION
-	if( hybridContext )
-	{
-		// When running hybrid model, download cross-attention buffers from VRAM to system RAM
-		check( hybridContext->downloadKeyValues( kvCross ) );
-	}
-#endif
 	return cur;
 }
 
@@ -585,6 +584,7 @@ void WhisperContext::decode( const int* tokens, const int n_tokens, const sDecod
 		HybridContext::sDecParams sdp;
 		sdp.n_threads = threads;
 		sdp.M = decParams.M;
+		sdp.allRows = decParams.allRows;
 		check( hybridContext->decode( tokens, n_tokens, decParams.n_past, sdp, probs ) );
 		return;
 	}
@@ -638,6 +638,70 @@ void WhisperContext::decode( const int* tokens, const int n_tokens, const sDecod
 	Tracing::vector( "probs", probs );
 }
 
+HRESULT WhisperContext::createSlots( uint32_t self, uint32_t cross )
+{
+#if BUILD_HYBRID_VERSION
+	if( hybridContext )
+		return hybridContext->createSlots( self, cross );
+#endif
+	// The GPU model doesn't have KV cache slots
+	return E_NOTIMPL;
+}
+
+void WhisperContext::decodeSample( const int* tokens, const int n_tokens, const sDecodeParams& decParams, const sSampleRules& rules, sSampledToken* results, int threads )
+{
+#if BUILD_HYBRID_VERSION
+	if( hybridContext )
+	{
+		auto cppp = profiler.cpuBlock( Whisper::eCpuBlock::DecodeStep );
+		HybridContext::sDecParams sdp;
+		sdp.n_threads = threads;
+		sdp.M = decParams.M;
+		sdp.allRows = decParams.allRows;
+		check( hybridContext->decodeSample( tokens, n_tokens, decParams.n_past, sdp, rules, results ) );
+		return;
+	}
+#endif
+	throw E_NOTIMPL;
+}
+
+void WhisperContext::decodeBatch( const int* tokens, const sBatchRow* rows, const int n_rows, const sDecodeParams& decParams, std::vector<float>& probs, int threads )
+{
+#if BUILD_HYBRID_VERSION
+	if( hybridContext )
+	{
+		auto cppp = profiler.cpuBlock( Whisper::eCpuBlock::DecodeStep );
+		HybridContext::sDecParams sdp;
+		sdp.n_threads = threads;
+		sdp.M = decParams.M;
+		check( hybridContext->decodeBatch( tokens, rows, n_rows, sdp, probs ) );
+		return;
+	}
+#endif
+	throw E_NOTIMPL;
+}
+
+HRESULT WhisperContext::forkBeam( uint32_t dest, uint32_t source, uint32_t length )
+{
+#if BUILD_HYBRID_VERSION
+	if( hybridContext )
+		return hybridContext->forkBeam( dest, source, length );
+#endif
+	return E_NOTIMPL;
+}
+
+HRESULT WhisperContext::swapCrossAttention( WhisperContext& that )
+{
+#if BUILD_HYBRID_VERSION
+	if( hybridContext && that.hybridContext )
+	{
+		hybridContext->swapCrossAttention( *that.hybridContext );
+		return S_OK;
+	}
+#endif
+	return E_NOTIMPL;
+}
+
 __m128i WhisperContext::Arenas::getMemoryUse() const
 {
 	__m128i res = outer.getMemoryUse();
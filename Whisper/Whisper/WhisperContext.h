@@ -93,18 +93,58 @@ namespace DirectCompute
 		WhisperContext( const Whisper::WhisperModel& wm, Whisper::ProfileCollection& pc );
 		WhisperContext( const WhisperContext& ) = delete;
 
-		Tensor encode( Whisper::iSpectrogram& spectrogram, const sEncodeParams& encParams );
+		// The threads argument is only used by the hybrid model, the GPU model ignores that number
+		// Non-zero crossSlot is only supported by the hybrid model, for batched decoding of multiple streams
+		Tensor encode( Whisper::iSpectrogram& spectrogram, const sEncodeParams& encParams, int threads, uint32_t crossSlot = 0 );
 
+		// The callers only use the last n_vocab elements of probs, the probabilities after the last token.
+		// The hybrid model only computes that row unless decParams.allRows is set, the GPU model computes a row for every token.
 		void decode( const int* tokens, const int n_tokens, const sDecodeParams& decParams, std::vector<float>& probs, int threads );
 
+		// Decode the tokens, and sample the next one without computing the probabilities of the complete vocabulary.
+		// Only implemented by the hybrid model, the GPU model throws E_NOTIMPL
+		void decodeSample( const int* tokens, const int n_tokens, const sDecodeParams& decParams, const sSampleRules& rules, sSampledToken* results, int threads );
+
+		// Beam search and batched decoding support, only implemented by the hybrid model; the GPU model returns E_NOTIMPL
+		HRESULT createSlots( uint32_t self, uint32_t cross );
+		// Decode a batch of tokens from independent sequences, the output has n_rows rows of probabilities
+		void decodeBatch( const int* tokens, const sBatchRow* rows, const int n_rows, const sDecodeParams& decParams, std::vector<float>& probs, int threads );
+		// Copy KV cache history of the beam into another slot
+		HRESULT forkBeam( uint32_t dest, uint32_t source, uint32_t length );
+		// Exchange the cross-attention buffers with another context of the same model, only implemented by the hybrid model
+		HRESULT swapCrossAttention( WhisperContext& that );
+
 		static WhisperContext& current();
 
+		// True for the hybrid model, which doesn't use the GPU after the context is created.
+		// Contexts of the hybrid model can run concurrently on different threads.
+		bool isHybrid() const
+		{
+#if BUILD_HYBRID_VERSION
+			return (bool)hybridContext;
+#else
+			return false;
+#endif
+		}
+
 		// Create a RAII object which measures both CPU and GPU time for the complete runFull() method
+		// The hybrid model only measures CPU time: GPU timestamp queries would touch the single-threaded D3D device from concurrent contexts
 		decltype( auto ) completeProfiler()
 		{
+#if BUILD_HYBRID_VERSION
+			if( hybridContext )
+				return std::make_tuple(
+					profiler.cpuBlock( Whisper::eCpuBlock::Run ),
+					std::optional<GpuProfiler::BlockRaii>{} );
+			else
+				return std::make_tuple(
+					profiler.cpuBlock( Whisper::eCpuBlock::Run ),
+					std::optional<GpuProfiler::BlockRaii>{ std::in_place, profiler.block( eProfilerBlock::Run ) } );
+#else
 			return std::make_tuple(
 				profiler.cpuBlock( Whisper::eCpuBlock::Run ),
 				profiler.block( eProfilerBlock::Run ) );
+#endif
 		}
 
 		// Create a RAII object which measures CPU and optionally GPU time for the loop which calls decode() method
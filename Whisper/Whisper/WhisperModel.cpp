@@ -7,6 +7,7 @@
 #include "../Utils/GpuProfilerSimple.h"
 #include "../Utils/CpuProfiler.h"
 #include "../CPU/HybridLoader.h"
+#include "../CPU/mulMat.h"
 #include "../ML/Reshaper.h"
 using namespace Whisper;
 using namespace DirectCompute;
@@ -105,20 +106,17 @@ namespace
 		}
 	}
 
-	void populateDecodeTensorsMap( CAtlMap<CStringA, PendingTensor>& map, int layersDec, DirectCompute::ModelBuffers& tensors, bool hybrid )
+	void populateDecodeTensorsMap( CAtlMap<CStringA, PendingTensor>& map, int layersDec, DirectCompute::ModelBuffers& tensors )
 	{
 		tensors.dec.layers.resize( layersDec );
 		CStringA tempString;
 		// Decoder tensors
 
 		auto& dec = tensors.dec;
-		if( !hybrid )
-		{
-			map[ "decoder.positional_embedding" ] = dec.positionalEmbedding;
-			map[ "decoder.token_embedding.weight" ] = dec.tokenEmbedding;
-			map[ "decoder.ln.weight" ] = dec.ln.w;
-			map[ "decoder.ln.bias" ] = dec.ln.b;
-		}
+		map[ "decoder.positional_embedding" ] = dec.positionalEmbedding;
+		map[ "decoder.token_embedding.weight" ] = dec.tokenEmbedding;
+		map[ "decoder.ln.weight" ] = dec.ln.w;
+		map[ "decoder.ln.bias" ] = dec.ln.b;
 
 		auto add = [ & ]( const char* name, int i, DirectCompute::Tensor& t, ePostProcessing pp = ePostProcessing::None )
 		{
@@ -138,9 +136,6 @@ namespace
 			auto& gpu = dec.layers[ i ];
 			add( "cross_attn.key.weight", i, gpu.crossAttnKey, ePostProcessing::MakePanels );
 			add2( "cross_attn.value", i, gpu.crossAttnValue, ePostProcessing::MakePanels );
-			if( hybrid )
-				continue;
-
 			add2( "mlp_ln", i, gpu.mlpLn );
 			add2( "mlp.0", i, gpu.mlp0, ePostProcessing::MakePanels );
 			add2( "mlp.2", i, gpu.mlp1, ePostProcessing::MakePanels );
@@ -155,10 +150,10 @@ namespace
 		}
 	}
 
-	void populateTensorsMap( CAtlMap<CStringA, PendingTensor>& map, int layersEnc, int layersDec, DirectCompute::ModelBuffers& tensors, bool hybrid )
+	void populateTensorsMap( CAtlMap<CStringA, PendingTensor>& map, int layersEnc, int layersDec, DirectCompute::ModelBuffers& tensors )
 	{
 		populateEncodeTensorsMap( map, layersEnc, tensors );
-		populateDecodeTensorsMap( map, layersDec, tensors, hybrid );
+		populateDecodeTensorsMap( map, layersDec, tensors );
 	}
 
 	struct sTensorHeader
@@ -254,10 +249,10 @@ public:
 	}
 };
 
-HRESULT WhisperModel::loadGpu( ComLight::iReadStream* stm, CallbacksImpl& callbacks )
+HRESULT WhisperModel::loadGpu( ComLight::iReadStream* stm, CallbacksImpl& callbacks, const MappedFile* mapped )
 {
 	CAtlMap<CStringA, PendingTensor> map;
-	populateTensorsMap( map, parameters.n_audio_layer, parameters.n_text_layer, tensors, false );
+	populateTensorsMap( map, parameters.n_audio_layer, parameters.n_text_layer, tensors );
 
 	DirectCompute::Reshaper reshape;
 
@@ -313,17 +308,33 @@ HRESULT WhisperModel::loadGpu( ComLight::iReadStream* stm, CallbacksImpl& callba
 		if( totalElts * cbElement > UINT_MAX )
 			return DISP_E_OVERFLOW;
 
-		try
+		const size_t payloadBytes = cbElement * totalElts;
+		const void* payload;
+		if( nullptr != mapped )
 		{
-			bytesVector.resize( cbElement * totalElts );
+			// Upload straight from the mapped pages of the file
+			int64_t pos;
+			CHECK( stm->getPosition( pos ) );
+			if( !mapped->contains( pos, payloadBytes ) )
+				return E_EOF;
+			payload = mapped->data() + pos;
+			CHECK( stm->seek( (int64_t)payloadBytes, ComLight::eSeekOrigin::Current ) );
 		}
-		catch( const std::bad_alloc& )
+		else
 		{
-			return E_OUTOFMEMORY;
+			try
+			{
+				bytesVector.resize( payloadBytes );
+			}
+			catch( const std::bad_alloc& )
+			{
+				return E_OUTOFMEMORY;
+			}
+			CHECK( readBytes( stm, bytesVector.data(), bytesVector.size() ) );
+			payload = bytesVector.data();
 		}
-		CHECK( readBytes( stm, bytesVector.data(), bytesVector.size() ) );
-		cb += bytesVector.size();
-		CHECK( p->m_value.dest->createImmutable( dt, ne, bytesVector.data() ) );
+		cb += payloadBytes;
+		CHECK( p->m_value.dest->createImmutable( dt, ne, payload ) );
 		CHECK( p->m_value.postProcess( reshape, dt ) );
 		countLoaded++;
 	}
@@ -340,17 +351,73 @@ HRESULT WhisperModel::loadGpu( ComLight::iReadStream* stm, CallbacksImpl& callba
 }
 
 #if BUILD_HYBRID_VERSION
-HRESULT WhisperModel::loadHybrid( ComLight::iReadStream* stm, CallbacksImpl& callbacks )
+namespace
 {
-	CAtlMap<CStringA, PendingTensor> map;
-	populateTensorsMap( map, parameters.n_audio_layer, parameters.n_text_layer, tensors, true );
-	DirectCompute::Reshaper reshape;
-	CpuCompute::HybridLoader loader( shared->hybridTensors, parameters.n_text_layer );
+	DirectCompute::eDataType quantizeType( uint32_t flags )
+	{
+		using DirectCompute::eDataType;
+		if( 0 != ( flags & (uint32_t)eGpuModelFlags::QuantizeQ4 ) )
+			return eDataType::Q4_0;
+		if( 0 != ( flags & (uint32_t)eGpuModelFlags::QuantizeQ8 ) )
+			return eDataType::Q8_0;
+		return eDataType::FP16;
+	}
+
+	HRESULT saveCache( ComLight::iReadStream* stm, int64_t cbPrefix, const CpuCompute::HybridLoader& loader, const CpuCompute::ModelCacheFile& cache, DirectCompute::eDataType quantize )
+	{
+		using namespace CpuCompute;
+		// Copy the parameters, MEL filters and vocabulary from the source file, loadCache() parses them with the same code
+		std::vector<uint8_t> prefix;
+		prefix.resize( (size_t)cbPrefix );
+		CHECK( stm->seek( 0, ComLight::eSeekOrigin::Begin ) );
+		CHECK( readBytes( stm, prefix.data(), prefix.size() ) );
+
+		sModelCacheHeader header = {};
+		header.magic = modelCacheMagic;
+		header.version = modelCacheVersion;
+		header.cbPrefix = (uint32_t)cbPrefix;
+		header.sourceHash = cache.sourceHash;
+		header.quantize = (uint8_t)quantize;
+		header.panelHeight = (uint8_t)prepackedPanelHeight;
+
+		ModelCacheWriter writer;
+		CHECK( writer.create( cache.path ) );
+		CHECK( writer.write( prefix.data(), prefix.size() ) );
+		CHECK( loader.saveCache( writer, header ) );
+		CHECK( writer.commit( header ) );
+		logDebug16( L"Saved the compiled model cache \"%s\"", cache.path.c_str() );
+		return S_OK;
+	}
+}
+
+HRESULT WhisperModel::loadHybrid( ComLight::iReadStream* stm, uint32_t flags, CallbacksImpl& callbacks, MappedFile* mapped, const CpuCompute::ModelCacheFile* cache )
+{
+	using DirectCompute::eDataType;
+	const eDataType quantize = quantizeType( flags );
+	// The stream is positioned right after the vocabulary
+	int64_t cbPrefix = 0;
+	if( nullptr != cache )
+		CHECK( stm->getPosition( cbPrefix ) );
+
+	shared->pinThreads = 0 != ( flags & (uint32_t)eGpuModelFlags::PinThreads );
+	if( 0 != ( flags & (uint32_t)eGpuModelFlags::NumaAware ) )
+	{
+		CHECK( shared->numaNodes.query() );
+		if( shared->numaNodes.empty() )
+			logDebug( u8"eGpuModelFlags.NumaAware is ignored, the computer has a single NUMA node" );
+	}
+
+	// The hybrid model runs both encoder and decoder on CPU, all tensors go to system RAM
+	CpuCompute::HybridLoader loader( shared->hybridTensors, parameters.n_text_layer, shared->hybridEncoder, parameters.n_audio_layer, quantize, &shared->numaNodes );
+	if( nullptr != mapped )
+	{
+		// The tensors will point into the mapped pages, the model owns the mapping.
+		// Moving the object doesn't change the address of the view, the stream keeps working.
+		shared->mappedFile = std::move( *mapped );
+		loader.setMappedFile( &shared->mappedFile );
+	}
 
-	std::vector<uint8_t> bytesVector;
-	size_t countLoaded = 0;
 	CStringA name;
-	int64_t cb = 0;
 	while( true )
 	{
 		CHECK( callbacks.call( stm ) );
@@ -375,67 +442,65 @@ HRESULT WhisperModel::loadHybrid( ComLight::iReadStream* stm, CallbacksImpl& cal
 		if( FAILED( hr ) )
 			return hr;
 
-		auto p = map.Lookup( name );
-		if( nullptr == p )
-		{
-			HRESULT hr = loader.setupTensor( name, header.n_dims, header.ftype, ne, stm, callbacks.postponedBytes );
-			if( hr == S_OK )
-				continue;
-			logError( u8"%s: unknown tensor '%s' in model file", __func__, cstr( name ) );
-			return E_INVALIDARG;
-		}
-
-		DirectCompute::eDataType dt;
-		size_t cbElement;
-		if( header.ftype == 0 )
-		{
-			dt = DirectCompute::eDataType::FP32;
-			cbElement = 4;
-		}
-		else
-		{
-			dt = DirectCompute::eDataType::FP16;
-			cbElement = 2;
-		}
+		hr = loader.setupTensor( name, header.n_dims, header.ftype, ne, stm, callbacks.postponedBytes );
+		if( hr == S_OK )
+			continue;
+		if( FAILED( hr ) )
+			return hr;
+		logError( u8"%s: unknown tensor '%s' in model file", __func__, cstr( name ) );
+		return E_INVALIDARG;
+	}
 
-		const size_t totalElts = (size_t)(uint32_t)ne[ 0 ] * (uint32_t)ne[ 1 ] * (uint32_t)ne[ 2 ];
-		if( totalElts * cbElement > UINT_MAX )
-			return DISP_E_OVERFLOW;
+	CHECK( loader.completeLoad( stm, callbacks ) );
 
-		try
-		{
-			bytesVector.resize( cbElement * totalElts );
-		}
-		catch( const std::bad_alloc& )
-		{
-			return E_OUTOFMEMORY;
-		}
-		CHECK( readBytes( stm, bytesVector.data(), bytesVector.size() ) );
-		CHECK( p->m_value.dest->createImmutable( dt, ne, bytesVector.data() ) );
-		CHECK( p->m_value.postProcess( reshape, dt ) );
-		countLoaded++;
-		cb += bytesVector.size();
+	if( nullptr != cache )
+	{
+		// The model is loaded, failing to write the cache is not an error
+		HRESULT hr = saveCache( stm, cbPrefix, loader, *cache, quantize );
+		if( FAILED( hr ) )
+			logWarningHr( hr, u8"Unable to save the compiled model cache" );
 	}
+	return S_OK;
+}
 
-	if( countLoaded != map.GetCount() )
+HRESULT WhisperModel::loadCache( const CpuCompute::ModelCacheFile& cache, uint32_t flags )
+{
+	using namespace CpuCompute;
+	MappedFile mf;
+	if( FAILED( mf.open( cache.path.c_str() ) ) )
+		return S_FALSE;
+
+	sModelCacheHeader header;
+	if( !mf.contains( 0, sizeof( header ) ) )
+		return S_FALSE;
+	memcpy( &header, mf.data(), sizeof( header ) );
+	if( header.magic != modelCacheMagic || header.version != modelCacheVersion || header.sourceHash != cache.sourceHash ||
+		header.quantize != (uint8_t)quantizeType( flags ) || header.panelHeight != prepackedPanelHeight )
 	{
-		logError( u8"Not all tensors loaded from model file - expected %zu, got %zu", map.GetCount(), countLoaded );
-		return E_INVALIDARG;
+		logDebug16( L"The compiled model cache \"%s\" is outdated", cache.path.c_str() );
+		return S_FALSE;
 	}
+	if( !mf.contains( sizeof( header ), header.cbPrefix ) )
+		return E_EOF;
 
-	constexpr double mulMb = 1.0 / ( 1 << 20 );
-	logDebug( u8"Loaded %zu GPU tensors, %g MB VRAM", countLoaded, mulMb * cb );
-
-	CHECK( loader.completeLoad( stm, callbacks ) );
+	CpuProfiler cpuPerf;
+	CallbacksImpl cb;
+	ComLight::Object<MappedReadStream> stream;
+	stream.attach( mf.data() + sizeof( header ), header.cbPrefix );
+	CHECK( loadPrefix( &stream, cb ) );
+
+	// Same quantization as in loadHybrid, the loader verifies the cached tensors have the layout made from the GGML file with these flags
+	CpuCompute::HybridLoader loader( shared->hybridTensors, parameters.n_text_layer, shared->hybridEncoder, parameters.n_audio_layer, quantizeType( flags ) );
+	CHECK( loader.loadCache( mf, header, parameters ) );
+	shared->mappedFile = std::move( mf );
+	shared->pinThreads = 0 != ( flags & (uint32_t)eGpuModelFlags::PinThreads );
+	loadTimeCpu = cpuPerf.elapsed();
 	return S_OK;
 }
 #endif
 
-HRESULT WhisperModel::load( ComLight::iReadStream* stm, bool hybrid, const sLoadModelCallbacks* callbacks )
+HRESULT WhisperModel::loadPrefix( ComLight::iReadStream* stm, CallbacksImpl& cb )
 {
-	CpuProfiler cpuPerf;
-	CallbacksImpl cb;
-	CHECK( cb.initialize( stm, callbacks ) );
 	// verify magic
 	{
 		uint32_t magic;
@@ -461,6 +526,7 @@ HRESULT WhisperModel::load( ComLight::iReadStream* stm, bool hybrid, const sLoad
 		const size_t len = (size_t)pmh.n_mel * pmh.n_fft;
 		shared->filters.data.resize( len );
 		CHECK( readBytes( stm, shared->filters.data.data(), len * 4 ) );
+		CHECK( shared->filters.makeBands() );
 
 		const int64_t cb = len * 4;
 		constexpr double mulKb = 1.0 / ( 1 << 10 );
@@ -471,22 +537,32 @@ HRESULT WhisperModel::load( ComLight::iReadStream* stm, bool hybrid, const sLoad
 	// Vocabulary
 	CHECK( shared->vocab.load( stm, parameters.n_vocab ) );
 	CHECK( cb.call( stm ) );
+	return S_OK;
+}
 
-	DirectCompute::GpuProfilerSimple gpuProfiler;
-	CHECK( gpuProfiler.create() );
+HRESULT WhisperModel::load( ComLight::iReadStream* stm, bool hybrid, uint32_t flags, const sLoadModelCallbacks* callbacks, MappedFile* mapped, const CpuCompute::ModelCacheFile* cache )
+{
+	CpuProfiler cpuPerf;
+	CallbacksImpl cb;
+	CHECK( cb.initialize( stm, callbacks ) );
+	CHECK( loadPrefix( stm, cb ) );
 
 	if( hybrid )
 	{
 #if BUILD_HYBRID_VERSION
-		CHECK( loadHybrid( stm, cb ) )
+		// Nothing is uploaded to VRAM, no need for the GPU profiler
+		CHECK( loadHybrid( stm, flags, cb, mapped, cache ) );
 #else
 		return E_NOTIMPL;
 #endif
 	}
 	else
-		CHECK( loadGpu( stm, cb ) );
-
-	CHECK( gpuProfiler.time( loadTimeGpu ) );
+	{
+		DirectCompute::GpuProfilerSimple gpuProfiler;
+		CHECK( gpuProfiler.create() );
+		CHECK( loadGpu( stm, cb, mapped ) );
+		CHECK( gpuProfiler.time( loadTimeGpu ) );
+	}
 	loadTimeCpu = cpuPerf.elapsed();
 	return S_OK;
 }
@@ -503,6 +579,8 @@ __m128i Whisper::WhisperModel::getMemoryUse() const
 {
 	size_t cb = shared->vocab.getMemoryUse();
 	cb += vectorMemoryUse( shared->filters.data );
+	cb += vectorMemoryUse( shared->filters.bands );
+	cb += vectorMemoryUse( shared->filters.bandWeights );
 	__m128i v = _mm_cvtsi64_si128( (int64_t)cb );
 	v = _mm_add_epi64( v, tensors.getMemoryUse() );
 	return v;
@@ -4,16 +4,35 @@
 #include "ModelBuffers.h"
 #include "../../ComLightLib/streams.h"
 #include "../CPU/DecoderTensors.h"
+#include "../CPU/EncoderTensors.h"
+#include "../CPU/NumaNodes.h"
+#include "../CPU/ModelCache.h"
+#include "../Utils/MappedFile.h"
 #include "../API/sLoadModelCallbacks.h"
 #include "sModelParams.h"
 
 namespace Whisper
 {
+	// Non-zero range of one MEL filter
+	struct MelFilterBand
+	{
+		// First FFT bin, and count of bins in the band
+		uint16_t begin, length;
+		// Offset of the first weight in Filters.bandWeights vector
+		uint32_t offset;
+	};
+
 	struct Filters
 	{
 		uint32_t n_mel;
 		uint32_t n_fft;
 		std::vector<float> data;
+		// Sparse version of the data matrix: each filter only covers a small band of the FFT bins
+		std::vector<MelFilterBand> bands;
+		std::vector<float> bandWeights;
+
+		// Build the sparse representation from the dense matrix, called once after the filters are loaded
+		HRESULT makeBands();
 	};
 
 	struct ModelShared
@@ -22,19 +41,35 @@ namespace Whisper
 		Filters filters;
 #if BUILD_HYBRID_VERSION
 		CpuCompute::DecoderTensors hybridTensors;
+		CpuCompute::EncoderTensors hybridEncoder;
+		// Empty unless eGpuModelFlags::NumaAware and the computer has multiple NUMA nodes
+		CpuCompute::NumaNodes numaNodes;
+		// eGpuModelFlags::PinThreads
+		bool pinThreads = false;
+		// With eGpuModelFlags::MemoryMapped, some of the above tensors point into the mapped pages of the model file.
+		// When loaded from the compiled model cache, this is the mapped cache file, and all tensors point there.
+		MappedFile mappedFile;
 #endif
 	};
 
 	// The complete model, as loaded from a GGML binary file.
 	// The entire model is immutable, and can be safely used from multiple threads in parallel.
 	// The tensors are uploaded to VRAM and don’t stay in system memory, everything else is in the system RAM.
+	// The hybrid model is the exception, it keeps all the tensors in system RAM, and runs both encoder and decoder on CPU.
 	struct WhisperModel
 	{
 		sModelParams parameters;
 		std::shared_ptr<ModelShared> shared;
 		DirectCompute::ModelBuffers tensors;
 
-		HRESULT load( ComLight::iReadStream* stm, bool hybrid, const sLoadModelCallbacks* callbacks );
+		// When `mapped` is not nullptr, the stream reads from that memory mapped file, and the hybrid model takes ownership of the mapping
+		// When `cache` is not nullptr, the hybrid model also writes the loaded tensors into that cache file
+		HRESULT load( ComLight::iReadStream* stm, bool hybrid, uint32_t flags, const sLoadModelCallbacks* callbacks, MappedFile* mapped = nullptr,
+			const CpuCompute::ModelCacheFile* cache = nullptr );
+#if BUILD_HYBRID_VERSION
+		// Load the hybrid model from the compiled model cache; S_FALSE when the cache is missing, or was made from a different model or with different flags
+		HRESULT loadCache( const CpuCompute::ModelCacheFile& cache, uint32_t flags );
+#endif
 		HRESULT createClone( const WhisperModel& rsi );
 
 		// A vector of 2 uint64_t values, both numbers are 100 nanosecond ticks:
@@ -54,7 +89,8 @@ namespace Whisper
 
 		class CallbacksImpl;
 
-		HRESULT loadGpu( ComLight::iReadStream* stm, CallbacksImpl& callbacks );
-		HRESULT loadHybrid( ComLight::iReadStream* stm, CallbacksImpl& callbacks );
+		HRESULT loadGpu( ComLight::iReadStream* stm, CallbacksImpl& callbacks, const MappedFile* mapped );
+		HRESULT loadPrefix( ComLight::iReadStream* stm, CallbacksImpl& callbacks );
+		HRESULT loadHybrid( ComLight::iReadStream* stm, uint32_t flags, CallbacksImpl& callbacks, MappedFile* mapped, const CpuCompute::ModelCacheFile* cache );
 	};
 }
\ No newline at end of file
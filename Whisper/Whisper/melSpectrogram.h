@@ -2,6 +2,7 @@
 #include "audioConstants.h"
 #include "WhisperModel.h"
 #include <memory>
+#include <immintrin.h>
 
 namespace Whisper
 {
@@ -22,13 +23,24 @@ namespace Whisper
 	class SpectrogramContext
 	{
 		const Filters& filters;
-		static float* fftRecursion( float* temp, const float* const rsi, const size_t len );
-		std::unique_ptr<float[]> tempBuffer;
+		// Work buffers of the batched FFT, see melSpectrogram.cpp
+		std::unique_ptr<__m256[]> tempBuffer;
 
 	public:
 		SpectrogramContext( const Filters& flt );
 
-		// First step of the MEL algorithm, and recursively compute the FFT
-		void fft( std::array<float, N_MEL>& rdi, const float* pcm, size_t length );
+		// Count of frames computed at once, in the lanes of AVX vectors
+		static constexpr size_t batchSize = 8;
+
+		// Compute MEL values of up to batchSize consecutive frames, FFT_STEP samples apart.
+		// length is the count of samples available after the pcm pointer.
+		// MEL value j of the frame i is written to rdi[ j * strideMel + i * strideFrame ]
+		void fftBatch( float* rdi, size_t strideMel, size_t strideFrame, size_t countFrames, const float* pcm, size_t length );
+
+		// Compute MEL values of a single frame
+		void fft( std::array<float, N_MEL>& rdi, const float* pcm, size_t length )
+		{
+			fftBatch( rdi.data(), 1, N_MEL, 1, pcm, length );
+		}
 	};
 }
\ No newline at end of file
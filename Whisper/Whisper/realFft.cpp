@@ -0,0 +1,188 @@
+#include "stdafx.h"
+#include <cmath>
+#include "realFft.h"
+using namespace Whisper;
+
+namespace
+{
+	__forceinline Complex8 add( Complex8 a, Complex8 b )
+	{
+		return Complex8{ _mm256_add_ps( a.re, b.re ), _mm256_add_ps( a.im, b.im ) };
+	}
+	__forceinline Complex8 sub( Complex8 a, Complex8 b )
+	{
+		return Complex8{ _mm256_sub_ps( a.re, b.re ), _mm256_sub_ps( a.im, b.im ) };
+	}
+	// Multiply by the complex scalar from [ re, im ] pair of floats in memory
+	__forceinline Complex8 mul( Complex8 a, const float* w )
+	{
+		const __m256 wr = _mm256_broadcast_ss( w );
+		const __m256 wi = _mm256_broadcast_ss( w + 1 );
+		const __m256 re = _mm256_sub_ps( _mm256_mul_ps( a.re, wr ), _mm256_mul_ps( a.im, wi ) );
+		const __m256 im = _mm256_add_ps( _mm256_mul_ps( a.re, wi ), _mm256_mul_ps( a.im, wr ) );
+		return Complex8{ re, im };
+	}
+	__forceinline Complex8 scale( Complex8 a, __m256 s )
+	{
+		return Complex8{ _mm256_mul_ps( a.re, s ), _mm256_mul_ps( a.im, s ) };
+	}
+}
+
+RealFft::RealFft( uint32_t length, bool foldMirrored )
+{
+	assert( 0 == length % 2 );
+	complexLength = length / 2;
+
+	uint32_t n = complexLength;
+	uint32_t s = 1;
+	while( n > 1 )
+	{
+		const uint32_t radix = ( 0 == n % 5 ) ? 5 : 2;
+		assert( 0 == n % radix );
+		const uint32_t m = n / radix;
+
+		Stage& stage = stages.emplace_back();
+		stage.radix = radix;
+		stage.m = m;
+		stage.s = s;
+		stage.twiddles = (uint32_t)twiddles.size();
+		// Twiddle factor for the output j of the butterfly group q is exp( -2*pi*i * j * q / n )
+		for( uint32_t q = 0; q < m; q++ )
+		{
+			for( uint32_t j = 1; j < radix; j++ )
+			{
+				const double angle = ( -2.0 * M_PI * j * q ) / n;
+				twiddles.push_back( (float)std::cos( angle ) );
+				twiddles.push_back( (float)std::sin( angle ) );
+			}
+		}
+		n = m;
+		s *= radix;
+	}
+	assert( s == complexLength );
+
+	const size_t bins = countBins();
+	postTwiddles.resize( bins * 2 );
+	powerScale.resize( bins );
+	for( size_t k = 0; k < bins; k++ )
+	{
+		const double angle = ( -2.0 * M_PI * (double)k ) / length;
+		postTwiddles[ k * 2 ] = (float)std::cos( angle );
+		postTwiddles[ k * 2 + 1 ] = (float)std::sin( angle );
+		const bool mirrored = foldMirrored && 0 != k && bins - 1 != k;
+		powerScale[ k ] = mirrored ? 0.5f : 0.25f;
+	}
+}
+
+void RealFft::stageRadix2( const Stage& stage, const float* tw, const Complex8* x, Complex8* y )
+{
+	const size_t m = stage.m;
+	const size_t s = stage.s;
+	for( size_t q = 0; q < m; q++ )
+	{
+		const Complex8* rsi = x + s * q;
+		Complex8* rdi = y + s * q * 2;
+		for( size_t k = 0; k < s; k++ )
+		{
+			const Complex8 a = rsi[ k ];
+			const Complex8 b = rsi[ k + s * m ];
+			rdi[ k ] = add( a, b );
+			// The twiddle for q = 0 is 1.0
+			rdi[ k + s ] = ( 0 != q ) ? mul( sub( a, b ), tw + q * 2 ) : sub( a, b );
+		}
+	}
+}
+
+void RealFft::stageRadix5( const Stage& stage, const float* tw, const Complex8* x, Complex8* y )
+{
+	const __m256 c1 = _mm256_set1_ps( (float)std::cos( 2.0 * M_PI / 5 ) );
+	const __m256 c2 = _mm256_set1_ps( (float)std::cos( 4.0 * M_PI / 5 ) );
+	const __m256 s1 = _mm256_set1_ps( (float)std::sin( 2.0 * M_PI / 5 ) );
+	const __m256 s2 = _mm256_set1_ps( (float)std::sin( 4.0 * M_PI / 5 ) );
+
+	const size_t m = stage.m;
+	const size_t s = stage.s;
+	for( size_t q = 0; q < m; q++, tw += 8 )
+	{
+		const Complex8* rsi = x + s * q;
+		Complex8* rdi = y + s * q * 5;
+		for( size_t k = 0; k < s; k++ )
+		{
+			const Complex8 x0 = rsi[ k ];
+			const Complex8 x1 = rsi[ k + s * m ];
+			const Complex8 x2 = rsi[ k + s * m * 2 ];
+			const Complex8 x3 = rsi[ k + s * m * 3 ];
+			const Complex8 x4 = rsi[ k + s * m * 4 ];
+
+			const Complex8 t1 = add( x1, x4 );
+			const Complex8 t2 = add( x2, x3 );
+			const Complex8 t3 = sub( x1, x4 );
+			const Complex8 t4 = sub( x2, x3 );
+
+			const Complex8 a1 = add( x0, add( scale( t1, c1 ), scale( t2, c2 ) ) );
+			const Complex8 a2 = add( x0, add( scale( t1, c2 ), scale( t2, c1 ) ) );
+			const Complex8 b1 = add( scale( t3, s1 ), scale( t4, s2 ) );
+			const Complex8 b2 = sub( scale( t3, s2 ), scale( t4, s1 ) );
+
+			// y1 = a1 - i * b1, y4 = a1 + i * b1, same for y2 and y3
+			const Complex8 y1{ _mm256_add_ps( a1.re, b1.im ), _mm256_sub_ps( a1.im, b1.re ) };
+			const Complex8 y4{ _mm256_sub_ps( a1.re, b1.im ), _mm256_add_ps( a1.im, b1.re ) };
+			const Complex8 y2{ _mm256_add_ps( a2.re, b2.im ), _mm256_sub_ps( a2.im, b2.re ) };
+			const Complex8 y3{ _mm256_sub_ps( a2.re, b2.im ), _mm256_add_ps( a2.im, b2.re ) };
+
+			rdi[ k ] = add( x0, add( t1, t2 ) );
+			if( 0 != q )
+			{
+				rdi[ k + s ] = mul( y1, tw );
+				rdi[ k + s * 2 ] = mul( y2, tw + 2 );
+				rdi[ k + s * 3 ] = mul( y3, tw + 4 );
+				rdi[ k + s * 4 ] = mul( y4, tw + 6 );
+			}
+			else
+			{
+				rdi[ k + s ] = y1;
+				rdi[ k + s * 2 ] = y2;
+				rdi[ k + s * 3 ] = y3;
+				rdi[ k + s * 4 ] = y4;
+			}
+		}
+	}
+}
+
+Complex8* RealFft::fft( Complex8* x, Complex8* y ) const
+{
+	for( const Stage& stage : stages )
+	{
+		const float* tw = twiddles.data() + stage.twiddles;
+		if( stage.radix == 5 )
+			stageRadix5( stage, tw, x, y );
+		else
+			stageRadix2( stage, tw, x, y );
+		std::swap( x, y );
+	}
+	return x;
+}
+
+void RealFft::powerSpectrum( const Complex8* z, __m256* rdi ) const
+{
+	const size_t n = complexLength;
+	const size_t bins = countBins();
+	for( size_t k = 0; k < bins; k++ )
+	{
+		// Z[ k ], and conjugate of Z[ N - k ], both indices are modulo complexLength
+		const Complex8 a = z[ ( k < n ) ? k : 0 ];
+		const Complex8 b = z[ ( 0 != k && k < n ) ? n - k : 0 ];
+
+		// Doubled spectrum of the even samples
+		const __m256 er = _mm256_add_ps( a.re, b.re );
+		const __m256 ei = _mm256_sub_ps( a.im, b.im );
+		// Doubled spectrum of the odd samples, ( a - conj( b ) ) / i
+		const Complex8 o{ _mm256_add_ps( a.im, b.im ), _mm256_sub_ps( b.re, a.re ) };
+		const Complex8 ow = mul( o, &postTwiddles[ k * 2 ] );
+
+		const __m256 re = _mm256_add_ps( er, ow.re );
+		const __m256 im = _mm256_add_ps( ei, ow.im );
+		__m256 p = _mm256_add_ps( _mm256_mul_ps( re, re ), _mm256_mul_ps( im, im ) );
+		rdi[ k ] = _mm256_mul_ps( p, _mm256_broadcast_ss( &powerScale[ k ] ) );
+	}
+}
\ No newline at end of file
@@ -0,0 +1,87 @@
+#pragma once
+#include <immintrin.h>
+#include <array>
+#include <vector>
+
+namespace Whisper
+{
+	// 8 complex numbers, one per lane of the AVX vectors
+	struct Complex8
+	{
+		__m256 re, im;
+	};
+
+	// Transpose 8x8 matrix of floats, rows[ i ] receives column i of the input
+	__forceinline void transpose8( std::array<__m256, 8>& rows )
+	{
+		const __m256 t0 = _mm256_unpacklo_ps( rows[ 0 ], rows[ 1 ] );
+		const __m256 t1 = _mm256_unpackhi_ps( rows[ 0 ], rows[ 1 ] );
+		const __m256 t2 = _mm256_unpacklo_ps( rows[ 2 ], rows[ 3 ] );
+		const __m256 t3 = _mm256_unpackhi_ps( rows[ 2 ], rows[ 3 ] );
+		const __m256 t4 = _mm256_unpacklo_ps( rows[ 4 ], rows[ 5 ] );
+		const __m256 t5 = _mm256_unpackhi_ps( rows[ 4 ], rows[ 5 ] );
+		const __m256 t6 = _mm256_unpacklo_ps( rows[ 6 ], rows[ 7 ] );
+		const __m256 t7 = _mm256_unpackhi_ps( rows[ 6 ], rows[ 7 ] );
+
+		const __m256 u0 = _mm256_shuffle_ps( t0, t2, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+		const __m256 u1 = _mm256_shuffle_ps( t0, t2, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+		const __m256 u2 = _mm256_shuffle_ps( t1, t3, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+		const __m256 u3 = _mm256_shuffle_ps( t1, t3, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+		const __m256 u4 = _mm256_shuffle_ps( t4, t6, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+		const __m256 u5 = _mm256_shuffle_ps( t4, t6, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+		const __m256 u6 = _mm256_shuffle_ps( t5, t7, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+		const __m256 u7 = _mm256_shuffle_ps( t5, t7, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+
+		rows[ 0 ] = _mm256_permute2f128_ps( u0, u4, 0x20 );
+		rows[ 1 ] = _mm256_permute2f128_ps( u1, u5, 0x20 );
+		rows[ 2 ] = _mm256_permute2f128_ps( u2, u6, 0x20 );
+		rows[ 3 ] = _mm256_permute2f128_ps( u3, u7, 0x20 );
+		rows[ 4 ] = _mm256_permute2f128_ps( u0, u4, 0x31 );
+		rows[ 5 ] = _mm256_permute2f128_ps( u1, u5, 0x31 );
+		rows[ 6 ] = _mm256_permute2f128_ps( u2, u6, 0x31 );
+		rows[ 7 ] = _mm256_permute2f128_ps( u3, u7, 0x31 );
+	}
+
+	// Batched FFT of real signals, computes 8 transforms at once, one per lane of the AVX vectors.
+	// The real-valued FFT of N samples is computed as a complex FFT of half the length:
+	// even samples go to real parts, odd samples to imaginary parts, then a post-processing pass separates the two spectra.
+	// The complex FFT is mixed-radix Stockham, N / 2 must be a product of 2 and 5.
+	// The plan is computed once, all twiddle factors are precomputed, the FFT itself doesn't compute any sines or cosines.
+	class RealFft
+	{
+		struct Stage
+		{
+			uint32_t radix;
+			// Count of butterfly groups, and the stride between elements of the butterflies
+			uint32_t m, s;
+			// Offset of this stage in the twiddles vector, in floats; the stage has ( radix - 1 ) * m complex twiddles
+			uint32_t twiddles;
+		};
+		std::vector<Stage> stages;
+		std::vector<float> twiddles;
+		// exp( -2*pi*i * k / N ) for k in [ 0 .. countBins ), as [ re, im ] pairs
+		std::vector<float> postTwiddles;
+		// Scaling of the power spectrum: 1/4 for the 1/2 factors of the real-to-complex split,
+		// optionally doubled for the bins which also include the mirrored half of the spectrum
+		std::vector<float> powerScale;
+		uint32_t complexLength;
+
+		static void stageRadix2( const Stage& stage, const float* tw, const Complex8* x, Complex8* y );
+		static void stageRadix5( const Stage& stage, const float* tw, const Complex8* x, Complex8* y );
+
+	public:
+		// When foldMirrored is true, the power spectrum includes the energy of the mirrored bins [ N/2 + 1 .. N )
+		RealFft( uint32_t length, bool foldMirrored );
+
+		// Count of complex numbers in the buffers of the FFT, N / 2
+		size_t complexCount() const { return complexLength; }
+		// Count of the frequency bins in the power spectrum, 1 + N / 2
+		size_t countBins() const { return complexLength + 1; }
+
+		// Compute the FFT of complexCount() elements in both buffers, return the pointer to the one with the output
+		Complex8* fft( Complex8* x, Complex8* y ) const;
+
+		// Separate the two spectra of the real input, and compute power spectrum of countBins() frequency bins
+		void powerSpectrum( const Complex8* z, __m256* rdi ) const;
+	};
+}
\ No newline at end of file
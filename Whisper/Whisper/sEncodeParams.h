@@ -16,5 +16,38 @@ namespace DirectCompute
 		uint32_t n_ctx, n_past, M;
 		uint32_t n_text_layer;
 		uint32_t n_vocab;
+		// When set, the hybrid model computes probabilities after every token, not just the last one
+		bool allRows;
+	};
+
+	// Parameters of a row in a batched decoder step, where every token belongs to an independent sequence
+	struct sBatchRow
+	{
+		// KV cache slot for the self-attention
+		uint32_t slot;
+		// Slot with the output of the encoder, for the cross-attention
+		uint32_t crossSlot;
+		// Position of the token in the sequence
+		uint32_t n_past;
+		// When false, the row only updates the KV cache, the output has no probabilities for that row
+		bool logits = true;
+	};
+
+	// Rules of the greedy sampling, same as in ContextImpl::sampleBest
+	struct sSampleRules
+	{
+		// Timestamp tokens are [ timestampBegin, timestampEnd ), the tokens before timestampBegin are text
+		uint32_t timestampBegin, timestampEnd;
+		// Special text tokens which are never sampled
+		int suppress[ 3 ];
+		// Only sample timestamp tokens
+		bool forceTimestamp;
+	};
+
+	// The token sampled from the logits, with the probabilities computed by the timestamp rules
+	struct sSampledToken
+	{
+		int id, tid;
+		float p, pt, ptsum;
 	};
 }
\ No newline at end of file
@@ -1,5 +1,8 @@
 #include "stdafx.h"
 #include "voiceActivityDetection.h"
+#include "realFft.h"
+#include <cmath>
+#include <cfloat>
 using namespace Whisper;
 
 // Initially ported (poorly) from there https://github.com/panmasuo/voice-activity-detection MIT license
@@ -15,101 +18,178 @@ inline VAD::Feature VAD::defaultPrimaryThresholds()
 	return f;
 }
 
-VAD::VAD() :
-	primThresh( defaultPrimaryThresholds() )
+namespace
 {
-	fft_signal = std::make_unique<cplx[]>( FFT_POINTS );
-}
+	constexpr size_t fftComplex = VAD::FFT_POINTS / 2;
+	constexpr size_t countBins = fftComplex + 1;
+	// The features use magnitudes of individual bins, the power spectrum doesn't fold the mirrored half
+	const RealFft s_plan{ VAD::FFT_POINTS, false };
 
-inline void VAD::fft( cplx* buf, cplx* out, size_t n, size_t step )
-{
-	if( step < n )
+	// Layout of the VAD.tempBuffer, in AVX vectors
+	// The zero row after the two complex buffers is the source for the missing frames of incomplete batches
+	constexpr size_t complexBufferVectors = fftComplex * 2;
+	constexpr size_t zeroRowVectors = VAD::FFT_POINTS / 8;
+	constexpr size_t tempBufferVectors = complexBufferVectors * 2 + zeroRowVectors;
+	static_assert( countBins <= complexBufferVectors );
+
+	constexpr float mulInt16FromFloat = 32768.0;
+
+	// Sum of log2 of positive numbers in 8 lanes, without computing any logarithms.
+	// The numbers are split into exponents and mantissas, the exponents are summed, the mantissas are multiplied,
+	// and the product is renormalized the same way before it overflows.
+	class Log2Sum
 	{
-		fft( out, buf, n, step * 2 );
-		fft( out + step, buf + step, n, step * 2 );
+		__m256 exponents = _mm256_setzero_ps();
+		__m256 product = _mm256_set1_ps( 1.0f );
 
-		for( size_t i = 0; i < n; i += 2 * step )
+		// Split positive normal numbers into mantissas in [ 1 .. 2 ) interval, and return the exponents.
+		// Only uses AVX1 instructions, no integer shifts.
+		static __forceinline __m256 split( __m256 x, __m256& mantissa )
 		{
-			// cplx t = cexp(-I * M_PI * i / n) * out[i + step];
-			// using namespace std::complex_literals;
-			const float mul = (float)M_PI * (float)(int)i / (float)(int)n;
-			// cplx t0 = std::exp( -1.0if * mul ) * out[ i + step ];
-			float sine, cosine;
-			DirectX::XMScalarSinCos( &sine, &cosine, -mul );
-			const cplx exponent{ cosine, sine };
-			cplx t = exponent * out[ i + step ];
-
-			buf[ i / 2 ] = out[ i ] + t;
-			buf[ ( i + n ) / 2 ] = out[ i ] - t;
+			// The exponent bits with zero mantissa are the power of 2, exactly
+			const __m256 pow2 = _mm256_and_ps( x, _mm256_castsi256_ps( _mm256_set1_epi32( 0x7F800000 ) ) );
+			mantissa = _mm256_div_ps( x, pow2 );
+			// Converted to float, the bits are ( e + 127 ) * 2^23, exactly representable in FP32
+			const __m256 biased = _mm256_cvtepi32_ps( _mm256_castps_si256( pow2 ) );
+			return _mm256_sub_ps( _mm256_mul_ps( biased, _mm256_set1_ps( 1.0f / ( 1 << 23 ) ) ), _mm256_set1_ps( 127.0f ) );
 		}
-	}
-}
 
-void VAD::fft() const
-{
-	cplx out[ FFT_POINTS ];
-	memcpy( &out[ 0 ], fft_signal.get(), FFT_POINTS * sizeof( cplx ) );
+	public:
+		// Add log2( x ), the mantissa in the product is below 2.0
+		__forceinline void add( __m256 x )
+		{
+			__m256 m;
+			exponents = _mm256_add_ps( exponents, split( x, m ) );
+			product = _mm256_mul_ps( product, m );
+		}
 
-	fft( fft_signal.get(), out, FFT_POINTS, 1 );
-}
+		// Add 2 * log2( x ), the mantissa in the product is below 4.0
+		__forceinline void addTwice( __m256 x )
+		{
+			__m256 m;
+			const __m256 e = split( x, m );
+			exponents = _mm256_add_ps( exponents, _mm256_add_ps( e, e ) );
+			product = _mm256_mul_ps( product, _mm256_mul_ps( m, m ) );
+		}
+
+		// Move the exponent of the product into the sum; without that, the product overflows after about 60 calls of addTwice()
+		__forceinline void normalize()
+		{
+			__m256 m;
+			exponents = _mm256_add_ps( exponents, split( product, m ) );
+			product = m;
+		}
 
-constexpr float mulInt16FromFloat = 32768.0;
+		// Log2 of the mantissa of the product is the only logarithm computed, for the 8 lanes of the result
+		void store( float* rdi )
+		{
+			normalize();
+			std::array<float, 8> e, m;
+			_mm256_storeu_ps( e.data(), exponents );
+			_mm256_storeu_ps( m.data(), product );
+			for( size_t i = 0; i < 8; i++ )
+				rdi[ i ] = e[ i ] + std::log2( m[ i ] );
+		}
+	};
+}
 
-inline float squareRoot( float x )
+VAD::VAD() :
+	primThresh( defaultPrimaryThresholds() )
 {
-	__m128 v = _mm_set_ss( x );
-	v = _mm_sqrt_ss( v );
-	return _mm_cvtss_f32( v );
+	// make_unique<T[]> zero-initializes the buffer
+	tempBuffer = std::make_unique<__m256[]>( tempBufferVectors );
 }
 
-float VAD::computeEnergy( const float* rsi )
+void VAD::computeFeatures( const float* rsi, size_t countFrames, std::array<Feature, batchSize>& rdi )
 {
-	// calculate_energy
-	double sum = 0;
-	for( size_t i = 0; i < FFT_POINTS; i++ )
+	assert( countFrames > 0 && countFrames <= batchSize );
+	Complex8* const bufferX = (Complex8*)tempBuffer.get();
+	Complex8* const bufferY = (Complex8*)( tempBuffer.get() + complexBufferVectors );
+	const float* const zeroRow = (const float*)( tempBuffer.get() + complexBufferVectors * 2 );
+
+	std::array<const float*, batchSize> rows;
+	for( size_t i = 0; i < batchSize; i++ )
+		rows[ i ] = ( i < countFrames ) ? rsi + i * FFT_POINTS : zeroRow;
+
+	// 3-1 calculate energy, while transposing 8x8 blocks so the frames are in the lanes, and packing even/odd samples into complex numbers
+	const __m256 mulInput = _mm256_set1_ps( mulInt16FromFloat );
+	__m256 e0 = _mm256_setzero_ps();
+	__m256 e1 = _mm256_setzero_ps();
+	std::array<__m256, 8> block;
+	for( size_t i = 0; i < FFT_POINTS; i += 8 )
 	{
-		float f = rsi[ i ];
-		f *= mulInt16FromFloat;
-		f *= f;
-		sum += f;
+		for( size_t j = 0; j < 8; j++ )
+			block[ j ] = _mm256_loadu_ps( rows[ j ] + i );
+		transpose8( block );
+
+		Complex8* const z = bufferX + i / 2;
+		for( size_t j = 0; j < 4; j++ )
+		{
+			const __m256 re = _mm256_mul_ps( block[ j * 2 ], mulInput );
+			const __m256 im = _mm256_mul_ps( block[ j * 2 + 1 ], mulInput );
+			e0 = _mm256_add_ps( e0, _mm256_mul_ps( re, re ) );
+			e1 = _mm256_add_ps( e1, _mm256_mul_ps( im, im ) );
+			z[ j ] = Complex8{ re, im };
+		}
 	}
-	return squareRoot( (float)( sum * ( 1.0 / FFT_POINTS ) ) );
-}
+	const __m256 energy = _mm256_sqrt_ps( _mm256_mul_ps( _mm256_add_ps( e0, e1 ), _mm256_set1_ps( 1.0f / FFT_POINTS ) ) );
 
-float VAD::computeDominant( const cplx* spectrum )
-{
-	// calculate_dominant, reworked heavily
-	float maxMagSquared = 0;
-	int maxFreq = 0;
+	// 3-2 calculate FFT
+	const Complex8* const spectrum = s_plan.fft( bufferX, bufferY );
+	__m256* const power = (__m256*)( ( spectrum == bufferX ) ? bufferY : bufferX );
+	s_plan.powerSpectrum( spectrum, power );
 
-	for( int i = 0; i < FFT_POINTS / 2; i++ )
+	// Dominant frequency, the first bin with the maximum magnitude in [ 0 .. FFT_POINTS / 2 ) range
+	__m256 maxPower = _mm256_setzero_ps();
+	__m256 maxIndex = _mm256_setzero_ps();
+	for( size_t k = 0; k < fftComplex; k++ )
 	{
-		const float real = (float)spectrum[ i ].real();
-		const float imag = (float)spectrum[ i ].imag();
-		float sq = real * real + imag * imag;
-		if( sq <= maxMagSquared )
-			continue;
-		maxMagSquared = sq;
-		maxFreq = i;
+		const __m256 greater = _mm256_cmp_ps( power[ k ], maxPower, _CMP_GT_OQ );
+		maxPower = _mm256_blendv_ps( maxPower, power[ k ], greater );
+		maxIndex = _mm256_blendv_ps( maxIndex, _mm256_set1_ps( (float)k ), greater );
 	}
-	return (float)maxFreq * FFT_STEP;
-}
+	const __m256 dominant = _mm256_mul_ps( maxIndex, _mm256_set1_ps( FFT_STEP ) );
 
-float VAD::computreSpectralFlatnessMeasure( const cplx* spectrum )
-{
-	// calculate_sfm
-	double sum_ari = 0;
-	double sum_geo = 0;
-	for( size_t i = 0; i < FFT_POINTS; i++ )
+	// Spectral flatness measure over all FFT_POINTS bins, the bins [ 1 .. FFT_POINTS / 2 ) are also in the mirrored half of the spectrum.
+	// The geometric mean of the magnitudes is computed from the power spectrum, log( sqrt( p ) ) = 0.5 * log( p ).
+	// The power is clamped to FLT_MIN, for the digital silence the measure is finite instead of NaN.
+	const __m256 minPower = _mm256_set1_ps( FLT_MIN );
+	__m256 sumMagnitude;
+	Log2Sum sumLog;
+	{
+		const __m256 p0 = _mm256_max_ps( power[ 0 ], minPower );
+		const __m256 pn = _mm256_max_ps( power[ fftComplex ], minPower );
+		sumMagnitude = _mm256_add_ps( _mm256_sqrt_ps( p0 ), _mm256_sqrt_ps( pn ) );
+		sumLog.add( p0 );
+		sumLog.add( pn );
+	}
+	__m256 sumMirrored = _mm256_setzero_ps();
+	for( size_t k = 1; k < fftComplex; k++ )
 	{
-		// sig = cabsf( spectrum[ i ] );
-		float sig = std::abs( spectrum[ i ] );
-		sum_ari += sig;
-		sum_geo += std::log( sig );
+		const __m256 p = _mm256_max_ps( power[ k ], minPower );
+		sumMirrored = _mm256_add_ps( sumMirrored, _mm256_sqrt_ps( p ) );
+		sumLog.addTwice( p );
+		if( 0 == ( k % 16 ) )
+			sumLog.normalize();
+	}
+	sumMagnitude = _mm256_add_ps( sumMagnitude, _mm256_add_ps( sumMirrored, sumMirrored ) );
+	const __m256 meanMagnitude = _mm256_mul_ps( sumMagnitude, _mm256_set1_ps( 1.0f / FFT_POINTS ) );
+
+	std::array<float, 8> energyLanes, dominantLanes, arithmetic, log2Sums;
+	_mm256_storeu_ps( energyLanes.data(), energy );
+	_mm256_storeu_ps( dominantLanes.data(), dominant );
+	_mm256_storeu_ps( arithmetic.data(), meanMagnitude );
+	sumLog.store( log2Sums.data() );
+
+	// -10 * log10( geometric / arithmetic ), where log10( geometric ) = log2 sum / ( 2 * FFT_POINTS ) * log10( 2 )
+	constexpr float geoScale = (float)( 0.30102999566398120 / ( 2 * FFT_POINTS ) );
+	for( size_t i = 0; i < countFrames; i++ )
+	{
+		Feature& f = rdi[ i ];
+		f.energy = energyLanes[ i ];
+		f.F = dominantLanes[ i ];
+		f.SFM = -10.0f * ( log2Sums[ i ] * geoScale - std::log10( arithmetic[ i ] ) );
 	}
-	sum_ari = sum_ari / FFT_POINTS;
-	sum_geo = std::exp( sum_geo / FFT_POINTS );
-	return -10.0f * std::log10f( (float)( sum_geo / sum_ari ) );
 }
 
 void VAD::clear()
@@ -119,6 +199,16 @@ void VAD::clear()
 }
 
 size_t VAD::detect( const float* rsi, size_t length )
+{
+	return detectImpl( rsi, length, nullptr );
+}
+
+size_t VAD::detect( const float* rsi, size_t length, std::vector<uint8_t>& decisions )
+{
+	return detectImpl( rsi, length, &decisions );
+}
+
+size_t VAD::detectImpl( const float* rsi, size_t length, std::vector<uint8_t>* decisions )
 {
 	// The cryptic numbers in the comments are from section 3 "Proposed VAD Algorithm" of the article, on page 2550, on the right
 	const size_t frames = length / FFT_POINTS;
@@ -137,60 +227,57 @@ size_t VAD::detect( const float* rsi, size_t length )
 	float silenceRun = state.silenceRun;
 	size_t i = state.i;
 
-	// Run the loop just on the [ state.i .. frames ] slice of the input PCM
-	rsi += i * FFT_POINTS;
-	for( ; i < frames; i++, rsi += FFT_POINTS )
+	// Run the loop just on the [ state.i .. frames ] slice of the input PCM, the features are computed in batches
+	std::array<Feature, batchSize> features;
+	while( i < frames )
 	{
-		// 3-2 calculate FFT
-		for( size_t j = 0; j < FFT_POINTS; j++ )
+		const size_t countFrames = std::min( frames - i, batchSize );
+		computeFeatures( rsi + i * FFT_POINTS, countFrames, features );
+
+		for( size_t j = 0; j < countFrames; j++, i++ )
 		{
-			const float re = rsi[ j ] * mulInt16FromFloat;
-			fft_signal[ j ] = { re, 0.0f };
-		}
-		fft();
+			curr = features[ j ];
 
-		// 3-1 + 3-2 calculate features
-		curr.energy = computeEnergy( rsi );
-		curr.F = computeDominant( fft_signal.get() );
-		curr.SFM = computreSpectralFlatnessMeasure( fft_signal.get() );
+			// 3-3 calculate minimum value for first 30 frames
+			if( i == 0 )
+				minFeature = curr;
+			else if( i < 30 )
+			{
+				minFeature.energy = std::min( minFeature.energy, curr.energy );
+				minFeature.F = std::min( minFeature.F, curr.F );
+				minFeature.SFM = std::min( minFeature.SFM, curr.SFM );
+			}
 
-		// 3-3 calculate minimum value for first 30 frames
-		if( i == 0 )
-			minFeature = curr;
-		else if( i < 30 )
-		{
-			minFeature.energy = std::min( minFeature.energy, curr.energy );
-			minFeature.F = std::min( minFeature.F, curr.F );
-			minFeature.SFM = std::min( minFeature.SFM, curr.SFM );
-		}
+			// 3-4 set thresholds
+			currThresh.energy = primThresh.energy * std::log10( minFeature.energy );
 
-		// 3-4 set thresholds
-		currThresh.energy = primThresh.energy * std::log10f( minFeature.energy );
+			// 3-5 calculate decision
+			uint8_t counter = 0;
+			if( ( curr.energy - minFeature.energy ) >= currThresh.energy )
+				counter = 1;
+			if( ( curr.F - minFeature.F ) >= currThresh.F )
+				counter++;
+			if( ( curr.SFM - minFeature.SFM ) >= currThresh.SFM )
+				counter++;
 
-		// 3-5 calculate decision
-		uint8_t counter = 0;
-		if( ( curr.energy - minFeature.energy ) >= currThresh.energy )
-			counter = 1;
-		if( ( curr.F - minFeature.F ) >= currThresh.F )
-			counter++;
-		if( ( curr.SFM - minFeature.SFM ) >= currThresh.SFM )
-			counter++;
+			if( counter > 1 )
+			{
+				// 3-6 If counter > 1 mark the current frame as speech
+				lastSpeech = ( i + 1 ) * FFT_POINTS;
+				silenceRun = 0.0f;
+			}
+			else
+			{
+				silenceRun += 1.0f;
+				// 3-7 If current frame is marked as silence, update the energy minimum value
+				minFeature.energy = ( ( silenceRun * minFeature.energy ) + curr.energy ) / ( silenceRun + 1 );
+			}
+			if( nullptr != decisions )
+				decisions->push_back( ( counter > 1 ) ? 1 : 0 );
 
-		if( counter > 1 )
-		{
-			// 3-6 If counter > 1 mark the current frame as speech
-			lastSpeech = ( i + 1 ) * FFT_POINTS;
-			silenceRun = 0.0f;
+			// 3-8
+			currThresh.energy = primThresh.energy * std::log10( minFeature.energy );
 		}
-		else
-		{
-			silenceRun += 1.0f;
-			// 3-7 If current frame is marked as silence, update the energy minimum value
-			minFeature.energy = ( ( silenceRun * minFeature.energy ) + curr.energy ) / ( silenceRun + 1 );
-		}
-
-		// 3-8
-		currThresh.energy = primThresh.energy * std::log10f( minFeature.energy );
 	}
 
 	// Store the updated detection state back into that field
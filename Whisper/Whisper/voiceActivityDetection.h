@@ -1,14 +1,16 @@
 #pragma once
-#include <complex>
+#include <array>
 #include <memory>
+#include <vector>
+#include <immintrin.h>
 #include "audioConstants.h"
 
 namespace Whisper
 {
 	class VAD
 	{
-		using cplx = std::complex<float>;
-		std::unique_ptr<cplx[]> fft_signal;
+		// Work buffers of the batched FFT, see voiceActivityDetection.cpp
+		std::unique_ptr<__m256[]> tempBuffer;
 
 		struct Feature
 		{
@@ -31,12 +33,13 @@ namespace Whisper
 		};
 		State state;
 
-		static inline void fft( cplx* buf, cplx* out, size_t n, size_t step );
-		void fft() const;
+		// Count of frames processed at once, in the lanes of AVX vectors
+		static constexpr size_t batchSize = 8;
 
-		static float computeEnergy( const float* rsi );
-		static float computeDominant( const cplx* spectrum );
-		static float computreSpectralFlatnessMeasure( const cplx* spectrum );
+		// Compute FFT and the features of up to batchSize consecutive frames
+		void computeFeatures( const float* rsi, size_t countFrames, std::array<Feature, batchSize>& rdi );
+
+		size_t detectImpl( const float* rsi, size_t length, std::vector<uint8_t>* decisions );
 
 	public:
 
@@ -46,6 +49,9 @@ namespace Whisper
 		// When speech is detected, returns sample position for the end of the speech
 		size_t detect( const float* rsi, size_t length );
 
+		// Same as above, and also append decisions for the new frames to the vector, 1 for speech, 0 for silence
+		size_t detect( const float* rsi, size_t length, std::vector<uint8_t>& decisions );
+
 		void clear();
 
 		static constexpr uint32_t FFT_POINTS = 256;
@@ -1172,6 +1172,7 @@ struct ggml_context {
     size_t mem_size;
     void * mem_buffer;
     bool   mem_buffer_owned;
+    bool   no_alloc;
 
     int n_objects;
 
@@ -1432,6 +1433,7 @@ struct ggml_context * ggml_init(struct ggml_init_params params) {
         .mem_size         = params.mem_size,
         .mem_buffer       = params.mem_buffer ? params.mem_buffer : malloc(params.mem_size),
         .mem_buffer_owned = params.mem_buffer ? false : true,
+        .no_alloc         = false,
         .n_objects        = 0,
         .objects_begin    = NULL,
         .objects_end      = NULL,
@@ -1479,6 +1481,14 @@ size_t ggml_used_mem(const struct ggml_context * ctx) {
     return ctx->objects_end->offset + ctx->objects_end->size;
 }
 
+size_t ggml_tensor_overhead(void) {
+    return GGML_OBJECT_SIZE + sizeof(struct ggml_tensor);
+}
+
+void ggml_set_no_alloc(struct ggml_context * ctx, bool no_alloc) {
+    ctx->no_alloc = no_alloc;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 struct ggml_tensor * ggml_new_tensor_impl(
@@ -1496,7 +1506,7 @@ struct ggml_tensor * ggml_new_tensor_impl(
 
     size_t size_needed = 0;
 
-    if (data == NULL) {
+    if (data == NULL && !ctx->no_alloc) {
         size_needed += GGML_TYPE_SIZE[type];
         for (int i = 0; i < n_dims; i++) {
             size_needed *= ne[i];
@@ -1545,6 +1555,7 @@ struct ggml_tensor * ggml_new_tensor_impl(
         /*.nb           =*/ { 0, 0, 0, 0 },
         /*.op           =*/ GGML_OP_NONE,
         /*.is_param     =*/ false,
+        /*.is_output    =*/ false,
         /*.grad         =*/ NULL,
         /*.src0         =*/ NULL,
         /*.src1         =*/ NULL,
@@ -1553,8 +1564,8 @@ struct ggml_tensor * ggml_new_tensor_impl(
         /*.perf_runs    =*/ 0,
         /*.perf_cycles  =*/ 0,
         /*.perf_time_us =*/ 0,
-        /*.data         =*/ data == NULL ? (void *)(result + 1) : data,
-        /*.pad          =*/ { 0 },
+        /*.data         =*/ data == NULL && !ctx->no_alloc ? (void *)(result + 1) : data,
+        /*.view_src     =*/ NULL,
     };
 
     ggml_assert_aligned(result->data);
@@ -1618,8 +1629,43 @@ struct ggml_tensor * ggml_new_tensor_4d(
     return ggml_new_tensor(ctx, type, 4, ne);
 }
 
+// the view shares the data of the source, it never allocates memory, even when the data of the source is not placed yet
+static struct ggml_tensor * ggml_new_view_impl(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * src,
+        enum   ggml_type type,
+        int    n_dims,
+        const int* ne,
+        size_t offset) {
+    const bool no_alloc = ctx->no_alloc;
+    ctx->no_alloc = true;
+
+    struct ggml_tensor * result = ggml_new_tensor_impl(ctx, type, n_dims, ne, (char *) src->data + offset);
+
+    ctx->no_alloc = no_alloc;
+
+    result->view_src = src->view_src ? src->view_src : src;
+
+    return result;
+}
+
+// small tensors which are written while the graph is built, they always have memory in the context
+static struct ggml_tensor * ggml_new_tensor_1d_alloc(
+        struct ggml_context * ctx,
+        enum   ggml_type type,
+        int    ne0) {
+    const bool no_alloc = ctx->no_alloc;
+    ctx->no_alloc = false;
+
+    struct ggml_tensor * result = ggml_new_tensor_1d(ctx, type, ne0);
+
+    ctx->no_alloc = no_alloc;
+
+    return result;
+}
+
 struct ggml_tensor * ggml_new_i32(struct ggml_context * ctx, int32_t value) {
-    struct ggml_tensor * result = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, 1);
+    struct ggml_tensor * result = ggml_new_tensor_1d_alloc(ctx, GGML_TYPE_I32, 1);
 
     ggml_set_i32(result, value);
 
@@ -1627,7 +1673,7 @@ struct ggml_tensor * ggml_new_i32(struct ggml_context * ctx, int32_t value) {
 }
 
 struct ggml_tensor * ggml_new_f32(struct ggml_context * ctx, float value) {
-    struct ggml_tensor * result = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, 1);
+    struct ggml_tensor * result = ggml_new_tensor_1d_alloc(ctx, GGML_TYPE_F32, 1);
 
     ggml_set_f32(result, value);
 
@@ -1899,7 +1945,7 @@ float * ggml_get_data_f32(const struct ggml_tensor * tensor) {
 struct ggml_tensor * ggml_view_tensor(
         struct ggml_context * ctx,
         const struct ggml_tensor * src) {
-    return ggml_new_tensor_impl(ctx, src->type, src->n_dims, src->ne, src->data);
+    return ggml_new_view_impl(ctx, (struct ggml_tensor *) src, src->type, src->n_dims, src->ne, 0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -2609,7 +2655,7 @@ struct ggml_tensor * ggml_reshape(
         is_node = true;
     }
 
-    struct ggml_tensor * result = ggml_new_tensor_impl(ctx, a->type, b->n_dims, b->ne, a->data);
+    struct ggml_tensor * result = ggml_new_view_impl(ctx, a, a->type, b->n_dims, b->ne, 0);
 
     result->op   = GGML_OP_RESHAPE;
     result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
@@ -2635,7 +2681,7 @@ struct ggml_tensor * ggml_reshape_2d(
     }
 
     const int ne[2] = { ne0, ne1 };
-    struct ggml_tensor * result = ggml_new_tensor_impl(ctx, a->type, 2, ne, a->data);
+    struct ggml_tensor * result = ggml_new_view_impl(ctx, a, a->type, 2, ne, 0);
 
     result->op   = GGML_OP_RESHAPE;
     result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
@@ -2662,7 +2708,7 @@ struct ggml_tensor * ggml_reshape_3d(
     }
 
     const int ne[3] = { ne0, ne1, ne2 };
-    struct ggml_tensor * result = ggml_new_tensor_impl(ctx, a->type, 3, ne, a->data);
+    struct ggml_tensor * result = ggml_new_view_impl(ctx, a, a->type, 3, ne, 0);
 
     result->op   = GGML_OP_RESHAPE;
     result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
@@ -2683,7 +2729,7 @@ struct ggml_tensor * ggml_view_1d(
         assert(false); // gradient propagation is not supported
     }
 
-    struct ggml_tensor * result = ggml_new_tensor_impl(ctx, a->type, 1, &ne0, (char *) a->data + offset);
+    struct ggml_tensor * result = ggml_new_view_impl(ctx, a, a->type, 1, &ne0, offset);
 
     result->op   = GGML_OP_VIEW;
     result->grad = NULL;
@@ -2708,7 +2754,7 @@ struct ggml_tensor * ggml_view_2d(
 
     const int ne[GGML_MAX_DIMS] = { ne0, ne1, 1, 1 };
 
-    struct ggml_tensor * result = ggml_new_tensor_impl(ctx, a->type, 2, ne, (char *) a->data + offset);
+    struct ggml_tensor * result = ggml_new_view_impl(ctx, a, a->type, 2, ne, offset);
 
     result->nb[1] = nb1;
     result->nb[2] = result->nb[1]*ne1;
@@ -2855,7 +2901,7 @@ struct ggml_tensor * ggml_diag_mask_inf(
     //struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
     struct ggml_tensor * result = ggml_view_tensor(ctx, a);
 
-    struct ggml_tensor * b = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, 1);
+    struct ggml_tensor * b = ggml_new_tensor_1d_alloc(ctx, GGML_TYPE_I32, 1);
     ((int32_t *) b->data)[0] = n_past;
 
     result->op   = GGML_OP_DIAG_MASK_INF;
@@ -2910,7 +2956,7 @@ struct ggml_tensor * ggml_rope(
     //struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
     struct ggml_tensor * result = ggml_view_tensor(ctx, a);
 
-    struct ggml_tensor * b = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, 3);
+    struct ggml_tensor * b = ggml_new_tensor_1d_alloc(ctx, GGML_TYPE_I32, 3);
     ((int32_t *) b->data)[0] = n_past;
     ((int32_t *) b->data)[1] = n_dims;
     ((int32_t *) b->data)[2] = mode;
@@ -6861,340 +6907,740 @@ struct ggml_cgraph ggml_build_backward(struct ggml_context * ctx, struct ggml_cg
 //
 // thread data
 //
-// synchronization is done via busy loops
-// I tried using spin locks, but not sure how to use them correctly - the things I tried were slower than busy loops
+// the worker threads are persistent, see ggml_threadpool below
+// between the tasks they spin for a while, then sleep on a condition variable until the main thread publishes the next one
 //
 
-#ifdef __APPLE__
-
-//#include <os/lock.h>
+typedef pthread_t ggml_thread_t;
 
-//typedef os_unfair_lock ggml_lock_t;
-//
-//#define ggml_lock_init(x)    UNUSED(x)
-//#define ggml_lock_destroy(x) UNUSED(x)
-//#define ggml_lock_lock       os_unfair_lock_lock
-//#define ggml_lock_unlock     os_unfair_lock_unlock
-//
-//#define GGML_LOCK_INITIALIZER OS_UNFAIR_LOCK_INIT
+#define ggml_thread_create pthread_create
+#define ggml_thread_join   pthread_join
 
-typedef int ggml_lock_t;
+#if defined _MSC_VER || defined(__MINGW32__)
 
-#define ggml_lock_init(x)    UNUSED(x)
-#define ggml_lock_destroy(x) UNUSED(x)
-#define ggml_lock_lock(x)    UNUSED(x)
-#define ggml_lock_unlock(x)  UNUSED(x)
+typedef SRWLOCK            ggml_mutex_t;
+typedef CONDITION_VARIABLE ggml_cond_t;
 
-#define GGML_LOCK_INITIALIZER 0
+#define ggml_mutex_init(x)    InitializeSRWLock(x)
+#define ggml_mutex_destroy(x) UNUSED(x)
+#define ggml_mutex_lock(x)    AcquireSRWLockExclusive(x)
+#define ggml_mutex_unlock(x)  ReleaseSRWLockExclusive(x)
 
-typedef pthread_t ggml_thread_t;
+#define ggml_cond_init(x)      InitializeConditionVariable(x)
+#define ggml_cond_destroy(x)   UNUSED(x)
+#define ggml_cond_wait(x, m)   SleepConditionVariableSRW(x, m, INFINITE, 0)
+#define ggml_cond_broadcast(x) WakeAllConditionVariable(x)
 
-#define ggml_thread_create pthread_create
-#define ggml_thread_join   pthread_join
+#define ggml_spin_pause() YieldProcessor()
 
 #else
 
-//typedef pthread_spinlock_t ggml_lock_t;
+typedef pthread_mutex_t ggml_mutex_t;
+typedef pthread_cond_t  ggml_cond_t;
 
-//#define ggml_lock_init(x) pthread_spin_init(x, PTHREAD_PROCESS_PRIVATE)
-//#define ggml_lock_destroy pthread_spin_destroy
-//#define ggml_lock_lock    pthread_spin_lock
-//#define ggml_lock_unlock  pthread_spin_unlock
+#define ggml_mutex_init(x)    pthread_mutex_init(x, NULL)
+#define ggml_mutex_destroy(x) pthread_mutex_destroy(x)
+#define ggml_mutex_lock(x)    pthread_mutex_lock(x)
+#define ggml_mutex_unlock(x)  pthread_mutex_unlock(x)
 
-typedef int ggml_lock_t;
+#define ggml_cond_init(x)      pthread_cond_init(x, NULL)
+#define ggml_cond_destroy(x)   pthread_cond_destroy(x)
+#define ggml_cond_wait(x, m)   pthread_cond_wait(x, m)
+#define ggml_cond_broadcast(x) pthread_cond_broadcast(x)
 
-#define ggml_lock_init(x)    UNUSED(x)
-#define ggml_lock_destroy(x) UNUSED(x)
-#define ggml_lock_lock(x)    UNUSED(x)
-#define ggml_lock_unlock(x)  UNUSED(x)
+#if defined(__x86_64__) || defined(__i386__)
+#define ggml_spin_pause() _mm_pause()
+#else
+#define ggml_spin_pause() ((void)0)
+#endif
 
-#define GGML_LOCK_INITIALIZER 0
+#endif
 
-typedef pthread_t ggml_thread_t;
+// how many times an idle worker polls for the next task before it goes to sleep
+// long enough to cover the single-threaded INIT of a node, and the sampling between the decoder calls
+#define GGML_THREADPOOL_SPIN 4096
 
-#define ggml_thread_create pthread_create
-#define ggml_thread_join   pthread_join
+struct ggml_compute_state {
+    ggml_thread_t thrd;
 
-#endif
+    int ith;
 
-struct ggml_compute_state_shared {
-    ggml_lock_t spin;
+    struct ggml_threadpool * pool;
+};
 
+struct ggml_threadpool {
     int n_threads;
 
-    // synchronization primitives
-    atomic_int  n_ready;
-    atomic_bool has_work;
-    atomic_bool stop; // stop all threads
-};
+    // the task of all workers, written by the main thread before it increments n_generation
+    struct ggml_tensor * node;
+    enum ggml_task_type type;
+    size_t wsize;
+    void * wdata;
 
-struct ggml_compute_state {
-    ggml_thread_t thrd;
+    // incremented by the main thread for every published task, and for the stop request
+    atomic_int  n_generation;
+    atomic_bool stop;
 
-    struct ggml_compute_params params;
-    struct ggml_tensor * node;
+    // keep the counter decremented by the workers away from the one they poll
+    char padding[CACHE_LINE_SIZE];
 
-    struct ggml_compute_state_shared * shared;
+    // count of workers still running the current task
+    atomic_int n_active;
+    // count of workers sleeping on the condition variable
+    atomic_int n_parked;
+
+    ggml_mutex_t mutex;
+    ggml_cond_t  cond;
+
+    struct ggml_compute_state * workers;
 };
 
 static thread_ret_t ggml_graph_compute_thread(void * data) {
     struct ggml_compute_state * state = (struct ggml_compute_state *) data;
+    struct ggml_threadpool * pool = state->pool;
 
-    const int n_threads = state->shared->n_threads;
+    int generation = 0;
 
     while (true) {
-        if (atomic_fetch_add(&state->shared->n_ready, 1) == n_threads - 1) {
-            atomic_store(&state->shared->has_work, false);
-        } else {
-            while (atomic_load(&state->shared->has_work)) {
-                if (atomic_load(&state->shared->stop)) {
-                    return 0;
-                }
-                ggml_lock_lock  (&state->shared->spin);
-                ggml_lock_unlock(&state->shared->spin);
+        // wait for the next task
+        for (int i = 0; atomic_load(&pool->n_generation) == generation; i++) {
+            if (i < GGML_THREADPOOL_SPIN) {
+                ggml_spin_pause();
+                continue;
             }
-        }
 
-        atomic_fetch_sub(&state->shared->n_ready, 1);
-
-        // wait for work
-        while (!atomic_load(&state->shared->has_work)) {
-            if (atomic_load(&state->shared->stop)) {
-                return 0;
+            // the generation is checked again under the mutex after n_parked is incremented,
+            // the main thread either sees the parked worker and wakes it up, or the worker sees the new task
+            ggml_mutex_lock(&pool->mutex);
+            atomic_fetch_add(&pool->n_parked, 1);
+            while (atomic_load(&pool->n_generation) == generation) {
+                ggml_cond_wait(&pool->cond, &pool->mutex);
             }
-            ggml_lock_lock  (&state->shared->spin);
-            ggml_lock_unlock(&state->shared->spin);
+            atomic_fetch_sub(&pool->n_parked, 1);
+            ggml_mutex_unlock(&pool->mutex);
         }
+        generation = atomic_load(&pool->n_generation);
 
-        // check if we should stop
-        if (atomic_load(&state->shared->stop)) {
+        if (atomic_load(&pool->stop)) {
             break;
         }
 
-        if (state->node) {
-            ggml_compute_forward(&state->params, state->node);
-            state->node = NULL;
-        } else {
-            break;
-        }
+        struct ggml_compute_params params = {
+            /*.type  =*/ pool->type,
+            /*.ith   =*/ state->ith,
+            /*.nth   =*/ pool->n_threads,
+            /*.wsize =*/ pool->wsize,
+            /*.wdata =*/ pool->wdata,
+        };
+
+        ggml_compute_forward(&params, pool->node);
+
+        atomic_fetch_sub(&pool->n_active, 1);
     }
 
     return 0;
 }
 
-void ggml_graph_compute(struct ggml_context * ctx, struct ggml_cgraph * cgraph) {
-    if (cgraph->n_threads <= 0) {
-        cgraph->n_threads = 8;
+// increment the generation, and wake up the sleeping workers if there're any
+static void ggml_threadpool_publish(struct ggml_threadpool * pool) {
+    atomic_fetch_add(&pool->n_generation, 1);
+
+    if (atomic_load(&pool->n_parked) > 0) {
+        ggml_mutex_lock(&pool->mutex);
+        ggml_cond_broadcast(&pool->cond);
+        ggml_mutex_unlock(&pool->mutex);
     }
+}
 
-    const int n_threads = cgraph->n_threads;
+// run the task on all workers, the main thread computes the part ith = 0 after this call
+static void ggml_threadpool_launch(struct ggml_threadpool * pool, const struct ggml_compute_params * params, struct ggml_tensor * node) {
+    pool->node  = node;
+    pool->type  = params->type;
+    pool->wsize = params->wsize;
+    pool->wdata = params->wdata;
 
-    struct ggml_compute_state_shared state_shared = {
-        /*.spin      =*/ GGML_LOCK_INITIALIZER,
-        /*.n_threads =*/ n_threads,
-        /*.n_ready   =*/ 0,
-        /*.has_work  =*/ false,
-        /*.stop      =*/ false,
-    };
-    struct ggml_compute_state * workers = n_threads > 1 ? alloca(sizeof(struct ggml_compute_state)*(n_threads - 1)) : NULL;
+    atomic_store(&pool->n_active, pool->n_threads - 1);
 
-    // create thread pool
-    if (n_threads > 1) {
-        ggml_lock_init(&state_shared.spin);
+    ggml_threadpool_publish(pool);
+}
+
+// per-node barrier, wait for the workers to finish the task
+static void ggml_threadpool_barrier(struct ggml_threadpool * pool) {
+    while (atomic_load(&pool->n_active) != 0) {
+        ggml_spin_pause();
+    }
+}
+
+struct ggml_threadpool * ggml_threadpool_create(int n_threads) {
+    if (n_threads <= 0) {
+        n_threads = 8;
+    }
+
+    struct ggml_threadpool * pool = malloc(sizeof(struct ggml_threadpool));
+    GGML_ASSERT(pool != NULL);
+    memset(pool, 0, sizeof(struct ggml_threadpool));
+
+    pool->n_threads = n_threads;
+
+    atomic_store(&pool->n_generation, 0);
+    atomic_store(&pool->stop,         false);
+    atomic_store(&pool->n_active,     0);
+    atomic_store(&pool->n_parked,     0);
 
-        atomic_store(&state_shared.has_work, true);
+    ggml_mutex_init(&pool->mutex);
+    ggml_cond_init(&pool->cond);
+
+    if (n_threads > 1) {
+        pool->workers = malloc(sizeof(struct ggml_compute_state)*(n_threads - 1));
+        GGML_ASSERT(pool->workers != NULL);
 
         for (int j = 0; j < n_threads - 1; j++) {
-            workers[j] = (struct ggml_compute_state) {
-                .thrd   = 0,
-                .params = {
-                    .type  = GGML_TASK_COMPUTE,
-                    .ith   = j + 1,
-                    .nth   = n_threads,
-                    .wsize = cgraph->work ? ggml_nbytes(cgraph->work) : 0,
-                    .wdata = cgraph->work ? cgraph->work->data : NULL,
-                },
-                .node   = NULL,
-                .shared = &state_shared,
+            pool->workers[j] = (struct ggml_compute_state) {
+                .thrd = 0,
+                .ith  = j + 1,
+                .pool = pool,
             };
-            int rc = ggml_thread_create(&workers[j].thrd, NULL, ggml_graph_compute_thread, &workers[j]);
+            int rc = ggml_thread_create(&pool->workers[j].thrd, NULL, ggml_graph_compute_thread, &pool->workers[j]);
             assert(rc == 0);
             UNUSED(rc);
         }
     }
 
-    // initialize tasks + work buffer
-    {
-        size_t work_size = 0;
-
-        // thread scheduling for the different operations
-        for (int i = 0; i < cgraph->n_nodes; i++) {
-            struct ggml_tensor * node = cgraph->nodes[i];
-
-            switch (node->op) {
-                case GGML_OP_DUP:
-                    {
-                        node->n_tasks = 1;
-                    } break;
-                case GGML_OP_ADD:
-                    {
-                        node->n_tasks = n_threads;
-                    } break;
-                case GGML_OP_SUB:
-                case GGML_OP_MUL:
-                case GGML_OP_DIV:
-                case GGML_OP_SQR:
-                case GGML_OP_SQRT:
-                case GGML_OP_SUM:
-                case GGML_OP_MEAN:
-                case GGML_OP_REPEAT:
-                case GGML_OP_ABS:
-                case GGML_OP_SGN:
-                case GGML_OP_NEG:
-                case GGML_OP_STEP:
-                case GGML_OP_RELU:
-                    {
-                        node->n_tasks = 1;
-                    } break;
-                case GGML_OP_GELU:
-                    {
-                        node->n_tasks = n_threads;
-                    } break;
-                case GGML_OP_NORM:
-                    {
-                        node->n_tasks = n_threads;
-                    } break;
-                case GGML_OP_MUL_MAT:
-                    {
-                        // TODO: use different scheduling for different matrix sizes
-                        node->n_tasks = n_threads;
-
-                        size_t cur = 0;
-
-                        // TODO: better way to determine if the matrix is transposed
-                        if (node->src0->nb[1] < node->src0->nb[0]) {
-                            cur = ggml_nbytes(node)*node->n_tasks; // TODO: this can become (n_tasks-1)
-                        } else {
-                            if (node->src0->type == GGML_TYPE_F16 &&
-                                node->src1->type == GGML_TYPE_F32) {
-#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
-                                if (ggml_compute_forward_mul_mat_use_blas(node->src0, node->src1, node)) {
-                                    cur = sizeof(float)*(node->src0->ne[0]*node->src0->ne[1]);
-                                } else {
-                                    cur = sizeof(ggml_fp16_t)*ggml_nelements(node->src1);
-                                }
-#else
-                                cur = sizeof(ggml_fp16_t)*ggml_nelements(node->src1);
-#endif
-                            } else if (node->src0->type == GGML_TYPE_F32 &&
-                                       node->src1->type == GGML_TYPE_F32) {
-                                cur = 0;
-                            } else {
-                                GGML_ASSERT(false);
-                            }
-                        }
+    return pool;
+}
+
+void ggml_threadpool_free(struct ggml_threadpool * pool) {
+    if (pool == NULL) {
+        return;
+    }
 
-                        work_size = MAX(work_size, cur);
-                    } break;
-                case GGML_OP_SCALE:
-                    {
-                        node->n_tasks = n_threads;
-                    } break;
-                case GGML_OP_CPY:
-                case GGML_OP_RESHAPE:
-                case GGML_OP_VIEW:
-                case GGML_OP_PERMUTE:
-                case GGML_OP_TRANSPOSE:
-                case GGML_OP_GET_ROWS:
-                case GGML_OP_DIAG_MASK_INF:
-                    {
-                        node->n_tasks = 1;
-                    } break;
-                case GGML_OP_SOFT_MAX:
-                    {
-                        node->n_tasks = n_threads;
-                    } break;
-                case GGML_OP_ROPE:
-                    {
-                        node->n_tasks = 1;
-                    } break;
-                case GGML_OP_CONV_1D_1S:
-                case GGML_OP_CONV_1D_2S:
-                    {
-                        node->n_tasks = n_threads;
-
-                        GGML_ASSERT(node->src0->ne[3] == 1);
-                        GGML_ASSERT(node->src1->ne[2] == 1);
-                        GGML_ASSERT(node->src1->ne[3] == 1);
-
-                        size_t cur = 0;
-                        const int nk = node->src0->ne[0];
+    if (pool->workers) {
+        atomic_store(&pool->stop, true);
+        ggml_threadpool_publish(pool);
 
+        for (int j = 0; j < pool->n_threads - 1; j++) {
+            int rc = ggml_thread_join(pool->workers[j].thrd, NULL);
+            assert(rc == 0);
+            UNUSED(rc);
+        }
+
+        free(pool->workers);
+    }
+
+    ggml_cond_destroy(&pool->cond);
+    ggml_mutex_destroy(&pool->mutex);
+
+    free(pool);
+}
+
+int ggml_threadpool_n_threads(const struct ggml_threadpool * pool) {
+    return pool ? pool->n_threads : 1;
+}
+
+// thread scheduling for the different operations, sets n_tasks of the nodes and returns the size of the work buffer
+static size_t ggml_graph_schedule(struct ggml_cgraph * cgraph, int n_threads) {
+    size_t work_size = 0;
+
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        struct ggml_tensor * node = cgraph->nodes[i];
+
+        switch (node->op) {
+            case GGML_OP_DUP:
+                {
+                    node->n_tasks = 1;
+                } break;
+            case GGML_OP_ADD:
+                {
+                    node->n_tasks = n_threads;
+                } break;
+            case GGML_OP_SUB:
+            case GGML_OP_MUL:
+            case GGML_OP_DIV:
+            case GGML_OP_SQR:
+            case GGML_OP_SQRT:
+            case GGML_OP_SUM:
+            case GGML_OP_MEAN:
+            case GGML_OP_REPEAT:
+            case GGML_OP_ABS:
+            case GGML_OP_SGN:
+            case GGML_OP_NEG:
+            case GGML_OP_STEP:
+            case GGML_OP_RELU:
+                {
+                    node->n_tasks = 1;
+                } break;
+            case GGML_OP_GELU:
+                {
+                    node->n_tasks = n_threads;
+                } break;
+            case GGML_OP_NORM:
+                {
+                    node->n_tasks = n_threads;
+                } break;
+            case GGML_OP_MUL_MAT:
+                {
+                    // TODO: use different scheduling for different matrix sizes
+                    node->n_tasks = n_threads;
+
+                    size_t cur = 0;
+
+                    // TODO: better way to determine if the matrix is transposed
+                    if (node->src0->nb[1] < node->src0->nb[0]) {
+                        cur = ggml_nbytes(node)*node->n_tasks; // TODO: this can become (n_tasks-1)
+                    } else {
                         if (node->src0->type == GGML_TYPE_F16 &&
                             node->src1->type == GGML_TYPE_F32) {
-                            cur = sizeof(ggml_fp16_t)*(
-                                    nk*ggml_up32(node->src0->ne[1])*node->src0->ne[2] +
-                                    ( 2*(nk/2) + node->src1->ne[0])*node->src1->ne[1]
-                                    );
+#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
+                            if (ggml_compute_forward_mul_mat_use_blas(node->src0, node->src1, node)) {
+                                cur = sizeof(float)*(node->src0->ne[0]*node->src0->ne[1]);
+                            } else {
+                                cur = sizeof(ggml_fp16_t)*ggml_nelements(node->src1);
+                            }
+#else
+                            cur = sizeof(ggml_fp16_t)*ggml_nelements(node->src1);
+#endif
                         } else if (node->src0->type == GGML_TYPE_F32 &&
                                    node->src1->type == GGML_TYPE_F32) {
-                            cur = sizeof(float)*(
-                                    nk*ggml_up32(node->src0->ne[1])*node->src0->ne[2] +
-                                    ( 2*(nk/2) + node->src1->ne[0])*node->src1->ne[1]
-                                    );
+                            cur = 0;
                         } else {
                             GGML_ASSERT(false);
                         }
+                    }
 
-                        work_size = MAX(work_size, cur);
-                    } break;
-                case GGML_OP_FLASH_ATTN:
-                    {
-                        node->n_tasks = n_threads;
+                    work_size = MAX(work_size, cur);
+                } break;
+            case GGML_OP_SCALE:
+                {
+                    node->n_tasks = n_threads;
+                } break;
+            case GGML_OP_CPY:
+            case GGML_OP_RESHAPE:
+            case GGML_OP_VIEW:
+            case GGML_OP_PERMUTE:
+            case GGML_OP_TRANSPOSE:
+            case GGML_OP_GET_ROWS:
+            case GGML_OP_DIAG_MASK_INF:
+                {
+                    node->n_tasks = 1;
+                } break;
+            case GGML_OP_SOFT_MAX:
+                {
+                    node->n_tasks = n_threads;
+                } break;
+            case GGML_OP_ROPE:
+                {
+                    node->n_tasks = 1;
+                } break;
+            case GGML_OP_CONV_1D_1S:
+            case GGML_OP_CONV_1D_2S:
+                {
+                    node->n_tasks = n_threads;
+
+                    GGML_ASSERT(node->src0->ne[3] == 1);
+                    GGML_ASSERT(node->src1->ne[2] == 1);
+                    GGML_ASSERT(node->src1->ne[3] == 1);
+
+                    size_t cur = 0;
+                    const int nk = node->src0->ne[0];
+
+                    if (node->src0->type == GGML_TYPE_F16 &&
+                        node->src1->type == GGML_TYPE_F32) {
+                        cur = sizeof(ggml_fp16_t)*(
+                                nk*ggml_up32(node->src0->ne[1])*node->src0->ne[2] +
+                                ( 2*(nk/2) + node->src1->ne[0])*node->src1->ne[1]
+                                );
+                    } else if (node->src0->type == GGML_TYPE_F32 &&
+                               node->src1->type == GGML_TYPE_F32) {
+                        cur = sizeof(float)*(
+                                nk*ggml_up32(node->src0->ne[1])*node->src0->ne[2] +
+                                ( 2*(nk/2) + node->src1->ne[0])*node->src1->ne[1]
+                                );
+                    } else {
+                        GGML_ASSERT(false);
+                    }
 
-                        size_t cur = 0;
+                    work_size = MAX(work_size, cur);
+                } break;
+            case GGML_OP_FLASH_ATTN:
+                {
+                    node->n_tasks = n_threads;
 
-                        if (node->src1->type == GGML_TYPE_F32) {
-                            cur  = sizeof(float)*node->src1->ne[1]*node->n_tasks; // TODO: this can become (n_tasks-1)
-                            cur += sizeof(float)*node->src1->ne[1]*node->n_tasks; // this is overestimated by x2
-                        }
+                    size_t cur = 0;
 
-                        if (node->src1->type == GGML_TYPE_F16) {
-                            cur  = sizeof(float)*node->src1->ne[1]*node->n_tasks; // TODO: this can become (n_tasks-1)
-                            cur += sizeof(float)*node->src1->ne[1]*node->n_tasks; // this is overestimated by x2
-                        }
+                    if (node->src1->type == GGML_TYPE_F32) {
+                        cur  = sizeof(float)*node->src1->ne[1]*node->n_tasks; // TODO: this can become (n_tasks-1)
+                        cur += sizeof(float)*node->src1->ne[1]*node->n_tasks; // this is overestimated by x2
+                    }
 
-                        work_size = MAX(work_size, cur);
-                    } break;
-                case GGML_OP_FLASH_FF:
-                    {
-                        node->n_tasks = n_threads;
+                    if (node->src1->type == GGML_TYPE_F16) {
+                        cur  = sizeof(float)*node->src1->ne[1]*node->n_tasks; // TODO: this can become (n_tasks-1)
+                        cur += sizeof(float)*node->src1->ne[1]*node->n_tasks; // this is overestimated by x2
+                    }
 
-                        size_t cur = 0;
+                    work_size = MAX(work_size, cur);
+                } break;
+            case GGML_OP_FLASH_FF:
+                {
+                    node->n_tasks = n_threads;
 
-                        if (node->src1->type == GGML_TYPE_F32) {
-                            cur  = sizeof(float)*node->src1->ne[1]*node->n_tasks; // TODO: this can become (n_tasks-1)
-                            cur += sizeof(float)*node->src1->ne[1]*node->n_tasks; // this is overestimated by x2
-                        }
+                    size_t cur = 0;
 
-                        if (node->src1->type == GGML_TYPE_F16) {
-                            cur  = sizeof(float)*node->src1->ne[1]*node->n_tasks; // TODO: this can become (n_tasks-1)
-                            cur += sizeof(float)*node->src1->ne[1]*node->n_tasks; // this is overestimated by x2
-                        }
+                    if (node->src1->type == GGML_TYPE_F32) {
+                        cur  = sizeof(float)*node->src1->ne[1]*node->n_tasks; // TODO: this can become (n_tasks-1)
+                        cur += sizeof(float)*node->src1->ne[1]*node->n_tasks; // this is overestimated by x2
+                    }
 
-                        work_size = MAX(work_size, cur);
-                    } break;
-                case GGML_OP_NONE:
-                    {
-                        node->n_tasks = 1;
-                    } break;
-                case GGML_OP_COUNT:
-                    {
-                        assert(false);
-                    } break;
+                    if (node->src1->type == GGML_TYPE_F16) {
+                        cur  = sizeof(float)*node->src1->ne[1]*node->n_tasks; // TODO: this can become (n_tasks-1)
+                        cur += sizeof(float)*node->src1->ne[1]*node->n_tasks; // this is overestimated by x2
+                    }
+
+                    work_size = MAX(work_size, cur);
+                } break;
+            case GGML_OP_NONE:
+                {
+                    node->n_tasks = 1;
+                } break;
+            case GGML_OP_COUNT:
+                {
+                    assert(false);
+                } break;
+        }
+    }
+
+    return work_size;
+}
+
+//
+// static memory planner
+//
+// the nodes are placed in the order of computation, a tensor is released after the last node which reads it,
+// directly or through a view; the released blocks are merged with their free neighbours, and reused with best fit
+//
+
+struct ggml_alloc_block {
+    size_t offset;
+    size_t size;
+};
+
+struct ggml_allocator {
+    // free blocks sorted by offset
+    struct ggml_alloc_block * free_blocks;
+    int n_free;
+
+    // high-water mark
+    size_t end;
+};
+
+static size_t ggml_allocator_alloc(struct ggml_allocator * alloc, size_t size) {
+    int best = -1;
+    for (int i = 0; i < alloc->n_free; i++) {
+        if (alloc->free_blocks[i].size >= size && (best < 0 || alloc->free_blocks[i].size < alloc->free_blocks[best].size)) {
+            best = i;
+        }
+    }
+
+    if (best < 0 && alloc->n_free > 0) {
+        // grow the last free block when it ends at the high-water mark
+        struct ggml_alloc_block * last = &alloc->free_blocks[alloc->n_free - 1];
+        if (last->offset + last->size == alloc->end) {
+            alloc->end = last->offset + size;
+            last->size = size;
+            best = alloc->n_free - 1;
+        }
+    }
+
+    if (best < 0) {
+        const size_t offset = alloc->end;
+        alloc->end += size;
+        return offset;
+    }
+
+    struct ggml_alloc_block * block = &alloc->free_blocks[best];
+    const size_t offset = block->offset;
+    block->offset += size;
+    block->size   -= size;
+
+    if (block->size == 0) {
+        for (int i = best; i < alloc->n_free - 1; i++) {
+            alloc->free_blocks[i] = alloc->free_blocks[i + 1];
+        }
+        alloc->n_free--;
+    }
+
+    return offset;
+}
+
+static void ggml_allocator_free(struct ggml_allocator * alloc, size_t offset, size_t size) {
+    int pos = 0;
+    while (pos < alloc->n_free && alloc->free_blocks[pos].offset < offset) {
+        pos++;
+    }
+
+    const bool merge_prev = pos > 0 && alloc->free_blocks[pos - 1].offset + alloc->free_blocks[pos - 1].size == offset;
+    const bool merge_next = pos < alloc->n_free && offset + size == alloc->free_blocks[pos].offset;
+
+    if (merge_prev && merge_next) {
+        alloc->free_blocks[pos - 1].size += size + alloc->free_blocks[pos].size;
+        for (int i = pos; i < alloc->n_free - 1; i++) {
+            alloc->free_blocks[i] = alloc->free_blocks[i + 1];
+        }
+        alloc->n_free--;
+    } else if (merge_prev) {
+        alloc->free_blocks[pos - 1].size += size;
+    } else if (merge_next) {
+        alloc->free_blocks[pos].offset = offset;
+        alloc->free_blocks[pos].size  += size;
+    } else {
+        for (int i = alloc->n_free; i > pos; i--) {
+            alloc->free_blocks[i] = alloc->free_blocks[i - 1];
+        }
+        alloc->free_blocks[pos] = (struct ggml_alloc_block) { offset, size };
+        alloc->n_free++;
+    }
+}
+
+// open addressing hash table from the nodes of the graph to their indices
+struct ggml_node_index {
+    const struct ggml_tensor ** keys;
+    int * values;
+    size_t mask;
+};
+
+static size_t ggml_node_index_slot(const struct ggml_node_index * index, const struct ggml_tensor * t) {
+    size_t i = ((size_t) t / sizeof(struct ggml_tensor)) & index->mask;
+    while (index->keys[i] != NULL && index->keys[i] != t) {
+        i = (i + 1) & index->mask;
+    }
+    return i;
+}
+
+static int ggml_node_index_find(const struct ggml_node_index * index, const struct ggml_tensor * t) {
+    if (t == NULL) {
+        return -1;
+    }
+    const size_t i = ggml_node_index_slot(index, t);
+    return index->keys[i] == t ? index->values[i] : -1;
+}
+
+static size_t ggml_graph_alloc_size(const struct ggml_tensor * t) {
+    return ((ggml_nbytes(t) + GGML_MEM_ALIGN - 1)/GGML_MEM_ALIGN)*GGML_MEM_ALIGN;
+}
+
+// the nodes of the graph, followed by the leafs
+static struct ggml_tensor * ggml_graph_tensor(const struct ggml_cgraph * cgraph, int i) {
+    return i < cgraph->n_nodes ? cgraph->nodes[i] : cgraph->leafs[i - cgraph->n_nodes];
+}
+
+void ggml_set_output(struct ggml_tensor * tensor) {
+    tensor->is_output = true;
+}
+
+size_t ggml_graph_alloc(struct ggml_context * ctx, struct ggml_cgraph * cgraph, void * buffer) {
+    if (cgraph->n_threads <= 0) {
+        cgraph->n_threads = 8;
+    }
+
+    const int n_threads = cgraph->n_threads;
+    const int n_nodes   = cgraph->n_nodes;
+    const int n_tensors = cgraph->n_nodes + cgraph->n_leafs;
+
+    size_t n_slots = 16;
+    while (n_slots < 2*(size_t) n_tensors) {
+        n_slots *= 2;
+    }
+
+    struct ggml_node_index index = {
+        .keys   = calloc(n_slots, sizeof(struct ggml_tensor *)),
+        .values = malloc(n_slots*sizeof(int)),
+        .mask   = n_slots - 1,
+    };
+
+    // the tensor which owns the placed data of the tensor, -1 when the data is not placed
+    int    * owner     = malloc(n_tensors*sizeof(int));
+    // the first and the last node which write or read the data
+    int    * first_use = malloc(n_tensors*sizeof(int));
+    int    * last_use  = malloc(n_tensors*sizeof(int));
+    bool   * consumed  = malloc(n_tensors*sizeof(bool));
+    size_t * offs      = malloc(n_tensors*sizeof(size_t));
+
+    struct ggml_allocator alloc = {
+        .free_blocks = malloc((n_tensors + 1)*sizeof(struct ggml_alloc_block)),
+        .n_free      = 0,
+        .end         = 0,
+    };
+
+    GGML_ASSERT(index.keys && index.values && owner && first_use && last_use && consumed && offs && alloc.free_blocks);
+
+    for (int i = 0; i < n_tensors; i++) {
+        const struct ggml_tensor * t = ggml_graph_tensor(cgraph, i);
+        const size_t slot = ggml_node_index_slot(&index, t);
+        index.keys[slot]   = t;
+        index.values[slot] = i;
+    }
+
+    // placed are the results of the operations, and the leafs without data, like the destinations of ggml_cpy
+    // the views of the other leafs keep their data
+    for (int i = 0; i < n_tensors; i++) {
+        const struct ggml_tensor * t = ggml_graph_tensor(cgraph, i);
+        if (t->view_src == NULL) {
+            owner[i] = (i < n_nodes || t->data == NULL) ? i : -1;
+        } else {
+            owner[i] = -1;
+        }
+        first_use[i] = -1;
+        last_use[i]  = -1;
+        consumed[i]  = false;
+    }
+    for (int i = 0; i < n_tensors; i++) {
+        const struct ggml_tensor * t = ggml_graph_tensor(cgraph, i);
+        if (t->view_src != NULL) {
+            const int j = ggml_node_index_find(&index, t->view_src);
+            owner[i] = j >= 0 ? owner[j] : -1;
+        }
+        GGML_ASSERT(owner[i] >= 0 || t->data != NULL);
+    }
+
+    // liveness, the first reference is the node itself: the in-place operations write the data of their owner
+    for (int i = 0; i < n_nodes; i++) {
+        struct ggml_tensor * node = cgraph->nodes[i];
+
+        struct ggml_tensor * refs[3 + GGML_MAX_OPT] = { node, node->src0, node->src1 };
+        for (int k = 0; k < GGML_MAX_OPT; k++) {
+            refs[3 + k] = node->opt[k];
+        }
+
+        for (int k = 0; k < 3 + GGML_MAX_OPT; k++) {
+            const int j = ggml_node_index_find(&index, refs[k]);
+            if (j < 0) {
+                continue;
+            }
+            if (k > 0) {
+                consumed[j] = true;
+            }
+            const int o = owner[j];
+            if (o >= 0) {
+                if (first_use[o] < 0) {
+                    first_use[o] = i;
+                }
+                last_use[o] = MAX(last_use[o], i);
+            }
+        }
+    }
+
+    // the outputs of the graph are never released, neither are the nodes marked with ggml_set_output()
+    for (int i = 0; i < n_nodes; i++) {
+        if ((!consumed[i] || cgraph->nodes[i]->is_output) && owner[i] >= 0) {
+            last_use[owner[i]] = n_nodes;
+        }
+    }
+
+    // placement, all tensors written by the node are placed before any of its sources are released
+    for (int i = 0; i < n_nodes; i++) {
+        struct ggml_tensor * node = cgraph->nodes[i];
+
+        struct ggml_tensor * refs[3 + GGML_MAX_OPT] = { node, node->src0, node->src1 };
+        for (int k = 0; k < GGML_MAX_OPT; k++) {
+            refs[3 + k] = node->opt[k];
+        }
+
+        for (int k = 0; k < 3 + GGML_MAX_OPT; k++) {
+            const int j = ggml_node_index_find(&index, refs[k]);
+            const int o = j >= 0 ? owner[j] : -1;
+            if (o >= 0 && first_use[o] == i) {
+                offs[o] = ggml_allocator_alloc(&alloc, ggml_graph_alloc_size(ggml_graph_tensor(cgraph, o)));
+                first_use[o] = -1;
+            }
+        }
+
+        for (int k = 0; k < 3 + GGML_MAX_OPT; k++) {
+            const int j = ggml_node_index_find(&index, refs[k]);
+            const int o = j >= 0 ? owner[j] : -1;
+            if (o >= 0 && last_use[o] == i) {
+                ggml_allocator_free(&alloc, offs[o], ggml_graph_alloc_size(ggml_graph_tensor(cgraph, o)));
+                last_use[o] = -1;
+            }
+        }
+    }
+
+    size_t size = alloc.end;
+
+    size_t work_offset = 0;
+    size_t work_size   = 0;
+
+    if (cgraph->work == NULL) {
+        work_size = ggml_graph_schedule(cgraph, n_threads);
+        if (work_size > 0) {
+            work_size  += CACHE_LINE_SIZE*(n_threads - 1);
+            work_offset = size;
+            size       += ((work_size + GGML_MEM_ALIGN - 1)/GGML_MEM_ALIGN)*GGML_MEM_ALIGN;
+        }
+    }
+
+    if (buffer != NULL) {
+        char * const base = buffer;
+
+        ggml_assert_aligned(base);
+
+        // the offsets of the views are relative to the current data of their owners, compute them before the owners are moved
+        for (int i = 0; i < n_tensors; i++) {
+            if (owner[i] >= 0 && owner[i] != i) {
+                offs[i] = (char *) ggml_graph_tensor(cgraph, i)->data - (char *) ggml_graph_tensor(cgraph, owner[i])->data;
             }
         }
 
+        for (int i = 0; i < n_tensors; i++) {
+            if (owner[i] == i) {
+                ggml_graph_tensor(cgraph, i)->data = base + offs[i];
+            }
+        }
+
+        for (int i = 0; i < n_tensors; i++) {
+            if (owner[i] >= 0 && owner[i] != i) {
+                ggml_graph_tensor(cgraph, i)->data = (char *) ggml_graph_tensor(cgraph, owner[i])->data + offs[i];
+            }
+        }
+
+        if (work_size > 0) {
+            const int ne = (int) work_size;
+            cgraph->work      = ggml_new_tensor_impl(ctx, GGML_TYPE_I8, 1, &ne, base + work_offset);
+            cgraph->work_size = work_size;
+        }
+    }
+
+    free(alloc.free_blocks);
+    free(offs);
+    free(consumed);
+    free(last_use);
+    free(first_use);
+    free(owner);
+    free(index.values);
+    free((void *) index.keys);
+
+    return size;
+}
+
+void ggml_graph_compute(struct ggml_context * ctx, struct ggml_cgraph * cgraph) {
+    if (cgraph->n_threads <= 0) {
+        cgraph->n_threads = 8;
+    }
+
+    // without a persistent pool, the worker threads only live for this graph
+    struct ggml_threadpool * pool = cgraph->n_threads > 1 ? ggml_threadpool_create(cgraph->n_threads) : NULL;
+
+    ggml_graph_compute_with_pool(ctx, cgraph, pool);
+
+    ggml_threadpool_free(pool);
+}
+
+void ggml_graph_compute_with_pool(struct ggml_context * ctx, struct ggml_cgraph * cgraph, struct ggml_threadpool * pool) {
+    const int n_threads = ggml_threadpool_n_threads(pool);
+    cgraph->n_threads = n_threads;
+
+    // initialize tasks + work buffer
+    {
+        const size_t work_size = ggml_graph_schedule(cgraph, n_threads);
+
         if (cgraph->work != NULL && work_size > cgraph->work_size) {
             assert(false); // TODO: better handling
         }
@@ -7203,7 +7649,7 @@ void ggml_graph_compute(struct ggml_context * ctx, struct ggml_cgraph * cgraph)
             cgraph->work_size = work_size + CACHE_LINE_SIZE*(n_threads - 1);
 
             GGML_PRINT_DEBUG("%s: allocating work buffer for graph (%zu bytes)\n", __func__, cgraph->work_size);
-            cgraph->work = ggml_new_tensor_1d(ctx, GGML_TYPE_I8, cgraph->work_size);
+            cgraph->work = ggml_new_tensor_1d_alloc(ctx, GGML_TYPE_I8, cgraph->work_size);
         }
     }
 
@@ -7235,113 +7681,29 @@ void ggml_graph_compute(struct ggml_context * ctx, struct ggml_cgraph * cgraph)
         ggml_compute_forward(&params, node);
 
         // COMPUTE
-        if (node->n_tasks > 1) {
-            if (atomic_fetch_add(&state_shared.n_ready, 1) == n_threads - 1) {
-                atomic_store(&state_shared.has_work, false);
-            }
-
-            while (atomic_load(&state_shared.has_work)) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
-            }
-
-            // launch thread pool
-            for (int j = 0; j < n_threads - 1; j++) {
-                workers[j].params = (struct ggml_compute_params) {
-                    .type  = GGML_TASK_COMPUTE,
-                    .ith   = j + 1,
-                    .nth   = n_threads,
-                    .wsize = cgraph->work ? ggml_nbytes(cgraph->work) : 0,
-                    .wdata = cgraph->work ? cgraph->work->data : NULL,
-                };
-                workers[j].node = node;
-            }
-
-            atomic_fetch_sub(&state_shared.n_ready, 1);
-
-            while (atomic_load(&state_shared.n_ready) > 0) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
-            }
+        params.type = GGML_TASK_COMPUTE;
 
-            atomic_store(&state_shared.has_work, true);
+        if (node->n_tasks > 1) {
+            ggml_threadpool_launch(pool, &params, node);
         }
 
-        params.type = GGML_TASK_COMPUTE;
         ggml_compute_forward(&params, node);
 
-        // wait for thread pool
         if (node->n_tasks > 1) {
-            if (atomic_fetch_add(&state_shared.n_ready, 1) == n_threads - 1) {
-                atomic_store(&state_shared.has_work, false);
-            }
-
-            while (atomic_load(&state_shared.has_work)) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
-            }
-
-            atomic_fetch_sub(&state_shared.n_ready, 1);
-
-            while (atomic_load(&state_shared.n_ready) != 0) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
-            }
+            ggml_threadpool_barrier(pool);
         }
 
         // FINALIZE
-        if (node->n_tasks > 1) {
-            if (atomic_fetch_add(&state_shared.n_ready, 1) == n_threads - 1) {
-                atomic_store(&state_shared.has_work, false);
-            }
-
-            while (atomic_load(&state_shared.has_work)) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
-            }
-
-            // launch thread pool
-            for (int j = 0; j < n_threads - 1; j++) {
-                workers[j].params = (struct ggml_compute_params) {
-                    .type  = GGML_TASK_FINALIZE,
-                    .ith   = j + 1,
-                    .nth   = n_threads,
-                    .wsize = cgraph->work ? ggml_nbytes(cgraph->work) : 0,
-                    .wdata = cgraph->work ? cgraph->work->data : NULL,
-                };
-                workers[j].node = node;
-            }
-
-            atomic_fetch_sub(&state_shared.n_ready, 1);
-
-            while (atomic_load(&state_shared.n_ready) > 0) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
-            }
+        params.type = GGML_TASK_FINALIZE;
 
-            atomic_store(&state_shared.has_work, true);
+        if (node->n_tasks > 1) {
+            ggml_threadpool_launch(pool, &params, node);
         }
 
-        params.type = GGML_TASK_FINALIZE;
         ggml_compute_forward(&params, node);
 
-        // wait for thread pool
         if (node->n_tasks > 1) {
-            if (atomic_fetch_add(&state_shared.n_ready, 1) == n_threads - 1) {
-                atomic_store(&state_shared.has_work, false);
-            }
-
-            while (atomic_load(&state_shared.has_work)) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
-            }
-
-            atomic_fetch_sub(&state_shared.n_ready, 1);
-
-            while (atomic_load(&state_shared.n_ready) != 0) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
-            }
+            ggml_threadpool_barrier(pool);
         }
 
         // performance stats (node)
@@ -7355,20 +7717,6 @@ void ggml_graph_compute(struct ggml_context * ctx, struct ggml_cgraph * cgraph)
         }
     }
 
-    // join thread pool
-    if (n_threads > 1) {
-        atomic_store(&state_shared.stop, true);
-        atomic_store(&state_shared.has_work, true);
-
-        for (int j = 0; j < n_threads - 1; j++) {
-            int rc = ggml_thread_join(workers[j].thrd, NULL);
-            assert(rc == 0);
-            UNUSED(rc);
-        }
-
-        ggml_lock_destroy(&state_shared.spin);
-    }
-
     // performance stats (graph)
     {
         int64_t perf_cycles_cur  = ggml_perf_cycles()  - perf_start_cycles;
@@ -80,6 +80,10 @@
 // and after defining the computation graph, call the ggml_used_mem() function to find out how much memory was
 // actually needed.
 //
+// For large graphs, the contexts can be switched into ggml_set_no_alloc() mode after the inputs are created. Then the
+// results of the operations don't get any memory in the context, ggml_graph_alloc() places them into a separate buffer
+// and reuses the memory of the tensors which are no longer needed by the remaining nodes of the graph.
+//
 // The ggml_set_param() function marks a tensor as an input variable. This is used by the automatic
 // differentiation and optimization algorithms.
 //
@@ -264,6 +268,7 @@ struct ggml_tensor {
     enum ggml_op op;
 
     bool is_param;
+    bool is_output; // ggml_graph_alloc() keeps the data until the end of the graph
 
     struct ggml_tensor * grad;
     struct ggml_tensor * src0;
@@ -279,7 +284,9 @@ struct ggml_tensor {
     int64_t perf_time_us;
 
     void * data;
-    char padding[8];
+
+    // the tensor which owns the data of this view, NULL when the tensor owns its data
+    struct ggml_tensor * view_src;
 };
 
 // computation graph
@@ -327,6 +334,13 @@ void ggml_free(struct ggml_context * ctx);
 
 size_t ggml_used_mem(const struct ggml_context * ctx);
 
+// bytes used in the context by the tensor object, not including the data
+size_t ggml_tensor_overhead(void);
+
+// when enabled, the new tensors have no data, use ggml_graph_alloc() to place the nodes of the graph
+// the small tensors created by ggml_new_i32(), ggml_new_f32(), and the parameters of some operations are still allocated
+void ggml_set_no_alloc(struct ggml_context * ctx, bool no_alloc);
+
 struct ggml_tensor * ggml_new_tensor(
         struct ggml_context * ctx,
         enum   ggml_type type,
@@ -610,6 +624,27 @@ struct ggml_cgraph ggml_build_forward (struct ggml_tensor * tensor);
 struct ggml_cgraph ggml_build_backward(struct ggml_context * ctx, struct ggml_cgraph * gf, bool keep);
 
 void ggml_graph_compute(struct ggml_context * ctx, struct ggml_cgraph * cgraph);
+
+// liveness-based placement of the nodes of the graph into a single buffer
+// the memory of a tensor is reused once all nodes reading it were computed, the outputs of the graph stay alive
+// the views follow the tensors which own their data; the work buffer for cgraph->n_threads is placed after the tensors
+// with NULL buffer, only returns the size; otherwise sets the data pointers, and returns the same size
+// the pointers into the buffer are only valid until the next graph is placed there: copy the results to be kept
+size_t ggml_graph_alloc(struct ggml_context * ctx, struct ggml_cgraph * cgraph, void * buffer);
+
+// mark an intermediate node which is read after the computation, ggml_graph_alloc() doesn't reuse its memory for the later nodes
+void ggml_set_output(struct ggml_tensor * tensor);
+
+// persistent worker threads for ggml_graph_compute_with_pool, create once and reuse for many graphs
+// ggml_graph_compute creates a temporary pool of cgraph->n_threads for every call
+struct ggml_threadpool;
+
+struct ggml_threadpool * ggml_threadpool_create(int n_threads);
+void ggml_threadpool_free     (struct ggml_threadpool * pool);
+int  ggml_threadpool_n_threads(const struct ggml_threadpool * pool);
+
+// compute the graph on the pool; cgraph->n_threads is set to the size of the pool, NULL pool computes on the calling thread
+void ggml_graph_compute_with_pool(struct ggml_context * ctx, struct ggml_cgraph * cgraph, struct ggml_threadpool * pool);
 void ggml_graph_reset  (struct ggml_cgraph * cgraph);
 
 // print info and performance information for the graph
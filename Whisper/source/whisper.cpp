@@ -150,38 +150,6 @@ static const std::map<e_model, size_t> MEM_REQ_MEMORY = {
     { MODEL_LARGE,   306ull*MB },
 };
 
-static const std::map<e_model, size_t> MEM_REQ_ENCODE = {
-    { MODEL_TINY,     80ull*MB },
-    { MODEL_BASE,    128ull*MB },
-    { MODEL_SMALL,   300ull*MB },
-    { MODEL_MEDIUM,  680ull*MB },
-    { MODEL_LARGE,  1100ull*MB },
-};
-
-static const std::map<e_model, size_t> MEM_REQ_ENCODE_LAYER = {
-    { MODEL_TINY,    104ull*MB },
-    { MODEL_BASE,    138ull*MB },
-    { MODEL_SMALL,   208ull*MB },
-    { MODEL_MEDIUM,  280ull*MB },
-    { MODEL_LARGE,   354ull*MB },
-};
-
-static const std::map<e_model, size_t> MEM_REQ_DECODE = {
-    { MODEL_TINY,    200ull*MB },
-    { MODEL_BASE,    202ull*MB },
-    { MODEL_SMALL,   204ull*MB },
-    { MODEL_MEDIUM,  206ull*MB },
-    { MODEL_LARGE,   208ull*MB },
-};
-
-static const std::map<e_model, size_t> MEM_REQ_DECODE_LAYER = {
-    { MODEL_TINY,     32ull*MB },
-    { MODEL_BASE,     44ull*MB },
-    { MODEL_SMALL,    64ull*MB },
-    { MODEL_MEDIUM,   84ull*MB },
-    { MODEL_LARGE,   110ull*MB },
-};
-
 struct whisper_mel {
     int n_len;
     int n_mel;
@@ -406,8 +374,9 @@ struct whisper_context {
 
     std::vector<uint8_t> * buf_model; // the model buffer is read-only and can be shared between processors
     std::vector<uint8_t>   buf_memory;
-    std::vector<uint8_t>   buf_compute;
+    std::vector<uint8_t>   buf_compute;       // tensor objects and inputs of the graphs, see whisper_graph_ctx_size()
     std::vector<uint8_t>   buf_compute_layer;
+    std::vector<uint8_t>   buf_alloc;         // intermediate tensors of the graphs, placed by ggml_graph_alloc()
 
     whisper_model model;
     whisper_vocab vocab;
@@ -429,8 +398,47 @@ struct whisper_context {
 
     // [EXPERIMENTAL] speed-up techniques
     int32_t exp_n_audio_ctx; // 0 - use default
+
+    // worker threads of the graphs, created on first use and re-created when n_threads changes
+    struct ggml_threadpool * threadpool = nullptr;
 };
 
+static struct ggml_threadpool * whisper_threadpool(whisper_context & wctx, int n_threads) {
+    if (n_threads <= 1) {
+        return nullptr;
+    }
+
+    if (wctx.threadpool && ggml_threadpool_n_threads(wctx.threadpool) != n_threads) {
+        ggml_threadpool_free(wctx.threadpool);
+        wctx.threadpool = nullptr;
+    }
+
+    if (!wctx.threadpool) {
+        wctx.threadpool = ggml_threadpool_create(n_threads);
+    }
+
+    return wctx.threadpool;
+}
+
+// The graph contexts run in ggml_set_no_alloc() mode, they only keep the tensor objects, and the data of the inputs
+static size_t whisper_graph_ctx_size(size_t input_bytes) {
+    // up to GGML_MAX_NODES nodes and as many leafs, including the scalars from ggml_new_f32()
+    return 2*GGML_MAX_NODES*(ggml_tensor_overhead() + 16) + input_bytes;
+}
+
+// place the intermediate tensors of the graph into wctx.buf_alloc, and compute the graph
+static void whisper_graph_compute(whisper_context & wctx, struct ggml_context * ctx, struct ggml_cgraph & gf, struct ggml_threadpool * pool) {
+    gf.n_threads = ggml_threadpool_n_threads(pool);
+
+    const size_t size = ggml_graph_alloc(ctx, &gf, nullptr);
+    if (wctx.buf_alloc.size() < size) {
+        wctx.buf_alloc.resize(size);
+    }
+    ggml_graph_alloc(ctx, &gf, wctx.buf_alloc.data());
+
+    ggml_graph_compute_with_pool(ctx, &gf, pool);
+}
+
 template<typename T>
 static void read_safe(std::ifstream& fin, T& dest)
 {
@@ -524,8 +532,6 @@ static bool whisper_model_load(const std::string & fname, whisper_context & wctx
         wctx.buf_model = new std::vector<uint8_t>();
         wctx.buf_model->resize(MEM_REQ_MODEL.at(model.type));
         wctx.buf_memory.resize(MEM_REQ_MEMORY.at(model.type));
-        wctx.buf_compute.resize(std::max(MEM_REQ_ENCODE.at(model.type), MEM_REQ_DECODE.at(model.type)));
-        wctx.buf_compute_layer.resize(std::max(MEM_REQ_ENCODE_LAYER.at(model.type), MEM_REQ_DECODE_LAYER.at(model.type)));
     }
 
     // load mel filters
@@ -607,12 +613,10 @@ static bool whisper_model_load(const std::string & fname, whisper_context & wctx
     }
 
     {
-        // this is the total memory required to run the inference
+        // this is the memory required to load the model, the compute buffers grow to the peak of the graphs on first use
         const size_t mem_required =
                    wctx.buf_model->size() +
-                   wctx.buf_memory.size() +
-                   wctx.buf_compute.size() +
-                   wctx.buf_compute_layer.size();
+                   wctx.buf_memory.size();
 
 		logDebug( u8"%s: mem_required  = %7.2f MB", __func__, mem_required / 1024.0 / 1024.0 );
     }
@@ -1097,6 +1101,13 @@ static bool whisper_encode(
     const int n_mels = hparams.n_mels;
     assert(mel_inp.n_mel == n_mels);
 
+    struct ggml_threadpool * pool = whisper_threadpool(wctx, n_threads);
+
+    // the mel input, the input of the layers, and the output of the encoder
+    const size_t input_bytes = (2*n_ctx*n_mels + 2*n_state*n_ctx)*sizeof(float);
+    wctx.buf_compute.resize(std::max(wctx.buf_compute.size(), whisper_graph_ctx_size(input_bytes)));
+    wctx.buf_compute_layer.resize(std::max(wctx.buf_compute_layer.size(), whisper_graph_ctx_size(0)));
+
     struct ggml_init_params params;
     params.mem_size   = wctx.buf_compute.size();
     params.mem_buffer = wctx.buf_compute.data();
@@ -1120,6 +1131,12 @@ static bool whisper_encode(
     }
 	Tracing::delayTensor( "enc.input", mel );
 
+    // these tensors outlive their graphs, they keep the memory in the context
+    struct ggml_tensor * layer_inp = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_state, n_ctx);
+    struct ggml_tensor * enc_out   = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_state, n_ctx);
+
+    ggml_set_no_alloc(ctx0, true);
+
     struct ggml_tensor * cur;
 
     // convolution + gelu
@@ -1170,7 +1187,7 @@ static bool whisper_encode(
     // original:
     //cur = ggml_add(ctx0, model.e_pe, ggml_transpose(ctx0, cur));
 
-    struct ggml_tensor * inpL = cur;
+    struct ggml_tensor * inpL = ggml_cpy(ctx0, cur, layer_inp);
 
     for (int il = 0; il < n_layer; ++il) {
         const auto & layer = model.layers_encoder[il];
@@ -1182,6 +1199,7 @@ static bool whisper_encode(
         paramsL.mem_buffer = wctx.buf_compute_layer.data();
 
         struct ggml_context * ctxL = ggml_init(paramsL);
+        ggml_set_no_alloc(ctxL, true);
 
 		Tracing::delayTensor( { "enc.layer[ %i ].in", il }, inpL );
 
@@ -1387,7 +1405,7 @@ static bool whisper_encode(
             gf.n_threads = n_threads;
 
             ggml_build_forward_expand(&gf, inpO);
-            ggml_graph_compute       (ctxL, &gf);
+            whisper_graph_compute(wctx, ctxL, gf, pool);
 			Tracing::writeDelayedTensors();
             //ggml_graph_print(&gf);
         }
@@ -1416,6 +1434,8 @@ static bool whisper_encode(
                     ggml_repeat(ctx0, model.e_ln_w, cur),
                     cur),
                 ggml_repeat(ctx0, model.e_ln_b, cur));
+
+        cur = ggml_cpy(ctx0, cur, enc_out);
     }
 
     // run the computation
@@ -1424,7 +1444,7 @@ static bool whisper_encode(
         gf.n_threads = n_threads;
 
         ggml_build_forward_expand(&gf, cur);
-        ggml_graph_compute       (ctx0, &gf);
+        whisper_graph_compute(wctx, ctx0, gf, pool);
 
         //ggml_graph_print(&gf);
     }
@@ -1483,7 +1503,7 @@ static bool whisper_encode(
             ggml_build_forward_expand(&gf, ggml_cpy(ctx0, Vcross, v));
         }
 
-        ggml_graph_compute(ctx0, &gf);
+        whisper_graph_compute(wctx, ctx0, gf, pool);
     }
 
     ////////////////////////////////////////////////////////////////////////////
@@ -1524,9 +1544,16 @@ static bool whisper_decode(
     const int n_head  = hparams.n_text_head;
     const int n_layer = hparams.n_text_layer;
 
+    struct ggml_threadpool * pool = whisper_threadpool(wctx, n_threads);
+
     const int N = n_tokens;
     const int M = wctx.exp_n_audio_ctx > 0 ? wctx.exp_n_audio_ctx : hparams.n_audio_ctx;
 
+    // the tokens and their positions, the input of the layers, and the logits
+    const size_t input_bytes = 2*N*sizeof(int32_t) + (n_state + n_vocab)*N*sizeof(float);
+    wctx.buf_compute.resize(std::max(wctx.buf_compute.size(), whisper_graph_ctx_size(input_bytes)));
+    wctx.buf_compute_layer.resize(std::max(wctx.buf_compute_layer.size(), whisper_graph_ctx_size(0)));
+
     struct ggml_init_params params;
     params.mem_size   = wctx.buf_compute.size();
     params.mem_buffer = wctx.buf_compute.data();
@@ -1541,6 +1568,12 @@ static bool whisper_decode(
         ((int32_t *) position->data)[i] = n_past + i;
     }
 
+    // these tensors outlive their graphs, they keep the memory in the context
+    struct ggml_tensor * layer_inp  = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_state, N);
+    struct ggml_tensor * logits_buf = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_vocab, N);
+
+    ggml_set_no_alloc(ctx0, true);
+
     // token encoding + position encoding
     struct ggml_tensor * cur =
         ggml_add(ctx0,
@@ -1548,7 +1581,7 @@ static bool whisper_decode(
                 ggml_get_rows(ctx0, model.d_pe, position));
 	Tracing::delayTensor( "dec-rows", cur );
 
-    struct ggml_tensor * inpL = cur;
+    struct ggml_tensor * inpL = ggml_cpy(ctx0, cur, layer_inp);
 
     for (int il = 0; il < n_layer; ++il) {
         const auto & layer = model.layers_decoder[il];
@@ -1558,6 +1591,8 @@ static bool whisper_decode(
         paramsL.mem_buffer = wctx.buf_compute_layer.data();
 
         struct ggml_context * ctxL = ggml_init(paramsL);
+        ggml_set_no_alloc(ctxL, true);
+
         struct ggml_cgraph gf = {};
         gf.n_threads = n_threads;
 
@@ -1805,7 +1840,7 @@ static bool whisper_decode(
 
         {
             ggml_build_forward_expand(&gf, inpO);
-            ggml_graph_compute       (ctxL, &gf);
+            whisper_graph_compute(wctx, ctxL, gf, pool);
 			Tracing::writeDelayedTensors();
             //ggml_graph_print(&gf);
         }
@@ -1837,7 +1872,7 @@ static bool whisper_decode(
                 ggml_repeat(ctx0, model.d_ln_b, cur));
     }
 
-    struct ggml_tensor * logits = ggml_mul_mat(ctx0, model.d_te, cur);
+    struct ggml_tensor * logits = ggml_cpy(ctx0, ggml_mul_mat(ctx0, model.d_te, cur), logits_buf);
 
     // logits -> probs
     cur = ggml_dup(ctx0, logits);
@@ -1849,7 +1884,7 @@ static bool whisper_decode(
         gf.n_threads = n_threads;
 
         ggml_build_forward_expand(&gf, cur);
-        ggml_graph_compute       (ctx0, &gf);
+        whisper_graph_compute(wctx, ctx0, gf, pool);
     }
 
     logits_out.resize(N*n_vocab);
@@ -2279,6 +2314,7 @@ void whisper_free(struct whisper_context * ctx) {
         if (ctx->buf_model) {
             delete ctx->buf_model;
         }
+        ggml_threadpool_free(ctx->threadpool);
         delete ctx;
     }
 }
@@ -3142,6 +3178,9 @@ int whisper_full_parallel(
     for (int i = 0; i < n_processors - 1; ++i) {
         ctxs[i] = *ctx;
 
+        // every processor runs its graphs on its own worker threads
+        ctxs[i].threadpool = nullptr;
+
         auto & model = ctxs[i].model;
 
         // create the ggml memory context
@@ -3250,6 +3289,9 @@ int whisper_full_parallel(
         ctx->t_sample_us += ctxs[i].t_sample_us;
         ctx->t_encode_us += ctxs[i].t_encode_us;
         ctx->t_decode_us += ctxs[i].t_decode_us;
+
+        ggml_threadpool_free(ctxs[i].threadpool);
+        ctxs[i].threadpool = nullptr;
     }
 
     // average the timings
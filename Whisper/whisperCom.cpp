@@ -147,6 +147,18 @@ namespace Whisper
 			return E_NOTIMPL;
 		}
 
+		HRESULT COMLIGHTCALL runBatch( const sFullParams& params, uint32_t count, const iAudioBuffer* const* buffers, eResultFlags flags, iTranscribeResult** results ) override final
+		{
+			logError( u8"The CPU reference implementation doesn’t support batched transcription" );
+			return E_NOTIMPL;
+		}
+
+		HRESULT COMLIGHTCALL runParallel( const sFullParams& params, const iAudioBuffer* buffer, uint32_t countContexts ) override final
+		{
+			logError( u8"The CPU reference implementation doesn’t support parallel transcription" );
+			return E_NOTIMPL;
+		}
+
 		HRESULT COMLIGHTCALL getResults( eResultFlags flags, iTranscribeResult** pp ) const override final
 		{
 			makeNewResults( &ctx, flags, pp );
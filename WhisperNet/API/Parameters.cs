@@ -11,7 +11,8 @@ namespace Whisper
 	{
 		/// <summary>Always select the most probable token</summary>
 		Greedy,
-		/// <summary>TODO: not implemented yet!</summary>
+		/// <summary>Keep several hypotheses, and pick the one with the best length-normalized probability.
+		/// Only implemented by the hybrid model, the GPU model falls back to greedy sampling.</summary>
 		BeamSearch,
 	};
 
@@ -30,6 +31,10 @@ namespace Whisper
 		// Experimental
 		TokenTimestamps = 0x100,
 		SpeedupAudio = 0x200,
+		// Hybrid model only: encode the next 30-seconds window on another context while the current one is decoding
+		PipelinedEncode = 0x400,
+		// Run VAD over the complete audio before transcribing, and skip long silences without encoding them
+		SkipSilence = 0x800,
 	};
 
 	/// <summary>Transcribe parameters</summary>
@@ -31,5 +31,31 @@ namespace Whisper
 
 		/// <summary>Create GPU tensors in a way which allows sharing across D3D devices</summary>
 		Cloneable = 0x10,
+
+		/// <summary>Hybrid model only: quantize FP16 matrices of the decoder into 8-bit blocks while loading the model</summary>
+		/// <remarks>Incompatible with <see cref="QuantizeQ4" /></remarks>
+		QuantizeQ8 = 0x20,
+
+		/// <summary>Hybrid model only: quantize FP16 matrices of the decoder into 4-bit blocks while loading the model</summary>
+		/// <remarks>Incompatible with <see cref="QuantizeQ8" /></remarks>
+		QuantizeQ4 = 0x40,
+
+		/// <summary>Hybrid model only: on computers with multiple NUMA nodes, distribute the decoder matrices across the nodes, and run the CPU threads on these nodes</summary>
+		/// <remarks>Ignored on computers with a single NUMA node</remarks>
+		NumaAware = 0x80,
+
+		/// <summary>Map the model file into memory instead of reading it</summary>
+		/// <remarks>The hybrid model keeps the tensors which don't need conversion in the mapped pages of the file.<br/>
+		/// These pages are in the OS file cache, shared by all processes which load the same model.</remarks>
+		MemoryMapped = 0x100,
+
+		/// <summary>Hybrid model only: save the prepacked and quantized tensors into <c>&lt;model&gt;.cache</c> file next to the model, and load from that file when it's up to date</summary>
+		/// <remarks>The cache is invalidated when the model file or the quantization flags change.<br/>
+		/// Ignored with <see cref="NumaAware" /> flag.</remarks>
+		ModelCache = 0x200,
+
+		/// <summary>Hybrid model only: pin the CPU threads to distinct logical processors of the process</summary>
+		/// <remarks>Ignored with <see cref="NumaAware" /> flag on computers with multiple NUMA nodes, the threads are then pinned to these nodes.</remarks>
+		PinThreads = 0x400,
 	}
 }
\ No newline at end of file
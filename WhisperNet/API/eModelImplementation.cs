@@ -6,8 +6,10 @@
 		/// <summary>GPGPU implementation based on Direct3D 11.0 compute shaders</summary>
 		GPU = 1,
 
-		/// <summary>A hybrid implementation which uses DirectCompute for encode, and decodes on CPU</summary>
+		/// <summary>A hybrid implementation which runs both encode and decode on CPU</summary>
 		/// <remarks>
+		/// <para>The model still creates a Direct3D 11 hardware device, the contexts use it for the constant buffer and the GPU profiler.<br/>
+		/// Loading the model fails when <c>D3D11CreateDevice</c> fails, e.g. on some GPU-less servers and containers.</para>
 		/// <para>The build of the native DLL included into this nuget package doesn’t implement this version.<br/>
 		/// To enable, edit <c>stdafx.h</c> in Whisper project, change the value of <c>BUILD_HYBRID_VERSION</c> macro from zero to one, and build.</para>
 		/// <para>This implementation requires a CPU with AVX1, FMA3, F16C and BMI1 instruction set extensions.</para>
@@ -36,5 +36,10 @@ namespace Whisper.Internals
 		internal pfnEncoderBegin? encoderBeginCallback;
 		/// <summary>Parameter for the above, not needed in C#</summary>
 		internal IntPtr encoderBeginCallbackData;
+
+		/// <summary>iModel of the draft model for the speculative decoding, not supported by this wrapper</summary>
+		internal IntPtr draftModel;
+		/// <summary>Count of tokens proposed by the draft model</summary>
+		internal int draftTokens;
 	}
 }
\ No newline at end of file